@@ -0,0 +1,500 @@
+#include "bench.h"
+
+static bench_config_t config = {
+    .no_entries = 1000,
+    .depth = 3,
+    .files_per_dir = 32,
+    .mean_size = 4096,
+    .size_dist = SIZE_DIST_EXP,
+    .symlink_density = 0.05,
+    .seed = 42,
+    .no_ops = 200,
+    .no_cold_ops = 20,
+    .format = FORMAT_JSON,
+    .output = NULL,
+};
+
+
+static uint64_t next_random(uint64_t *state)
+{
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+
+static size_t random_below(uint64_t *state, size_t bound) { return (bound == 0) ? 0 : next_random(state) % bound; }
+
+
+static double random_unit(uint64_t *state) { return (next_random(state) >> 11) * (1.0 / 9007199254740992.0); }
+
+
+static size_t random_size(uint64_t *state)
+{
+    switch (config.size_dist)
+    {
+        case SIZE_DIST_FIXED:   return config.mean_size;
+        case SIZE_DIST_UNIFORM: return random_below(state, 2 * config.mean_size + 1);
+        default:                return (size_t) (-log(1.0 - random_unit(state)) * config.mean_size);
+    }
+}
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static int out_write(bench_writer_t *writer, const void *bytes, size_t len)
+{
+    while (len > 0)
+    {
+        if (writer->len == BENCH_WRITE_BUFFER)
+        {
+            if (write(writer->fd, writer->buffer, writer->len) != (ssize_t) writer->len) return -1;
+            writer->len = 0;
+        }
+        size_t chunk = (len < BENCH_WRITE_BUFFER - writer->len) ? len : BENCH_WRITE_BUFFER - writer->len;
+        memcpy(writer->buffer + writer->len, bytes, chunk);
+        writer->len += chunk;
+        bytes = (const uint8_t *) bytes + chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+
+static int out_flush(bench_writer_t *writer)
+{
+    if (writer->len > 0 && write(writer->fd, writer->buffer, writer->len) != (ssize_t) writer->len) return -1;
+    writer->len = 0;
+    return 0;
+}
+
+
+static int write_member(bench_writer_t *writer, const char *name, char typeflag, size_t size, const char *linkname)
+{
+    static const uint8_t zeros[HEADER_SIZE];
+    static uint8_t content[HEADER_SIZE];
+    tar_header_t header;
+
+    if (content[0] == 0) for (size_t i = 0; i < HEADER_SIZE; i++) content[i] = 'a' + i % 26;
+
+    memset(&header, 0, sizeof(tar_header_t));
+    memcpy(header.name, name, strnlen(name, sizeof(header.name)));
+    snprintf(header.mode, sizeof(header.mode), "%07o", (typeflag == DIRTYPE) ? 0755 : 0644);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 1000);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 1000);
+    snprintf(header.size, sizeof(header.size), "%011lo", (unsigned long) size);
+    snprintf(header.mtime, sizeof(header.mtime), "%011lo", 1700000000ul);
+    header.typeflag = typeflag;
+    if (linkname != NULL) memcpy(header.linkname, linkname, strnlen(linkname, sizeof(header.linkname)));
+    memcpy(header.magic, TMAGIC, TMAGLEN);
+    memcpy(header.version, TVERSION, TVERSLEN);
+    strcpy(header.uname, "bench");
+    strcpy(header.gname, "bench");
+    snprintf(header.chksum, sizeof(header.chksum), "%06lo", (unsigned long) header_checksum((const uint8_t *) &header));
+    header.chksum[7] = ' ';
+
+    if (out_write(writer, &header, HEADER_SIZE) != 0) return -1;
+    for (size_t done = 0; done < size; done += HEADER_SIZE)
+    {
+        size_t chunk = (size - done < HEADER_SIZE) ? size - done : HEADER_SIZE;
+        if (out_write(writer, content, chunk) != 0) return -1;
+    }
+    return out_write(writer, zeros, TAR_PADDED_SIZE(size) - size);
+}
+
+
+static char *add_path(bench_paths_t *paths, const char *path)
+{
+    if (paths->len == paths->cap)
+    {
+        paths->cap = (paths->cap == 0) ? 64 : 2 * paths->cap;
+        char **new_items = (char **) realloc(paths->items, paths->cap * sizeof(char *));
+        if (new_items == NULL) return NULL;
+        paths->items = new_items;
+    }
+    char *copy = strdup(path);
+    if (copy != NULL) paths->items[paths->len++] = copy;
+    return copy;
+}
+
+
+static void free_paths(bench_paths_t *paths)
+{
+    for (size_t i = 0; i < paths->len; i++) free(paths->items[i]);
+    free(paths->items);
+}
+
+
+// Relative link from the directory 'dir' to 'target', going up only to their common ancestor.
+// Returns -1 if it does not fit in the linkname field.
+static int relative_link(const char *dir, const char *target, char *linkname, size_t size)
+{
+    size_t common = 0;
+    for (size_t i = 0; dir[i] != '\0' && dir[i] == target[i]; i++) if (dir[i] == '/') common = i + 1;
+
+    size_t len = 0;
+    for (size_t i = common; dir[i] != '\0' && len < size; i++) if (dir[i] == '/') len += snprintf(linkname + len, size - len, "../");
+    if (len < size) len += snprintf(linkname + len, size - len, "%s", target + common);
+    return (len >= size || len >= sizeof(((tar_header_t *) NULL)->linkname)) ? -1 : 0;
+}
+
+
+int generate_archive(int fd, bench_archive_t *archive)
+{
+    uint64_t state = config.seed * 2654435761u + 1;
+    char path[2 * TAR_PATH_MAX];
+    char linkname[2 * TAR_PATH_MAX];
+
+    memset(archive, 0, sizeof(bench_archive_t));
+    bench_writer_t writer = {.fd = fd, .len = 0};
+    writer.buffer = (uint8_t *) malloc(BENCH_WRITE_BUFFER);
+    if (writer.buffer == NULL) return -1;
+
+    // Directories: the i-th one is at level 1 + i % depth, below a random directory of the previous level
+    size_t no_dirs = config.no_entries / (config.files_per_dir + 1);
+    if (no_dirs < (size_t) config.depth) no_dirs = config.depth;
+    size_t *no_children = (size_t *) calloc(no_dirs, sizeof(size_t));
+    if (no_children == NULL) goto error;
+    size_t file_name_len = snprintf(NULL, 0, "f%zu", config.no_entries);
+
+    for (size_t i = 0; i < no_dirs; i++)
+    {
+        size_t level = 1 + i % config.depth;
+        if (level == 1) snprintf(path, sizeof(path), "d%zu/", i);
+        else
+        {
+            // Directories of level l - 1 are the ones whose index is congruent to l - 2 modulo depth
+            size_t no_candidates = (i - (level - 2) + config.depth - 1) / config.depth;
+            size_t parent = (level - 2) + config.depth * random_below(&state, no_candidates);
+            snprintf(path, sizeof(path), "%sd%zu/", archive->dirs.items[parent], i);
+            no_children[parent]++;
+        }
+        // Room is left for the names of the files, a path is never truncated to fit in the header
+        if (strlen(path) + file_name_len >= sizeof(((tar_header_t *) NULL)->name)) {fprintf(stderr, "bench: depth %d makes paths longer than 99 characters\n", config.depth); goto error;}
+        if (add_path(&archive->dirs, path) == NULL || write_member(&writer, path, DIRTYPE, 0, NULL) != 0) goto error;
+    }
+
+    size_t no_files = (config.no_entries > no_dirs) ? config.no_entries - no_dirs : 0;
+    for (size_t i = 0; i < no_files; i++)
+    {
+        size_t dir = random_below(&state, no_dirs);
+        no_children[dir]++;
+        snprintf(path, sizeof(path), "%sf%zu", archive->dirs.items[dir], i);
+        if (strlen(path) >= sizeof(((tar_header_t *) NULL)->name)) {fprintf(stderr, "bench: path %s is longer than 99 characters\n", path); goto error;}
+
+        // Relative symlink to a random regular file, a regular file if the link does not fit in the header
+        int is_link = archive->files.len > 0 && random_unit(&state) < config.symlink_density
+                      && relative_link(archive->dirs.items[dir], archive->files.items[random_below(&state, archive->files.len)], linkname, sizeof(linkname)) == 0;
+        if (is_link)
+        {
+            if (add_path(&archive->links, path) == NULL || write_member(&writer, path, SYMTYPE, 0, linkname) != 0) goto error;
+        }
+        else
+        {
+            size_t size = random_size(&state);
+            if (add_path(&archive->files, path) == NULL || write_member(&writer, path, REGTYPE, size, NULL) != 0) goto error;
+            archive->content_bytes += size;
+        }
+    }
+
+    uint8_t end_blocks[2 * HEADER_SIZE];
+    memset(end_blocks, 0, sizeof(end_blocks));
+    if (out_write(&writer, end_blocks, sizeof(end_blocks)) != 0 || out_flush(&writer) != 0) goto error;
+
+    for (size_t i = 0; i < no_dirs; i++) if (no_children[i] > archive->max_children) archive->max_children = no_children[i];
+    archive->archive_bytes = lseek(fd, 0, SEEK_CUR);
+
+    free(no_children);
+    free(writer.buffer);
+    return 0;
+
+error:
+    free(no_children);
+    free(writer.buffer);
+    free_archive(archive);
+    return -1;
+}
+
+
+void free_archive(bench_archive_t *archive)
+{
+    free_paths(&archive->dirs);
+    free_paths(&archive->files);
+    free_paths(&archive->links);
+    memset(archive, 0, sizeof(bench_archive_t));
+}
+
+
+// A path of the archive, one query out of eight is a path that does not exist
+static char *random_path(bench_ctx_t *ctx)
+{
+    bench_archive_t *archive = ctx->archive;
+    size_t total = archive->dirs.len + archive->files.len + archive->links.len;
+    size_t i = random_below(&ctx->state, total + total / 7 + 1);
+
+    if (i < archive->dirs.len) return archive->dirs.items[i];
+    i -= archive->dirs.len;
+    if (i < archive->files.len) return archive->files.items[i];
+    i -= archive->files.len;
+    if (i < archive->links.len) return archive->links.items[i];
+    return "doesnt_exist/file";
+}
+
+
+static char *random_file(bench_ctx_t *ctx)
+{
+    bench_paths_t *paths = (ctx->archive->links.len > 0 && random_unit(&ctx->state) < config.symlink_density) ? &ctx->archive->links : &ctx->archive->files;
+    return paths->items[random_below(&ctx->state, paths->len)];
+}
+
+
+static int op_check_archive(bench_ctx_t *ctx) { return check_archive(ctx->fd) > 0; }
+
+
+static int op_exists(bench_ctx_t *ctx) { return exists(ctx->fd, random_path(ctx)); }
+
+
+static int op_is_x(bench_ctx_t *ctx)
+{
+    char *path = random_path(ctx);
+    switch (random_below(&ctx->state, 3))
+    {
+        case 0:  return is_dir(ctx->fd, path);
+        case 1:  return is_file(ctx->fd, path);
+        default: return is_symlink(ctx->fd, path);
+    }
+}
+
+
+static int op_list(bench_ctx_t *ctx)
+{
+    size_t no_entries = ctx->archive->max_children;
+    return list(ctx->fd, ctx->archive->dirs.items[random_below(&ctx->state, ctx->archive->dirs.len)], ctx->entries, &no_entries);
+}
+
+
+static int op_read_file(bench_ctx_t *ctx)
+{
+    size_t len = BENCH_READ_BUFFER;
+    return read_file(ctx->fd, random_file(ctx), 0, ctx->buffer, &len) >= 0;
+}
+
+
+static int op_tar_open(bench_ctx_t *ctx)
+{
+    tar_handle_t *handle = tar_open(ctx->fd);
+    tar_close(handle);
+    return handle != NULL;
+}
+
+
+static int op_tar_exists(bench_ctx_t *ctx) { return tar_exists(ctx->handle, random_path(ctx)); }
+
+
+static int op_tar_list(bench_ctx_t *ctx)
+{
+    size_t no_entries = ctx->archive->max_children;
+    return tar_list(ctx->handle, ctx->archive->dirs.items[random_below(&ctx->state, ctx->archive->dirs.len)], ctx->entries, &no_entries);
+}
+
+
+static int op_tar_read_file(bench_ctx_t *ctx)
+{
+    size_t len = BENCH_READ_BUFFER;
+    return tar_read_file(ctx->handle, random_file(ctx), 0, ctx->buffer, &len) >= 0;
+}
+
+
+static int cmp_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+
+static double percentile_us(const uint64_t *sorted, size_t n, double p)
+{
+    size_t rank = (size_t) (p * (n - 1) + 0.5);
+    return sorted[rank] / 1000.0;
+}
+
+
+int run_bench(bench_ctx_t *ctx, const char *api, int cold, size_t no_ops, int (*op)(bench_ctx_t *))
+{
+    if (no_ops == 0) return 0;
+    uint64_t *latencies = (uint64_t *) malloc(no_ops * sizeof(uint64_t));
+    if (latencies == NULL) return -1;
+
+    uint64_t total = 0;
+    size_t no_hits = 0;
+    for (size_t i = 0; i < no_ops; i++)
+    {
+        // Best effort: drops the pages of the archive from the page cache before each operation
+        if (cold) posix_fadvise(ctx->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        uint64_t start = now_ns();
+        no_hits += (op(ctx) != 0);
+        latencies[i] = now_ns() - start;
+        total += latencies[i];
+    }
+
+    qsort(latencies, no_ops, sizeof(uint64_t), cmp_latency);
+    double ops_per_s = (total == 0) ? 0 : no_ops * 1e9 / total;
+    double mean_us = total / 1000.0 / no_ops;
+    const char *cache = cold ? "cold" : "hot";
+
+    if (config.format == FORMAT_JSON)
+    {
+        printf("{\"api\":\"%s\",\"cache\":\"%s\",\"entries\":%zu,\"archive_bytes\":%zu,\"ops\":%zu,\"hits\":%zu,"
+               "\"ops_per_s\":%.1f,\"mean_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+               api, cache, config.no_entries, ctx->archive->archive_bytes, no_ops, no_hits, ops_per_s, mean_us,
+               percentile_us(latencies, no_ops, 0.5), percentile_us(latencies, no_ops, 0.9),
+               percentile_us(latencies, no_ops, 0.99), latencies[no_ops - 1] / 1000.0);
+    }
+    else
+    {
+        printf("%s,%s,%zu,%zu,%zu,%zu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+               api, cache, config.no_entries, ctx->archive->archive_bytes, no_ops, no_hits, ops_per_s, mean_us,
+               percentile_us(latencies, no_ops, 0.5), percentile_us(latencies, no_ops, 0.9),
+               percentile_us(latencies, no_ops, 0.99), latencies[no_ops - 1] / 1000.0);
+    }
+    fflush(stdout);
+
+    free(latencies);
+    return 0;
+}
+
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n entries      number of entries in the archive (default %zu)\n"
+            "  -d depth        depth of the directory tree (default %d)\n"
+            "  -w files        average number of entries per directory (default %zu)\n"
+            "  -s bytes        mean size of the files (default %zu)\n"
+            "  -D dist         distribution of the sizes: fixed, uniform or exp (default exp)\n"
+            "  -l density      fraction of the files that are symlinks (default %.2f)\n"
+            "  -S seed         seed of the generator (default %lu)\n"
+            "  -r ops          operations per API, hot cache (default %zu)\n"
+            "  -c ops          operations per API, cold cache (default %zu)\n"
+            "  -F format       output format: json or csv (default json)\n"
+            "  -o path         keeps the generated archive at this path\n",
+            program, config.no_entries, config.depth, config.files_per_dir, config.mean_size,
+            config.symlink_density, (unsigned long) config.seed, config.no_ops, config.no_cold_ops);
+}
+
+
+static int parse_args(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:w:s:D:l:S:r:c:F:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': config.no_entries = strtoul(optarg, NULL, 10); break;
+            case 'd': config.depth = atoi(optarg); break;
+            case 'w': config.files_per_dir = strtoul(optarg, NULL, 10); break;
+            case 's': config.mean_size = strtoul(optarg, NULL, 10); break;
+            case 'l': config.symlink_density = atof(optarg); break;
+            case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'r': config.no_ops = strtoul(optarg, NULL, 10); break;
+            case 'c': config.no_cold_ops = strtoul(optarg, NULL, 10); break;
+            case 'o': config.output = optarg; break;
+            case 'D':
+                if (strcmp(optarg, "fixed") == 0)        config.size_dist = SIZE_DIST_FIXED;
+                else if (strcmp(optarg, "uniform") == 0) config.size_dist = SIZE_DIST_UNIFORM;
+                else if (strcmp(optarg, "exp") == 0)     config.size_dist = SIZE_DIST_EXP;
+                else return -1;
+                break;
+            case 'F':
+                if (strcmp(optarg, "json") == 0)     config.format = FORMAT_JSON;
+                else if (strcmp(optarg, "csv") == 0) config.format = FORMAT_CSV;
+                else return -1;
+                break;
+            default: return -1;
+        }
+    }
+    if (config.no_entries == 0 || config.depth <= 0 || config.files_per_dir == 0) return -1;
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    if (parse_args(argc, argv) != 0) {usage(argv[0]); return EXIT_FAILURE;}
+
+    char tmp_path[] = "/tmp/lib_tar_bench_XXXXXX";
+    int fd = (config.output != NULL) ? open(config.output, O_RDWR | O_CREAT | O_TRUNC, 0644) : mkstemp(tmp_path);
+    if (fd == -1) {perror("open(archive)"); return EXIT_FAILURE;}
+    if (config.output == NULL) unlink(tmp_path);
+
+    bench_archive_t archive;
+    uint64_t start = now_ns();
+    if (generate_archive(fd, &archive) != 0) {fprintf(stderr, "bench: could not generate the archive\n"); close(fd); return EXIT_FAILURE;}
+    // The pages must be clean to be dropped by the cold runs
+    fdatasync(fd);
+    fprintf(stderr, "bench: %zu directories, %zu files, %zu symlinks, %zu bytes generated in %.2f s\n",
+            archive.dirs.len, archive.files.len, archive.links.len, archive.archive_bytes, (now_ns() - start) / 1e9);
+
+    bench_ctx_t ctx = {.fd = fd, .archive = &archive, .state = config.seed + 1};
+    ctx.buffer = (uint8_t *) malloc(BENCH_READ_BUFFER);
+    ctx.entries = (char **) calloc(archive.max_children + 1, sizeof(char *));
+    int ret = (ctx.buffer == NULL || ctx.entries == NULL) ? -1 : 0;
+    for (size_t i = 0; ret == 0 && i <= archive.max_children; i++)
+    {
+        ctx.entries[i] = (char *) malloc(TAR_PATH_MAX);
+        if (ctx.entries[i] == NULL) ret = -1;
+    }
+
+    if (ret == 0)
+    {
+        if (config.format == FORMAT_CSV) printf("api,cache,entries,archive_bytes,ops,hits,ops_per_s,mean_us,p50_us,p90_us,p99_us,max_us\n");
+
+        // A full scan per operation: a few operations are enough
+        size_t no_check_ops = (config.no_ops < 10) ? config.no_ops : 10;
+        size_t no_cold_check_ops = (config.no_cold_ops < 3) ? config.no_cold_ops : 3;
+
+        for (int cold = 0; cold <= 1; cold++)
+        {
+            size_t no_ops = cold ? config.no_cold_ops : config.no_ops;
+            run_bench(&ctx, "check_archive", cold, cold ? no_cold_check_ops : no_check_ops, op_check_archive);
+            run_bench(&ctx, "exists", cold, no_ops, op_exists);
+            run_bench(&ctx, "is_x", cold, no_ops, op_is_x);
+            run_bench(&ctx, "list", cold, no_ops, op_list);
+            run_bench(&ctx, "read_file", cold, no_ops, op_read_file);
+            run_bench(&ctx, "tar_open", cold, cold ? no_cold_check_ops : no_check_ops, op_tar_open);
+        }
+
+        // The handle-based functions do not read the headers again, only the cached index is measured
+        ctx.handle = tar_open(fd);
+        if (ctx.handle != NULL)
+        {
+            tar_index_usage_t index_usage;
+            tar_index_usage(ctx.handle, &index_usage);
+            fprintf(stderr, "bench: index of %zu entries and %zu directory prefixes in %zu bytes (%.1f bytes per entry)\n", index_usage.no_entries,
+                    index_usage.no_prefixes, index_usage.total_bytes, (double) index_usage.total_bytes / (index_usage.no_entries + (index_usage.no_entries == 0)));
+            run_bench(&ctx, "tar_exists", 0, config.no_ops, op_tar_exists);
+            run_bench(&ctx, "tar_list", 0, config.no_ops, op_tar_list);
+            run_bench(&ctx, "tar_read_file", 0, config.no_ops, op_tar_read_file);
+            run_bench(&ctx, "tar_read_file", 1, config.no_cold_ops, op_tar_read_file);
+            tar_close(ctx.handle);
+        }
+    }
+
+    if (ctx.entries != NULL) for (size_t i = 0; i <= archive.max_children; i++) free(ctx.entries[i]);
+    free(ctx.entries);
+    free(ctx.buffer);
+    free_archive(&archive);
+    close(fd);
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,102 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../headers/lib_tar.h"
+#include "../headers/handle.h"
+
+#define BENCH_WRITE_BUFFER (1 << 20)
+#define BENCH_READ_BUFFER (1 << 16)
+
+#define SIZE_DIST_FIXED 0
+#define SIZE_DIST_UNIFORM 1
+#define SIZE_DIST_EXP 2
+
+#define FORMAT_JSON 0
+#define FORMAT_CSV 1
+
+typedef struct bench_config
+{
+    size_t no_entries;            /* directories, files and symlinks */
+    int depth;                    /* levels of directories */
+    size_t files_per_dir;         /* average number of entries per directory */
+    size_t mean_size;             /* mean size of the files, in bytes */
+    int size_dist;                /* SIZE_DIST_* */
+    double symlink_density;       /* fraction of the files that are symlinks */
+    uint64_t seed;
+    size_t no_ops;                /* operations per API with a hot page cache */
+    size_t no_cold_ops;           /* operations per API with a cold page cache */
+    int format;                   /* FORMAT_* */
+    const char *output;           /* path where the archive is kept, NULL for a temporary file */
+} bench_config_t;
+
+typedef struct bench_paths
+{
+    char **items;
+    size_t len;
+    size_t cap;
+} bench_paths_t;
+
+typedef struct bench_archive
+{
+    bench_paths_t dirs;
+    bench_paths_t files;
+    bench_paths_t links;
+    size_t max_children;          /* entries of the largest directory */
+    size_t content_bytes;
+    size_t archive_bytes;
+} bench_archive_t;
+
+typedef struct bench_writer
+{
+    int fd;
+    uint8_t *buffer;
+    size_t len;
+} bench_writer_t;
+
+typedef struct bench_ctx
+{
+    int fd;
+    tar_handle_t *handle;
+    bench_archive_t *archive;
+    uint64_t state;               /* state of the generator of the queries */
+    uint8_t *buffer;              /* destination of read_file() */
+    char **entries;               /* destination of list() */
+} bench_ctx_t;
+
+/**
+ * Writes a synthetic ustar archive with the shape given on the command line.
+ *
+ * @param fd A file descriptor open for writing, at the start of an empty file.
+ * @param archive An out argument, set to the paths of the generated entries.
+ *                It must be released with free_archive().
+ * @return 0 on success, -1 on failure.
+ */
+int generate_archive(int fd, bench_archive_t *archive);
+
+/**
+ * Releases the paths of a generated archive.
+ *
+ * @param archive The archive filled by generate_archive().
+ */
+void free_archive(bench_archive_t *archive);
+
+/**
+ * Times an operation and prints its throughput and latency percentiles as a JSON or CSV row.
+ *
+ * @param ctx The archive and buffers the operation works on.
+ * @param api The name of the API in the report.
+ * @param cold Non-zero to drop the archive from the page cache before each operation.
+ * @param no_ops The number of operations.
+ * @param op The operation, returning non-zero when the queried path was found.
+ * @return 0 on success, -1 on failure.
+ */
+int run_bench(bench_ctx_t *ctx, const char *api, int cold, size_t no_ops, int (*op)(bench_ctx_t *));
+
+#endif /* BENCH_H */
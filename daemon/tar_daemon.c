@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+#include "../headers/server.h"
+
+static tar_server_t server;
+
+
+static void handle_signal(int signum)
+{
+    (void) signum;
+    tar_server_stop(&server);
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        printf("Usage: %s SOCKET_PATH\n", argv[0]);
+        return -1;
+    }
+
+    if (tar_server_init(&server, argv[1]) != 0)
+    {
+        perror("tar_server_init");
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Listening on %s\n", argv[1]);
+    int ret = tar_server_run(&server);
+    tar_server_free(&server);
+    return ret;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+
+#include "../headers/diff.h"
+
+static const char *type_name(char typeflag)
+{
+    switch (typeflag)
+    {
+        case REGTYPE:
+        case AREGTYPE: return "file";
+        case DIRTYPE:  return "directory";
+        case SYMTYPE:  return "symlink";
+        case LNKTYPE:  return "hard link";
+        default:       return "other";
+    }
+}
+
+
+static int print_difference(const tar_diff_entry_t *entry, void *user_data)
+{
+    (void) user_data;
+    printf("%c %s", entry->kind, entry->path);
+    if (entry->kind == DIFF_TYPE_CHANGED) printf(" (%s -> %s)", type_name(entry->old_type), type_name(entry->new_type));
+    if (entry->kind == DIFF_MODIFIED)
+    {
+        printf(" (");
+        const char *separator = "";
+        if (entry->changes & DIFF_SIZE)     {printf("%ssize %zu -> %zu", separator, entry->old_size, entry->new_size); separator = ", ";}
+        if (entry->changes & DIFF_MODE)     {printf("%smode", separator); separator = ", ";}
+        if (entry->changes & DIFF_LINKNAME) {printf("%slink target", separator); separator = ", ";}
+        if (entry->changes & DIFF_CONTENT)  {printf("%scontent", separator);}
+        printf(")");
+    }
+    printf("\n");
+    return 0;
+}
+
+
+static int open_archive(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    // Compressed archives are read through their index
+    if (fd != -1 && tar_gz_open(fd, 0) == -2) {close(fd); return -1;}
+    return fd;
+}
+
+
+// Exits with 0 if the archives are the same, 1 if they differ and 2 on failure, like diff
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        printf("Usage: %s OLD_ARCHIVE NEW_ARCHIVE [THREADS]\n", argv[0]);
+        return 2;
+    }
+
+    int old_fd = open_archive(argv[1]);
+    int new_fd = open_archive(argv[2]);
+    if (old_fd == -1 || new_fd == -1)
+    {
+        perror("open");
+        return 2;
+    }
+
+    tar_diff_options_t options = {.no_threads = (argc == 4) ? atoi(argv[3]) : 0};
+    ssize_t ret = tar_diff(old_fd, new_fd, &options, print_difference, NULL);
+    if (ret < 0) fprintf(stderr, "Could not compare the archives\n");
+
+    tar_gz_close(old_fd);
+    tar_gz_close(new_fd);
+    close(old_fd);
+    close(new_fd);
+    return (ret < 0) ? 2 : (ret > 0);
+}
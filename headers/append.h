@@ -0,0 +1,58 @@
+#ifndef APPEND_H
+#define APPEND_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "handle.h"
+#include "writer.h"
+
+/**
+ * Finds the end of the members of an archive, where its end-of-archive blocks start.
+ *
+ * With a handle, the end is computed from the index and only checked against the archive:
+ * no header is read. Otherwise, the headers are scanned once.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param handle A handle opened on the archive, NULL to scan it.
+ * @return The offset of the end-of-archive blocks (the size of the archive if it has none),
+ *         -1 if the archive is truncated or compressed.
+ */
+off_t tar_archive_end(int tar_fd, tar_handle_t *handle);
+
+/**
+ * Starts adding members at the end of an existing archive.
+ *
+ * The writer is placed on the end-of-archive blocks, which the new members overwrite. Members are
+ * then added with the functions of writer.h (tar_add_data(), tar_add_files(), ...) and the append
+ * is completed by tar_append_finish(). A member with the path of an earlier one shadows it, as
+ * tar does on extraction.
+ *
+ * @param writer The writer to initialize.
+ * @param tar_fd A file descriptor on the archive, opened for reading and writing.
+ * @param handle A handle opened on the archive to find its end without scanning it, or NULL.
+ * @return 0 on success, -1 if the end of the archive was not found or the allocation failed.
+ */
+int tar_append_begin(tar_writer_t *writer, int tar_fd, tar_handle_t *handle);
+
+/**
+ * Writes the end-of-archive blocks after the appended members and releases the writer.
+ *
+ * The headers of the new members are indexed in the given handle, which keeps its existing
+ * entries and their tree: only the new entries are linked (a handle opened from a sidecar is
+ * copied to memory first, and a mapped archive is mapped again). If the sidecar file at 'idx_path'
+ * exists, the new members are journaled in it by sidecar_append(); it is only written again when
+ * its journal is full or it did not match the archive. The handle must not be used by other
+ * threads during the call.
+ *
+ * @param writer A writer started by tar_append_begin().
+ * @param handle The handle to update, NULL if none is open.
+ * @param idx_path The path of the sidecar file of the archive, NULL if there is none.
+ * @return 0 on success,
+ *         -1 if writing the archive failed,
+ *         -2 if the archive was written but the handle or the sidecar could not be updated.
+ */
+int tar_append_finish(tar_writer_t *writer, tar_handle_t *handle, const char *idx_path);
+
+#endif /* APPEND_H */
@@ -0,0 +1,147 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "handle.h"
+
+/* Default number of reads in flight */
+#define TAR_ASYNC_DEPTH_DEFAULT 256
+
+/* Default number of threads of the fallback, doing blocking reads */
+#define TAR_ASYNC_THREADS_DEFAULT 16
+
+typedef struct tar_read_req
+{
+    char *path;                   /* file to read, links are resolved */
+    size_t offset;                /* offset in the file */
+    uint8_t *dest;                /* destination buffer */
+    size_t len;                   /* in: size of dest, out: number of bytes written to dest */
+    ssize_t ret;                  /* out: same value as tar_read_file() */
+    void *user_data;              /* left untouched, for the caller */
+    size_t total_len;             /* bytes from the offset to the end of the file, set at submission */
+} tar_read_req_t;
+
+typedef struct tar_async_options
+{
+    unsigned depth;               /* reads in flight at most, 0 for TAR_ASYNC_DEPTH_DEFAULT */
+    int no_threads;               /* threads of the fallback, 0 for TAR_ASYNC_THREADS_DEFAULT */
+    int no_uring;                 /* non-zero to use the thread pool even if io_uring is available */
+} tar_async_options_t;
+
+typedef struct tar_async
+{
+    tar_handle_t *handle;
+    int uring;                    /* whether the reads go through io_uring rather than the thread pool */
+    unsigned depth;
+    unsigned in_flight;           /* reads submitted and not reaped yet */
+    int event_fd;                 /* readable once reads completed */
+
+    pthread_mutex_t lock;
+    tar_read_req_t **done;        /* completed reads not reaped yet, circular */
+    unsigned done_head;
+    unsigned done_len;
+
+    /* io_uring */
+    int ring_fd;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned to_submit;           /* entries of the submission queue not passed to the kernel yet */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* thread pool */
+    pthread_t *threads;
+    int no_threads;
+    tar_read_req_t **pending;     /* reads not taken by a thread yet, circular */
+    unsigned pending_head;
+    unsigned pending_len;
+    pthread_cond_t work;
+    pthread_cond_t completed;
+    int stop;
+} tar_async_t;
+
+/**
+ * Starts an asynchronous reader on a handle.
+ *
+ * The reads are looked up in the index of the handle when they are submitted and their data
+ * are read with io_uring: a whole batch of reads costs a single system call and up to 'depth'
+ * of them are in flight at once. If io_uring is not available (old kernel, seccomp, compressed
+ * archive), a pool of threads does the reads with pread() instead. Handles opened by
+ * tar_open_mmap() complete every read at submission, with a copy from the mapping.
+ *
+ * The reader is not thread-safe: it is meant to be driven by a single thread, for example
+ * an event loop polling tar_async_fd().
+ *
+ * @param async The reader to start.
+ * @param handle A handle opened on the archive, used until tar_async_free().
+ * @param options The options of the reader, NULL for the defaults.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_async_init(tar_async_t *async, tar_handle_t *handle, const tar_async_options_t *options);
+
+/**
+ * Submits reads. The requests are owned by the reader until tar_async_reap() returns them.
+ *
+ * @param async A reader started by tar_async_init().
+ * @param reqs The reads to submit.
+ * @param n The number of reads.
+ * @return The number of reads submitted, the first ones of 'reqs': fewer than 'n' once 'depth'
+ *         reads are in flight or if the kernel refused some of them, -1 if none was submitted.
+ *         The reads not submitted are given back to the caller and can be submitted again.
+ */
+ssize_t tar_async_submit(tar_async_t *async, tar_read_req_t *const *reqs, size_t n);
+
+/**
+ * Returns completed reads, whose 'len' and 'ret' fields are set.
+ *
+ * @param async A reader started by tar_async_init().
+ * @param done An array receiving the completed requests.
+ * @param max The size of 'done'.
+ * @param wait Non-zero to wait until at least one read completes, if any is in flight.
+ * @return The number of requests written to 'done'.
+ */
+size_t tar_async_reap(tar_async_t *async, tar_read_req_t **done, size_t max, int wait);
+
+/**
+ * Returns an eventfd that becomes readable when reads complete, to be polled with poll() or epoll.
+ * It is reset by tar_async_reap().
+ *
+ * @param async A reader started by tar_async_init().
+ * @return The file descriptor.
+ */
+int tar_async_fd(const tar_async_t *async);
+
+/**
+ * Waits for the reads in flight and releases the reader.
+ *
+ * @param async A reader started by tar_async_init().
+ */
+void tar_async_free(tar_async_t *async);
+
+/**
+ * Reads many files at once, keeping up to 'depth' reads in flight.
+ *
+ * @param handle A handle opened on the archive.
+ * @param reqs The reads, each one completed as if by tar_read_file().
+ * @param n The number of reads.
+ * @param options The options of the reader, NULL for the defaults.
+ * @return The number of reads that succeeded ('ret' zero or positive), -1 if the reader could not be started.
+ */
+ssize_t tar_read_batch(tar_handle_t *handle, tar_read_req_t *reqs, size_t n, const tar_async_options_t *options);
+
+#endif /* ASYNC_H */
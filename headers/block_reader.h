@@ -0,0 +1,111 @@
+#ifndef BLOCK_READER_H
+#define BLOCK_READER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "gz.h"
+#include "stats.h"
+#include "var.h"
+
+/* Default size of the readahead buffer of a block reader */
+#define READAHEAD_DEFAULT (64 * 1024)
+
+typedef struct block_reader
+{
+    int tar_fd;                   /* file descriptor of the archive */
+    uint8_t *buffer;              /* readahead buffer */
+    size_t capacity;              /* size of the buffer, a multiple of HEADER_SIZE */
+    off_t buffer_offset;          /* offset in the archive of the first byte of the buffer */
+    size_t buffer_len;            /* number of bytes loaded in the buffer */
+    off_t offset;                 /* current position of the reader in the archive */
+} block_reader_t;
+
+typedef struct reader_stats
+{
+    size_t no_reads;              /* pread() calls */
+    size_t bytes_read;            /* bytes returned by pread() */
+} reader_stats_t;
+
+/**
+ * Sets the size of the readahead buffer of the block readers initialized afterwards.
+ * The size is rounded up to a whole number of blocks.
+ *
+ * @param size The size of the buffer in bytes, READAHEAD_DEFAULT if zero.
+ */
+void reader_set_readahead(size_t size);
+
+/**
+ * Initializes a block reader at the start of an archive.
+ *
+ * The reader loads the archive by chunks of the readahead size, so that walking through
+ * headers and skipping small contents are served from memory instead of one read() and one
+ * lseek() per header. The chunks are loaded with pread(): the file offset of 'tar_fd' is never
+ * used nor moved, so several readers, in several threads, can share the same file descriptor.
+ *
+ * @param reader The reader to initialize.
+ * @param tar_fd A file descriptor pointing to a tar archive.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int reader_init(block_reader_t *reader, int tar_fd);
+
+/**
+ * Releases the buffer of a block reader.
+ *
+ * @param reader The reader to release.
+ */
+void reader_free(block_reader_t *reader);
+
+/**
+ * Reads the block at the current position of the reader and moves past it.
+ *
+ * @param reader The reader.
+ * @return A pointer to the block, valid until the next call on the reader,
+ *         or NULL if the archive ends before a whole block.
+ */
+const tar_header_t *reader_next_header(block_reader_t *reader);
+
+/**
+ * Moves the reader forward. Nothing is read until the next block or bytes are requested,
+ * and no system call is made if they are already loaded.
+ *
+ * @param reader The reader.
+ * @param len The number of bytes to skip.
+ */
+void reader_skip(block_reader_t *reader, size_t len);
+
+/**
+ * Copies bytes from the current position of the reader and moves past them.
+ * Large reads go straight to 'dest' instead of through the buffer.
+ *
+ * @param reader The reader.
+ * @param dest The destination buffer.
+ * @param len The number of bytes to read.
+ * @return The number of bytes copied, less than 'len' if the archive ends before.
+ */
+size_t reader_read(block_reader_t *reader, uint8_t *dest, size_t len);
+
+/**
+ * Returns the current position of the reader in the archive.
+ *
+ * @param reader The reader.
+ * @return The offset of the next byte the reader returns.
+ */
+off_t reader_tell(const block_reader_t *reader);
+
+/**
+ * Returns the number of pread() calls made by all block readers since the last reset.
+ *
+ * @return The counters of the block readers.
+ */
+reader_stats_t reader_get_stats(void);
+
+/**
+ * Sets the counters returned by reader_get_stats() back to zero.
+ */
+void reader_reset_stats(void);
+
+#endif /* BLOCK_READER_H */
@@ -0,0 +1,134 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* Size of the blocks of the cache, a multiple of the tar block size */
+#define CACHE_BLOCK_SIZE 4096
+
+/* Reads larger than this bypass the cache, so that a large file does not evict every small one */
+#define CACHE_READ_MAX (256 * 1024)
+
+/* Default number of shards, each with its own lock */
+#define CACHE_SHARDS_DEFAULT 16
+
+/* Maximum number of archives cached at the same time */
+#define CACHE_MAX_ARCHIVES 64
+
+/* Sentinel for the end of a bucket chain */
+#define CACHE_NONE UINT32_MAX
+
+typedef struct cache_slot
+{
+    int tar_fd;                   /* archive of the block, -1 if the slot is free */
+    uint32_t len;                 /* bytes of the block in the archive, less than CACHE_BLOCK_SIZE at its end */
+    off_t block;                  /* offset of the block divided by CACHE_BLOCK_SIZE */
+    uint32_t next;                /* next slot of the same bucket */
+    uint8_t referenced;           /* CLOCK bit, set by each hit */
+} cache_slot_t;
+
+typedef struct cache_shard
+{
+    pthread_mutex_t lock;
+    cache_slot_t *slots;
+    uint8_t *data;                /* CACHE_BLOCK_SIZE bytes per slot */
+    size_t no_slots;
+    size_t no_used;               /* slots used at least once */
+    size_t hand;                  /* next slot considered for eviction */
+    uint32_t *buckets;            /* first slot of each bucket */
+    size_t no_buckets;            /* always a power of two */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} cache_shard_t;
+
+typedef struct tar_cache_stats
+{
+    uint64_t hits;                /* blocks copied from the cache */
+    uint64_t misses;              /* blocks read from the archive and added to the cache */
+    uint64_t evictions;           /* blocks evicted to make room for others */
+    size_t no_blocks;             /* blocks in the cache */
+    size_t capacity;              /* blocks the cache can hold */
+} tar_cache_stats_t;
+
+/**
+ * Creates the block cache shared by every archive opened with tar_cache_open().
+ *
+ * The cache holds blocks of CACHE_BLOCK_SIZE bytes keyed by (archive, block offset), headers
+ * and contents alike, within a fixed memory budget. It is split into shards, each with its own
+ * lock, and evicts blocks with the CLOCK algorithm (an approximation of LRU).
+ *
+ * @param budget The memory used by the blocks, in bytes.
+ * @param no_shards The number of shards, rounded up to a power of two, 0 for CACHE_SHARDS_DEFAULT.
+ * @return 0 on success, -1 if the cache already exists or the allocation failed.
+ */
+int tar_cache_init(size_t budget, size_t no_shards);
+
+/**
+ * Releases the cache. No archive may be read while it is released.
+ */
+void tar_cache_free(void);
+
+/**
+ * Caches the reads of an archive until tar_cache_close().
+ *
+ * Every function reading the archive through its file descriptor (read_file(), the handles,
+ * the iterator, ...) then reads it through the cache. The archive must not be modified by other
+ * means than the writer of this library, which invalidates the blocks it writes.
+ *
+ * @param tar_fd A file descriptor on the archive.
+ * @return 0 on success, -1 if there is no cache or too many archives are cached.
+ */
+int tar_cache_open(int tar_fd);
+
+/**
+ * Stops caching the reads of an archive and drops its blocks. Must be called before closing the file descriptor.
+ *
+ * @param tar_fd A file descriptor given to tar_cache_open().
+ */
+void tar_cache_close(int tar_fd);
+
+/**
+ * Drops the cached blocks of a range of an archive, after it was modified.
+ *
+ * @param tar_fd A file descriptor on the archive.
+ * @param offset The offset of the range.
+ * @param len The length of the range.
+ */
+void tar_cache_invalidate(int tar_fd, off_t offset, size_t len);
+
+/**
+ * Copies the counters of the cache, summed over its shards.
+ *
+ * @param stats The destination of the counters.
+ * @return 0 on success, -1 if there is no cache.
+ */
+int tar_cache_get_stats(tar_cache_stats_t *stats);
+
+/**
+ * Returns whether the reads of an archive go through the cache.
+ *
+ * @param tar_fd A file descriptor on the archive.
+ * @return 1 if the archive was given to tar_cache_open(), 0 otherwise.
+ */
+int cache_is_open(int tar_fd);
+
+/**
+ * Reads an archive through the cache: the blocks found are copied, the others are read with a
+ * single call to 'read_fn', from the first block missing to the end of the range, and added.
+ *
+ * @param tar_fd A file descriptor given to tar_cache_open().
+ * @param dest The destination buffer.
+ * @param len The number of bytes to read.
+ * @param offset The offset in the archive.
+ * @param read_fn The function reading the archive, pread() or its equivalent for compressed archives.
+ * @return The number of bytes read, or -1 on error.
+ */
+ssize_t cache_pread(int tar_fd, void *dest, size_t len, off_t offset, ssize_t (*read_fn)(int, void *, size_t, off_t));
+
+#endif /* CACHE_H */
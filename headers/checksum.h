@@ -0,0 +1,46 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "var.h"
+
+/* Offset and length of the chksum field in a tar header */
+#define CHKSUM_OFFSET 148
+#define CHKSUM_LEN    8
+
+/**
+ * Computes the checksum of a tar header.
+ *
+ * The checksum is the sum of the 512 bytes of the header, with the bytes of the chksum field
+ * counted as spaces. The header is neither copied nor modified. The sum is computed with
+ * AVX2 or SSE2 instructions when the CPU supports them (checked once, at the first call),
+ * and with a scalar loop otherwise.
+ *
+ * @param block The 512 bytes of the header.
+ * @return The checksum of the header.
+ */
+long header_checksum(const uint8_t *block);
+
+/**
+ * Same as header_checksum(), without vector instructions.
+ *
+ * @param block The 512 bytes of the header.
+ * @return The checksum of the header.
+ */
+long header_checksum_scalar(const uint8_t *block);
+
+/**
+ * Converts an ASCII-encoded octal number of a tar header field into a regular integer.
+ *
+ * Leading spaces are skipped and the number ends at the first character that is not an
+ * octal digit (usually a null or a space) or at the end of the field.
+ *
+ * @param field The field holding the number, not necessarily null-terminated.
+ * @param len The length of the field.
+ * @return The value of the number, or -1 if the field holds no octal digit.
+ */
+long tar_octal(const char *field, size_t len);
+
+#endif /* CHECKSUM_H */
@@ -0,0 +1,82 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdlib.h>
+#include <sys/un.h>
+
+#include "gz.h"
+#include "protocol.h"
+
+typedef struct tar_remote
+{
+    int sock_fd;                  /* connection to the server */
+    int tar_fd;                   /* descriptor on the archive, from which the contents are read */
+    int shared;                   /* whether the server had already indexed the archive */
+    int is_inline;                /* whether the server sends the contents, the archive being compressed */
+} tar_remote_t;
+
+/**
+ * Connects to a server started with tar_server_init() and opens an archive on it.
+ *
+ * The descriptor of the archive is passed to the server, which indexes the archive unless another
+ * client already opened it. The functions below then answer like their counterpart taking a
+ * file descriptor, with a single round trip to the server and no scan of the archive.
+ *
+ * @param socket_path The path of the socket of the server.
+ * @param tar_fd A file descriptor on the archive, which must stay open until tar_remote_close().
+ * @return A connection to the server, or NULL if it could not connect or open the archive.
+ */
+tar_remote_t *tar_remote_open(const char *socket_path, int tar_fd);
+
+/**
+ * Closes the connection to the server. The file descriptor of the archive is not closed.
+ *
+ * @param remote A connection returned by tar_remote_open().
+ */
+void tar_remote_close(tar_remote_t *remote);
+
+/**
+ * Same as exists().
+ *
+ * @return Same as exists(), -1 if the request failed.
+ */
+int tar_remote_exists(tar_remote_t *remote, char *path);
+
+/**
+ * Same as is_dir().
+ *
+ * @return Same as is_dir(), -1 if the request failed.
+ */
+int tar_remote_is_dir(tar_remote_t *remote, char *path);
+
+/**
+ * Same as is_file().
+ *
+ * @return Same as is_file(), -1 if the request failed.
+ */
+int tar_remote_is_file(tar_remote_t *remote, char *path);
+
+/**
+ * Same as is_symlink().
+ *
+ * @return Same as is_symlink(), -1 if the request failed.
+ */
+int tar_remote_is_symlink(tar_remote_t *remote, char *path);
+
+/**
+ * Same as list(): the server sends the names of the entries, copied in 'entries'.
+ *
+ * @return Same as list(), -1 if the request failed.
+ */
+int tar_remote_list(tar_remote_t *remote, char *path, char **entries, size_t *no_entries);
+
+/**
+ * Same as read_file(): the server sends the offset of the content, which is read from the
+ * descriptor of the archive. The content of a compressed archive is sent by the server, at most
+ * PROTOCOL_INLINE_MAX bytes per call.
+ *
+ * @return Same as read_file(), -1 if the request failed.
+ */
+ssize_t tar_remote_read_file(tar_remote_t *remote, char *path, size_t offset, uint8_t *dest, size_t *len);
+
+#endif /* CLIENT_H */
@@ -0,0 +1,87 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <pthread.h>
+
+#include "handle.h"
+
+/* Kinds of differences */
+#define DIFF_ADDED        'A'     /* only in the new archive */
+#define DIFF_REMOVED      'D'     /* only in the old archive */
+#define DIFF_MODIFIED     'M'     /* same type, different metadata or content */
+#define DIFF_TYPE_CHANGED 'T'     /* a file replaced by a directory, a symlink, ... */
+
+/* What differs in a modified entry */
+#define DIFF_SIZE     1
+#define DIFF_MODE     2
+#define DIFF_LINKNAME 4
+#define DIFF_CONTENT  8
+
+/* Contents of the same size are compared by chunks of this size, each one by any thread */
+#define DIFF_CHUNK_SIZE (256 * 1024)
+
+typedef struct tar_diff_entry
+{
+    const char *path;             /* path of the entry, valid during the callback */
+    char kind;                    /* DIFF_ADDED, DIFF_REMOVED, ... */
+    int changes;                  /* DIFF_SIZE, DIFF_MODE, ... of a modified entry, 0 otherwise */
+    char old_type;                /* typeflags of the entry in each archive, unset if it is not in the archive */
+    char new_type;
+    size_t old_size;
+    size_t new_size;
+} tar_diff_entry_t;
+
+typedef struct tar_diff_options
+{
+    int no_threads;               /* threads comparing the contents, 0 for one per CPU */
+} tar_diff_options_t;
+
+/**
+ * Called for each difference between two archives, in path order.
+ *
+ * @param entry The difference.
+ * @param user_data The pointer given to tar_diff().
+ * @return 0 to go on, any other value to stop reporting.
+ */
+typedef int (*tar_diff_fn)(const tar_diff_entry_t *entry, void *user_data);
+
+typedef struct diff_item
+{
+    uint32_t old_id;              /* entry in each archive, INDEX_EMPTY if it is not in the archive */
+    uint32_t new_id;
+    char kind;
+    int changes;
+} diff_item_t;
+
+typedef struct diff_job
+{
+    tar_handle_t *old_handle;
+    tar_handle_t *new_handle;
+    diff_item_t *items;
+    uint32_t *candidates;         /* items whose contents must be compared */
+    size_t *first_chunk;          /* first chunk of each candidate, and the total number of chunks */
+    size_t no_candidates;
+    size_t no_chunks;
+    size_t next_chunk;            /* first chunk not taken by a worker yet */
+    int error;                    /* set if an archive could not be read */
+} diff_job_t;
+
+/**
+ * Compares two archives without extracting them.
+ *
+ * Both archives are indexed, and their entries are matched by path by walking the two sorted
+ * path tables side by side. The types, sizes, modes and link targets are compared through the
+ * indexes. The contents of regular files are only read when their sizes are the same, and are
+ * then compared by chunks of DIFF_CHUNK_SIZE bytes spread across a pool of threads. A content
+ * stops being read once a chunk differs.
+ *
+ * @param old_fd A file descriptor on the old archive.
+ * @param new_fd A file descriptor on the new archive.
+ * @param options The options of the comparison, NULL for the defaults.
+ * @param callback Called for each difference, NULL to only count them.
+ * @param user_data Passed to 'callback'.
+ * @return The number of differences, or -1 if an archive could not be indexed or read.
+ */
+ssize_t tar_diff(int old_fd, int new_fd, const tar_diff_options_t *options, tar_diff_fn callback, void *user_data);
+
+#endif /* DIFF_H */
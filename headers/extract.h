@@ -0,0 +1,49 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "handle.h"
+
+typedef struct tar_extract_options
+{
+    int no_threads;               /* threads writing the files, 0 for one per CPU */
+    int no_permissions;           /* non-zero to keep the default permissions instead of the ones of the archive */
+} tar_extract_options_t;
+
+typedef struct extract_job
+{
+    tar_handle_t *handle;
+    int dest_fd;                  /* destination directory */
+    int copy;                     /* whether the data must go through a buffer (compressed archives) */
+    int permissions;              /* whether the modes of the archive are applied */
+    uint32_t *files;              /* ids of the regular files to write */
+    size_t no_files;
+    size_t next_file;             /* first file not taken by a worker yet */
+    size_t no_extracted;
+    size_t no_failed;
+} extract_job_t;
+
+/**
+ * Extracts every entry of an archive into a directory.
+ *
+ * The archive is indexed once. The directories are created first, then the regular files are
+ * written by a pool of threads, their content being copied from the archive by the kernel
+ * (copy_file_range(), or sendfile()) without going through user space. Hard links and symlinks
+ * are created last, so that no file is written through a symlink of the archive.
+ * Entries whose path is absolute or leaves the directory with '..' are not extracted.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param dest_dir The directory to extract to, created if it does not exist.
+ * @param options The options of the extraction, NULL for the defaults.
+ * @return The number of entries extracted,
+ *         -1 if the archive could not be indexed or the directory could not be opened,
+ *         -2 if any entry could not be extracted (the others are).
+ */
+ssize_t tar_extract(int tar_fd, const char *dest_dir, const tar_extract_options_t *options);
+
+#endif /* EXTRACT_H */
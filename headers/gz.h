@@ -0,0 +1,135 @@
+#ifndef GZ_H
+#define GZ_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "cache.h"
+
+/* Size of the deflate window, kept at each checkpoint */
+#define GZ_WINDOW_SIZE 32768
+
+/* Default distance between two checkpoints, in uncompressed bytes */
+#define GZ_SPAN_DEFAULT (1024 * 1024)
+
+/* Size of the compressed chunks read from the file */
+#define GZ_CHUNK_SIZE 16384
+
+/* Number of compressed archives that can be opened with tar_gz_open() at the same time */
+#define GZ_MAX_ARCHIVES 64
+
+typedef struct gz_point
+{
+    off_t out;                    /* offset in the uncompressed stream */
+    off_t in;                     /* offset in the compressed file of the first complete byte */
+    int bits;                     /* number of bits of the byte before 'in' that belong to the stream, 0 to 7 */
+    uint8_t *window;              /* the GZ_WINDOW_SIZE bytes of uncompressed data before 'out' */
+} gz_point_t;
+
+typedef struct gz_cursor
+{
+    z_stream strm;
+    int active;                   /* whether strm holds a stream ready to continue */
+    int ended;                    /* whether the end of the compressed stream was reached */
+    off_t out;                    /* offset in the uncompressed stream of the next byte inflated */
+    off_t in;                     /* offset in the compressed file of the next chunk to read */
+    uint8_t input[GZ_CHUNK_SIZE];
+} gz_cursor_t;
+
+typedef struct gz_index
+{
+    int gz_fd;                    /* file descriptor of the compressed file */
+    size_t span;
+    gz_point_t *points;           /* checkpoints, by increasing offset */
+    size_t no_points;
+    size_t cap_points;
+    off_t length;                 /* size of the uncompressed stream */
+    gz_cursor_t *cursor;          /* stream left where the last read stopped, to continue sequential reads */
+    pthread_mutex_t lock;         /* protects the cursor */
+} gz_index_t;
+
+/**
+ * Decompresses a gzip (or zlib) file once and records a checkpoint about every 'span'
+ * uncompressed bytes, so that it can then be read at any offset with gz_read_at().
+ *
+ * @param index The index to build.
+ * @param gz_fd A file descriptor on the compressed file, opened for reading.
+ * @param span The distance between two checkpoints, GZ_SPAN_DEFAULT if zero.
+ * @return 0 on success,
+ *         -1 if the file is not a complete gzip or zlib stream,
+ *         -2 if the allocation failed.
+ *         The index must be released with gz_free_index().
+ */
+int gz_build_index(gz_index_t *index, int gz_fd, size_t span);
+
+/**
+ * Releases an index built by gz_build_index().
+ *
+ * @param index The index to release.
+ */
+void gz_free_index(gz_index_t *index);
+
+/**
+ * Reads the uncompressed stream at a given offset, like pread() on the uncompressed file.
+ *
+ * Only the data from the nearest checkpoint before the offset is decompressed. A read
+ * starting where the previous one ended continues from there without decompressing anything
+ * again. Several threads can read from the same index.
+ *
+ * @param index An index built by gz_build_index().
+ * @param dest The destination buffer.
+ * @param len The number of bytes to read.
+ * @param offset The offset in the uncompressed stream.
+ * @return The number of bytes read, less than 'len' only at the end of the stream, or -1 on error.
+ */
+ssize_t gz_read_at(gz_index_t *index, uint8_t *dest, size_t len, off_t offset);
+
+/**
+ * Opens a gzip-compressed tar archive (.tar.gz) for the functions of the library.
+ *
+ * The file is indexed with gz_build_index() and, until tar_gz_close() is called, every function
+ * taking a file descriptor reads the uncompressed archive when given 'gz_fd'.
+ * tar_open_mmap() is not supported on such a file descriptor.
+ *
+ * @param gz_fd A file descriptor on the compressed archive, opened for reading.
+ * @param span The distance between two checkpoints, GZ_SPAN_DEFAULT if zero.
+ * @return 0 on success,
+ *         -1 if the file is not a gzip file,
+ *         -2 if the allocation failed or GZ_MAX_ARCHIVES archives are already opened.
+ */
+int tar_gz_open(int gz_fd, size_t span);
+
+/**
+ * Releases the index of an archive opened by tar_gz_open(). The file descriptor is not closed.
+ *
+ * @param gz_fd The file descriptor given to tar_gz_open().
+ */
+void tar_gz_close(int gz_fd);
+
+/**
+ * Returns the index of an archive opened by tar_gz_open().
+ *
+ * @param tar_fd A file descriptor.
+ * @return The index, or NULL if the file descriptor was not opened by tar_gz_open().
+ */
+gz_index_t *tar_gz_index(int tar_fd);
+
+/**
+ * Reads an archive at a given offset: with pread() on a regular archive, through the index
+ * of an archive opened by tar_gz_open(), and through the block cache if tar_cache_open() was called.
+ *
+ * @param tar_fd A file descriptor on the archive.
+ * @param dest The destination buffer.
+ * @param len The number of bytes to read.
+ * @param offset The offset in the (uncompressed) archive.
+ * @return The number of bytes read, or -1 on error.
+ */
+ssize_t archive_pread(int tar_fd, void *dest, size_t len, off_t offset);
+
+#endif /* GZ_H */
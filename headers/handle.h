@@ -0,0 +1,200 @@
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index.h"
+#include "sidecar.h"
+
+typedef struct tar_handle
+{
+    int tar_fd;                   /* file descriptor of the archive */
+    tar_index_t index;            /* every entry of the archive, by path */
+    const uint8_t *map;           /* mapping of the whole archive, NULL if not mapped */
+    size_t map_len;
+} tar_handle_t;
+
+/**
+ * Opens a handle on a tar archive.
+ *
+ * The archive is walked once and each entry is indexed by its full path, so that the
+ * functions taking a handle answer without reading any header again.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @return A handle on the archive, or NULL if the allocation failed.
+ *         The handle must be released with tar_close().
+ */
+tar_handle_t *tar_open(int tar_fd);
+
+/**
+ * Opens a handle on a tar archive mapped in memory.
+ *
+ * The whole archive is mapped read-only, its headers are parsed in place from the mapping
+ * and the contents of its files are read from the mapping instead of the file descriptor.
+ * This also enables read_file_view() on the handle.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file, opened for reading.
+ * @return A handle on the archive, or NULL if the archive could not be mapped or the allocation failed.
+ *         The handle must be released with tar_close().
+ */
+tar_handle_t *tar_open_mmap(int tar_fd);
+
+/**
+ * Opens a handle on a tar archive, loading its index from a sidecar file.
+ *
+ * The sidecar is mapped in memory and used as is, without scanning the archive. If it does not
+ * exist, is invalid or does not match the archive anymore, the archive is scanned like tar_open()
+ * does. In both cases the handle behaves the same.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param idx_path The path of the sidecar file written by tar_write_sidecar().
+ * @return A handle on the archive, or NULL if the allocation failed.
+ *         handle->index.map is not NULL if the index was loaded from the sidecar.
+ *         The handle must be released with tar_close().
+ */
+tar_handle_t *tar_open_sidecar(int tar_fd, const char *idx_path);
+
+/**
+ * Writes the index of a handle to a sidecar file (for example "archive.tar.idx"),
+ * so that tar_open_sidecar() can later open the archive without scanning it.
+ *
+ * @param handle A handle on the archive.
+ * @param idx_path The path of the sidecar file.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_write_sidecar(tar_handle_t *handle, const char *idx_path);
+
+/**
+ * Reports the memory used by the index of a handle: the entries and their parallel arrays, the
+ * hash tables and the arena holding each directory prefix once and the rest of each path.
+ *
+ * @param handle A handle on an archive.
+ * @param usage The destination of the report.
+ */
+void tar_index_usage(tar_handle_t *handle, tar_index_usage_t *usage);
+
+/**
+ * Releases a handle opened by tar_open(), tar_open_mmap() or tar_open_sidecar().
+ * The file descriptor of the archive is not closed.
+ *
+ * @param handle The handle to release.
+ */
+void tar_close(tar_handle_t *handle);
+
+/**
+ * Resolves a path of the archive to the entry it finally designates.
+ *
+ * If the entry at the given path is a link, its target is normalized ('.' and '..' components
+ * are resolved) and followed, hop after hop, until an entry that is not a link is reached. A
+ * target without trailing '/' also designates the directory of that name. Chains longer than
+ * MAX_SYMLINK_HOPS are considered cycles and do not resolve.
+ * The final entry of each link followed is memoized, so resolving a link again costs a single lookup.
+ * A chain cut by the hop limit is not memoized: a link further down it may still resolve.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive.
+ * @return The entry designated by the path (the entry itself if it is not a link),
+ *         or NULL if the path does not exist, the link is dangling or part of a cycle.
+ */
+tar_entry_t *tar_resolve(tar_handle_t *handle, char *path);
+
+/**
+ * Same as exists(), using the index of the handle.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive.
+ *
+ * @return zero if no entry at the given path exists in the archive,
+ *         any other value otherwise.
+ */
+int tar_exists(tar_handle_t *handle, char *path);
+
+/**
+ * Same as is_dir(), using the index of the handle.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive.
+ *
+ * @return zero if no entry at the given path exists in the archive or the entry is not a directory,
+ *         any other value otherwise.
+ */
+int tar_is_dir(tar_handle_t *handle, char *path);
+
+/**
+ * Same as is_file(), using the index of the handle.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive.
+ *
+ * @return zero if no entry at the given path exists in the archive or the entry is not a file,
+ *         any other value otherwise.
+ */
+int tar_is_file(tar_handle_t *handle, char *path);
+
+/**
+ * Same as is_symlink(), using the index of the handle.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive.
+ *
+ * @return zero if no entry at the given path exists in the archive or the entry is not symlink,
+ *         any other value otherwise.
+ */
+int tar_is_symlink(tar_handle_t *handle, char *path);
+
+/**
+ * Same as list(), using the index of the handle.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         any other value otherwise.
+ */
+int tar_list(tar_handle_t *handle, char *path, char **entries, size_t *no_entries);
+
+/**
+ * Same as read_file(), using the index of the handle.
+ * Only the content of the file is read from the archive.
+ *
+ * @param handle A handle opened by tar_open().
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param offset An offset in the file from which to start reading from, zero indicates the start of the file.
+ * @param dest A destination buffer to read the given file into.
+ * @param len An in-out argument.
+ *            The caller set it to the size of dest.
+ *            The callee set it to the number of bytes written to dest.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
+ *         the end of the file.
+ */
+ssize_t tar_read_file(tar_handle_t *handle, char *path, size_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Gives direct access to the content of a file in an archive mapped by tar_open_mmap().
+ *
+ * Nothing is copied: 'view' points straight into the mapping and stays valid until the
+ * handle is closed.
+ *
+ * @param handle A handle opened by tar_open_mmap().
+ * @param path A path to an entry in the archive to read from. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param offset An offset in the file from which the view starts, zero indicates the start of the file.
+ * @param view An out argument, set to the address of the content of the file at the given offset.
+ * @param len An out argument, set to the number of bytes from the offset to the end of the file.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if the handle was not opened by tar_open_mmap(),
+ *         zero otherwise.
+ */
+ssize_t read_file_view(tar_handle_t *handle, char *path, size_t offset, const uint8_t **view, size_t *len);
+
+#endif /* HANDLE_H */
@@ -1,6 +1,7 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,6 +11,8 @@
 #include <stdbool.h>
 
 #include "var.h"
+#include "block_reader.h"
+#include "checksum.h"
 
 /**
  * Prints information about a tar header for debugging or informational purposes.
@@ -25,56 +28,102 @@ void get_info_header(tar_header_t header, int id);
 /**
  * Skips the content of a file within a tar archive based on the provided tar header information.
  *
- * This function advances the file pointer within the tar archive file descriptor ('tar_fd') to
- * skip the content of the file associated with the given 'header'. The skipping is performed
- * based on the file size specified in the tar header, ensuring that the file content is
- * effectively skipped, and the file pointer is positioned at the next tar header or the end of
- * the tar archive.
+ * This function advances the block reader of the tar archive ('reader') to skip the content
+ * of the file associated with the given 'header'. The skipping is performed based on the file
+ * size specified in the tar header, ensuring that the file content is effectively skipped, and
+ * the reader is positioned at the next tar header or the end of the tar archive. No system
+ * call is made: the next header is read from the readahead buffer if it is already loaded.
  *
- * @param tar_fd The file descriptor of the tar archive.
+ * @param reader The block reader of the tar archive.
  * @param header The tar header structure containing information about the file to skip.
  */
-void skip_file_content(int tar_fd, tar_header_t header);
+void skip_file_content(block_reader_t *reader, const tar_header_t *header);
 
 /**
- * Skips the directory entries in a tar archive until a different directory is encountered.
+ * Copies the full path of a member: the name field, preceded by the prefix field and a '/'
+ * if the header is a POSIX ustar header with a prefix.
  *
- * This function reads the tar archive file descriptor 'tar_fd' and advances the
- * 'header' to the next entry, skipping entries with the same directory name as the
- * current 'header->name'. It continues until a different directory entry is found.
+ * @param header The tar header of the member.
+ * @param dest The destination of the null-terminated path, at least TAR_PATH_MAX bytes.
+ * @return Returns the length of the path.
+ */
+size_t header_path(const tar_header_t *header, char *dest);
+
+/**
+ * Hashes a path (32-bit FNV-1a).
+ *
+ * @param path A null-terminated character string representing the path to hash.
+ * @return Returns the hash of 'path'.
+ */
+uint32_t hash_path(const char *path);
+
+/**
+ * Checks if a path is a direct child of a directory.
+ *
+ * This function returns 1 if 'path' starts with 'parent_dir' and the rest of 'path' is a single
+ * path component (a file name, or a directory name followed by a trailing '/'), and 0 otherwise.
+ * Entries of subdirectories of 'parent_dir' are therefore not considered as direct children.
  *
- * @param tar_fd The file descriptor of the tar archive.
- * @param header A pointer to the current tar header structure.
+ * @param parent_dir A null-terminated character string representing the directory (with its trailing '/').
+ * @param path A null-terminated character string representing the path to check.
+ * @return Returns 1 if 'path' is a direct child of 'parent_dir', and 0 otherwise.
  */
-void skip_dir(int tar_fd, tar_header_t *header);
+int is_direct_child(const char *parent_dir, const char *path);
 
 /**
- * Checks if the current path belongs to the same directory as the parent directory.
+ * Gets the length of the directory part of a path.
  *
- * This function compares the 'parent_dir' and 'current_path' character strings to determine
- * whether they represent entries in the same directory. It returns 1 if 'current_path' is
- * a subdirectory or a file within 'parent_dir', and 0 otherwise.
+ * The directory part keeps its trailing '/', so that it is the path of the directory entry
+ * in the archive. For example, the directory part of "a/b/c.txt" and "a/b/c/" is "a/b/".
  *
- * @param parent_dir A null-terminated character string representing the parent directory.
- * @param current_path A null-terminated character string representing the current directory path.
- * @return Returns 1 if 'current_path' is within or equal to 'parent_dir', and 0 otherwise.
+ * @param path A null-terminated character string representing a path in the archive.
+ * @return Returns the length of the directory part of 'path', 0 if the path is at the root of the archive.
  */
-int check_if_entry_folder(char *parent_dir, char *current_path);
+size_t parent_dir_len(const char *path);
 
 /**
- * Parses the symlink path based on the header information.
+ * Normalizes a path of the archive.
  *
- * This function constructs the parsed symlink path by combining the base directory
- * from the 'header_name' and the relative symlink path from 'header_linkname'. The
- * resulting parsed symlink path is returned as a dynamically allocated string.
+ * This function removes the empty and '.' components of 'path' and resolves each '..'
+ * component by removing the component before it, without looking at the archive. A trailing
+ * '/' is kept. For example, "folder1/../folder3/./file3_1.txt" is normalized to "folder3/file3_1.txt".
  *
- * @param header_name A null-terminated character string representing the base directory.
- * @param header_linkname A null-terminated character string representing the symlink path.
- * @return Returns the parsed symlink path as a dynamically allocated string.
- *         If the allocation fails or the resulting path exceeds 100 characters, an
- *         empty string is returned.
+ * @param path A null-terminated character string representing the path to normalize.
+ * @param normalized A buffer receiving the normalized path.
+ * @param size The size of the 'normalized' buffer.
+ * @return Returns 0 on success, -1 if the path goes above the root of the archive or does not fit in 'normalized'.
  */
-char *parse_symlink(char *header_name, char *header_linkname);
+int normalize_path(const char *path, char *normalized, size_t size);
+
+/**
+ * Computes the normalized path of the entry a link points to.
+ *
+ * The target of a symlink is relative to the directory containing the symlink, unless it is an
+ * absolute path, in which case it is taken from the root of the archive. The target of a hard
+ * link is always a path from the root of the archive.
+ *
+ * @param name A null-terminated character string representing the path of the link.
+ * @param linkname A null-terminated character string representing the target of the link.
+ * @param typeflag The typeflag of the link (SYMTYPE or LNKTYPE).
+ * @param target A buffer receiving the normalized path of the target.
+ * @param size The size of the 'target' buffer.
+ * @return Returns 0 on success, -1 if the target is outside the archive or does not fit in 'target'.
+ */
+int link_target(const char *name, const char *linkname, char typeflag, char *target, size_t size);
+
+/**
+ * Validates a single tar header.
+ *
+ * The header is valid if its magic value is "ustar" and a null, its version value is "00"
+ * and its checksum matches the sum of its bytes (the checksum field counted as spaces).
+ *
+ * @param header The tar header to validate.
+ * @return 0 if the header is valid,
+ *         -1 if its magic value is invalid,
+ *         -2 if its version value is invalid,
+ *         -3 if its checksum is invalid.
+ */
+int check_header(const tar_header_t *header);
 
 /**
  * Checks whether an entry in the archive matches the specified type.
@@ -88,4 +137,17 @@ char *parse_symlink(char *header_name, char *header_linkname);
  */
 int is_x(int tar_fd, char *path, char *type_file);
 
+/**
+ * Runs a worker on a pool of threads and waits for all of them.
+ *
+ * The workers share 'arg' and take their work from it until none is left, so the calling
+ * thread runs the worker itself when a single thread is useful or none could be started.
+ *
+ * @param worker The function run by each thread.
+ * @param arg The argument passed to every worker.
+ * @param no_threads The number of threads, 0 for one per CPU.
+ * @param max_useful The number of threads beyond which some would have nothing to do.
+ */
+void run_workers(void *(*worker)(void *), void *arg, int no_threads, size_t max_useful);
+
 #endif /* HELPER_H */
\ No newline at end of file
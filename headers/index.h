@@ -0,0 +1,215 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <sys/mman.h>
+
+#include "helper.h"
+
+/* Sentinel stored in the hash table for an empty slot, and for ids not set */
+#define INDEX_EMPTY UINT32_MAX
+
+/* Memoized target of a link that does not resolve to any entry */
+#define INDEX_DANGLING (UINT32_MAX - 1)
+
+/* Directory prefixes are interned in a table kept at most half full */
+#define INDEX_PREFIX_BUCKETS 64
+
+typedef struct tar_entry
+{
+    uint32_t prefix;              /* offset of the entry's directory part in the index arena, shared by its directory */
+    uint32_t name;                /* offset of the rest of the entry path in the index arena */
+    uint32_t linkname;            /* offset of the link target in the index arena */
+
+    uint32_t parent;              /* id of the directory containing the entry */
+    uint32_t first_child;         /* id of the first entry of the directory */
+    uint32_t next_sibling;        /* id of the next entry of the same directory */
+
+    uint32_t target;              /* memoized id of the entry a link finally resolves to */
+} tar_entry_t;
+
+typedef struct tar_index
+{
+    tar_entry_t *entries;         /* paths and tree of the entries, in archive order */
+    uint64_t *offsets;            /* offset of each entry's header in the archive */
+    uint64_t *sizes;              /* size of each entry's content */
+    char *types;                  /* typeflag of each entry's header */
+    uint16_t *modes;              /* permission bits of each entry */
+    size_t no_entries;
+    size_t cap_entries;
+
+    char *arena;                  /* every directory prefix, path remainder and link target, null-terminated */
+    size_t arena_len;
+    size_t arena_cap;
+
+    uint32_t *buckets;            /* open-addressing table of entry ids */
+    size_t no_buckets;            /* always a power of two */
+
+    uint32_t *prefixes;           /* open-addressing table of the arena offsets of the directory prefixes */
+    size_t no_prefixes;
+    size_t no_prefix_buckets;     /* always a power of two, 0 while the table is not built */
+
+    int links_cached;             /* whether any link target was memoized */
+
+    uint32_t *sorted;             /* entry ids sorted by path, NULL until index_sorted() */
+
+    void *map;                    /* sidecar file the arrays are mapped from, NULL if they are allocated */
+    size_t map_len;
+} tar_index_t;
+
+typedef struct tar_index_usage
+{
+    size_t no_entries;
+    size_t no_prefixes;           /* distinct directory prefixes stored in the arena */
+    size_t entries_bytes;         /* entry records and the parallel arrays of offsets, sizes, types and modes */
+    size_t tables_bytes;          /* hash tables and table of the entries sorted by path */
+    size_t arena_bytes;           /* paths and link targets */
+    size_t total_bytes;           /* memory of the index, allocated or mapped */
+} tar_index_usage_t;
+
+/**
+ * Initializes an empty index.
+ *
+ * @param index The index to initialize.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int index_init(tar_index_t *index);
+
+/**
+ * Releases every buffer owned by the index, or unmaps it if it was mapped from a sidecar file.
+ *
+ * @param index The index to free.
+ */
+void index_free(tar_index_t *index);
+
+/**
+ * Copies an index mapped from a sidecar file to allocated arrays, so that entries can be added to it.
+ * Does nothing if the index is not mapped.
+ *
+ * @param index The index.
+ * @return 0 on success, -1 if the allocation failed (the index is left mapped).
+ */
+int index_own(tar_index_t *index);
+
+/**
+ * Adds an entry to the index.
+ *
+ * If an entry with the same path is already indexed, it is replaced by the new one so that
+ * later members of the archive shadow earlier ones, as tar does on extraction. Replacing an
+ * entry forgets every memoized link target.
+ *
+ * @param index The index to add the entry to.
+ * @param header The tar header of the entry.
+ * @param hdr_offset The offset of the header in the archive.
+ * @return A pointer to the indexed entry, or NULL if the allocation failed or the index is mapped from a sidecar file.
+ *         The pointer stays valid until the next entry is added.
+ */
+tar_entry_t *index_insert(tar_index_t *index, const tar_header_t *header, off_t hdr_offset);
+
+/**
+ * Links every entry of the index to the directory containing it.
+ *
+ * Once built, the entries of a directory are reached from its 'first_child' through
+ * the 'next_sibling' ids, in archive order. The tree does not depend on the order of
+ * the members in the archive: a directory may be stored after its own entries.
+ * Entries whose directory is not in the archive are not linked to any directory.
+ *
+ * @param index The index to build the tree of, once every entry was inserted.
+ */
+void index_build_tree(tar_index_t *index);
+
+/**
+ * Links the entries added since 'first' to the tree built by index_build_tree(), without
+ * walking the entries already linked: each new entry is chained after the last entry of its
+ * directory. Entries indexed before a new directory that contains them are linked to it,
+ * which is the only case where the older entries are walked.
+ *
+ * @param index The index, whose entries before 'first' are linked.
+ * @param first The id of the first entry inserted since the tree was built.
+ */
+void index_link_entries(tar_index_t *index, size_t first);
+
+/**
+ * Returns the ids of the entries sorted by path (in strcmp() order).
+ * The table is built at the first call, which can be made by several threads at the same time,
+ * and kept until an entry is added.
+ *
+ * @param index The index.
+ * @return The 'no_entries' ids sorted by path, or NULL if the allocation failed.
+ */
+const uint32_t *index_sorted(tar_index_t *index);
+
+/**
+ * Looks up an entry by its full path.
+ *
+ * @param index The index to search.
+ * @param path A null-terminated path to an entry in the archive.
+ * @return A pointer to the entry, or NULL if no entry has the given path.
+ */
+tar_entry_t *index_find(const tar_index_t *index, const char *path);
+
+/**
+ * Copies the path of an indexed entry, its directory prefix followed by the rest of the path.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @param dest The destination of the null-terminated path.
+ * @param size The size of 'dest', at least TAR_PATH_MAX to never truncate the path.
+ * @return The length of the path, which is truncated if it is not less than 'size'.
+ */
+size_t index_path(const tar_index_t *index, const tar_entry_t *entry, char *dest, size_t size);
+
+/**
+ * Returns the link target of an indexed entry.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @return The null-terminated link target of the entry (empty if the entry is not a link).
+ */
+const char *index_linkname(const tar_index_t *index, const tar_entry_t *entry);
+
+/**
+ * Returns the offset of the header of an indexed entry in the archive.
+ * The metadata of the entries are stored in parallel arrays, indexed by the id of the entry.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @return The offset of the header of the entry.
+ */
+off_t index_offset(const tar_index_t *index, const tar_entry_t *entry);
+
+/**
+ * Returns the size of the content of an indexed entry.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @return The size of the content of the entry.
+ */
+size_t index_size(const tar_index_t *index, const tar_entry_t *entry);
+
+/**
+ * Returns the typeflag of an indexed entry.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @return The typeflag of the header of the entry.
+ */
+char index_type(const tar_index_t *index, const tar_entry_t *entry);
+
+/**
+ * Returns the permission bits of an indexed entry.
+ *
+ * @param index The index owning the entry.
+ * @param entry The entry.
+ * @return The permission bits of the entry.
+ */
+mode_t index_mode(const tar_index_t *index, const tar_entry_t *entry);
+
+/**
+ * Reports the memory used by an index.
+ *
+ * @param index The index.
+ * @param usage The destination of the report.
+ */
+void index_usage(const tar_index_t *index, tar_index_usage_t *usage);
+
+#endif /* INDEX_H */
@@ -0,0 +1,82 @@
+#ifndef ITER_H
+#define ITER_H
+
+#include <sys/types.h>
+
+#include "helper.h"
+
+typedef struct tar_member
+{
+    char name[TAR_PATH_MAX];      /* full path, the ustar prefix joined to the name */
+    char linkname[101];           /* target of a link, null-terminated */
+    char typeflag;
+    size_t size;                  /* size of the content */
+    mode_t mode;
+    time_t mtime;
+    off_t hdr_offset;             /* offset of the header in the archive */
+    off_t data_offset;            /* offset of the content in the archive */
+} tar_member_t;
+
+typedef struct tar_iter
+{
+    block_reader_t reader;
+    tar_member_t member;          /* member returned by the last call to tar_iter_next() */
+    size_t remaining;             /* bytes of its content not read yet */
+    size_t padding;               /* bytes after its content, up to the next header */
+} tar_iter_t;
+
+/**
+ * Starts iterating over the members of an archive, in archive order.
+ *
+ * The iterator reads the archive sequentially, once, through a block reader. Its buffer is
+ * allocated here; tar_iter_next() and tar_iter_read() do not allocate anything.
+ *
+ * @param iter The iterator to initialize.
+ * @param tar_fd A file descriptor pointing to a tar archive.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int tar_iter_begin(tar_iter_t *iter, int tar_fd);
+
+/**
+ * Moves to the next member of the archive.
+ *
+ * The content of the current member that was not read with tar_iter_read() is skipped without
+ * being read when possible. The header of the next member is validated like check_archive() does.
+ *
+ * @param iter An iterator started by tar_iter_begin().
+ * @param member An out argument, set to the decoded metadata of the member. It stays valid until the next call.
+ * @return 1 if a member was found,
+ *         0 at the end of the archive,
+ *         -1 if its header has an invalid magic value,
+ *         -2 if its header has an invalid version value,
+ *         -3 if its header has an invalid checksum value.
+ */
+int tar_iter_next(tar_iter_t *iter, const tar_member_t **member);
+
+/**
+ * Reads the content of the current member, from where the previous call stopped.
+ *
+ * @param iter An iterator on a member returned by tar_iter_next().
+ * @param dest A destination buffer.
+ * @param len The size of 'dest'.
+ * @return The number of bytes written to 'dest', zero at the end of the content.
+ */
+size_t tar_iter_read(tar_iter_t *iter, uint8_t *dest, size_t len);
+
+/**
+ * Decodes the metadata of a member from its header, which must have been validated.
+ *
+ * @param header The header of the member.
+ * @param hdr_offset The offset of the header in the archive.
+ * @param member The destination of the metadata.
+ */
+void tar_decode_member(const tar_header_t *header, off_t hdr_offset, tar_member_t *member);
+
+/**
+ * Stops an iteration and releases its buffer.
+ *
+ * @param iter An iterator started by tar_iter_begin().
+ */
+void tar_iter_end(tar_iter_t *iter);
+
+#endif /* ITER_H */
@@ -1,8 +1,23 @@
 #ifndef LIB_TAR_H
 #define LIB_TAR_H
 
+#include <pthread.h>
+
 #include "helper.h"
 
+/*
+ * Every function reads the archive with positional reads (pread): the file offset of 'tar_fd'
+ * is neither used nor moved, so several threads can call them on the same file descriptor.
+ */
+
+typedef struct tar_lookup_result
+{
+    int found;                    /* zero if no entry at the path exists in the archive */
+    char typeflag;                /* typeflag of the entry */
+    size_t size;                  /* size of the entry's content */
+    off_t data_offset;            /* offset of the entry's content in the archive */
+} tar_lookup_result_t;
+
 /**
  * Checks whether the archive is valid.
  *
@@ -20,6 +35,22 @@
  */
 int check_archive(int tar_fd);
 
+/**
+ * Same as check_archive(), with the headers validated by several threads.
+ *
+ * A first sequential pass only finds the offsets of the headers. Their magic, version and
+ * checksum are then validated by a pool of 'no_threads' workers. The result is the same as
+ * check_archive(): if several headers are invalid, the error of the first one in archive order
+ * is returned.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
+ * @param no_threads The number of workers. Zero or a negative value uses one worker per CPU,
+ *                   and no additional thread for small archives.
+ *
+ * @return the same values as check_archive().
+ */
+int check_archive_mt(int tar_fd, int no_threads);
+
 /**
  * Checks whether an entry exists in the archive.
  *
@@ -108,4 +139,22 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/**
+ * Looks up many paths in a single pass over the archive.
+ *
+ * The paths are hashed once, then each header of the archive is looked up in this set, so the
+ * cost is one scan of the archive whatever the number of paths (instead of one scan per call to
+ * exists() or is_x()). Links are not resolved. If several members have the same path, the last
+ * one is reported, as it is the one tar extracts.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param paths The paths to look up. The same path may appear several times.
+ * @param n The number of paths.
+ * @param results An array of 'n' results, results[i] being set for paths[i].
+ *
+ * @return the number of paths found in the archive,
+ *         -1 if the allocation failed.
+ */
+ssize_t tar_lookup_batch(int tar_fd, char **paths, size_t n, tar_lookup_result_t *results);
+
 #endif //LIB_TAR_H
\ No newline at end of file
@@ -0,0 +1,122 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include "handle.h"
+#include "writer.h"
+
+/* Most layers in an overlay, the layer of each entry is stored on a byte */
+#define OVERLAY_MAX_LAYERS 256
+
+/* Name of a whiteout entry, followed by the name of the entry it deletes from the lower layers */
+#define WHITEOUT_PREFIX ".wh."
+
+/* Whiteout entry making its directory opaque: the lower layers do not contribute to it */
+#define WHITEOUT_OPAQUE ".wh..wh..opq"
+
+typedef struct tar_overlay
+{
+    tar_handle_t *view;           /* merged index of the visible entries, their offsets are in their own layer */
+    uint8_t *layers;              /* layer of each entry of the view, parallel to its entries */
+    size_t cap_layers;
+    int *layer_fds;               /* file descriptors of the layers, lowest first */
+    size_t no_layers;
+} tar_overlay_t;
+
+/**
+ * Opens a merged view of several archives stacked as layers, like the layers of a container image.
+ *
+ * Each layer is indexed once and its entries are merged in a single index, the upper layers
+ * shadowing the entries of the lower ones at the same path. A directory is merged with the
+ * directories of the same path below it, whereas any other entry hides everything below it
+ * at its path. An entry named ".wh.NAME" deletes NAME, and its contents if it is a directory,
+ * from the layers below it. An entry named ".wh..wh..opq" hides the contents the layers below
+ * give to its directory. Whiteout entries never appear in the view.
+ *
+ * The functions on the overlay then answer from the merged index alone, at the cost of a query
+ * on a single archive, and read the contents of the files from the layer providing them.
+ *
+ * @param tar_fds File descriptors on the archives, from the lowest layer to the upper one.
+ *                They must stay open until tar_overlay_close().
+ * @param no_layers The number of archives, at most OVERLAY_MAX_LAYERS.
+ * @return The overlay, or NULL if there are too many layers or the allocation failed.
+ *         The overlay must be released with tar_overlay_close().
+ */
+tar_overlay_t *tar_overlay_open(const int *tar_fds, size_t no_layers);
+
+/**
+ * Releases an overlay. The file descriptors of the layers are not closed.
+ *
+ * @param overlay The overlay to release.
+ */
+void tar_overlay_close(tar_overlay_t *overlay);
+
+/**
+ * Returns the layer providing an entry of the view.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to an entry.
+ * @return The position of the layer in the array given to tar_overlay_open(), or -1 if no entry is visible at the path.
+ */
+int tar_overlay_layer(tar_overlay_t *overlay, char *path);
+
+/**
+ * Same as tar_exists(), on the merged view.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to an entry.
+ * @return zero if no entry is visible at the given path, any other value otherwise.
+ */
+int tar_overlay_exists(tar_overlay_t *overlay, char *path);
+
+/**
+ * Same as tar_is_dir(), on the merged view.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to an entry.
+ * @return zero if no directory is visible at the given path, any other value otherwise.
+ */
+int tar_overlay_is_dir(tar_overlay_t *overlay, char *path);
+
+/**
+ * Same as tar_is_file(), on the merged view.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to an entry.
+ * @return zero if no file is visible at the given path, any other value otherwise.
+ */
+int tar_overlay_is_file(tar_overlay_t *overlay, char *path);
+
+/**
+ * Same as tar_is_symlink(), on the merged view.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to an entry.
+ * @return zero if no symlink is visible at the given path, any other value otherwise.
+ */
+int tar_overlay_is_symlink(tar_overlay_t *overlay, char *path);
+
+/**
+ * Same as tar_list(), on the merged view: the entries of a directory come from every layer
+ * it is merged from, those of the upper layers first.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to a directory. If the entry is a symlink, it is resolved in the view.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument, as for tar_list().
+ * @return zero if no directory is visible at the given path, any other value otherwise.
+ */
+int tar_overlay_list(tar_overlay_t *overlay, char *path, char **entries, size_t *no_entries);
+
+/**
+ * Same as tar_read_file(), on the merged view. The content is read from the layer providing the file.
+ *
+ * @param overlay An overlay opened by tar_overlay_open().
+ * @param path A path to a file. If the entry is a symlink, it is resolved in the view.
+ * @param offset An offset in the file from which to start reading from.
+ * @param dest A destination buffer to read the given file into.
+ * @param len An in-out argument, as for tar_read_file().
+ * @return The same values as tar_read_file().
+ */
+ssize_t tar_overlay_read_file(tar_overlay_t *overlay, char *path, size_t offset, uint8_t *dest, size_t *len);
+
+#endif /* OVERLAY_H */
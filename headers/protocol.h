@@ -0,0 +1,99 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*
+ * Binary protocol between the archive server and its clients, over a local Unix stream socket.
+ * Every message is a fixed-size header, in native byte order, followed by 'path_len' or 'len'
+ * bytes. The first request of a connection opens the archive the following ones query.
+ */
+
+#define PROTOCOL_VERSION 1
+
+/* Largest content sent inline, when the archive is compressed and the client cannot read it itself */
+#define PROTOCOL_INLINE_MAX (1024 * 1024)
+
+/* Longest path accepted in a request */
+#define PROTOCOL_PATH_MAX 4096
+
+#define OP_OPEN       1           /* carries a file descriptor on the archive, count is set in the reply if it was already indexed */
+#define OP_EXISTS     2
+#define OP_IS_DIR     3
+#define OP_IS_FILE    4
+#define OP_IS_SYMLINK 5
+#define OP_LIST       6           /* len: maximum number of entries, the reply carries their names, null-terminated */
+#define OP_READ_FILE  7           /* offset, len: same as read_file() */
+
+/* Reply flag: the content follows the reply instead of being read by the client at 'data_offset' */
+#define REPLY_INLINE 1
+
+typedef struct request
+{
+    uint8_t op;                   /* OP_* */
+    uint8_t version;              /* PROTOCOL_VERSION */
+    uint16_t padding;
+    uint32_t path_len;            /* bytes of the path following the request, without null byte */
+    uint64_t offset;
+    uint64_t len;
+} request_t;
+
+typedef struct reply
+{
+    int64_t ret;                  /* return value of the function */
+    uint64_t len;                 /* bytes of the result: entries, or content */
+    uint64_t data_offset;         /* offset of the content in the archive */
+    uint32_t count;               /* number of entries listed */
+    uint32_t flags;               /* REPLY_* */
+} reply_t;
+
+/**
+ * Sends a whole buffer on a socket, with a file descriptor attached to its first byte.
+ *
+ * @param sock_fd The socket.
+ * @param buffer The bytes to send.
+ * @param len The number of bytes.
+ * @param pass_fd The file descriptor passed with SCM_RIGHTS, -1 for none.
+ * @return 0 on success, -1 on failure.
+ */
+int protocol_send(int sock_fd, const void *buffer, size_t len, int pass_fd);
+
+/**
+ * Receives exactly 'len' bytes from a socket, and the file descriptor attached to them if any.
+ *
+ * @param sock_fd The socket.
+ * @param buffer The destination of the bytes.
+ * @param len The number of bytes.
+ * @param received_fd Set to the file descriptor received, -1 if none. NULL to close any received descriptor.
+ * @return 0 on success, -1 on failure or if the peer closed the connection.
+ */
+int protocol_recv(int sock_fd, void *buffer, size_t len, int *received_fd);
+
+/**
+ * Sends the beginning of a buffer on a non-blocking socket, as much as the socket takes.
+ *
+ * @param sock_fd The socket.
+ * @param buffer The bytes to send.
+ * @param len The number of bytes, more than 0.
+ * @return The number of bytes sent, 0 if the socket is full, -1 on failure.
+ */
+ssize_t protocol_send_some(int sock_fd, const void *buffer, size_t len);
+
+/**
+ * Receives the bytes available on a non-blocking socket, up to 'len', and the file descriptor attached to them if any.
+ *
+ * @param sock_fd The socket.
+ * @param buffer The destination of the bytes.
+ * @param len The most bytes to receive, more than 0.
+ * @param received_fd Set to the file descriptor received if it is -1, any other descriptor received is closed.
+ *                    NULL to close any received descriptor.
+ * @return The number of bytes received, 0 if none is available yet, -1 on failure or if the peer closed the connection.
+ */
+ssize_t protocol_recv_some(int sock_fd, void *buffer, size_t len, int *received_fd);
+
+#endif /* PROTOCOL_H */
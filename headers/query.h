@@ -0,0 +1,78 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "handle.h"
+
+/* Cursor of a paginated query once every match was returned */
+#define TAR_QUERY_END SIZE_MAX
+
+/* Longest pattern accepted */
+#define TAR_PATTERN_MAX 1024
+
+/**
+ * Called for each entry matching a query, in path order.
+ *
+ * @param path The full path of the entry.
+ * @param entry The entry, to be passed to index_type(), index_size(), ... or tar_resolve().
+ * @param user_data The pointer given to the query.
+ * @return 0 to go on, any other value to stop the query.
+ */
+typedef int (*tar_match_fn)(const char *path, const tar_entry_t *entry, void *user_data);
+
+/**
+ * Finds the entries whose path matches a glob pattern.
+ *
+ * '?' matches any character but '/', '*' matches any sequence of characters without '/' and
+ * '**' matches any sequence of characters. A '**' directly followed by '/' matches zero or more
+ * whole directories, so that "configs/", '**', "/", '*' and ".json" in a row match both
+ * "configs/a.json" and "configs/b/c/d.json". '\' makes the next character literal. The trailing
+ * '/' of a directory is ignored, unless the pattern ends with '/' itself to match directories only.
+ *
+ * The part of the pattern before its first wildcard is searched by binary search in the paths
+ * sorted by the index, and only the paths starting with it are matched against the rest.
+ *
+ * @param handle A handle on an archive.
+ * @param pattern The null-terminated pattern.
+ * @param callback Called for each match.
+ * @param user_data Passed to 'callback'.
+ * @return The number of matches passed to 'callback', or -1 if the pattern is too long or the allocation failed.
+ */
+ssize_t tar_glob(tar_handle_t *handle, const char *pattern, tar_match_fn callback, void *user_data);
+
+/**
+ * Same as tar_glob(), the paths of the matches being copied page by page.
+ *
+ * @param handle A handle on an archive.
+ * @param pattern The null-terminated pattern.
+ * @param cursor 0 for the first page, then the value set by the previous call. Set to TAR_QUERY_END once there is no match left.
+ *               It is valid as long as no entry is added to the index.
+ * @param entries An array of 'no_entries' buffers of TAR_PATH_MAX bytes, receiving the paths.
+ * @param no_entries The number of buffers in 'entries'.
+ * @return The number of paths written to 'entries', or -1 if the pattern is too long or the allocation failed.
+ */
+ssize_t tar_glob_page(tar_handle_t *handle, const char *pattern, size_t *cursor, char **entries, size_t no_entries);
+
+/**
+ * Finds the entries whose path starts with a prefix, which is not interpreted.
+ *
+ * @param handle A handle on an archive.
+ * @param prefix The null-terminated prefix, "" for every entry.
+ * @param callback Called for each match.
+ * @param user_data Passed to 'callback'.
+ * @return The number of matches passed to 'callback', or -1 if the allocation failed.
+ */
+ssize_t tar_prefix(tar_handle_t *handle, const char *prefix, tar_match_fn callback, void *user_data);
+
+/**
+ * Same as tar_prefix(), the paths of the matches being copied page by page.
+ *
+ * @param handle A handle on an archive.
+ * @param prefix The null-terminated prefix.
+ * @param cursor As for tar_glob_page().
+ * @param entries An array of 'no_entries' buffers of TAR_PATH_MAX bytes, receiving the paths.
+ * @param no_entries The number of buffers in 'entries'.
+ * @return The number of paths written to 'entries', or -1 if the allocation failed.
+ */
+ssize_t tar_prefix_page(tar_handle_t *handle, const char *prefix, size_t *cursor, char **entries, size_t no_entries);
+
+#endif /* QUERY_H */
@@ -0,0 +1,108 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "handle.h"
+#include "protocol.h"
+
+/* Clients connected at the same time */
+#define SERVER_MAX_CLIENTS 256
+
+/* Archives kept open by the server, those no client uses are closed from the least recently used when it is full */
+#define SERVER_MAX_ARCHIVES 64
+
+/* Most entries returned by a single list request */
+#define SERVER_LIST_MAX 65536
+
+typedef struct server_archive
+{
+    int tar_fd;                   /* descriptor received from the first client opening the archive */
+    dev_t dev;                    /* identity of the archive, to share its index between clients */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int direct;                   /* whether clients read the contents themselves (not compressed) */
+    tar_handle_t *handle;         /* NULL if the slot is free */
+    size_t no_clients;            /* clients that opened the archive */
+    uint64_t last_used;           /* when the last of them disconnected */
+} server_archive_t;
+
+/* Largest request: its header and the longest path */
+#define SERVER_REQUEST_MAX (sizeof(request_t) + PROTOCOL_PATH_MAX)
+
+typedef struct server_client
+{
+    int sock_fd;                  /* non-blocking */
+    server_archive_t *archive;    /* archive opened by the client, NULL before its first request */
+    uint8_t *in;                  /* request being received, SERVER_REQUEST_MAX bytes */
+    size_t in_len;                /* bytes of the request received so far */
+    int in_fd;                    /* descriptor received with the request, -1 if none */
+    uint8_t *out;                 /* reply not sent yet, NULL if none */
+    size_t out_len;
+    size_t out_sent;              /* bytes of the reply already sent */
+} server_client_t;
+
+typedef struct tar_server
+{
+    int listen_fd;
+    int wake_fds[2];              /* pipe waking the server up to stop it */
+    char socket_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    server_archive_t archives[SERVER_MAX_ARCHIVES];
+    size_t no_archives;           /* slots used so far, some of them freed */
+    uint64_t clock;               /* incremented each time an archive is released */
+    server_client_t clients[SERVER_MAX_CLIENTS];
+    size_t no_clients;
+    int stop;
+} tar_server_t;
+
+/**
+ * Creates a server listening on a Unix socket.
+ *
+ * The server owns the archives opened by its clients and their indexes: each archive is
+ * indexed once, whatever the number of clients and processes querying it. An archive no client
+ * uses anymore is kept for the next ones, unless it was modified since it was indexed, and is
+ * closed when the server needs its slot for another archive. A client opens an
+ * archive by passing its own file descriptor with SCM_RIGHTS, which proves that it may read it.
+ * The contents of files are not sent through the socket: the server replies with their offset
+ * in the archive and the client reads them from its descriptor, except for gzip-compressed
+ * archives whose contents are sent inline.
+ *
+ * @param server The server to create.
+ * @param socket_path The path of the socket, replaced if it exists.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_server_init(tar_server_t *server, const char *socket_path);
+
+/**
+ * Answers the requests of the clients until tar_server_stop() is called.
+ *
+ * A single thread serves every client. Their sockets are non-blocking: a request received in
+ * pieces and a reply the socket does not take at once are kept with the client until its socket
+ * is ready, so a slow or stalled client never makes the others wait. The next request of a client
+ * is only read once its reply is sent.
+ *
+ * @param server A server created by tar_server_init().
+ * @return 0 once stopped, -1 on failure.
+ */
+int tar_server_run(tar_server_t *server);
+
+/**
+ * Makes tar_server_run() return. Can be called from another thread or from a signal handler.
+ *
+ * @param server A server created by tar_server_init().
+ */
+void tar_server_stop(tar_server_t *server);
+
+/**
+ * Disconnects the clients, closes the archives and removes the socket.
+ *
+ * @param server A server created by tar_server_init(), not running.
+ */
+void tar_server_free(tar_server_t *server);
+
+#endif /* SERVER_H */
@@ -0,0 +1,100 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "index.h"
+
+#define SIDECAR_MAGIC   "TARIDX\0"
+#define SIDECAR_MAGLEN  8
+#define SIDECAR_VERSION 4
+
+/* Appended members are journaled until they outnumber both this and a quarter of the indexed entries, the sidecar is then rewritten */
+#define SIDECAR_JOURNAL_MIN 64
+
+/* Written in native byte order, the loader rejects a sidecar written on another architecture */
+#define SIDECAR_BYTE_ORDER 0x01020304u
+
+typedef struct sidecar_header
+{                                 /* byte offset */
+    char magic[SIDECAR_MAGLEN];   /*   0 */
+    uint32_t version;             /*   8 */
+    uint32_t byte_order;          /*  12 */
+    uint32_t entry_size;          /*  16 sizeof(tar_entry_t) */
+    uint32_t padding;             /*  20 */
+    uint64_t archive_size;        /*  24 */
+    int64_t archive_mtime_sec;    /*  32 */
+    int64_t archive_mtime_nsec;   /*  40 */
+    uint64_t header_hash;         /*  48 hash of the first and last headers of the archive */
+    uint64_t no_entries;          /*  56 */
+    uint64_t no_buckets;          /*  64 */
+    uint64_t arena_len;           /*  72 */
+    uint64_t entries_offset;      /*  80 entries (paths and tree), in archive order */
+    uint64_t buckets_offset;      /*  88 hash table of entry ids */
+    uint64_t sorted_offset;       /*  96 entry ids sorted by path */
+    uint64_t arena_offset;        /* 104 directory prefixes, paths and link targets */
+    uint64_t offsets_offset;      /* 112 header offset of each entry */
+    uint64_t sizes_offset;        /* 120 content size of each entry */
+    uint64_t types_offset;        /* 128 typeflag of each entry */
+    uint64_t modes_offset;        /* 136 permission bits of each entry */
+    uint64_t no_prefixes;         /* 144 */
+    uint64_t last_offset;         /* 152 offset of the last header, hashed with the first one */
+    uint64_t journal_offset;      /* 160 header offsets of the members appended since the sections were written */
+    uint64_t no_journaled;        /* 168 */
+} sidecar_header_t;
+
+/**
+ * Writes an index to a sidecar file (for example "archive.tar.idx").
+ *
+ * The sidecar holds the entries of the index (paths, directory tree), the parallel arrays of
+ * their offsets, sizes, types and modes, its hash table, a table of the entries sorted by path
+ * and the arena of paths and link targets, laid out as they are in memory. It also records the size and modification time of the archive and a
+ * hash of its first and last headers, so that sidecar_load() can tell when it is stale.
+ * The file is written under a unique temporary name in the same directory and renamed, so readers
+ * never see it partially written and concurrent writers do not overwrite each other's temporary file.
+ *
+ * @param index The index of the archive.
+ * @param tar_fd A file descriptor pointing to the archive.
+ * @param idx_path The path of the sidecar file.
+ * @return 0 on success, -1 on failure.
+ */
+int sidecar_write(tar_index_t *index, int tar_fd, const char *idx_path);
+
+/**
+ * Records members appended to an archive in its sidecar file, without writing the index again.
+ *
+ * The offsets of their headers are added to a journal at the end of the sidecar, and the size,
+ * modification time and hash of the archive are updated in its header, which is written last.
+ * sidecar_load() indexes the journaled members from their headers.
+ *
+ * @param tar_fd A file descriptor pointing to the archive, once the members are written.
+ * @param idx_path The path of the sidecar file written by sidecar_write().
+ * @param start The offset where the new members start, the previous end of the archive.
+ * @param offsets The offsets of the headers of the new members, in archive order.
+ * @param count The number of new members.
+ * @return 0 on success, -1 if the sidecar does not exist, did not match the archive before the members
+ *         were appended, or its journal is full: it must then be written again by sidecar_write().
+ */
+int sidecar_append(int tar_fd, const char *idx_path, off_t start, const uint64_t *offsets, size_t count);
+
+/**
+ * Loads an index from a sidecar file.
+ *
+ * The sidecar is mapped in memory and the arrays of the index point into the mapping: nothing
+ * is parsed. Every section must fit in the file and every entry id and arena offset is checked
+ * once, so that a truncated or corrupt sidecar is rejected instead of read out of bounds.
+ * The mapping is private, so memoizing link targets does not modify the file. If members were
+ * journaled by sidecar_append(), the index is copied to memory and their headers are read and indexed.
+ *
+ * @param index The index to load, not initialized.
+ * @param tar_fd A file descriptor pointing to the archive.
+ * @param idx_path The path of the sidecar file written by sidecar_write().
+ * @return 0 on success,
+ *         -1 if the sidecar does not exist, is invalid or corrupt,
+ *         -2 if it does not match the archive anymore (size, modification time or headers changed).
+ */
+int sidecar_load(tar_index_t *index, int tar_fd, const char *idx_path);
+
+#endif /* SIDECAR_H */
@@ -0,0 +1,132 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Per-API counters, compiled in only when TAR_STATS is defined (make STATS=1).
+ * Without it, the macros below expand to nothing and tar_stats_get() reports zeros.
+ *
+ * The work done while an API function runs is attributed to that function, including the
+ * work of the other API functions it calls itself.
+ */
+
+typedef enum tar_api
+{
+    TAR_API_OTHER,                /* work done outside of any API function, e.g. by a block reader used directly */
+    TAR_API_CHECK_ARCHIVE,
+    TAR_API_EXISTS,
+    TAR_API_IS_DIR,
+    TAR_API_IS_FILE,
+    TAR_API_IS_SYMLINK,
+    TAR_API_LIST,
+    TAR_API_READ_FILE,
+    TAR_API_LOOKUP_BATCH,
+    TAR_API_OPEN,
+    TAR_API_OPEN_MMAP,
+    TAR_API_OPEN_SIDECAR,
+    TAR_API_RESOLVE,
+    TAR_API_HANDLE_EXISTS,
+    TAR_API_HANDLE_IS_DIR,
+    TAR_API_HANDLE_IS_FILE,
+    TAR_API_HANDLE_IS_SYMLINK,
+    TAR_API_HANDLE_LIST,
+    TAR_API_HANDLE_READ_FILE,
+    TAR_API_READ_FILE_VIEW,
+    TAR_API_ITER_NEXT,
+    TAR_API_ITER_READ,
+    TAR_API_EXTRACT,
+    TAR_API_COUNT
+} tar_api_t;
+
+typedef struct tar_api_stats
+{
+    uint64_t no_calls;
+    uint64_t time_ns;             /* wall-clock time spent in the function */
+    uint64_t no_headers;          /* headers visited */
+    uint64_t no_syscalls;         /* pread() calls on the archive */
+    uint64_t bytes_read;          /* bytes read from the archive or copied from its mapping */
+    uint64_t symlink_hops;        /* links followed */
+} tar_api_stats_t;
+
+typedef struct tar_stats
+{
+    tar_api_stats_t api[TAR_API_COUNT];
+} tar_stats_t;
+
+#ifdef TAR_STATS
+
+#define STATS_CALL(api, expr) ({ stats_enter(api); __typeof__(expr) _stats_ret = (expr); stats_exit(); _stats_ret; })
+#define STATS_ADD(field, n) stats_add(offsetof(tar_api_stats_t, field), (n))
+#define STATS_ATTACH(api) stats_attach(api)
+
+/**
+ * Marks the start of a call to an API function by the calling thread.
+ * Nested calls are attributed to the outermost function.
+ *
+ * @param api The function called.
+ */
+void stats_enter(tar_api_t api);
+
+/**
+ * Marks the end of the call started by the matching stats_enter().
+ */
+void stats_exit(void);
+
+/**
+ * Attributes the work of the calling thread to an API function, without counting a call.
+ * Used by the worker threads started by an API function.
+ *
+ * @param api The function that started the thread.
+ */
+void stats_attach(tar_api_t api);
+
+/**
+ * Adds to a counter of the API function running in the calling thread.
+ *
+ * @param field The offset of the counter in tar_api_stats_t.
+ * @param n The value to add.
+ */
+void stats_add(size_t field, uint64_t n);
+
+#else
+
+#define STATS_CALL(api, expr) (expr)
+#define STATS_ADD(field, n) ((void) 0)
+#define STATS_ATTACH(api) ((void) 0)
+
+#endif /* TAR_STATS */
+
+/**
+ * Copies the counters of every API function.
+ *
+ * @param stats An out argument, set to the counters accumulated since the last tar_stats_reset().
+ * @return 0 if the counters are compiled in, -1 otherwise (the counters are then all zero).
+ */
+int tar_stats_get(tar_stats_t *stats);
+
+/**
+ * Sets every counter to zero.
+ */
+void tar_stats_reset(void);
+
+/**
+ * Returns the name of an API function, as used by get_info_stats().
+ *
+ * @param api The function.
+ * @return The name of the function.
+ */
+const char *tar_api_name(tar_api_t api);
+
+/**
+ * Prints the counters of the API functions that were called or did any work.
+ *
+ * @param stats The counters filled by tar_stats_get().
+ */
+void get_info_stats(const tar_stats_t *stats);
+
+#endif /* STATS_H */
@@ -0,0 +1,102 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <errno.h>
+
+#include "iter.h"
+
+/* Bytes read from the file descriptor at once by tar_stream_fd() */
+#define STREAM_READ_SIZE (64 * 1024)
+
+/* Return values of on_member */
+#define STREAM_CONTENT 0          /* the content of the member is passed to on_data */
+#define STREAM_SKIP    1          /* the content of the member is discarded */
+
+/* Errors of the parser, after those of check_header() */
+#define STREAM_ABORTED   -4       /* a callback returned a negative value */
+#define STREAM_TRUNCATED -5       /* the input ended inside a member, or could not be read */
+
+typedef enum
+{
+    STREAM_HEADER,                /* collecting the bytes of a header */
+    STREAM_DATA,                  /* passing the content of a member */
+    STREAM_PADDING,               /* discarding the bytes after the content */
+    STREAM_END,                   /* the end-of-archive block was found */
+    STREAM_ERROR
+} stream_state_t;
+
+typedef struct tar_stream_callbacks
+{
+    /* Called for each member once its header is validated. Returns STREAM_CONTENT, STREAM_SKIP, or a negative value to stop. */
+    int (*on_member)(const tar_member_t *member, void *user_data);
+    /* Called with each chunk of the content, in order. Returns 0, or a negative value to stop. */
+    int (*on_data)(const tar_member_t *member, const uint8_t *data, size_t len, void *user_data);
+    /* Called after the last chunk of each member whose content was passed. Returns 0, or a negative value to stop. */
+    int (*on_end)(const tar_member_t *member, void *user_data);
+    void *user_data;
+} tar_stream_callbacks_t;
+
+typedef struct tar_stream
+{
+    tar_stream_callbacks_t callbacks;
+    stream_state_t state;
+    int error;                    /* return value once in STREAM_ERROR */
+    uint8_t header[HEADER_SIZE];  /* header being collected, when it spans several calls */
+    size_t header_len;
+    tar_member_t member;          /* current member */
+    int skip;                     /* whether its content is discarded */
+    size_t remaining;             /* bytes of its content not received yet */
+    size_t padding;               /* bytes after its content, up to the next header */
+    off_t offset;                 /* bytes of the archive received */
+    size_t no_members;
+} tar_stream_t;
+
+/**
+ * Starts parsing an archive received piece by piece, in a single forward pass.
+ *
+ * The archive is pushed with tar_stream_feed() in chunks of any size, and the callbacks are
+ * called as soon as the bytes they need are received. Only a header split between two chunks is
+ * copied: the contents are passed to on_data straight from the chunks, and skipped contents are
+ * discarded, so that the memory used does not depend on the size of the archive.
+ *
+ * @param stream The parser to initialize.
+ * @param callbacks The callbacks, copied. A NULL on_member passes every content, a NULL on_data skips them all.
+ */
+void tar_stream_init(tar_stream_t *stream, const tar_stream_callbacks_t *callbacks);
+
+/**
+ * Parses the next bytes of the archive. Each header is validated like check_archive() does.
+ *
+ * @param stream A parser started by tar_stream_init().
+ * @param data The bytes following those of the previous call.
+ * @param len The number of bytes.
+ * @return 0 if more bytes are expected,
+ *         1 once the end of the archive is reached (the bytes after it are ignored),
+ *         -1, -2, -3 if a header has an invalid magic, version or checksum value,
+ *         STREAM_ABORTED if a callback stopped the parsing.
+ *         Once an error is returned, it is returned by every following call.
+ */
+int tar_stream_feed(tar_stream_t *stream, const uint8_t *data, size_t len);
+
+/**
+ * Ends the parsing, once the whole input was fed.
+ *
+ * An input ending right after a member, without the end-of-archive blocks, is accepted.
+ *
+ * @param stream A parser started by tar_stream_init().
+ * @return The number of members, or a negative value as tar_stream_feed(), or STREAM_TRUNCATED
+ *         if the input ended inside a member.
+ */
+int tar_stream_finish(tar_stream_t *stream);
+
+/**
+ * Parses an archive read from a file descriptor, which does not need to be seekable (a pipe,
+ * a socket, the standard input). The archive is read forward once, with read(), until its end.
+ *
+ * @param fd The file descriptor, read from its current position.
+ * @param callbacks The callbacks, as for tar_stream_init().
+ * @return Same as tar_stream_finish(), STREAM_TRUNCATED if a read failed.
+ */
+int tar_stream_fd(int fd, const tar_stream_callbacks_t *callbacks);
+
+#endif /* STREAM_H */
@@ -6,7 +6,32 @@
 #include <fcntl.h>
 #include <stdio.h>
 
+#include <ftw.h>
+#include <poll.h>
+#include <pthread.h>
+
 #include "lib_tar.h"
+#include "handle.h"
+#include "iter.h"
+#include "extract.h"
+#include "writer.h"
+#include "append.h"
+#include "async.h"
+#include "server.h"
+#include "client.h"
+#include "stream.h"
+#include "query.h"
+#include "overlay.h"
+#include "diff.h"
+
+typedef struct stress_arg
+{
+    int id;
+    int fd;
+    tar_handle_t *handle;
+    int no_iterations;
+    int no_errors;
+} stress_arg_t;
 
 /**
  * @brief Display a hexadecimal dump of a byte array.
@@ -24,6 +49,84 @@ void debug_dump(const uint8_t *bytes, size_t len);
  */
 void check_archive_test(int fd, int expected);
 
+/**
+ * @brief Test function for the check_archive_mt function.
+ *
+ * @param fd         File descriptor of the tar archive.
+ * @param no_threads Number of workers validating the headers.
+ * @param expected   Expected return value.
+ */
+void check_archive_mt_test(int fd, int no_threads, int expected);
+
+/**
+ * @brief Test function for the header_checksum function, compared to the stored checksums and the scalar version.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void header_checksum_test(int fd);
+
+/**
+ * @brief Test function for the tar_octal function.
+ *
+ * @param field    Field holding the octal number.
+ * @param len      Length of the field.
+ * @param expected Expected return value.
+ */
+void tar_octal_test(char *field, size_t len, long expected);
+
+/**
+ * @brief Test that exists() on the given path makes at most the given number of system calls.
+ *
+ * @param fd           File descriptor of the tar archive.
+ * @param path         Path to check for existence.
+ * @param max_syscalls Maximum number of pread() calls.
+ */
+void reader_stats_test(int fd, char *path, size_t max_syscalls);
+
+/**
+ * @brief Thread body of concurrency_test(): calls exists, is_dir, list and read_file in a loop and counts the wrong results.
+ *
+ * @param arg The stress_arg_t of the thread.
+ * @return    NULL.
+ */
+void *stress_worker(void *arg);
+
+/**
+ * @brief Runs several threads calling the library on the same file descriptor (or handle) at the same time.
+ *
+ * @param fd            File descriptor of the tar archive, shared by every thread.
+ * @param handle        Handle shared by every thread, NULL to use the fd-based functions.
+ * @param no_threads    Number of threads.
+ * @param no_iterations Number of iterations of each thread.
+ */
+void concurrency_test(int fd, tar_handle_t *handle, int no_threads, int no_iterations);
+
+/**
+ * @brief Test function for the tar_iter_begin, tar_iter_next and tar_iter_read functions.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void iter_test(int fd);
+
+/**
+ * @brief Test function for the tar_lookup_batch function.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void lookup_batch_test(int fd);
+
+/**
+ * @brief Copies the tar archive into a temporary file, with some bytes of its headers modified.
+ *
+ * @param fd              File descriptor of the tar archive.
+ * @param no_corruptions  Number of bytes to modify.
+ * @param member          Index of the member whose header is modified, for each byte.
+ * @param field_offset    Offset of the byte in the header, for each byte.
+ * @param value           New value of the byte, for each byte.
+ * @return                File descriptor of the corrupted archive (already unlinked), -1 on failure.
+ */
+int corrupt_archive(int fd, int no_corruptions, int member[], size_t field_offset[], char value[]);
+
 /**
  * @brief Test function for the exists function.
  *
@@ -77,6 +180,240 @@ void list_test(int fd, char *path, size_t no_entries, int expected_ret, size_t e
  */
 void read_file_test(int fd, char *path, size_t offset, size_t len, int expected_ret, size_t expected_len, char *expected_buffer);
 
+/**
+ * @brief Test function for the read_file_view function.
+ *
+ * @param handle          Handle opened by tar_open_mmap() on the tar archive.
+ * @param path            Path to the file to view.
+ * @param offset          Offset from the beginning of the file.
+ * @param expected_ret    Expected return value.
+ * @param expected_len    Expected length of the view.
+ * @param expected_buffer Expected content of the view.
+ */
+void read_file_view_test(tar_handle_t *handle, char *path, size_t offset, int expected_ret, size_t expected_len, char *expected_buffer);
+
+/**
+ * @brief Test function for the sidecar_load function.
+ *
+ * @param fd       File descriptor of the tar archive.
+ * @param idx_path Path of the sidecar file.
+ * @param expected Expected return value.
+ */
+void sidecar_load_test(int fd, const char *idx_path, int expected);
+
+/**
+ * @brief Test function for the counters of tar_stats_get().
+ *
+ * @param api          API function whose counters are checked.
+ * @param no_calls     Expected number of calls.
+ * @param no_headers   Expected number of headers visited.
+ * @param no_syscalls  Expected number of system calls.
+ * @param bytes_read   Expected number of bytes read.
+ * @param symlink_hops Expected number of links followed.
+ */
+void stats_test(tar_api_t api, uint64_t no_calls, uint64_t no_headers, uint64_t no_syscalls, uint64_t bytes_read, uint64_t symlink_hops);
+
+/**
+ * @brief Compresses the tar archive into a temporary gzip file.
+ *
+ * @param fd          File descriptor of the tar archive.
+ * @param flush_every Number of bytes of the archive after which the current deflate block is ended.
+ * @return            File descriptor of the compressed archive (already unlinked), -1 on failure.
+ */
+int gzip_archive(int fd, size_t flush_every);
+
+/**
+ * @brief Test function for the gz_read_at function, comparing its reads with the uncompressed archive.
+ *
+ * @param fd         File descriptor of the uncompressed tar archive.
+ * @param index      Index built on the compressed archive.
+ * @param min_points Minimum number of checkpoints expected in the index.
+ */
+void gz_read_test(int fd, gz_index_t *index, size_t min_points);
+
+/**
+ * @brief Copies the tar archive into a temporary file, with its members in reverse order.
+ *
+ * @param fd File descriptor of the tar archive.
+ * @return   File descriptor of the reversed archive (already unlinked), -1 on failure.
+ */
+int reverse_archive(int fd);
+
+/**
+ * @brief Tests of the list function that do not depend on the order of the members in the archive.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void unordered_list_tests(int fd);
+
+/**
+ * @brief Creates a temporary tar archive whose symlinks form cycles or point outside of the archive.
+ *
+ * @return File descriptor of the archive (already unlinked), -1 on failure.
+ */
+int link_cycle_archive(void);
+
+/**
+ * @brief Creates a temporary tar archive whose entries try to be extracted outside of the destination directory.
+ *
+ * @return File descriptor of the archive (already unlinked), -1 on failure.
+ */
+int unsafe_archive(void);
+
+/**
+ * @brief Removes a directory and everything it contains, without following symlinks.
+ *
+ * @param path Path of the directory.
+ */
+void remove_tree(const char *path);
+
+/**
+ * @brief Test function for the tar_extract function, comparing the extracted files with the archive.
+ *
+ * @param fd         File descriptor of the tar archive.
+ * @param no_threads Number of threads writing the files.
+ */
+void extract_test(int fd, int no_threads);
+
+/**
+ * @brief Tests that tar_extract() with no_permissions leaves the directories with the default mode of the umask.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void default_modes_extract_test(int fd);
+
+/**
+ * @brief Tests that tar_extract() does not write outside of the destination directory.
+ *
+ * @param fd File descriptor of the archive created by unsafe_archive().
+ */
+void unsafe_extract_test(int fd);
+
+/**
+ * @brief Creates a temporary tar archive with the writer: a directory, files, a symlink and a name split with the prefix field.
+ *
+ * @param big      Content of a file too large to be copied to the staging buffer.
+ * @param big_size Size of this content.
+ * @return File descriptor of the archive (already unlinked), -1 on failure.
+ */
+int writer_archive(uint8_t *big, size_t big_size);
+
+/**
+ * @brief Tests that the archive created by writer_archive() is valid and holds the expected members.
+ *
+ * @param fd       File descriptor of the archive created by writer_archive().
+ * @param big      Content of the large file.
+ * @param big_size Size of this content.
+ */
+void writer_test(int fd, uint8_t *big, size_t big_size);
+
+/**
+ * @brief Test function for the tar_add_files function, archiving the extracted test archive again and comparing the members.
+ *
+ * @param fd         File descriptor of the tar archive.
+ * @param no_threads Number of threads reading the files.
+ */
+void add_files_test(int fd, int no_threads);
+
+/**
+ * @brief Test function for the append functions: members are appended to a copy of the archive through a handle, a
+ *        handle loaded from a sidecar, no handle and a mapped archive, and read back through each of them.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void append_test(int fd);
+
+/**
+ * @brief Test function for the asynchronous reads, compared to tar_read_file(): through tar_read_batch(), then
+ *        through tar_async_submit() and tar_async_reap() driven by poll().
+ *
+ * @param handle  Handle opened on the test archive.
+ * @param options Options of the reader (queue depth, thread pool instead of io_uring).
+ */
+void async_test(tar_handle_t *handle, const tar_async_options_t *options);
+
+/**
+ * @brief Test function for the block cache: hits on repeated reads, eviction within the budget and invalidation of the
+ *        blocks rewritten by an append. The cache is left open on the archive for the tests that follow.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void cache_test(int fd);
+
+/**
+ * @brief Test function for the query server: clients on the plain and the compressed archive get the same answers as the
+ *        functions reading the archive, and clients opening the same archive share its index.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void server_test(int fd);
+
+/**
+ * @brief Test function for the streaming parser: the archive is parsed from a pipe and from chunks of various sizes, with
+ *        some contents skipped, and the errors (checksum, truncated input, parsing stopped by a callback) are reported.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void stream_test(int fd);
+
+/**
+ * @brief Test function for the index: paths rebuilt from their interned directory prefix, metadata read from the
+ *        parallel arrays, sorted order and memory usage, on the test archive and on 20000 synthetic entries.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void index_test(int fd);
+
+/**
+ * @brief Test function for the prefix and glob queries: number and order of the matches of wildcard, '**',
+ *        escaped and directory patterns, pagination, early stop, and threads sharing a handle.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void query_test(int fd);
+
+/**
+ * @brief Test function for the overlay: three layers shadowing, deleting and replacing each other's entries with
+ *        whiteouts and opaque directories, then queries, listings and reads on the merged view.
+ */
+void overlay_test(void);
+
+/**
+ * @brief Creates one of the two temporary tar archives compared by diff_test(): the new one adds, removes, replaces
+ *        and modifies entries of the old one, and changes a large file in its last chunk.
+ *
+ * @param is_new   Whether to create the new archive.
+ * @param big      Content of the large files, restored before returning.
+ * @param big_size Size of this content, more than one DIFF_CHUNK_SIZE.
+ * @return File descriptor of the archive (already unlinked), -1 on failure.
+ */
+int diff_archive(int is_new, uint8_t *big, size_t big_size);
+
+/**
+ * @brief Test function for tar_diff(): kind, changes and order of the differences between two archives with one
+ *        and several threads, identical archives and reversed comparisons.
+ */
+void diff_test(void);
+
+/**
+ * @brief Tests that list() and read_file() fail on symlinks that cannot be resolved.
+ *
+ * @param fd File descriptor of the archive created by link_cycle_archive().
+ */
+void link_cycle_tests(int fd);
+
+/**
+ * @brief Tests that a chain of MAX_SYMLINK_HOPS + 1 links resolves the same whatever link of it is resolved first.
+ */
+void link_hops_test(void);
+
+/**
+ * @brief Runs every test on the test archive.
+ *
+ * @param fd File descriptor of the tar archive.
+ */
+void run_tests(int fd);
+
 /**
  * @brief Main test function.
  *
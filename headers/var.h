@@ -24,6 +24,9 @@ typedef struct posix_header
 
 #define HEADER_SIZE (int) sizeof(tar_header_t)
 
+/* Size of a content of 'size' bytes once padded to a whole number of blocks */
+#define TAR_PADDED_SIZE(size) ((((size) + HEADER_SIZE - 1) / HEADER_SIZE) * HEADER_SIZE)
+
 #define TMAGIC   "ustar"        /* ustar and a null */
 #define TMAGLEN  6
 #define TVERSION "00"           /* 00 and no null */
@@ -36,6 +39,18 @@ typedef struct posix_header
 #define SYMTYPE  '2'            /* reserved */
 #define DIRTYPE  '5'            /* directory */
 
+/* Size of a buffer long enough for any path computed from a header: a ustar prefix, '/', a name and a null byte */
+#define TAR_PATH_MAX (155 + 1 + 100 + 1)
+
+/* Number of links followed before a symlink is considered part of a cycle */
+#define MAX_SYMLINK_HOPS 40
+
+/* Below this number of headers per thread, check_archive() validates in the calling thread */
+#define CHECK_MIN_HEADERS_PER_THREAD 4096
+
+/* Number of headers a worker of check_archive() validates before taking new ones */
+#define CHECK_BATCH_SIZE 256
+
 /* Converts an ASCII-encoded octal-based number into a regular integer */
 #define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
 
@@ -0,0 +1,149 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "helper.h"
+
+/* Number of buffers written by a single pwritev() call */
+#define WRITER_IOV_MAX 1024
+
+/* Size of the buffer holding the headers and the small contents until they are written */
+#define WRITER_STAGING_SIZE (256 * 1024)
+
+/* Contents up to this size are copied to the staging buffer, larger ones are written from the caller's buffer */
+#define WRITER_COPY_MAX 4096
+
+/* Bytes waiting to be written after which the writer flushes */
+#define WRITER_BATCH_BYTES (4 * 1024 * 1024)
+
+/* Files read in parallel by tar_add_files() before their members are written */
+#define WRITER_BATCH_FILES 256
+
+/* Files larger than this are not loaded in memory but copied by the kernel */
+#define WRITER_PREFETCH_MAX (256 * 1024)
+
+/* Largest size the 12 bytes of the size field can hold */
+#define TAR_SIZE_MAX 077777777777L
+
+typedef struct tar_writer
+{
+    int tar_fd;                   /* file descriptor of the archive */
+    off_t start;                  /* offset in the archive of the first member written */
+    off_t offset;                 /* offset in the archive of the next byte written */
+    uint8_t *staging;             /* headers and small contents waiting to be written */
+    size_t staging_len;
+    struct iovec iov[WRITER_IOV_MAX];
+    int no_iov;
+    size_t pending;               /* bytes referenced by iov */
+    void *owned[WRITER_IOV_MAX];  /* buffers released once written */
+    int no_owned;
+    int error;                    /* non-zero once a write failed */
+} tar_writer_t;
+
+/**
+ * Fills a ustar header, checksum included.
+ *
+ * Names longer than the name field are split between the prefix and the name fields at a '/'.
+ *
+ * @param header The header to fill.
+ * @param name The path of the member, ending with '/' for a directory.
+ * @param typeflag The type of the member.
+ * @param size The size of the content of the member.
+ * @param mode The permission bits of the member.
+ * @param mtime The modification time of the member.
+ * @param linkname The target of a link, NULL for other members.
+ * @return 0 on success, -1 if the name, the link target or the size does not fit in the header.
+ */
+int tar_fill_header(tar_header_t *header, const char *name, char typeflag, size_t size, mode_t mode, time_t mtime, const char *linkname);
+
+/**
+ * Starts writing a new archive at the start of a file.
+ *
+ * The members are written with positional writes: the file offset of 'tar_fd' is not moved.
+ * Nothing is guaranteed to be written before tar_writer_finish() is called.
+ *
+ * @param writer The writer to initialize.
+ * @param tar_fd A file descriptor on the archive, opened for writing.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int tar_writer_init(tar_writer_t *writer, int tar_fd);
+
+/**
+ * Adds a directory to the archive.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @param name The path of the directory, a '/' is appended if it does not end with one.
+ * @param mode The permission bits of the directory.
+ * @param mtime The modification time of the directory.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_add_dir(tar_writer_t *writer, const char *name, mode_t mode, time_t mtime);
+
+/**
+ * Adds a symlink to the archive.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @param name The path of the symlink.
+ * @param target The target of the symlink.
+ * @param mtime The modification time of the symlink.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_add_symlink(tar_writer_t *writer, const char *name, const char *target, time_t mtime);
+
+/**
+ * Adds a regular file whose content is in memory to the archive.
+ * The buffer can be reused as soon as the function returns.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @param name The path of the file.
+ * @param data The content of the file.
+ * @param size The size of the content.
+ * @param mode The permission bits of the file.
+ * @param mtime The modification time of the file.
+ * @return 0 on success, -1 on failure.
+ */
+int tar_add_data(tar_writer_t *writer, const char *name, const uint8_t *data, size_t size, mode_t mode, time_t mtime);
+
+/**
+ * Adds files, directories and symlinks of the file system to the archive, in the given order.
+ *
+ * The files are read by a pool of threads, WRITER_BATCH_FILES at a time, and their members are
+ * written in batches with pwritev(): the header, the content and the padding of many members
+ * cost a single system call. Files larger than WRITER_PREFETCH_MAX are copied by the kernel.
+ * Directories are added alone, not with their contents.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @param paths The paths of the files to add.
+ * @param names The paths of the members in the archive, NULL to use 'paths' without leading '/'.
+ * @param n The number of files.
+ * @param no_threads The number of threads reading the files, 0 for one per CPU.
+ * @return The number of members added,
+ *         -1 if writing the archive failed,
+ *         -2 if any file could not be read or does not fit in a header (the others are added).
+ */
+ssize_t tar_add_files(tar_writer_t *writer, const char *const *paths, const char *const *names, size_t n, int no_threads);
+
+/**
+ * Writes everything added so far to the archive.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @return 0 on success, -1 if a write failed.
+ */
+int tar_writer_flush(tar_writer_t *writer);
+
+/**
+ * Writes the end-of-archive blocks and releases the writer.
+ * A regular file is truncated after these blocks.
+ *
+ * @param writer A writer started by tar_writer_init().
+ * @return 0 on success, -1 if a write failed (now or before).
+ */
+int tar_writer_finish(tar_writer_t *writer);
+
+#endif /* WRITER_H */
@@ -0,0 +1,144 @@
+#include "../headers/append.h"
+
+static int is_zero_block(const uint8_t *block)
+{
+    for (size_t i = 0; i < HEADER_SIZE; i++)
+    {
+        if (block[i] != 0) return 0;
+    }
+    return 1;
+}
+
+
+// End computed from the index: the member stored last is the one whose header has the highest offset
+static off_t indexed_end(tar_handle_t *handle)
+{
+    tar_index_t *index = &handle->index;
+    off_t end = 0;
+    for (size_t i = 0; i < index->no_entries; i++)
+    {
+        off_t entry_end = index->offsets[i] + HEADER_SIZE + TAR_PADDED_SIZE(index->sizes[i]);
+        if (entry_end > end) end = entry_end;
+    }
+    return end;
+}
+
+
+static off_t scanned_end(int tar_fd, off_t size)
+{
+    block_reader_t reader;
+    const tar_header_t *header;
+    if (reader_init(&reader, tar_fd) != 0) return -1;
+
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0') skip_file_content(&reader, header);
+
+    // Without end-of-archive blocks, the archive ends after the content of its last member
+    off_t end = (header == NULL) ? reader_tell(&reader) : reader_tell(&reader) - HEADER_SIZE;
+    reader_free(&reader);
+    return (end > size) ? -1 : end;
+}
+
+
+off_t tar_archive_end(int tar_fd, tar_handle_t *handle)
+{
+    struct stat st;
+    if (tar_gz_index(tar_fd) != NULL || fstat(tar_fd, &st) != 0) return -1;
+    if (handle == NULL) return scanned_end(tar_fd, st.st_size);
+
+    // The index may not match the archive anymore: the end found must be followed by a zero block
+    uint8_t block[HEADER_SIZE];
+    off_t end = indexed_end(handle);
+    if (end == st.st_size || (end < st.st_size && pread(tar_fd, block, HEADER_SIZE, end) == HEADER_SIZE && is_zero_block(block))) return end;
+    return scanned_end(tar_fd, st.st_size);
+}
+
+
+int tar_append_begin(tar_writer_t *writer, int tar_fd, tar_handle_t *handle)
+{
+    off_t end = tar_archive_end(tar_fd, handle);
+    if (end < 0 || tar_writer_init(writer, tar_fd) != 0) return -1;
+    writer->start = writer->offset = end;
+    return 0;
+}
+
+
+// Finds the headers of the members written between 'start' and 'end', and indexes them in the handle if one is given
+static int index_members(int tar_fd, tar_handle_t *handle, off_t start, off_t end, uint64_t **offsets, size_t *count)
+{
+    block_reader_t reader;
+    const tar_header_t *header;
+    size_t cap_offsets = 64;
+    size_t first = 0;
+    *count = 0;
+    *offsets = (uint64_t *) malloc(cap_offsets * sizeof(uint64_t));
+    if (*offsets == NULL) return -1;
+    if (handle != NULL && index_own(&handle->index) != 0) return -1;
+    if (reader_init(&reader, tar_fd) != 0) return -1;
+    if (handle != NULL) first = handle->index.no_entries;
+    reader_skip(&reader, start);
+
+    int ret = 0;
+    while (reader_tell(&reader) < end && (header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
+    {
+        off_t hdr_offset = reader_tell(&reader) - HEADER_SIZE;
+        if (*count == cap_offsets)
+        {
+            cap_offsets *= 2;
+            uint64_t *new_offsets = (uint64_t *) realloc(*offsets, cap_offsets * sizeof(uint64_t));
+            if (new_offsets == NULL) {ret = -1; break;}
+            *offsets = new_offsets;
+        }
+        (*offsets)[(*count)++] = hdr_offset;
+        if (handle != NULL && index_insert(&handle->index, header, hdr_offset) == NULL) {ret = -1; break;}
+        skip_file_content(&reader, header);
+    }
+
+    reader_free(&reader);
+    // Only the new entries are linked, the tree of the entries already indexed is kept
+    if (handle != NULL) index_link_entries(&handle->index, first);
+    return ret;
+}
+
+
+// Maps the archive again, the previous mapping does not cover the new members
+static int remap(tar_handle_t *handle)
+{
+    struct stat st;
+    if (fstat(handle->tar_fd, &st) != 0 || st.st_size <= 0) return -1;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, handle->tar_fd, 0);
+    if (map == MAP_FAILED) return -1;
+    munmap((void *) handle->map, handle->map_len);
+    handle->map = (const uint8_t *) map;
+    handle->map_len = st.st_size;
+    return 0;
+}
+
+
+int tar_append_finish(tar_writer_t *writer, tar_handle_t *handle, const char *idx_path)
+{
+    int tar_fd = writer->tar_fd;
+    off_t start = writer->start;
+    int ret = tar_writer_flush(writer);
+    off_t end = writer->offset;
+    if (tar_writer_finish(writer) != 0 || ret != 0) return -1;
+
+    int has_sidecar = (idx_path != NULL && access(idx_path, F_OK) == 0);
+    if (handle == NULL && has_sidecar == 0) return 0;
+
+    uint64_t *offsets;
+    size_t count;
+    ret = (index_members(tar_fd, handle, start, end, &offsets, &count) == 0) ? 0 : -2;
+    if (ret == 0 && handle != NULL && handle->map != NULL && remap(handle) != 0) ret = -2;
+
+    // The sidecar is written again only when the new members cannot be journaled in it, without a handle the archive is indexed again
+    if (ret == 0 && has_sidecar == 1 && sidecar_append(tar_fd, idx_path, start, offsets, count) != 0)
+    {
+        tar_handle_t *scanned = (handle == NULL) ? tar_open(tar_fd) : handle;
+        if (scanned == NULL || sidecar_write(&scanned->index, tar_fd, idx_path) != 0) ret = -2;
+        if (scanned != NULL && scanned != handle) tar_close(scanned);
+    }
+
+    free(offsets);
+    return ret;
+}
@@ -0,0 +1,387 @@
+#include "../headers/async.h"
+
+// Same checks as tar_read_file(), the read itself is left to the caller.
+// Returns the number of bytes to read, 0 if the request is already completed.
+static size_t prepare(tar_async_t *async, tar_read_req_t *req, off_t *data_offset)
+{
+    size_t dest_len = req->len;
+    req->len = 0;
+    req->total_len = 0;
+
+    tar_index_t *index = &async->handle->index;
+    tar_entry_t *entry = tar_resolve(async->handle, req->path);
+    if (entry == NULL || (index_type(index, entry) != REGTYPE && index_type(index, entry) != AREGTYPE)) {req->ret = -1; return 0;}
+    if ((ssize_t) req->offset < 0 || req->offset >= index_size(index, entry)) {req->ret = -2; return 0;}
+
+    req->total_len = index_size(index, entry) - req->offset;
+    size_t used_len = (req->total_len > dest_len) ? dest_len : req->total_len;
+    *data_offset = index_offset(index, entry) + HEADER_SIZE + req->offset;
+    if (used_len == 0) {req->ret = -1; return 0;}
+
+    if (async->handle->map != NULL)
+    {
+        memcpy(req->dest, async->handle->map + *data_offset, used_len);
+        req->len = used_len;
+        req->ret = req->total_len - used_len;
+        return 0;
+    }
+    // Set when the read completes: a read given back by tar_async_submit() is submitted again unchanged
+    req->len = dest_len;
+    return used_len;
+}
+
+
+static void complete(tar_read_req_t *req, ssize_t nber_read)
+{
+    if (nber_read <= 0) {req->len = 0; req->ret = -1; return;}
+    req->len = nber_read;
+    req->ret = req->total_len - nber_read;
+}
+
+
+// Adds a completed request, the caller holds the lock
+static void push_done(tar_async_t *async, tar_read_req_t *req)
+{
+    async->done[(async->done_head + async->done_len) % async->depth] = req;
+    async->done_len++;
+}
+
+
+static void notify(tar_async_t *async)
+{
+    uint64_t one = 1;
+    if (write(async->event_fd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+
+static void *read_worker(void *arg)
+{
+    tar_async_t *async = (tar_async_t *) arg;
+
+    pthread_mutex_lock(&async->lock);
+    while (1)
+    {
+        while (async->pending_len == 0 && async->stop == 0) pthread_cond_wait(&async->work, &async->lock);
+        if (async->pending_len == 0) break;
+
+        tar_read_req_t *req = async->pending[async->pending_head];
+        async->pending_head = (async->pending_head + 1) % async->depth;
+        async->pending_len--;
+        pthread_mutex_unlock(&async->lock);
+
+        off_t data_offset;
+        size_t used_len = prepare(async, req, &data_offset);
+        if (used_len > 0) complete(req, archive_pread(async->handle->tar_fd, req->dest, used_len, data_offset));
+
+        pthread_mutex_lock(&async->lock);
+        push_done(async, req);
+        pthread_cond_signal(&async->completed);
+        notify(async);
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+
+
+static int uring_enter(tar_async_t *async, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, async->ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+static void uring_free(tar_async_t *async)
+{
+    if (async->sqes != NULL) munmap(async->sqes, async->sqes_len);
+    if (async->cq_map != NULL && async->cq_map != async->sq_map) munmap(async->cq_map, async->cq_map_len);
+    if (async->sq_map != NULL) munmap(async->sq_map, async->sq_map_len);
+    if (async->ring_fd != -1) close(async->ring_fd);
+    async->sqes = NULL;
+    async->cq_map = async->sq_map = NULL;
+    async->ring_fd = -1;
+}
+
+
+// Whether the kernel knows IORING_OP_READ (Linux 5.6)
+static int uring_supports_read(int ring_fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *) calloc(1, len);
+    if (probe == NULL) return 0;
+
+    int ret = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0
+              && probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+    free(probe);
+    return ret;
+}
+
+
+static int uring_init(tar_async_t *async)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    async->ring_fd = syscall(__NR_io_uring_setup, async->depth, &params);
+    if (async->ring_fd < 0) {async->ring_fd = -1; return -1;}
+    if (uring_supports_read(async->ring_fd) == 0) {uring_free(async); return -1;}
+
+    // Both rings are in a single mapping since Linux 5.4
+    async->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    async->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map && async->cq_map_len > async->sq_map_len) async->sq_map_len = async->cq_map_len;
+
+    void *map = mmap(NULL, async->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ring_fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {uring_free(async); return -1;}
+    async->sq_map = map;
+
+    if (single_map) async->cq_map = async->sq_map;
+    else
+    {
+        map = mmap(NULL, async->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ring_fd, IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED) {uring_free(async); return -1;}
+        async->cq_map = map;
+    }
+
+    async->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, async->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ring_fd, IORING_OFF_SQES);
+    if (map == MAP_FAILED) {uring_free(async); return -1;}
+    async->sqes = (struct io_uring_sqe *) map;
+
+    uint8_t *sq = (uint8_t *) async->sq_map;
+    uint8_t *cq = (uint8_t *) async->cq_map;
+    async->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    async->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    async->sq_array = (unsigned *) (sq + params.sq_off.array);
+    async->cq_head = (unsigned *) (cq + params.cq_off.head);
+    async->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    async->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    async->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // The completions signal the eventfd themselves
+    if (syscall(__NR_io_uring_register, async->ring_fd, IORING_REGISTER_EVENTFD, &async->event_fd, 1) != 0) {uring_free(async); return -1;}
+    return 0;
+}
+
+
+static int pool_init(tar_async_t *async, int no_threads)
+{
+    pthread_cond_init(&async->work, NULL);
+    pthread_cond_init(&async->completed, NULL);
+    async->pending = (tar_read_req_t **) malloc(async->depth * sizeof(tar_read_req_t *));
+    async->threads = (pthread_t *) malloc(no_threads * sizeof(pthread_t));
+    if (async->pending == NULL || async->threads == NULL) {free(async->threads); async->threads = NULL; return -1;}
+
+    for (; async->no_threads < no_threads; async->no_threads++)
+    {
+        if (pthread_create(&async->threads[async->no_threads], NULL, read_worker, async) != 0) break;
+    }
+    return (async->no_threads == 0) ? -1 : 0;
+}
+
+
+int tar_async_init(tar_async_t *async, tar_handle_t *handle, const tar_async_options_t *options)
+{
+    tar_async_options_t defaults = {.depth = 0, .no_threads = 0, .no_uring = 0};
+    if (options == NULL) options = &defaults;
+
+    memset(async, 0, sizeof(tar_async_t));
+    async->handle = handle;
+    async->ring_fd = -1;
+    async->depth = (options->depth == 0) ? TAR_ASYNC_DEPTH_DEFAULT : options->depth;
+    int no_threads = (options->no_threads <= 0) ? TAR_ASYNC_THREADS_DEFAULT : options->no_threads;
+    pthread_mutex_init(&async->lock, NULL);
+
+    async->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    async->done = (tar_read_req_t **) malloc(async->depth * sizeof(tar_read_req_t *));
+    if (async->event_fd == -1 || async->done == NULL) {tar_async_free(async); return -1;}
+
+    // io_uring reads the archive as it is stored: not for compressed archives
+    if (options->no_uring == 0 && handle->map == NULL && tar_gz_index(handle->tar_fd) == NULL && uring_init(async) == 0) async->uring = 1;
+    else if (handle->map == NULL && pool_init(async, no_threads) != 0) {tar_async_free(async); return -1;}
+    return 0;
+}
+
+
+ssize_t tar_async_submit(tar_async_t *async, tar_read_req_t *const *reqs, size_t n)
+{
+    size_t no_submitted = 0;
+    int completed = 0;
+
+    pthread_mutex_lock(&async->lock);
+    for (; no_submitted < n && async->in_flight < async->depth; no_submitted++)
+    {
+        tar_read_req_t *req = reqs[no_submitted];
+        async->in_flight++;
+
+        if (async->threads != NULL)
+        {
+            async->pending[(async->pending_head + async->pending_len) % async->depth] = req;
+            async->pending_len++;
+            continue;
+        }
+
+        // The lookup is done now, only the read of the data goes to the kernel
+        off_t data_offset;
+        size_t used_len = prepare(async, req, &data_offset);
+        if (used_len == 0) {push_done(async, req); completed = 1; continue;}
+
+        unsigned tail = *async->sq_tail + async->to_submit;
+        struct io_uring_sqe *sqe = &async->sqes[tail & async->sq_mask];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = async->handle->tar_fd;
+        sqe->addr = (uint64_t) (uintptr_t) req->dest;
+        sqe->len = (used_len > UINT32_MAX) ? UINT32_MAX : used_len;
+        sqe->off = data_offset;
+        sqe->user_data = (uint64_t) (uintptr_t) req;
+        async->sq_array[tail & async->sq_mask] = tail & async->sq_mask;
+        async->to_submit++;
+    }
+    if (async->threads != NULL && no_submitted > 0) pthread_cond_broadcast(&async->work);
+    pthread_mutex_unlock(&async->lock);
+
+    if (completed) notify(async);
+    if (async->to_submit == 0) return no_submitted;
+
+    // The whole batch is passed to the kernel with a single system call
+    unsigned tail = *async->sq_tail + async->to_submit;
+    __atomic_store_n(async->sq_tail, tail, __ATOMIC_RELEASE);
+    while (async->to_submit > 0)
+    {
+        int ret = uring_enter(async, async->to_submit, 0, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        async->to_submit -= ret;
+    }
+    if (async->to_submit == 0) return no_submitted;
+
+    // The kernel consumes the entries in order: the ones left are taken back, with the requests after the first of them
+    tar_read_req_t *first = (tar_read_req_t *) (uintptr_t) async->sqes[(tail - async->to_submit) & async->sq_mask].user_data;
+    size_t no_kept = no_submitted;
+    while (reqs[--no_kept] != first);
+    __atomic_store_n(async->sq_tail, tail - async->to_submit, __ATOMIC_RELEASE);
+    // The requests completed at submission after it are the last ones added to the completed reads
+    pthread_mutex_lock(&async->lock);
+    async->done_len -= (no_submitted - no_kept) - async->to_submit;
+    pthread_mutex_unlock(&async->lock);
+    async->in_flight -= no_submitted - no_kept;
+    async->to_submit = 0;
+    return (no_kept > 0) ? (ssize_t) no_kept : -1;
+}
+
+
+static size_t reap_ready(tar_async_t *async, tar_read_req_t **done, size_t max)
+{
+    size_t no_reaped = 0;
+
+    pthread_mutex_lock(&async->lock);
+    for (; no_reaped < max && async->done_len > 0; no_reaped++)
+    {
+        done[no_reaped] = async->done[async->done_head];
+        async->done_head = (async->done_head + 1) % async->depth;
+        async->done_len--;
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    if (async->uring == 0) return no_reaped;
+
+    unsigned head = *async->cq_head;
+    unsigned tail = __atomic_load_n(async->cq_tail, __ATOMIC_ACQUIRE);
+    for (; no_reaped < max && head != tail; no_reaped++, head++)
+    {
+        struct io_uring_cqe *cqe = &async->cqes[head & async->cq_mask];
+        tar_read_req_t *req = (tar_read_req_t *) (uintptr_t) cqe->user_data;
+        complete(req, cqe->res);
+        done[no_reaped] = req;
+    }
+    __atomic_store_n(async->cq_head, head, __ATOMIC_RELEASE);
+    return no_reaped;
+}
+
+
+size_t tar_async_reap(tar_async_t *async, tar_read_req_t **done, size_t max, int wait)
+{
+    // Reset first: a read completing from now on makes the eventfd readable again
+    uint64_t count;
+    if (read(async->event_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+
+    size_t no_reaped = reap_ready(async, done, max);
+    while (no_reaped == 0 && wait && max > 0 && async->in_flight > 0)
+    {
+        if (async->uring)
+        {
+            if (uring_enter(async, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) break;
+        }
+        else
+        {
+            pthread_mutex_lock(&async->lock);
+            while (async->done_len == 0) pthread_cond_wait(&async->completed, &async->lock);
+            pthread_mutex_unlock(&async->lock);
+        }
+        no_reaped = reap_ready(async, done, max);
+    }
+
+    async->in_flight -= no_reaped;
+    return no_reaped;
+}
+
+
+int tar_async_fd(const tar_async_t *async) { return async->event_fd; }
+
+
+void tar_async_free(tar_async_t *async)
+{
+    // The buffers of the reads in flight must not be written once the caller got them back
+    tar_read_req_t *done[64];
+    while (async->in_flight > 0 && tar_async_reap(async, done, 64, 1) > 0);
+
+    if (async->threads != NULL)
+    {
+        pthread_mutex_lock(&async->lock);
+        async->stop = 1;
+        pthread_cond_broadcast(&async->work);
+        pthread_mutex_unlock(&async->lock);
+        for (int i = 0; i < async->no_threads; i++) pthread_join(async->threads[i], NULL);
+        pthread_cond_destroy(&async->work);
+        pthread_cond_destroy(&async->completed);
+    }
+    if (async->uring) uring_free(async);
+    pthread_mutex_destroy(&async->lock);
+    if (async->event_fd != -1) close(async->event_fd);
+
+    free(async->threads);
+    free(async->pending);
+    free(async->done);
+    memset(async, 0, sizeof(tar_async_t));
+    async->event_fd = -1;
+}
+
+
+ssize_t tar_read_batch(tar_handle_t *handle, tar_read_req_t *reqs, size_t n, const tar_async_options_t *options)
+{
+    tar_async_t async;
+    if (tar_async_init(&async, handle, options) != 0) return -1;
+
+    tar_read_req_t *ptrs[64];
+    tar_read_req_t *done[64];
+    size_t next = 0, no_succeeded = 0;
+    while (next < n || async.in_flight > 0)
+    {
+        // As many reads as the queue takes, then the completions
+        while (next < n && async.in_flight < async.depth)
+        {
+            size_t batch = 0;
+            for (; batch < 64 && next + batch < n; batch++) ptrs[batch] = &reqs[next + batch];
+            ssize_t no_submitted = tar_async_submit(&async, ptrs, batch);
+            if (no_submitted <= 0) break;
+            next += no_submitted;
+        }
+
+        size_t no_reaped = tar_async_reap(&async, done, 64, 1);
+        for (size_t i = 0; i < no_reaped; i++) no_succeeded += (done[i]->ret >= 0);
+        if (no_reaped == 0 && next < n && async.in_flight == 0) break;
+    }
+
+    tar_async_free(&async);
+    return no_succeeded;
+}
@@ -0,0 +1,125 @@
+#include "../headers/block_reader.h"
+
+static size_t readahead = READAHEAD_DEFAULT;
+static reader_stats_t stats = {0, 0};
+
+
+void reader_set_readahead(size_t size)
+{
+    if (size == 0) size = READAHEAD_DEFAULT;
+    __atomic_store_n(&readahead, TAR_PADDED_SIZE(size), __ATOMIC_RELAXED);
+}
+
+
+int reader_init(block_reader_t *reader, int tar_fd)
+{
+    reader->tar_fd = tar_fd;
+    reader->capacity = __atomic_load_n(&readahead, __ATOMIC_RELAXED);
+    reader->buffer = (uint8_t *) malloc(reader->capacity);
+    reader->buffer_offset = 0;
+    reader->buffer_len = 0;
+    reader->offset = 0;
+    return (reader->buffer == NULL) ? -1 : 0;
+}
+
+
+static ssize_t read_at(block_reader_t *reader, uint8_t *dest, size_t len, off_t offset)
+{
+    __atomic_fetch_add(&stats.no_reads, 1, __ATOMIC_RELAXED);
+    STATS_ADD(no_syscalls, 1);
+    ssize_t nber_read = archive_pread(reader->tar_fd, dest, len, offset);
+    if (nber_read > 0) __atomic_fetch_add(&stats.bytes_read, nber_read, __ATOMIC_RELAXED);
+    if (nber_read > 0) STATS_ADD(bytes_read, nber_read);
+    return nber_read;
+}
+
+
+void reader_free(block_reader_t *reader)
+{
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+
+// Makes sure the buffer holds 'len' bytes from the current position, or as many as the archive has
+static size_t fill(block_reader_t *reader, size_t len)
+{
+    off_t end = reader->buffer_offset + (off_t) reader->buffer_len;
+    if (reader->offset >= reader->buffer_offset && reader->offset + (off_t) len <= end) return len;
+
+    reader->buffer_offset = reader->offset;
+    reader->buffer_len = 0;
+    while (reader->buffer_len < len)
+    {
+        ssize_t nber_read = read_at(reader, reader->buffer + reader->buffer_len, reader->capacity - reader->buffer_len, reader->buffer_offset + reader->buffer_len);
+        if (nber_read <= 0) break;
+        reader->buffer_len += nber_read;
+    }
+
+    return (reader->buffer_len < len) ? reader->buffer_len : len;
+}
+
+
+const tar_header_t *reader_next_header(block_reader_t *reader)
+{
+    if (fill(reader, HEADER_SIZE) < (size_t) HEADER_SIZE) return NULL;
+
+    const tar_header_t *header = (const tar_header_t *) (reader->buffer + (reader->offset - reader->buffer_offset));
+    reader->offset += HEADER_SIZE;
+    STATS_ADD(no_headers, 1);
+    return header;
+}
+
+
+void reader_skip(block_reader_t *reader, size_t len) { reader->offset += len; }
+
+
+size_t reader_read(block_reader_t *reader, uint8_t *dest, size_t len)
+{
+    size_t done = 0;
+
+    // Bytes already loaded
+    off_t end = reader->buffer_offset + (off_t) reader->buffer_len;
+    if (reader->offset >= reader->buffer_offset && reader->offset < end)
+    {
+        done = end - reader->offset;
+        if (done > len) done = len;
+        memcpy(dest, reader->buffer + (reader->offset - reader->buffer_offset), done);
+        reader->offset += done;
+    }
+
+    while (done < len)
+    {
+        ssize_t nber_read;
+        if (len - done >= reader->capacity) nber_read = read_at(reader, dest + done, len - done, reader->offset);
+        else
+        {
+            nber_read = fill(reader, len - done);
+            memcpy(dest + done, reader->buffer, nber_read);
+        }
+        if (nber_read <= 0) break;
+        done += nber_read;
+        reader->offset += nber_read;
+    }
+
+    return done;
+}
+
+
+off_t reader_tell(const block_reader_t *reader) { return reader->offset; }
+
+
+reader_stats_t reader_get_stats(void)
+{
+    reader_stats_t copy;
+    copy.no_reads = __atomic_load_n(&stats.no_reads, __ATOMIC_RELAXED);
+    copy.bytes_read = __atomic_load_n(&stats.bytes_read, __ATOMIC_RELAXED);
+    return copy;
+}
+
+
+void reader_reset_stats(void)
+{
+    __atomic_store_n(&stats.no_reads, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.bytes_read, 0, __ATOMIC_RELAXED);
+}
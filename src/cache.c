@@ -0,0 +1,305 @@
+#include "../headers/cache.h"
+
+static cache_shard_t *shards = NULL;
+static size_t no_shards = 0;
+
+static int archives[CACHE_MAX_ARCHIVES];
+static size_t no_archives = 0;
+static pthread_rwlock_t archives_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static uint64_t hash_key(int tar_fd, off_t block)
+{
+    uint64_t hash = ((uint64_t) block * 0x9E3779B97F4A7C15ull) ^ ((uint64_t) (uint32_t) tar_fd * 0xC2B2AE3D27D4EB4Full);
+    return hash ^ (hash >> 29);
+}
+
+
+static cache_shard_t *shard_of(uint64_t hash) { return &shards[hash & (no_shards - 1)]; }
+
+
+static uint32_t *bucket_of(cache_shard_t *shard, uint64_t hash) { return &shard->buckets[(hash >> 16) & (shard->no_buckets - 1)]; }
+
+
+// Slot holding the block, CACHE_NONE if it is not cached. The caller holds the lock of the shard.
+static uint32_t find_slot(cache_shard_t *shard, uint64_t hash, int tar_fd, off_t block)
+{
+    uint32_t id = *bucket_of(shard, hash);
+    while (id != CACHE_NONE && (shard->slots[id].tar_fd != tar_fd || shard->slots[id].block != block)) id = shard->slots[id].next;
+    return id;
+}
+
+
+// Removes a slot from its bucket and frees it
+static void drop_slot(cache_shard_t *shard, uint32_t id)
+{
+    cache_slot_t *slot = &shard->slots[id];
+    uint32_t *link = bucket_of(shard, hash_key(slot->tar_fd, slot->block));
+    while (*link != id) link = &shard->slots[*link].next;
+    *link = slot->next;
+
+    slot->tar_fd = -1;
+    slot->referenced = 0;
+}
+
+
+static void insert_block(int tar_fd, off_t block, const uint8_t *data, size_t len)
+{
+    uint64_t hash = hash_key(tar_fd, block);
+    cache_shard_t *shard = shard_of(hash);
+
+    pthread_mutex_lock(&shard->lock);
+    uint32_t id = find_slot(shard, hash, tar_fd, block);
+    if (id == CACHE_NONE)
+    {
+        if (shard->no_used < shard->no_slots) id = shard->no_used++;
+        else
+        {
+            // CLOCK: the slots hit since the hand last passed get a second chance
+            while (shard->slots[shard->hand].referenced) {shard->slots[shard->hand].referenced = 0; shard->hand = (shard->hand + 1) % shard->no_slots;}
+            id = shard->hand;
+            shard->hand = (shard->hand + 1) % shard->no_slots;
+            if (shard->slots[id].tar_fd != -1) {drop_slot(shard, id); shard->evictions++;}
+        }
+
+        cache_slot_t *slot = &shard->slots[id];
+        uint32_t *bucket = bucket_of(shard, hash);
+        slot->tar_fd = tar_fd;
+        slot->block = block;
+        slot->next = *bucket;
+        *bucket = id;
+        slot->referenced = 0;
+        shard->misses++;
+    }
+
+    shard->slots[id].len = len;
+    memcpy(shard->data + (size_t) id * CACHE_BLOCK_SIZE, data, len);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+
+// Copies the cached part of a block from 'in_block', returns -1 if the block is not cached
+static ssize_t copy_block(int tar_fd, off_t block, size_t in_block, uint8_t *dest, size_t len)
+{
+    uint64_t hash = hash_key(tar_fd, block);
+    cache_shard_t *shard = shard_of(hash);
+    ssize_t copied = -1;
+
+    pthread_mutex_lock(&shard->lock);
+    uint32_t id = find_slot(shard, hash, tar_fd, block);
+    if (id != CACHE_NONE)
+    {
+        cache_slot_t *slot = &shard->slots[id];
+        copied = (slot->len > in_block) ? slot->len - in_block : 0;
+        if ((size_t) copied > len) copied = len;
+        memcpy(dest, shard->data + (size_t) id * CACHE_BLOCK_SIZE + in_block, copied);
+        slot->referenced = 1;
+        shard->hits++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return copied;
+}
+
+
+ssize_t cache_pread(int tar_fd, void *dest, size_t len, off_t offset, ssize_t (*read_fn)(int, void *, size_t, off_t))
+{
+    if (len == 0 || len > CACHE_READ_MAX || offset < 0) return read_fn(tar_fd, dest, len, offset);
+
+    uint8_t *out = (uint8_t *) dest;
+    size_t done = 0;
+    while (done < len)
+    {
+        off_t block = (offset + done) / CACHE_BLOCK_SIZE;
+        size_t in_block = (offset + done) % CACHE_BLOCK_SIZE;
+
+        ssize_t copied = copy_block(tar_fd, block, in_block, out + done, len - done);
+        if (copied == 0) break;
+        if (copied > 0)
+        {
+            done += copied;
+            // A block shorter than CACHE_BLOCK_SIZE is the end of the archive
+            if (in_block + copied < CACHE_BLOCK_SIZE && done < len) break;
+            continue;
+        }
+
+        // Everything left is read at once, whole blocks so that they can be cached
+        off_t start = block * CACHE_BLOCK_SIZE;
+        size_t span = ((offset + len - start + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE) * CACHE_BLOCK_SIZE;
+        uint8_t *buffer = (uint8_t *) malloc(span);
+        if (buffer == NULL) return (done > 0) ? (ssize_t) done : read_fn(tar_fd, out, len, offset);
+
+        size_t nber_read = 0;
+        while (nber_read < span)
+        {
+            ssize_t ret = read_fn(tar_fd, buffer + nber_read, span - nber_read, start + nber_read);
+            if (ret < 0 && nber_read == 0 && done == 0) {free(buffer); return -1;}
+            if (ret <= 0) break;
+            nber_read += ret;
+        }
+
+        for (size_t i = 0; i < nber_read; i += CACHE_BLOCK_SIZE)
+        {
+            size_t block_len = (nber_read - i < CACHE_BLOCK_SIZE) ? nber_read - i : CACHE_BLOCK_SIZE;
+            insert_block(tar_fd, block + i / CACHE_BLOCK_SIZE, buffer + i, block_len);
+        }
+
+        size_t available = (nber_read > in_block) ? nber_read - in_block : 0;
+        if (available > len - done) available = len - done;
+        memcpy(out + done, buffer + in_block, available);
+        done += available;
+        free(buffer);
+        break;
+    }
+
+    return done;
+}
+
+
+int tar_cache_init(size_t budget, size_t wanted_shards)
+{
+    if (shards != NULL) return -1;
+    if (wanted_shards == 0) wanted_shards = CACHE_SHARDS_DEFAULT;
+    size_t count = 1;
+    while (count < wanted_shards) count *= 2;
+
+    size_t no_blocks = budget / CACHE_BLOCK_SIZE;
+    size_t slots_per_shard = (no_blocks / count > 0) ? no_blocks / count : 1;
+    size_t no_buckets = 1;
+    while (no_buckets < 2 * slots_per_shard) no_buckets *= 2;
+
+    cache_shard_t *new_shards = (cache_shard_t *) calloc(count, sizeof(cache_shard_t));
+    if (new_shards == NULL) return -1;
+    for (size_t i = 0; i < count; i++)
+    {
+        cache_shard_t *shard = &new_shards[i];
+        shard->slots = (cache_slot_t *) malloc(slots_per_shard * sizeof(cache_slot_t));
+        shard->data = (uint8_t *) malloc(slots_per_shard * CACHE_BLOCK_SIZE);
+        shard->buckets = (uint32_t *) malloc(no_buckets * sizeof(uint32_t));
+        shard->no_slots = slots_per_shard;
+        shard->no_buckets = no_buckets;
+        pthread_mutex_init(&shard->lock, NULL);
+        if (shard->slots == NULL || shard->data == NULL || shard->buckets == NULL) {shards = new_shards; no_shards = i + 1; tar_cache_free(); return -1;}
+        memset(shard->buckets, 0xff, no_buckets * sizeof(uint32_t));
+    }
+
+    shards = new_shards;
+    no_shards = count;
+    return 0;
+}
+
+
+void tar_cache_free(void)
+{
+    pthread_rwlock_wrlock(&archives_lock);
+    __atomic_store_n(&no_archives, 0, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&archives_lock);
+
+    for (size_t i = 0; i < no_shards; i++)
+    {
+        free(shards[i].slots);
+        free(shards[i].data);
+        free(shards[i].buckets);
+        pthread_mutex_destroy(&shards[i].lock);
+    }
+    free(shards);
+    shards = NULL;
+    no_shards = 0;
+}
+
+
+int tar_cache_open(int tar_fd)
+{
+    if (shards == NULL) return -1;
+
+    pthread_rwlock_wrlock(&archives_lock);
+    int ret = (no_archives == CACHE_MAX_ARCHIVES) ? -1 : 0;
+    if (ret == 0)
+    {
+        archives[no_archives] = tar_fd;
+        __atomic_store_n(&no_archives, no_archives + 1, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&archives_lock);
+    return ret;
+}
+
+
+void tar_cache_close(int tar_fd)
+{
+    int found = 0;
+
+    pthread_rwlock_wrlock(&archives_lock);
+    for (size_t i = 0; i < no_archives; i++)
+    {
+        if (archives[i] != tar_fd) continue;
+        archives[i] = archives[no_archives - 1];
+        __atomic_store_n(&no_archives, no_archives - 1, __ATOMIC_RELEASE);
+        found = 1;
+        break;
+    }
+    pthread_rwlock_unlock(&archives_lock);
+    if (found == 0) return;
+
+    // The file descriptor may be reused for another archive
+    for (size_t i = 0; i < no_shards; i++)
+    {
+        cache_shard_t *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t id = 0; id < shard->no_used; id++)
+        {
+            if (shard->slots[id].tar_fd == tar_fd) drop_slot(shard, id);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+
+void tar_cache_invalidate(int tar_fd, off_t offset, size_t len)
+{
+    if (len == 0 || cache_is_open(tar_fd) == 0) return;
+
+    for (off_t block = offset / CACHE_BLOCK_SIZE; block <= (off_t) ((offset + len - 1) / CACHE_BLOCK_SIZE); block++)
+    {
+        uint64_t hash = hash_key(tar_fd, block);
+        cache_shard_t *shard = shard_of(hash);
+        pthread_mutex_lock(&shard->lock);
+        uint32_t id = find_slot(shard, hash, tar_fd, block);
+        if (id != CACHE_NONE) drop_slot(shard, id);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+
+int tar_cache_get_stats(tar_cache_stats_t *stats)
+{
+    memset(stats, 0, sizeof(tar_cache_stats_t));
+    if (shards == NULL) return -1;
+
+    for (size_t i = 0; i < no_shards; i++)
+    {
+        cache_shard_t *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->capacity += shard->no_slots;
+        for (size_t id = 0; id < shard->no_used; id++) stats->no_blocks += (shard->slots[id].tar_fd != -1);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return 0;
+}
+
+
+int cache_is_open(int tar_fd)
+{
+    // Archives that are not cached do not take the lock as long as none is
+    if (__atomic_load_n(&no_archives, __ATOMIC_ACQUIRE) == 0) return 0;
+
+    int found = 0;
+    pthread_rwlock_rdlock(&archives_lock);
+    for (size_t i = 0; i < no_archives; i++)
+    {
+        if (archives[i] == tar_fd) {found = 1; break;}
+    }
+    pthread_rwlock_unlock(&archives_lock);
+    return found;
+}
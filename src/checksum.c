@@ -0,0 +1,98 @@
+#include "../headers/checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+// Sum of the chksum field, to replace by the sum of 8 spaces
+static long chksum_field_sum(const uint8_t *block)
+{
+    long sum = 0;
+    for (int i = CHKSUM_OFFSET; i < CHKSUM_OFFSET + CHKSUM_LEN; i++) sum += block[i];
+    return sum;
+}
+
+
+long header_checksum_scalar(const uint8_t *block)
+{
+    long sum = 0;
+    for (int i = 0; i < HEADER_SIZE; i++) sum += block[i];
+    return sum - chksum_field_sum(block) + CHKSUM_LEN * ' ';
+}
+
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse2")))
+static long header_checksum_sse2(const uint8_t *block)
+{
+    // _mm_sad_epu8 against zero adds each half of 16 bytes into a 64-bit lane
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < HEADER_SIZE; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, zero));
+    }
+
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    long sum = (long) _mm_cvtsi128_si32(acc);
+    return sum - chksum_field_sum(block) + CHKSUM_LEN * ' ';
+}
+
+
+__attribute__((target("avx2")))
+static long header_checksum_avx2(const uint8_t *block)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < HEADER_SIZE; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, zero));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+    long sum = (long) _mm_cvtsi128_si32(half);
+    return sum - chksum_field_sum(block) + CHKSUM_LEN * ' ';
+}
+#endif
+
+
+static long (*select_kernel(void))(const uint8_t *)
+{
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return header_checksum_avx2;
+    if (__builtin_cpu_supports("sse2")) return header_checksum_sse2;
+#endif
+    return header_checksum_scalar;
+}
+
+
+long header_checksum(const uint8_t *block)
+{
+    static long (*kernel)(const uint8_t *) = NULL;
+
+    // Selecting the kernel twice from two threads is harmless, both select the same one
+    long (*selected)(const uint8_t *) = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+    if (selected == NULL)
+    {
+        selected = select_kernel();
+        __atomic_store_n(&kernel, selected, __ATOMIC_RELAXED);
+    }
+    return selected(block);
+}
+
+
+long tar_octal(const char *field, size_t len)
+{
+    size_t i = 0;
+    while (i < len && field[i] == ' ') i++;
+    if (i == len || field[i] < '0' || field[i] > '7') return -1;
+
+    long value = 0;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) value = (value << 3) | (field[i] - '0');
+    return value;
+}
@@ -0,0 +1,131 @@
+#include "../headers/client.h"
+
+// Sends a request and receives the fixed part of its reply
+static int round_trip(tar_remote_t *remote, uint8_t op, char *path, uint64_t offset, uint64_t len, int pass_fd, reply_t *reply)
+{
+    size_t path_len = (path == NULL) ? 0 : strlen(path);
+    if (path_len > PROTOCOL_PATH_MAX) return -1;
+
+    request_t request = {.op = op, .version = PROTOCOL_VERSION, .padding = 0, .path_len = path_len, .offset = offset, .len = len};
+    if (protocol_send(remote->sock_fd, &request, sizeof(request_t), pass_fd) != 0) return -1;
+    if (path_len > 0 && protocol_send(remote->sock_fd, path, path_len, -1) != 0) return -1;
+    return protocol_recv(remote->sock_fd, reply, sizeof(reply_t), NULL);
+}
+
+
+// Receives the payload of a reply that cannot be used, so that the next reply starts with its fixed part
+static int drain_payload(tar_remote_t *remote, size_t len)
+{
+    uint8_t buffer[4096];
+    while (len > 0)
+    {
+        size_t chunk = (len < sizeof(buffer)) ? len : sizeof(buffer);
+        if (protocol_recv(remote->sock_fd, buffer, chunk, NULL) != 0) return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+
+tar_remote_t *tar_remote_open(const char *socket_path, int tar_fd)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return NULL;
+    strcpy(addr.sun_path, socket_path);
+
+    tar_remote_t *remote = (tar_remote_t *) malloc(sizeof(tar_remote_t));
+    if (remote == NULL) return NULL;
+    remote->tar_fd = tar_fd;
+    remote->sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (remote->sock_fd == -1) {free(remote); return NULL;}
+
+    reply_t reply;
+    if (connect(remote->sock_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || round_trip(remote, OP_OPEN, NULL, 0, 0, tar_fd, &reply) != 0 || reply.ret != 0) {tar_remote_close(remote); return NULL;}
+
+    remote->shared = reply.count;
+    remote->is_inline = (reply.flags & REPLY_INLINE) != 0;
+    return remote;
+}
+
+
+void tar_remote_close(tar_remote_t *remote)
+{
+    close(remote->sock_fd);
+    free(remote);
+}
+
+
+static int remote_check(tar_remote_t *remote, uint8_t op, char *path)
+{
+    reply_t reply;
+    if (round_trip(remote, op, path, 0, 0, -1, &reply) != 0) return -1;
+    return reply.ret;
+}
+
+
+int tar_remote_exists(tar_remote_t *remote, char *path) { return remote_check(remote, OP_EXISTS, path); }
+
+
+int tar_remote_is_dir(tar_remote_t *remote, char *path) { return remote_check(remote, OP_IS_DIR, path); }
+
+
+int tar_remote_is_file(tar_remote_t *remote, char *path) { return remote_check(remote, OP_IS_FILE, path); }
+
+
+int tar_remote_is_symlink(tar_remote_t *remote, char *path) { return remote_check(remote, OP_IS_SYMLINK, path); }
+
+
+int tar_remote_list(tar_remote_t *remote, char *path, char **entries, size_t *no_entries)
+{
+    reply_t reply;
+    size_t max_entries = *no_entries;
+    *no_entries = 0;
+    if (round_trip(remote, OP_LIST, path, 0, max_entries, -1, &reply) != 0) return -1;
+    if (reply.count > max_entries) {drain_payload(remote, reply.len); return -1;}
+
+    char *names = (char *) malloc(reply.len + 1);
+    if (names == NULL) return -1;
+    if (reply.len > 0 && protocol_recv(remote->sock_fd, names, reply.len, NULL) != 0) {free(names); return -1;}
+    names[reply.len] = '\0';
+
+    size_t pos = 0;
+    for (size_t i = 0; i < reply.count && pos < reply.len; i++)
+    {
+        strcpy(entries[i], names + pos);
+        pos += strlen(names + pos) + 1;
+        *no_entries = i + 1;
+    }
+    free(names);
+    return reply.ret;
+}
+
+
+ssize_t tar_remote_read_file(tar_remote_t *remote, char *path, size_t offset, uint8_t *dest, size_t *len)
+{
+    reply_t reply;
+    size_t dest_len = *len;
+    *len = 0;
+    if (round_trip(remote, OP_READ_FILE, path, offset, dest_len, -1, &reply) != 0) return -1;
+    if (reply.len > dest_len) {if (reply.flags & REPLY_INLINE) drain_payload(remote, reply.len); return -1;}
+
+    if (reply.flags & REPLY_INLINE)
+    {
+        if (reply.len > 0 && protocol_recv(remote->sock_fd, dest, reply.len, NULL) != 0) return -1;
+        *len = reply.len;
+        return reply.ret;
+    }
+    if (reply.ret < 0) return reply.ret;
+
+    size_t nber_read = 0;
+    while (nber_read < reply.len)
+    {
+        ssize_t ret = archive_pread(remote->tar_fd, dest + nber_read, reply.len - nber_read, reply.data_offset + nber_read);
+        if (ret <= 0) return -1;
+        nber_read += ret;
+    }
+    *len = nber_read;
+    return reply.ret;
+}
@@ -0,0 +1,207 @@
+#include "../headers/diff.h"
+
+static int is_regular(char typeflag) { return typeflag == REGTYPE || typeflag == AREGTYPE; }
+
+
+// Compares the metadata of an entry found in both archives, returns whether it differs
+static int compare_entries(diff_job_t *job, diff_item_t *item)
+{
+    tar_index_t *old_index = &job->old_handle->index;
+    tar_index_t *new_index = &job->new_handle->index;
+    tar_entry_t *old_entry = &old_index->entries[item->old_id];
+    tar_entry_t *new_entry = &new_index->entries[item->new_id];
+    char old_type = index_type(old_index, old_entry);
+    char new_type = index_type(new_index, new_entry);
+
+    item->changes = 0;
+    if (old_type != new_type && !(is_regular(old_type) && is_regular(new_type))) {item->kind = DIFF_TYPE_CHANGED; return 1;}
+
+    item->kind = DIFF_MODIFIED;
+    if (index_size(old_index, old_entry) != index_size(new_index, new_entry)) item->changes |= DIFF_SIZE;
+    if (index_mode(old_index, old_entry) != index_mode(new_index, new_entry)) item->changes |= DIFF_MODE;
+    if (strcmp(index_linkname(old_index, old_entry), index_linkname(new_index, new_entry)) != 0) item->changes |= DIFF_LINKNAME;
+    return item->changes != 0;
+}
+
+
+// The entry of the same name with or without trailing '/', when a directory replaces another type of entry or the reverse
+static tar_entry_t *find_other_type(const tar_index_t *index, const char *path)
+{
+    char other[TAR_PATH_MAX + 1];
+    size_t len = strlen(path);
+    if (len == 0) return NULL;
+    memcpy(other, path, len);
+    if (path[len - 1] == '/') other[len - 1] = '\0';
+    else {other[len] = '/'; other[len + 1] = '\0';}
+    return index_find(index, other);
+}
+
+
+// Matches the entries of both archives by path, keeps the differences and the contents to compare
+static ssize_t match_entries(diff_job_t *job, size_t *no_items)
+{
+    tar_index_t *old_index = &job->old_handle->index;
+    tar_index_t *new_index = &job->new_handle->index;
+    const uint32_t *old_sorted = index_sorted(old_index);
+    const uint32_t *new_sorted = index_sorted(new_index);
+    if (old_sorted == NULL || new_sorted == NULL) return -1;
+
+    size_t max_items = old_index->no_entries + new_index->no_entries;
+    job->items = (diff_item_t *) malloc((max_items + 1) * sizeof(diff_item_t));
+    job->candidates = (uint32_t *) malloc((max_items + 1) * sizeof(uint32_t));
+    job->first_chunk = (size_t *) malloc((max_items + 1) * sizeof(size_t));
+    if (job->items == NULL || job->candidates == NULL || job->first_chunk == NULL) return -1;
+
+    char old_path[TAR_PATH_MAX];
+    char new_path[TAR_PATH_MAX];
+    size_t i = 0, j = 0, n = 0;
+    while (i < old_index->no_entries || j < new_index->no_entries)
+    {
+        if (i < old_index->no_entries) index_path(old_index, &old_index->entries[old_sorted[i]], old_path, sizeof(old_path));
+        if (j < new_index->no_entries) index_path(new_index, &new_index->entries[new_sorted[j]], new_path, sizeof(new_path));
+        int cmp = (i == old_index->no_entries) ? 1 : (j == new_index->no_entries) ? -1 : strcmp(old_path, new_path);
+
+        diff_item_t *item = &job->items[n];
+        item->old_id = (cmp <= 0) ? old_sorted[i++] : INDEX_EMPTY;
+        item->new_id = (cmp >= 0) ? new_sorted[j++] : INDEX_EMPTY;
+        item->changes = 0;
+        if (cmp < 0)
+        {
+            tar_entry_t *other = find_other_type(new_index, old_path);
+            item->kind = (other == NULL) ? DIFF_REMOVED : DIFF_TYPE_CHANGED;
+            if (other != NULL) item->new_id = (uint32_t) (other - new_index->entries);
+            n++;
+            continue;
+        }
+        // Already reported as a type change at the path of the old entry
+        if (cmp > 0 && find_other_type(old_index, new_path) != NULL) continue;
+        if (cmp > 0) {item->kind = DIFF_ADDED; n++; continue;}
+
+        int differs = compare_entries(job, item);
+        tar_entry_t *new_entry = &new_index->entries[item->new_id];
+        size_t size = index_size(new_index, new_entry);
+        // Only contents of the same size may be the same
+        if (item->kind == DIFF_MODIFIED && (item->changes & DIFF_SIZE) == 0 && size > 0 && is_regular(index_type(new_index, new_entry)))
+        {
+            job->candidates[job->no_candidates] = n;
+            job->first_chunk[job->no_candidates++] = job->no_chunks;
+            job->no_chunks += (size + DIFF_CHUNK_SIZE - 1) / DIFF_CHUNK_SIZE;
+            differs = 1;
+        }
+        if (differs) n++;
+    }
+    job->first_chunk[job->no_candidates] = job->no_chunks;
+    *no_items = n;
+    return 0;
+}
+
+
+static int read_chunk(tar_handle_t *handle, tar_entry_t *entry, size_t offset, uint8_t *dest, size_t len)
+{
+    off_t data_offset = index_offset(&handle->index, entry) + HEADER_SIZE + offset;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t nber_read = archive_pread(handle->tar_fd, dest + done, len - done, data_offset + done);
+        if (nber_read <= 0) return -1;
+        done += nber_read;
+    }
+    return 0;
+}
+
+
+static void *diff_worker(void *arg)
+{
+    diff_job_t *job = (diff_job_t *) arg;
+    uint8_t *buffers = (uint8_t *) malloc(2 * DIFF_CHUNK_SIZE);
+    if (buffers == NULL) {__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED); return NULL;}
+    size_t candidate = 0;
+
+    while (1)
+    {
+        size_t chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= job->no_chunks) break;
+
+        // The chunks are taken in order, the candidate owning this one is at or after the previous one
+        while (job->first_chunk[candidate + 1] <= chunk) candidate++;
+        diff_item_t *item = &job->items[job->candidates[candidate]];
+        // The rest of a content already found different is not read
+        if (__atomic_load_n(&item->changes, __ATOMIC_RELAXED) & DIFF_CONTENT) continue;
+
+        tar_entry_t *old_entry = &job->old_handle->index.entries[item->old_id];
+        tar_entry_t *new_entry = &job->new_handle->index.entries[item->new_id];
+        size_t offset = (chunk - job->first_chunk[candidate]) * DIFF_CHUNK_SIZE;
+        size_t size = index_size(&job->new_handle->index, new_entry);
+        size_t len = (size - offset < DIFF_CHUNK_SIZE) ? size - offset : DIFF_CHUNK_SIZE;
+
+        if (read_chunk(job->old_handle, old_entry, offset, buffers, len) != 0
+            || read_chunk(job->new_handle, new_entry, offset, buffers + DIFF_CHUNK_SIZE, len) != 0) {__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED); break;}
+        if (memcmp(buffers, buffers + DIFF_CHUNK_SIZE, len) != 0) __atomic_fetch_or(&item->changes, DIFF_CONTENT, __ATOMIC_RELAXED);
+    }
+
+    free(buffers);
+    return NULL;
+}
+
+
+// Passes the differences to the callback, in path order
+static ssize_t report(diff_job_t *job, size_t no_items, tar_diff_fn callback, void *user_data)
+{
+    tar_index_t *old_index = &job->old_handle->index;
+    tar_index_t *new_index = &job->new_handle->index;
+    char path[TAR_PATH_MAX];
+    ssize_t no_differences = 0;
+    int stopped = 0;
+
+    for (size_t i = 0; i < no_items; i++)
+    {
+        diff_item_t *item = &job->items[i];
+        // Candidates whose contents turned out to be the same
+        if (item->kind == DIFF_MODIFIED && item->changes == 0) continue;
+        no_differences++;
+        if (callback == NULL || stopped) continue;
+
+        tar_diff_entry_t entry = {.path = path, .kind = item->kind, .changes = item->changes, .old_type = 0, .new_type = 0, .old_size = 0, .new_size = 0};
+        if (item->old_id != INDEX_EMPTY)
+        {
+            tar_entry_t *old_entry = &old_index->entries[item->old_id];
+            index_path(old_index, old_entry, path, sizeof(path));
+            entry.old_type = index_type(old_index, old_entry);
+            entry.old_size = index_size(old_index, old_entry);
+        }
+        if (item->new_id != INDEX_EMPTY)
+        {
+            tar_entry_t *new_entry = &new_index->entries[item->new_id];
+            index_path(new_index, new_entry, path, sizeof(path));
+            entry.new_type = index_type(new_index, new_entry);
+            entry.new_size = index_size(new_index, new_entry);
+        }
+        stopped = (callback(&entry, user_data) != 0);
+    }
+    return no_differences;
+}
+
+
+ssize_t tar_diff(int old_fd, int new_fd, const tar_diff_options_t *options, tar_diff_fn callback, void *user_data)
+{
+    tar_diff_options_t defaults = {.no_threads = 0};
+    if (options == NULL) options = &defaults;
+
+    diff_job_t job;
+    memset(&job, 0, sizeof(diff_job_t));
+    job.old_handle = tar_open(old_fd);
+    job.new_handle = tar_open(new_fd);
+
+    size_t no_items = 0;
+    ssize_t ret = (job.old_handle == NULL || job.new_handle == NULL) ? -1 : match_entries(&job, &no_items);
+    if (ret == 0 && job.no_chunks > 0) run_workers(diff_worker, &job, options->no_threads, job.no_chunks);
+    if (ret == 0 && job.error == 0) ret = report(&job, no_items, callback, user_data);
+    else ret = -1;
+
+    free(job.items);
+    free(job.candidates);
+    free(job.first_chunk);
+    tar_close(job.old_handle);
+    tar_close(job.new_handle);
+    return ret;
+}
@@ -0,0 +1,239 @@
+// copy_file_range()
+#define _GNU_SOURCE
+
+#include "../headers/extract.h"
+
+// Size of the buffer used when the kernel cannot copy the content of a file itself
+#define EXTRACT_BUFFER_SIZE (64 * 1024)
+
+
+// Path of an entry relative to the destination, without trailing '/'.
+// Absolute paths, paths leaving the destination and paths below a link of the archive are refused.
+static int entry_path(tar_handle_t *handle, tar_entry_t *entry, char *path, size_t size)
+{
+    char name[TAR_PATH_MAX];
+    index_path(&handle->index, entry, name, sizeof(name));
+    if (name[0] == '/' || normalize_path(name, path, size) != 0) return -1;
+
+    size_t len = strlen(path);
+    if (len > 0 && path[len - 1] == '/') path[--len] = '\0';
+    if (len == 0) return -1;
+
+    char parent[TAR_PATH_MAX];
+    for (size_t i = 1; i < len; i++)
+    {
+        if (path[i] != '/') continue;
+        memcpy(parent, path, i);
+        parent[i] = '\0';
+        tar_entry_t *ancestor = index_find(&handle->index, parent);
+        char typeflag = (ancestor == NULL) ? 0 : index_type(&handle->index, ancestor);
+        if (typeflag == SYMTYPE || typeflag == LNKTYPE) return -1;
+    }
+    return 0;
+}
+
+
+// Creates the directories leading to 'path', like mkdir -p on its parent
+static void make_parents(int dest_fd, const char *path)
+{
+    char parent[TAR_PATH_MAX];
+    for (size_t i = 1; path[i] != '\0'; i++)
+    {
+        if (path[i] != '/') continue;
+        memcpy(parent, path, i);
+        parent[i] = '\0';
+        mkdirat(dest_fd, parent, 0755);
+    }
+}
+
+
+static int make_dir(int dest_fd, const char *path, int permissions)
+{
+    // Writable until every entry is extracted, the mode of the archive is applied at the end.
+    // Without it, the directory gets the default mode left by the umask.
+    mode_t mode = permissions ? 0700 : 0777;
+    int ret = mkdirat(dest_fd, path, mode);
+    if (ret != 0 && errno == ENOENT) {make_parents(dest_fd, path); ret = mkdirat(dest_fd, path, mode);}
+    if (ret != 0 && errno == EEXIST)
+    {
+        struct stat st;
+        if (fstatat(dest_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) ret = 0;
+    }
+    return ret;
+}
+
+
+static int copy_buffered(extract_job_t *job, int out_fd, off_t offset, size_t len)
+{
+    uint8_t *buffer = (uint8_t *) malloc(EXTRACT_BUFFER_SIZE);
+    if (buffer == NULL) return -1;
+
+    while (len > 0)
+    {
+        size_t chunk = (len < EXTRACT_BUFFER_SIZE) ? len : EXTRACT_BUFFER_SIZE;
+        STATS_ADD(no_syscalls, 1);
+        ssize_t nber_read = archive_pread(job->handle->tar_fd, buffer, chunk, offset);
+        if (nber_read <= 0 || write(out_fd, buffer, nber_read) != nber_read) {free(buffer); return -1;}
+        STATS_ADD(bytes_read, nber_read);
+        offset += nber_read;
+        len -= nber_read;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+
+static int copy_content(extract_job_t *job, int out_fd, tar_entry_t *entry)
+{
+    int tar_fd = job->handle->tar_fd;
+    off_t offset = index_offset(&job->handle->index, entry) + HEADER_SIZE;
+    size_t len = index_size(&job->handle->index, entry);
+    if (job->copy) return copy_buffered(job, out_fd, offset, len);
+
+    // The offset is passed explicitly: the file offset of the archive is not moved
+    while (len > 0)
+    {
+        STATS_ADD(no_syscalls, 1);
+        ssize_t nber_copied = copy_file_range(tar_fd, &offset, out_fd, NULL, len, 0);
+        if (nber_copied <= 0) break;
+        STATS_ADD(bytes_read, nber_copied);
+        len -= nber_copied;
+    }
+
+    // copy_file_range() may not be supported between these two files
+    while (len > 0)
+    {
+        STATS_ADD(no_syscalls, 1);
+        ssize_t nber_copied = sendfile(out_fd, tar_fd, &offset, len);
+        if (nber_copied <= 0) break;
+        STATS_ADD(bytes_read, nber_copied);
+        len -= nber_copied;
+    }
+
+    return (len == 0) ? 0 : copy_buffered(job, out_fd, offset, len);
+}
+
+
+static int write_file(extract_job_t *job, tar_entry_t *entry, const char *path)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+    int out_fd = openat(job->dest_fd, path, flags, 0644);
+    if (out_fd == -1 && errno == ENOENT) {make_parents(job->dest_fd, path); out_fd = openat(job->dest_fd, path, flags, 0644);}
+    // An existing symlink is replaced, never written through
+    if (out_fd == -1 && errno == ELOOP && unlinkat(job->dest_fd, path, 0) == 0) out_fd = openat(job->dest_fd, path, flags, 0644);
+    if (out_fd == -1) return -1;
+
+    int ret = copy_content(job, out_fd, entry);
+    if (ret == 0 && job->permissions && fchmod(out_fd, index_mode(&job->handle->index, entry)) != 0) ret = -1;
+    if (close(out_fd) != 0) ret = -1;
+    return ret;
+}
+
+
+static void *extract_worker(void *arg)
+{
+    extract_job_t *job = (extract_job_t *) arg;
+    char path[TAR_PATH_MAX];
+    STATS_ATTACH(TAR_API_EXTRACT);
+
+    while (1)
+    {
+        size_t i = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED);
+        if (i >= job->no_files) break;
+
+        tar_entry_t *entry = &job->handle->index.entries[job->files[i]];
+        if (entry_path(job->handle, entry, path, sizeof(path)) == 0 && write_file(job, entry, path) == 0) __atomic_fetch_add(&job->no_extracted, 1, __ATOMIC_RELAXED);
+        else                                                                                              __atomic_fetch_add(&job->no_failed, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+
+static int make_link(extract_job_t *job, tar_entry_t *entry, const char *path)
+{
+    tar_index_t *index = &job->handle->index;
+    int ret;
+
+    if (index_type(index, entry) == LNKTYPE)
+    {
+        // The target of a hard link is a path of the archive
+        char name[TAR_PATH_MAX];
+        char target[TAR_PATH_MAX];
+        index_path(index, entry, name, sizeof(name));
+        if (link_target(name, index_linkname(index, entry), LNKTYPE, target, sizeof(target)) != 0) return -1;
+        ret = linkat(job->dest_fd, target, job->dest_fd, path, 0);
+        if (ret != 0 && errno == EEXIST && unlinkat(job->dest_fd, path, 0) == 0) ret = linkat(job->dest_fd, target, job->dest_fd, path, 0);
+    }
+    else
+    {
+        ret = symlinkat(index_linkname(index, entry), job->dest_fd, path);
+        if (ret != 0 && errno == EEXIST && unlinkat(job->dest_fd, path, 0) == 0) ret = symlinkat(index_linkname(index, entry), job->dest_fd, path);
+    }
+    return ret;
+}
+
+
+static ssize_t extract_all(int tar_fd, const char *dest_dir, const tar_extract_options_t *options)
+{
+    tar_extract_options_t defaults = {.no_threads = 0, .no_permissions = 0};
+    if (options == NULL) options = &defaults;
+
+    mkdir(dest_dir, 0755);
+    int dest_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dest_fd == -1) return -1;
+
+    tar_handle_t *handle = tar_open(tar_fd);
+    const uint32_t *sorted = (handle == NULL) ? NULL : index_sorted(&handle->index);
+    uint32_t *files = (handle == NULL) ? NULL : (uint32_t *) malloc((handle->index.no_entries + 1) * sizeof(uint32_t));
+    if (sorted == NULL || files == NULL) {free(files); tar_close(handle); close(dest_fd); return -1;}
+
+    extract_job_t job = {.handle = handle, .dest_fd = dest_fd, .files = files, .no_files = 0, .next_file = 0, .no_extracted = 0, .no_failed = 0};
+    job.copy = (tar_gz_index(tar_fd) != NULL);
+    job.permissions = (options->no_permissions == 0);
+    tar_index_t *index = &handle->index;
+    char path[TAR_PATH_MAX];
+
+    // In path order, each directory is created before its entries
+    for (size_t i = 0; i < index->no_entries; i++)
+    {
+        tar_entry_t *entry = &index->entries[sorted[i]];
+        char typeflag = index_type(index, entry);
+        if (typeflag == REGTYPE || typeflag == AREGTYPE) {files[job.no_files++] = sorted[i]; continue;}
+        if (typeflag != DIRTYPE) continue;
+
+        if (entry_path(handle, entry, path, sizeof(path)) == 0 && make_dir(dest_fd, path, job.permissions) == 0) job.no_extracted++;
+        else                                                                                                  job.no_failed++;
+    }
+
+    run_workers(extract_worker, &job, options->no_threads, job.no_files);
+
+    // Links last, so that no file of the archive is written through one of them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < index->no_entries; i++)
+        {
+            tar_entry_t *entry = &index->entries[sorted[i]];
+            if (index_type(index, entry) != ((pass == 0) ? LNKTYPE : SYMTYPE)) continue;
+
+            if (entry_path(handle, entry, path, sizeof(path)) == 0 && make_link(&job, entry, path) == 0) job.no_extracted++;
+            else                                                                                        job.no_failed++;
+        }
+    }
+
+    // The directories get their mode once nothing has to be created in them anymore, the deepest ones first
+    for (size_t i = index->no_entries; job.permissions && i-- > 0;)
+    {
+        tar_entry_t *entry = &index->entries[sorted[i]];
+        if (index_type(index, entry) == DIRTYPE && entry_path(handle, entry, path, sizeof(path)) == 0) fchmodat(dest_fd, path, index_mode(index, entry), 0);
+    }
+
+    free(files);
+    tar_close(handle);
+    close(dest_fd);
+    return (job.no_failed > 0) ? -2 : (ssize_t) job.no_extracted;
+}
+
+
+ssize_t tar_extract(int tar_fd, const char *dest_dir, const tar_extract_options_t *options) { return STATS_CALL(TAR_API_EXTRACT, extract_all(tar_fd, dest_dir, options)); }
@@ -0,0 +1,314 @@
+#include "../headers/gz.h"
+
+typedef struct gz_archive
+{
+    int gz_fd;
+    gz_index_t *index;
+} gz_archive_t;
+
+static gz_archive_t archives[GZ_MAX_ARCHIVES];
+static size_t no_archives = 0;
+static pthread_rwlock_t archives_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void cursor_stop(gz_cursor_t *cursor);
+
+
+static int add_point(gz_index_t *index, int bits, off_t in, off_t out, unsigned left, const uint8_t *window)
+{
+    if (index->no_points == index->cap_points)
+    {
+        size_t cap_points = (index->cap_points == 0) ? 8 : 2 * index->cap_points;
+        gz_point_t *new_points = (gz_point_t *) realloc(index->points, cap_points * sizeof(gz_point_t));
+        if (new_points == NULL) return -1;
+        index->points = new_points;
+        index->cap_points = cap_points;
+    }
+
+    gz_point_t *point = &index->points[index->no_points];
+    point->window = (uint8_t *) malloc(GZ_WINDOW_SIZE);
+    if (point->window == NULL) return -1;
+    point->bits = bits;
+    point->in = in;
+    point->out = out;
+
+    // The window is circular: its oldest bytes are the 'left' last ones of the buffer
+    if (left > 0) memcpy(point->window, window + GZ_WINDOW_SIZE - left, left);
+    if (left < GZ_WINDOW_SIZE) memcpy(point->window + left, window, GZ_WINDOW_SIZE - left);
+
+    index->no_points++;
+    return 0;
+}
+
+
+int gz_build_index(gz_index_t *index, int gz_fd, size_t span)
+{
+    memset(index, 0, sizeof(gz_index_t));
+    index->gz_fd = gz_fd;
+    index->span = (span == 0) ? GZ_SPAN_DEFAULT : span;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(z_stream));
+    // 47: gzip or zlib header, detected automatically
+    if (inflateInit2(&strm, 47) != Z_OK) return -2;
+
+    uint8_t *input = (uint8_t *) malloc(GZ_CHUNK_SIZE);
+    uint8_t *window = (uint8_t *) calloc(GZ_WINDOW_SIZE, 1);
+    if (input == NULL || window == NULL) {free(input); free(window); inflateEnd(&strm); return -2;}
+
+    // Uncompressed data go through the window, the bytes are only kept for the checkpoints
+    off_t total_in = 0, total_out = 0, last = 0;
+    int ret = Z_OK;
+    do
+    {
+        if (strm.avail_in == 0)
+        {
+            ssize_t nber_read = pread(gz_fd, input, GZ_CHUNK_SIZE, total_in);
+            if (nber_read <= 0) {ret = Z_DATA_ERROR; break;}
+            strm.avail_in = nber_read;
+            strm.next_in = input;
+        }
+
+        do
+        {
+            if (strm.avail_out == 0)
+            {
+                strm.avail_out = GZ_WINDOW_SIZE;
+                strm.next_out = window;
+            }
+
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            // Z_BLOCK stops at the end of each deflate block, the only places where a checkpoint can be made
+            ret = inflate(&strm, Z_BLOCK);
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+
+            if (ret == Z_NEED_DICT) ret = Z_DATA_ERROR;
+            if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR || ret == Z_STREAM_END) break;
+
+            // End of a block that is not the last one of the stream
+            if ((strm.data_type & 128) != 0 && (strm.data_type & 64) == 0 && (total_out == 0 || total_out - last > (off_t) index->span))
+            {
+                if (add_point(index, strm.data_type & 7, total_in, total_out, strm.avail_out, window) != 0) {ret = Z_MEM_ERROR; break;}
+                last = total_out;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+    inflateEnd(&strm);
+    free(input);
+    free(window);
+
+    if (ret != Z_STREAM_END || index->no_points == 0)
+    {
+        gz_free_index(index);
+        return (ret == Z_MEM_ERROR) ? -2 : -1;
+    }
+
+    index->length = total_out;
+    pthread_mutex_init(&index->lock, NULL);
+    index->cursor = (gz_cursor_t *) calloc(1, sizeof(gz_cursor_t));
+    if (index->cursor == NULL) {pthread_mutex_destroy(&index->lock); gz_free_index(index); return -2;}
+    return 0;
+}
+
+
+void gz_free_index(gz_index_t *index)
+{
+    for (size_t i = 0; i < index->no_points; i++) free(index->points[i].window);
+    free(index->points);
+    if (index->cursor != NULL)
+    {
+        cursor_stop(index->cursor);
+        free(index->cursor);
+        pthread_mutex_destroy(&index->lock);
+    }
+    memset(index, 0, sizeof(gz_index_t));
+}
+
+
+static void cursor_stop(gz_cursor_t *cursor)
+{
+    if (cursor->active) inflateEnd(&cursor->strm);
+    cursor->active = 0;
+}
+
+
+// Starts a raw inflate stream at a checkpoint
+static int cursor_start(gz_index_t *index, gz_cursor_t *cursor, const gz_point_t *point)
+{
+    cursor_stop(cursor);
+    cursor->ended = 0;
+
+    memset(&cursor->strm, 0, sizeof(z_stream));
+    if (inflateInit2(&cursor->strm, -15) != Z_OK) return -1;
+    cursor->active = 1;
+    cursor->out = point->out;
+    cursor->in = point->in;
+
+    if (point->bits > 0)
+    {
+        uint8_t byte;
+        if (pread(index->gz_fd, &byte, 1, point->in - 1) != 1) return -1;
+        inflatePrime(&cursor->strm, point->bits, byte >> (8 - point->bits));
+    }
+    return (inflateSetDictionary(&cursor->strm, point->window, GZ_WINDOW_SIZE) == Z_OK) ? 0 : -1;
+}
+
+
+// Inflates 'len' bytes into 'dest', or discards them if 'dest' is NULL
+static ssize_t cursor_inflate(gz_index_t *index, gz_cursor_t *cursor, uint8_t *dest, size_t len)
+{
+    uint8_t discard[GZ_CHUNK_SIZE];
+    size_t done = 0;
+
+    while (done < len && cursor->ended == 0)
+    {
+        if (cursor->strm.avail_in == 0)
+        {
+            ssize_t nber_read = pread(index->gz_fd, cursor->input, GZ_CHUNK_SIZE, cursor->in);
+            if (nber_read <= 0) return -1;
+            cursor->in += nber_read;
+            cursor->strm.avail_in = nber_read;
+            cursor->strm.next_in = cursor->input;
+        }
+
+        size_t chunk = len - done;
+        if (dest == NULL && chunk > sizeof(discard)) chunk = sizeof(discard);
+        if (chunk > UINT_MAX) chunk = UINT_MAX;
+        cursor->strm.next_out = (dest == NULL) ? discard : dest + done;
+        cursor->strm.avail_out = chunk;
+
+        int ret = inflate(&cursor->strm, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) return -1;
+        if (ret == Z_STREAM_END) cursor->ended = 1;
+
+        size_t produced = chunk - cursor->strm.avail_out;
+        done += produced;
+        cursor->out += produced;
+    }
+
+    return done;
+}
+
+
+static ssize_t read_from(gz_index_t *index, gz_cursor_t *cursor, uint8_t *dest, size_t len, off_t offset)
+{
+    // Last checkpoint before the offset
+    size_t low = 0, high = index->no_points;
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        if (index->points[middle].out <= offset) low = middle;
+        else                                     high = middle;
+    }
+    const gz_point_t *point = &index->points[low];
+
+    // The stream left by the previous read is used if it is closer than the checkpoint
+    if (cursor->active == 0 || cursor->out > offset || cursor->out < point->out)
+    {
+        if (cursor_start(index, cursor, point) != 0) {cursor_stop(cursor); return -1;}
+    }
+
+    ssize_t ret = cursor_inflate(index, cursor, NULL, offset - cursor->out);
+    if (ret >= 0) ret = cursor_inflate(index, cursor, dest, len);
+    if (ret < 0) cursor_stop(cursor);
+    return ret;
+}
+
+
+ssize_t gz_read_at(gz_index_t *index, uint8_t *dest, size_t len, off_t offset)
+{
+    if (offset < 0) return -1;
+    if (offset >= index->length || len == 0) return 0;
+    if ((off_t) len > index->length - offset) len = index->length - offset;
+
+    // Another thread is using the shared cursor: a private one is started from a checkpoint
+    if (pthread_mutex_trylock(&index->lock) != 0)
+    {
+        gz_cursor_t *cursor = (gz_cursor_t *) calloc(1, sizeof(gz_cursor_t));
+        if (cursor == NULL) return -1;
+        ssize_t ret = read_from(index, cursor, dest, len, offset);
+        cursor_stop(cursor);
+        free(cursor);
+        return ret;
+    }
+
+    ssize_t ret = read_from(index, index->cursor, dest, len, offset);
+    pthread_mutex_unlock(&index->lock);
+    return ret;
+}
+
+
+int tar_gz_open(int gz_fd, size_t span)
+{
+    gz_index_t *index = (gz_index_t *) malloc(sizeof(gz_index_t));
+    if (index == NULL) return -2;
+
+    int ret = gz_build_index(index, gz_fd, span);
+    if (ret != 0) {free(index); return ret;}
+
+    pthread_rwlock_wrlock(&archives_lock);
+    if (no_archives == GZ_MAX_ARCHIVES)
+    {
+        pthread_rwlock_unlock(&archives_lock);
+        gz_free_index(index);
+        free(index);
+        return -2;
+    }
+    archives[no_archives].gz_fd = gz_fd;
+    archives[no_archives].index = index;
+    __atomic_store_n(&no_archives, no_archives + 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&archives_lock);
+    return 0;
+}
+
+
+void tar_gz_close(int gz_fd)
+{
+    gz_index_t *index = NULL;
+
+    pthread_rwlock_wrlock(&archives_lock);
+    for (size_t i = 0; i < no_archives; i++)
+    {
+        if (archives[i].gz_fd != gz_fd) continue;
+        index = archives[i].index;
+        archives[i] = archives[no_archives - 1];
+        __atomic_store_n(&no_archives, no_archives - 1, __ATOMIC_RELEASE);
+        break;
+    }
+    pthread_rwlock_unlock(&archives_lock);
+
+    if (index != NULL) {gz_free_index(index); free(index);}
+}
+
+
+gz_index_t *tar_gz_index(int tar_fd)
+{
+    // Regular archives do not take the lock
+    if (__atomic_load_n(&no_archives, __ATOMIC_ACQUIRE) == 0) return NULL;
+
+    gz_index_t *index = NULL;
+    pthread_rwlock_rdlock(&archives_lock);
+    for (size_t i = 0; i < no_archives; i++)
+    {
+        if (archives[i].gz_fd == tar_fd) {index = archives[i].index; break;}
+    }
+    pthread_rwlock_unlock(&archives_lock);
+    return index;
+}
+
+
+static ssize_t read_archive(int tar_fd, void *dest, size_t len, off_t offset)
+{
+    gz_index_t *index = tar_gz_index(tar_fd);
+    if (index == NULL) return pread(tar_fd, dest, len, offset);
+    return gz_read_at(index, (uint8_t *) dest, len, offset);
+}
+
+
+ssize_t archive_pread(int tar_fd, void *dest, size_t len, off_t offset)
+{
+    if (cache_is_open(tar_fd)) return cache_pread(tar_fd, dest, len, offset, read_archive);
+    return read_archive(tar_fd, dest, len, offset);
+}
@@ -0,0 +1,294 @@
+#include "../headers/handle.h"
+
+static tar_handle_t *new_handle(int tar_fd)
+{
+    tar_handle_t *handle = (tar_handle_t *) malloc(sizeof(tar_handle_t));
+    if (handle == NULL) return NULL;
+
+    handle->tar_fd = tar_fd;
+    handle->map = NULL;
+    handle->map_len = 0;
+    if (index_init(&handle->index) != 0) {free(handle); return NULL;}
+    return handle;
+}
+
+
+static tar_handle_t *open_scan(int tar_fd)
+{
+    tar_handle_t *handle = new_handle(tar_fd);
+    if (handle == NULL) return NULL;
+
+    block_reader_t reader;
+    const tar_header_t *header;
+    if (reader_init(&reader, tar_fd) != 0) {tar_close(handle); return NULL;}
+
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
+    {
+        if (index_insert(&handle->index, header, reader_tell(&reader) - HEADER_SIZE) == NULL) {reader_free(&reader); tar_close(handle); return NULL;}
+        skip_file_content(&reader, header);
+    }
+
+    reader_free(&reader);
+    index_build_tree(&handle->index);
+    return handle;
+}
+
+
+tar_handle_t *tar_open(int tar_fd) { return STATS_CALL(TAR_API_OPEN, open_scan(tar_fd)); }
+
+
+static tar_handle_t *open_mapped(int tar_fd)
+{
+    struct stat st;
+    // A compressed archive cannot be read in place
+    if (tar_gz_index(tar_fd) != NULL) return NULL;
+    if (fstat(tar_fd, &st) != 0 || st.st_size <= 0) return NULL;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, tar_fd, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    tar_handle_t *handle = new_handle(tar_fd);
+    if (handle == NULL) {munmap(map, st.st_size); return NULL;}
+    handle->map = (const uint8_t *) map;
+    handle->map_len = st.st_size;
+
+    // The headers are parsed in place, nothing is read through the file descriptor
+    size_t offset = 0;
+    while (offset + HEADER_SIZE <= handle->map_len)
+    {
+        const tar_header_t *header = (const tar_header_t *) (handle->map + offset);
+        if (header->name[0] == '\0') break;
+        // A truncated archive must not make the views point outside the mapping
+        if (offset + HEADER_SIZE + TAR_INT(header->size) > handle->map_len) break;
+        STATS_ADD(no_headers, 1);
+        if (index_insert(&handle->index, header, offset) == NULL) {tar_close(handle); return NULL;}
+        offset += HEADER_SIZE + TAR_PADDED_SIZE(TAR_INT(header->size));
+    }
+
+    index_build_tree(&handle->index);
+    return handle;
+}
+
+
+tar_handle_t *tar_open_mmap(int tar_fd) { return STATS_CALL(TAR_API_OPEN_MMAP, open_mapped(tar_fd)); }
+
+
+static tar_handle_t *open_sidecar(int tar_fd, const char *idx_path)
+{
+    tar_handle_t *handle = (tar_handle_t *) malloc(sizeof(tar_handle_t));
+    if (handle == NULL) return NULL;
+
+    handle->tar_fd = tar_fd;
+    handle->map = NULL;
+    handle->map_len = 0;
+    if (sidecar_load(&handle->index, tar_fd, idx_path) == 0) return handle;
+
+    // Missing or stale sidecar
+    free(handle);
+    return tar_open(tar_fd);
+}
+
+
+tar_handle_t *tar_open_sidecar(int tar_fd, const char *idx_path) { return STATS_CALL(TAR_API_OPEN_SIDECAR, open_sidecar(tar_fd, idx_path)); }
+
+
+int tar_write_sidecar(tar_handle_t *handle, const char *idx_path) { return sidecar_write(&handle->index, handle->tar_fd, idx_path); }
+
+
+void tar_index_usage(tar_handle_t *handle, tar_index_usage_t *usage) { index_usage(&handle->index, usage); }
+
+
+void tar_close(tar_handle_t *handle)
+{
+    if (handle == NULL) return;
+    if (handle->map != NULL) munmap((void *) handle->map, handle->map_len);
+    index_free(&handle->index);
+    free(handle);
+}
+
+
+static int is_link(const tar_index_t *index, const tar_entry_t *entry)
+{
+    char typeflag = index_type(index, entry);
+    return typeflag == SYMTYPE || typeflag == LNKTYPE;
+}
+
+
+static int in_chain(const uint32_t *chain, size_t hops, uint32_t id)
+{
+    for (size_t i = 0; i < hops; i++) if (chain[i] == id) return 1;
+    return 0;
+}
+
+
+static tar_entry_t *resolve_entry(tar_handle_t *handle, tar_entry_t *entry)
+{
+    tar_index_t *index = &handle->index;
+    uint32_t chain[MAX_SYMLINK_HOPS];
+    size_t hops = 0;
+    uint32_t target = INDEX_EMPTY;
+
+    while (is_link(index, entry))
+    {
+        // The memoized targets are shared by the threads using the handle
+        uint32_t cached = __atomic_load_n(&entry->target, __ATOMIC_RELAXED);
+        STATS_ADD(symlink_hops, 1);
+        // A resolved target memoized further down a chain does not tell how many hops it took, only failures are final
+        if (cached == INDEX_DANGLING || (cached != INDEX_EMPTY && hops == 0)) {target = cached; break;}
+        // Out of hops without a cycle: the answer depends on the link the chain is entered by, nothing is memoized
+        if (hops == MAX_SYMLINK_HOPS) {hops = 0; target = INDEX_DANGLING; break;}
+        chain[hops++] = (uint32_t) (entry - index->entries);
+
+        char name[TAR_PATH_MAX];
+        char path[TAR_PATH_MAX];
+        index_path(index, entry, name, sizeof(name));
+        if (link_target(name, index_linkname(index, entry), index_type(index, entry), path, sizeof(path) - 1) != 0) {target = INDEX_DANGLING; break;}
+
+        tar_entry_t *next = index_find(index, path);
+        if (next == NULL)
+        {
+            size_t len = strlen(path);
+            if (len == 0 || path[len - 1] == '/') {target = INDEX_DANGLING; break;}
+            path[len] = '/';
+            path[len + 1] = '\0';
+            next = index_find(index, path);
+            if (next == NULL) {target = INDEX_DANGLING; break;}
+        }
+        if (in_chain(chain, hops, (uint32_t) (next - index->entries))) {target = INDEX_DANGLING; break;}
+        entry = next;
+    }
+
+    if (target == INDEX_EMPTY) target = (uint32_t) (entry - index->entries);
+    for (size_t i = 0; i < hops; i++) __atomic_store_n(&index->entries[chain[i]].target, target, __ATOMIC_RELAXED);
+    if (hops > 0) __atomic_store_n(&index->links_cached, 1, __ATOMIC_RELAXED);
+
+    return (target == INDEX_DANGLING) ? NULL : &index->entries[target];
+}
+
+
+static tar_entry_t *resolve_path(tar_handle_t *handle, char *path)
+{
+    tar_entry_t *entry = index_find(&handle->index, path);
+    return (entry == NULL) ? NULL : resolve_entry(handle, entry);
+}
+
+
+tar_entry_t *tar_resolve(tar_handle_t *handle, char *path) { return STATS_CALL(TAR_API_RESOLVE, resolve_path(handle, path)); }
+
+
+int tar_exists(tar_handle_t *handle, char *path) { return STATS_CALL(TAR_API_HANDLE_EXISTS, index_find(&handle->index, path)) != NULL; }
+
+
+int tar_is_dir(tar_handle_t *handle, char *path)
+{
+    tar_entry_t *entry = STATS_CALL(TAR_API_HANDLE_IS_DIR, index_find(&handle->index, path));
+    return entry != NULL && index_type(&handle->index, entry) == DIRTYPE;
+}
+
+
+int tar_is_file(tar_handle_t *handle, char *path)
+{
+    tar_entry_t *entry = STATS_CALL(TAR_API_HANDLE_IS_FILE, index_find(&handle->index, path));
+    if (entry == NULL) return 0;
+    char typeflag = index_type(&handle->index, entry);
+    return typeflag == REGTYPE || typeflag == AREGTYPE;
+}
+
+
+int tar_is_symlink(tar_handle_t *handle, char *path)
+{
+    tar_entry_t *entry = STATS_CALL(TAR_API_HANDLE_IS_SYMLINK, index_find(&handle->index, path));
+    return entry != NULL && is_link(&handle->index, entry);
+}
+
+
+static int list_children(tar_handle_t *handle, char *path, char **entries, size_t *no_entries)
+{
+    tar_index_t *index = &handle->index;
+    tar_entry_t *dir = tar_resolve(handle, path);
+    size_t listed_entries = 0;
+
+    if (dir == NULL || index_type(index, dir) != DIRTYPE) {*no_entries = 0; return 0;}
+
+    for (uint32_t id = dir->first_child; id != INDEX_EMPTY && listed_entries < *no_entries; id = index->entries[id].next_sibling)
+    {
+        index_path(index, &index->entries[id], entries[listed_entries], TAR_PATH_MAX);
+        listed_entries++;
+    }
+
+    *no_entries = listed_entries;
+    return 1;
+}
+
+
+int tar_list(tar_handle_t *handle, char *path, char **entries, size_t *no_entries) { return STATS_CALL(TAR_API_HANDLE_LIST, list_children(handle, path, entries, no_entries)); }
+
+
+// Finds the file at the given path, following links.
+// Returns -1 if there is no file at the path, -2 if the offset is outside the file and 0 otherwise.
+static int find_file(tar_handle_t *handle, char *path, size_t offset, tar_entry_t **file)
+{
+    tar_entry_t *entry = tar_resolve(handle, path);
+
+    if (entry == NULL) return -1;
+    char typeflag = index_type(&handle->index, entry);
+    if (typeflag != REGTYPE && typeflag != AREGTYPE) return -1;
+    if ((ssize_t) offset < 0 || offset >= index_size(&handle->index, entry)) return -2;
+
+    *file = entry;
+    return 0;
+}
+
+
+static ssize_t read_entry(tar_handle_t *handle, char *path, size_t offset, uint8_t *dest, size_t *len)
+{
+    tar_entry_t *entry;
+    size_t dest_len = *len;
+    *len = 0;
+
+    int ret = find_file(handle, path, offset, &entry);
+    if (ret < 0) return ret;
+
+    size_t total_len = index_size(&handle->index, entry) - offset;
+    size_t used_len = (total_len > dest_len) ? dest_len : total_len;
+    off_t data_offset = index_offset(&handle->index, entry) + HEADER_SIZE + offset;
+
+    if (handle->map != NULL)
+    {
+        if (used_len == 0) return -1;
+        memcpy(dest, handle->map + data_offset, used_len);
+        STATS_ADD(bytes_read, used_len);
+        *len = used_len;
+        return total_len - used_len;
+    }
+
+    STATS_ADD(no_syscalls, 1);
+    ssize_t nber_read = archive_pread(handle->tar_fd, dest, used_len, data_offset);
+    if (nber_read <= 0) return -1;
+    STATS_ADD(bytes_read, nber_read);
+
+    *len = nber_read;
+    return total_len - nber_read;
+}
+
+
+ssize_t tar_read_file(tar_handle_t *handle, char *path, size_t offset, uint8_t *dest, size_t *len) { return STATS_CALL(TAR_API_HANDLE_READ_FILE, read_entry(handle, path, offset, dest, len)); }
+
+
+static ssize_t view_entry(tar_handle_t *handle, char *path, size_t offset, const uint8_t **view, size_t *len)
+{
+    tar_entry_t *entry;
+    *view = NULL;
+    *len = 0;
+
+    if (handle->map == NULL) return -3;
+    int ret = find_file(handle, path, offset, &entry);
+    if (ret < 0) return ret;
+
+    *view = handle->map + index_offset(&handle->index, entry) + HEADER_SIZE + offset;
+    *len = index_size(&handle->index, entry) - offset;
+    return 0;
+}
+
+
+ssize_t read_file_view(tar_handle_t *handle, char *path, size_t offset, const uint8_t **view, size_t *len) { return STATS_CALL(TAR_API_READ_FILE_VIEW, view_entry(handle, path, offset, view, len)); }
@@ -12,93 +12,181 @@ void get_info_header(tar_header_t header, int id)
 }
 
 
-void skip_file_content(int tar_fd, tar_header_t header)
+void skip_file_content(block_reader_t *reader, const tar_header_t *header)
 {
-    int nb_blocks = TAR_INT(header.size) / HEADER_SIZE;
-    if (TAR_INT(header.size) % HEADER_SIZE != 0) nb_blocks++;
-    lseek(tar_fd, HEADER_SIZE * nb_blocks, SEEK_CUR);
+    int nb_blocks = TAR_INT(header->size) / HEADER_SIZE;
+    if (TAR_INT(header->size) % HEADER_SIZE != 0) nb_blocks++;
+    reader_skip(reader, HEADER_SIZE * nb_blocks);
 }
 
 
-void skip_dir(int tar_fd, tar_header_t *header)
+size_t header_path(const tar_header_t *header, char *dest)
 {
-    char *name_dir = (char *) malloc(100 * sizeof(char));
-    memcpy(name_dir, header->name, 100 * sizeof(char));
-
-    while (check_if_entry_folder(name_dir, header->name) == 1)
+    size_t len = 0;
+    // The prefix field of GNU headers holds other fields
+    if (memcmp(header->magic, TMAGIC, TMAGLEN) == 0 && header->prefix[0] != '\0')
     {
-        if (header->typeflag == REGTYPE || header->typeflag == AREGTYPE) skip_file_content(tar_fd, *header);
-        if (read(tar_fd, header, HEADER_SIZE) <= 0 || header->name[0] == '\0') break;
+        len = strnlen(header->prefix, sizeof(header->prefix));
+        memcpy(dest, header->prefix, len);
+        dest[len++] = '/';
     }
-
-    free(name_dir);
+    size_t name_len = strnlen(header->name, sizeof(header->name));
+    memcpy(dest + len, header->name, name_len);
+    dest[len + name_len] = '\0';
+    return len + name_len;
 }
 
 
-int check_if_entry_folder(char *parent_dir, char *current_path)
+uint32_t hash_path(const char *path)
 {
-    for (int i = 0; parent_dir[i] != '\0' ; i++)
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++)
     {
-        if (current_path[i] == '\0' || parent_dir[i] != current_path[i]) return 0;
+        hash ^= (uint8_t) *path;
+        hash *= 16777619u;
     }
-    return 1;
+    return hash;
 }
 
 
-char *parse_symlink(char *header_name, char *header_linkname)
+int is_direct_child(const char *parent_dir, const char *path)
 {
-    char *parsed_name = (char *) malloc(100 * sizeof(char));
-    int len = strlen(header_name) - 1;
-    // Get the len of the last '/'
-    for (int i = len; i >= 0; i--)
-    {
-        if (header_name[i] != '/') len--;
-        else break;
-    }
+    size_t len = strlen(parent_dir);
+    if (len == 0 || parent_dir[len - 1] != '/') return 0;
+    if (strncmp(parent_dir, path, len) != 0 || path[len] == '\0') return 0;
+
+    const char *slash = strchr(path + len, '/');
+    return (slash == NULL || slash[1] == '\0') ? 1 : 0;
+}
+
+
+size_t parent_dir_len(const char *path)
+{
+    size_t len = strlen(path);
+    // The trailing '/' of a directory is part of its own name
+    if (len > 0 && path[len - 1] == '/') len--;
+    while (len > 0 && path[len - 1] != '/') len--;
+    return len;
+}
+
 
-    // Size max of a name : 100 characters
-    if (strlen(header_linkname) + len + 1 >= 100) return parsed_name;
-    
-    if (len > 0)
+int normalize_path(const char *path, char *normalized, size_t size)
+{
+    size_t path_len = strlen(path);
+    int trailing_slash = (path_len > 0 && path[path_len - 1] == '/');
+    size_t len = 0;
+
+    while (*path != '\0')
     {
-        memcpy(parsed_name, header_name, len + 1);
-        strcat(parsed_name, header_linkname);
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+
+        const char *component = path;
+        while (*path != '\0' && *path != '/') path++;
+        size_t component_len = path - component;
+
+        if (component_len == 1 && component[0] == '.') continue;
+        if (component_len == 2 && component[0] == '.' && component[1] == '.')
+        {
+            if (len == 0) return -1;
+            // Removes the last component and its '/'
+            len--;
+            while (len > 0 && normalized[len - 1] != '/') len--;
+            continue;
+        }
+
+        if (len + component_len + 2 > size) return -1;
+        memcpy(normalized + len, component, component_len);
+        len += component_len;
+        normalized[len++] = '/';
     }
-    // No backslash in header_name
-    else memcpy(parsed_name, header_linkname, 100 * sizeof(char));
 
-    return parsed_name;
+    // Each component is followed by a '/', the last one keeps it only if the path had one
+    if (len > 0 && trailing_slash == 0) len--;
+    normalized[len] = '\0';
+    return 0;
+}
+
+
+int link_target(const char *name, const char *linkname, char typeflag, char *target, size_t size)
+{
+    char joined[2 * TAR_PATH_MAX];
+    size_t dir_len = 0;
+
+    // Hard links and absolute symlinks start from the root of the archive
+    if (typeflag == SYMTYPE && linkname[0] != '/') dir_len = parent_dir_len(name);
+    if (dir_len + strlen(linkname) + 1 > sizeof(joined)) return -1;
+
+    memcpy(joined, name, dir_len);
+    strcpy(joined + dir_len, linkname);
+    return normalize_path(joined, target, size);
+}
+
+
+int check_header(const tar_header_t *header)
+{
+    // Vérifie la valeur "magic" et "version"
+    if (strncmp(header->magic, TMAGIC, TMAGLEN) != 0)      return -1;
+    if (strncmp(header->version, TVERSION, TVERSLEN) != 0) return -2;
+
+    // Calcule le checksum, sans copier le header
+    long int header_chksum = tar_octal(header->chksum, sizeof(header->chksum));
+    long int chksum_calculated = header_checksum((const uint8_t *) header);
+
+    // Vérifie le checksum
+    return (header_chksum != chksum_calculated) ? -3 : 0;
 }
 
 
 int is_x(int tar_fd, char *path, char *type_file)
 {
-    tar_header_t header;
+    block_reader_t reader;
+    const tar_header_t *header;
     int ret = 0;
 
-    lseek(tar_fd, 0, SEEK_SET);
+    if (reader_init(&reader, tar_fd) != 0) return 0;
 
-    while (read(tar_fd, &header, HEADER_SIZE) > 0 && header.name[0] != '\0')
+    char name[TAR_PATH_MAX];
+
+    // Later members shadow earlier ones with the same path: the type of the last match is checked
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
     {   
-        if (strcmp(header.name, path) == 0)
+        header_path(header, name);
+        if (strcmp(name, path) == 0)
         {
-            if (strcmp(type_file, "dir") == 0)
-            {
-                if (header.typeflag == DIRTYPE)                                 {ret = 1; break;}
-            }
-            else if (strcmp(type_file, "file") == 0)
-            {
-                if (header.typeflag == REGTYPE || header.typeflag == AREGTYPE)  {ret = 1; break;}
-            }
-            else if (strcmp(type_file, "symlink") == 0)
-            {
-                if (header.typeflag == SYMTYPE || header.typeflag == LNKTYPE)   {ret = 1; break;}
-            }
-            else                                                                {ret = -1; break;}
+            if (strcmp(type_file, "dir") == 0)          ret = (header->typeflag == DIRTYPE);
+            else if (strcmp(type_file, "file") == 0)    ret = (header->typeflag == REGTYPE || header->typeflag == AREGTYPE);
+            else if (strcmp(type_file, "symlink") == 0) ret = (header->typeflag == SYMTYPE || header->typeflag == LNKTYPE);
+            else                                        {ret = -1; break;}
         }
-        skip_file_content(tar_fd, header);
+        skip_file_content(&reader, header);
     }
 
-    lseek(tar_fd, 0, SEEK_SET);
+    reader_free(&reader);
     return ret;
-}
\ No newline at end of file
+}
+
+
+void run_workers(void *(*worker)(void *), void *arg, int no_threads, size_t max_useful)
+{
+    if (no_threads <= 0)
+    {
+        long no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        no_threads = (no_cpus > 0) ? no_cpus : 1;
+    }
+    if ((size_t) no_threads > max_useful) no_threads = max_useful;
+
+    if (no_threads <= 1) {worker(arg); return;}
+
+    pthread_t *threads = (pthread_t *) malloc(no_threads * sizeof(pthread_t));
+    int no_started = 0;
+    for (; threads != NULL && no_started < no_threads; no_started++)
+    {
+        if (pthread_create(&threads[no_started], NULL, worker, arg) != 0) break;
+    }
+    // If no thread could be started, the calling thread does the work
+    if (no_started == 0) worker(arg);
+    for (int i = 0; i < no_started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+}
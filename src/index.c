@@ -0,0 +1,487 @@
+#include "../headers/index.h"
+
+#define FNV_BASIS 2166136261u
+
+// FNV-1a continued over 'len' bytes, the same hash as hash_path() over a whole path
+static uint32_t hash_continue(uint32_t hash, const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t) str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static int arena_push(tar_index_t *index, const char *str, size_t len, uint32_t *offset)
+{
+    if (index->arena_len + len + 1 > index->arena_cap)
+    {
+        size_t new_cap = index->arena_cap * 2;
+        while (index->arena_len + len + 1 > new_cap) new_cap *= 2;
+        char *new_arena = (char *) realloc(index->arena, new_cap);
+        if (new_arena == NULL) return -1;
+        index->arena = new_arena;
+        index->arena_cap = new_cap;
+    }
+
+    memcpy(index->arena + index->arena_len, str, len);
+    index->arena[index->arena_len + len] = '\0';
+    *offset = (uint32_t) index->arena_len;
+    index->arena_len += len + 1;
+    return 0;
+}
+
+
+// Slot of the prefix in the table of prefixes, growing it first if needed. Returns NULL if the allocation failed.
+static uint32_t *prefix_bucket(tar_index_t *index, const char *prefix, size_t len)
+{
+    if ((index->no_prefixes + 1) * 2 > index->no_prefix_buckets)
+    {
+        size_t new_size = (index->no_prefix_buckets == 0) ? INDEX_PREFIX_BUCKETS : 2 * index->no_prefix_buckets;
+        uint32_t *new_prefixes = (uint32_t *) malloc(new_size * sizeof(uint32_t));
+        if (new_prefixes == NULL) return NULL;
+        memset(new_prefixes, 0xff, new_size * sizeof(uint32_t));
+
+        for (size_t i = 0; i < index->no_prefix_buckets; i++)
+        {
+            uint32_t offset = index->prefixes[i];
+            if (offset == INDEX_EMPTY) continue;
+            const char *stored = index->arena + offset;
+            size_t slot = hash_continue(FNV_BASIS, stored, strlen(stored)) & (new_size - 1);
+            while (new_prefixes[slot] != INDEX_EMPTY) slot = (slot + 1) & (new_size - 1);
+            new_prefixes[slot] = offset;
+        }
+        free(index->prefixes);
+        index->prefixes = new_prefixes;
+        index->no_prefix_buckets = new_size;
+    }
+
+    size_t mask = index->no_prefix_buckets - 1;
+    size_t slot = hash_continue(FNV_BASIS, prefix, len) & mask;
+    while (index->prefixes[slot] != INDEX_EMPTY)
+    {
+        const char *stored = index->arena + index->prefixes[slot];
+        if (strncmp(stored, prefix, len) == 0 && stored[len] == '\0') break;
+        slot = (slot + 1) & mask;
+    }
+    return &index->prefixes[slot];
+}
+
+
+// Offset of the directory prefix in the arena, where it is stored once for all the entries of the directory
+static int intern_prefix(tar_index_t *index, const char *prefix, size_t len, uint32_t *offset)
+{
+    // Offset 0 of the arena is the empty string, the prefix of the entries at the root
+    if (len == 0) {*offset = 0; return 0;}
+
+    uint32_t *bucket = prefix_bucket(index, prefix, len);
+    if (bucket == NULL) return -1;
+    if (*bucket == INDEX_EMPTY)
+    {
+        if (arena_push(index, prefix, len, bucket) != 0) return -1;
+        index->no_prefixes++;
+    }
+    *offset = *bucket;
+    return 0;
+}
+
+
+// Whether the path of the entry, its prefix followed by its name, is 'path'
+static int path_equals(const tar_index_t *index, const tar_entry_t *entry, const char *path)
+{
+    for (const char *prefix = index->arena + entry->prefix; *prefix != '\0'; prefix++, path++)
+    {
+        if (*prefix != *path) return 0;
+    }
+    return strcmp(index->arena + entry->name, path) == 0;
+}
+
+
+static uint32_t entry_hash(const tar_index_t *index, const tar_entry_t *entry)
+{
+    const char *prefix = index->arena + entry->prefix;
+    const char *name = index->arena + entry->name;
+    return hash_continue(hash_continue(FNV_BASIS, prefix, strlen(prefix)), name, strlen(name));
+}
+
+
+static size_t find_slot(const tar_index_t *index, const char *path)
+{
+    size_t mask = index->no_buckets - 1;
+    size_t slot = hash_path(path) & mask;
+
+    while (index->buckets[slot] != INDEX_EMPTY)
+    {
+        if (path_equals(index, &index->entries[index->buckets[slot]], path)) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+
+static int grow_buckets(tar_index_t *index)
+{
+    size_t new_size = index->no_buckets * 2;
+    uint32_t *new_buckets = (uint32_t *) malloc(new_size * sizeof(uint32_t));
+    if (new_buckets == NULL) return -1;
+    memset(new_buckets, 0xff, new_size * sizeof(uint32_t));
+
+    // The paths are all different: each one goes to the first free slot
+    for (size_t i = 0; i < index->no_buckets; i++)
+    {
+        if (index->buckets[i] == INDEX_EMPTY) continue;
+        size_t slot = entry_hash(index, &index->entries[index->buckets[i]]) & (new_size - 1);
+        while (new_buckets[slot] != INDEX_EMPTY) slot = (slot + 1) & (new_size - 1);
+        new_buckets[slot] = index->buckets[i];
+    }
+
+    free(index->buckets);
+    index->buckets = new_buckets;
+    index->no_buckets = new_size;
+    return 0;
+}
+
+
+// Grows the entries and every parallel array to 'cap' entries
+static int resize_entries(tar_index_t *index, size_t cap)
+{
+    tar_entry_t *entries = (tar_entry_t *) realloc(index->entries, cap * sizeof(tar_entry_t));
+    if (entries == NULL) return -1;
+    index->entries = entries;
+    uint64_t *offsets = (uint64_t *) realloc(index->offsets, cap * sizeof(uint64_t));
+    if (offsets == NULL) return -1;
+    index->offsets = offsets;
+    uint64_t *sizes = (uint64_t *) realloc(index->sizes, cap * sizeof(uint64_t));
+    if (sizes == NULL) return -1;
+    index->sizes = sizes;
+    char *types = (char *) realloc(index->types, cap);
+    if (types == NULL) return -1;
+    index->types = types;
+    uint16_t *modes = (uint16_t *) realloc(index->modes, cap * sizeof(uint16_t));
+    if (modes == NULL) return -1;
+    index->modes = modes;
+
+    index->cap_entries = cap;
+    return 0;
+}
+
+
+int index_init(tar_index_t *index)
+{
+    memset(index, 0, sizeof(tar_index_t));
+
+    index->arena_cap = 4096;
+    index->no_buckets = 128;
+    index->arena = (char *) malloc(index->arena_cap);
+    index->buckets = (uint32_t *) malloc(index->no_buckets * sizeof(uint32_t));
+
+    if (resize_entries(index, 64) != 0 || index->arena == NULL || index->buckets == NULL) {index_free(index); return -1;}
+    memset(index->buckets, 0xff, index->no_buckets * sizeof(uint32_t));
+
+    // Offset 0 of the arena is the empty string, used by entries without link target
+    index->arena[0] = '\0';
+    index->arena_len = 1;
+    return 0;
+}
+
+
+void index_free(tar_index_t *index)
+{
+    if (index->map != NULL) munmap(index->map, index->map_len);
+    else
+    {
+        free(index->entries);
+        free(index->offsets);
+        free(index->sizes);
+        free(index->types);
+        free(index->modes);
+        free(index->arena);
+        free(index->buckets);
+        free(index->sorted);
+    }
+    free(index->prefixes);
+    memset(index, 0, sizeof(tar_index_t));
+}
+
+
+int index_own(tar_index_t *index)
+{
+    if (index->map == NULL) return 0;
+
+    tar_index_t owned;
+    memset(&owned, 0, sizeof(tar_index_t));
+    size_t cap_entries = (index->no_entries < 32) ? 64 : 2 * index->no_entries;
+    owned.arena = (char *) malloc(index->arena_len);
+    owned.buckets = (uint32_t *) malloc(index->no_buckets * sizeof(uint32_t));
+    if (resize_entries(&owned, cap_entries) != 0 || owned.arena == NULL || owned.buckets == NULL) {index_free(&owned); return -1;}
+
+    memcpy(owned.entries, index->entries, index->no_entries * sizeof(tar_entry_t));
+    memcpy(owned.offsets, index->offsets, index->no_entries * sizeof(uint64_t));
+    memcpy(owned.sizes, index->sizes, index->no_entries * sizeof(uint64_t));
+    memcpy(owned.types, index->types, index->no_entries);
+    memcpy(owned.modes, index->modes, index->no_entries * sizeof(uint16_t));
+    memcpy(owned.arena, index->arena, index->arena_len);
+    memcpy(owned.buckets, index->buckets, index->no_buckets * sizeof(uint32_t));
+    owned.no_entries = index->no_entries;
+    owned.arena_len = owned.arena_cap = index->arena_len;
+    owned.no_buckets = index->no_buckets;
+    owned.links_cached = index->links_cached;
+
+    // The table of prefixes is not in the sidecar, it is rebuilt from the entries
+    for (size_t i = 0; i < owned.no_entries; i++)
+    {
+        const char *prefix = owned.arena + owned.entries[i].prefix;
+        if (prefix[0] == '\0') continue;
+        uint32_t *bucket = prefix_bucket(&owned, prefix, strlen(prefix));
+        if (bucket == NULL) {index_free(&owned); return -1;}
+        if (*bucket == INDEX_EMPTY) {*bucket = owned.entries[i].prefix; owned.no_prefixes++;}
+    }
+
+    // The sorted table is rebuilt from the entries when needed
+    index_free(index);
+    *index = owned;
+    return 0;
+}
+
+
+tar_entry_t *index_insert(tar_index_t *index, const tar_header_t *header, off_t hdr_offset)
+{
+    // The name and linkname fields are not null-terminated when they are full
+    char name[TAR_PATH_MAX];
+    size_t name_len = header_path(header, name);
+
+    size_t link_len = strnlen(header->linkname, sizeof(header->linkname));
+
+    if (index->map != NULL) return NULL;
+    free(index->sorted);
+    index->sorted = NULL;
+
+    // Keep the load factor under 1/2
+    if ((index->no_entries + 1) * 2 > index->no_buckets && grow_buckets(index) != 0) return NULL;
+
+    size_t slot = find_slot(index, name);
+    uint32_t id = index->buckets[slot];
+
+    if (id != INDEX_EMPTY)
+    {
+        if (index->links_cached == 1)
+        {
+            for (size_t i = 0; i < index->no_entries; i++) index->entries[i].target = INDEX_EMPTY;
+            index->links_cached = 0;
+        }
+    }
+    else
+    {
+        if (index->no_entries == index->cap_entries && resize_entries(index, 2 * index->cap_entries) != 0) return NULL;
+
+        id = (uint32_t) index->no_entries;
+        tar_entry_t *entry = &index->entries[id];
+        entry->parent = entry->first_child = entry->next_sibling = entry->target = INDEX_EMPTY;
+        size_t prefix_len = parent_dir_len(name);
+        if (intern_prefix(index, name, prefix_len, &entry->prefix) != 0) return NULL;
+        if (arena_push(index, name + prefix_len, name_len - prefix_len, &entry->name) != 0) return NULL;
+        index->buckets[slot] = id;
+        index->no_entries++;
+    }
+
+    tar_entry_t *entry = &index->entries[id];
+    entry->linkname = 0;
+    if (link_len > 0 && arena_push(index, header->linkname, link_len, &entry->linkname) != 0) return NULL;
+
+    index->offsets[id] = hdr_offset;
+    index->sizes[id] = TAR_INT(header->size);
+    index->types[id] = header->typeflag;
+    long mode = tar_octal(header->mode, sizeof(header->mode));
+    index->modes[id] = (mode < 0) ? 0 : mode & 07777;
+    return entry;
+}
+
+
+void index_build_tree(tar_index_t *index)
+{
+    for (size_t i = 0; i < index->no_entries; i++) index->entries[i].first_child = INDEX_EMPTY;
+
+    // Walking backwards and pushing in front keeps the entries of a directory in archive order
+    for (size_t i = index->no_entries; i-- > 0;)
+    {
+        tar_entry_t *entry = &index->entries[i];
+        entry->parent = entry->next_sibling = INDEX_EMPTY;
+
+        // The prefix of an entry is the path of its directory
+        const char *parent_dir = index->arena + entry->prefix;
+        if (parent_dir[0] == '\0') continue;
+
+        tar_entry_t *parent = index_find(index, parent_dir);
+        if (parent == NULL) continue;
+
+        entry->parent = (uint32_t) (parent - index->entries);
+        entry->next_sibling = parent->first_child;
+        parent->first_child = (uint32_t) i;
+    }
+}
+
+
+void index_link_entries(tar_index_t *index, size_t first)
+{
+    if (first >= index->no_entries) return;
+
+    // A new directory may contain entries indexed before: only prefixes interned before the new names were pushed can be theirs
+    uint32_t new_arena = index->entries[first].name;
+    for (size_t i = first; i < index->no_entries; i++)
+    {
+        char path[TAR_PATH_MAX];
+        size_t len = index_path(index, &index->entries[i], path, sizeof(path));
+        uint32_t *bucket = prefix_bucket(index, path, len);
+        if (bucket == NULL || *bucket == INDEX_EMPTY || *bucket >= new_arena) continue;
+
+        // The directory has no entry yet: the adopted ones are chained first, in archive order
+        uint32_t tail = INDEX_EMPTY;
+        for (size_t j = 0; j < first; j++)
+        {
+            tar_entry_t *entry = &index->entries[j];
+            if (entry->parent != INDEX_EMPTY || entry->prefix != *bucket) continue;
+            entry->parent = (uint32_t) i;
+            if (tail == INDEX_EMPTY) index->entries[i].first_child = (uint32_t) j;
+            else index->entries[tail].next_sibling = (uint32_t) j;
+            tail = (uint32_t) j;
+        }
+    }
+
+    // The new entries are chained after the entries of their directory, consecutive entries often share it
+    uint32_t prefix = INDEX_EMPTY;
+    uint32_t parent = INDEX_EMPTY;
+    uint32_t tail = INDEX_EMPTY;
+    for (size_t i = first; i < index->no_entries; i++)
+    {
+        tar_entry_t *entry = &index->entries[i];
+        if (entry->prefix != prefix)
+        {
+            prefix = entry->prefix;
+            const char *parent_dir = index->arena + prefix;
+            tar_entry_t *dir = (parent_dir[0] == '\0') ? NULL : index_find(index, parent_dir);
+            parent = tail = INDEX_EMPTY;
+            if (dir == NULL) continue;
+
+            parent = (uint32_t) (dir - index->entries);
+            tail = dir->first_child;
+            while (tail != INDEX_EMPTY && index->entries[tail].next_sibling != INDEX_EMPTY) tail = index->entries[tail].next_sibling;
+        }
+        if (parent == INDEX_EMPTY) continue;
+
+        entry->parent = parent;
+        if (tail == INDEX_EMPTY) index->entries[parent].first_child = (uint32_t) i;
+        else index->entries[tail].next_sibling = (uint32_t) i;
+        tail = (uint32_t) i;
+    }
+}
+
+
+typedef struct sort_item
+{
+    const char *prefix;
+    const char *name;
+    uint32_t id;
+} sort_item_t;
+
+
+// strcmp() of the paths, each made of its prefix followed by its name
+static int cmp_sort_item(const void *a, const void *b)
+{
+    const sort_item_t *x = (const sort_item_t *) a;
+    const sort_item_t *y = (const sort_item_t *) b;
+    if (x->prefix == y->prefix) return strcmp(x->name, y->name);
+
+    const char *p = x->prefix;
+    const char *q = y->prefix;
+    int p_in_name = 0;
+    int q_in_name = 0;
+    while (1)
+    {
+        if (*p == '\0' && p_in_name == 0) {p = x->name; p_in_name = 1; continue;}
+        if (*q == '\0' && q_in_name == 0) {q = y->name; q_in_name = 1; continue;}
+        if (*p != *q || *p == '\0') return (int) (uint8_t) *p - (int) (uint8_t) *q;
+        p++;
+        q++;
+    }
+}
+
+
+const uint32_t *index_sorted(tar_index_t *index)
+{
+    uint32_t *current = __atomic_load_n(&index->sorted, __ATOMIC_ACQUIRE);
+    if (current != NULL) return current;
+
+    sort_item_t *items = (sort_item_t *) malloc((index->no_entries + 1) * sizeof(sort_item_t));
+    uint32_t *sorted = (uint32_t *) malloc((index->no_entries + 1) * sizeof(uint32_t));
+    if (items == NULL || sorted == NULL) {free(items); free(sorted); return NULL;}
+
+    for (size_t i = 0; i < index->no_entries; i++)
+    {
+        items[i].prefix = index->arena + index->entries[i].prefix;
+        items[i].name = index->arena + index->entries[i].name;
+        items[i].id = (uint32_t) i;
+    }
+    qsort(items, index->no_entries, sizeof(sort_item_t), cmp_sort_item);
+    for (size_t i = 0; i < index->no_entries; i++) sorted[i] = items[i].id;
+
+    free(items);
+    // Threads sharing a handle may build the table at the same time, the first one stored is kept
+    if (__atomic_compare_exchange_n(&index->sorted, &current, sorted, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return sorted;
+    free(sorted);
+    return current;
+}
+
+
+tar_entry_t *index_find(const tar_index_t *index, const char *path)
+{
+    uint32_t id = index->buckets[find_slot(index, path)];
+    return (id == INDEX_EMPTY) ? NULL : &index->entries[id];
+}
+
+
+size_t index_path(const tar_index_t *index, const tar_entry_t *entry, char *dest, size_t size)
+{
+    const char *prefix = index->arena + entry->prefix;
+    const char *name = index->arena + entry->name;
+    size_t prefix_len = strlen(prefix);
+    size_t name_len = strlen(name);
+    if (size == 0) return prefix_len + name_len;
+
+    size_t copied = (prefix_len < size - 1) ? prefix_len : size - 1;
+    memcpy(dest, prefix, copied);
+    size_t rest = (name_len < size - 1 - copied) ? name_len : size - 1 - copied;
+    memcpy(dest + copied, name, rest);
+    dest[copied + rest] = '\0';
+    return prefix_len + name_len;
+}
+
+
+const char *index_linkname(const tar_index_t *index, const tar_entry_t *entry) { return index->arena + entry->linkname; }
+
+
+off_t index_offset(const tar_index_t *index, const tar_entry_t *entry) { return index->offsets[entry - index->entries]; }
+
+
+size_t index_size(const tar_index_t *index, const tar_entry_t *entry) { return index->sizes[entry - index->entries]; }
+
+
+char index_type(const tar_index_t *index, const tar_entry_t *entry) { return index->types[entry - index->entries]; }
+
+
+mode_t index_mode(const tar_index_t *index, const tar_entry_t *entry) { return index->modes[entry - index->entries]; }
+
+
+void index_usage(const tar_index_t *index, tar_index_usage_t *usage)
+{
+    // A mapped index only uses what the sidecar holds, an allocated one its whole capacity
+    size_t no_slots = (index->map != NULL) ? index->no_entries : index->cap_entries;
+    usage->no_entries = index->no_entries;
+    usage->no_prefixes = index->no_prefixes;
+    usage->entries_bytes = no_slots * (sizeof(tar_entry_t) + 2 * sizeof(uint64_t) + sizeof(char) + sizeof(uint16_t));
+    usage->tables_bytes = (index->no_buckets + index->no_prefix_buckets) * sizeof(uint32_t);
+    if (index->sorted != NULL) usage->tables_bytes += index->no_entries * sizeof(uint32_t);
+    usage->arena_bytes = (index->map != NULL) ? index->arena_len : index->arena_cap;
+    usage->total_bytes = (index->map != NULL) ? index->map_len : usage->entries_bytes + usage->tables_bytes + usage->arena_bytes;
+}
@@ -0,0 +1,67 @@
+#include "../headers/iter.h"
+
+int tar_iter_begin(tar_iter_t *iter, int tar_fd)
+{
+    memset(&iter->member, 0, sizeof(tar_member_t));
+    iter->remaining = 0;
+    iter->padding = 0;
+    return reader_init(&iter->reader, tar_fd);
+}
+
+
+void tar_decode_member(const tar_header_t *header, off_t hdr_offset, tar_member_t *member)
+{
+    header_path(header, member->name);
+
+    size_t link_len = strnlen(header->linkname, sizeof(header->linkname));
+    memcpy(member->linkname, header->linkname, link_len);
+    member->linkname[link_len] = '\0';
+
+    // Fields left empty are decoded as zero
+    long size = tar_octal(header->size, sizeof(header->size));
+    long mode = tar_octal(header->mode, sizeof(header->mode));
+    long mtime = tar_octal(header->mtime, sizeof(header->mtime));
+
+    member->typeflag = header->typeflag;
+    member->size = (size < 0) ? 0 : size;
+    member->mode = (mode < 0) ? 0 : mode;
+    member->mtime = (mtime < 0) ? 0 : mtime;
+    member->hdr_offset = hdr_offset;
+    member->data_offset = hdr_offset + HEADER_SIZE;
+}
+
+
+static int next_member(tar_iter_t *iter, const tar_member_t **member)
+{
+    reader_skip(&iter->reader, iter->remaining + iter->padding);
+    iter->remaining = iter->padding = 0;
+
+    const tar_header_t *header = reader_next_header(&iter->reader);
+    if (header == NULL || header->name[0] == '\0') return 0;
+
+    int ret = check_header(header);
+    if (ret != 0) return ret;
+
+    tar_member_t *current = &iter->member;
+    tar_decode_member(header, reader_tell(&iter->reader) - HEADER_SIZE, current);
+
+    iter->remaining = current->size;
+    iter->padding = TAR_PADDED_SIZE(current->size) - current->size;
+    *member = current;
+    return 1;
+}
+
+
+int tar_iter_next(tar_iter_t *iter, const tar_member_t **member) { return STATS_CALL(TAR_API_ITER_NEXT, next_member(iter, member)); }
+
+
+size_t tar_iter_read(tar_iter_t *iter, uint8_t *dest, size_t len)
+{
+    if (len > iter->remaining) len = iter->remaining;
+    size_t nber_read = STATS_CALL(TAR_API_ITER_READ, reader_read(&iter->reader, dest, len));
+    iter->remaining -= nber_read;
+    return nber_read;
+}
+
+
+void tar_iter_end(tar_iter_t *iter) { reader_free(&iter->reader); }
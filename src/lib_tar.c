@@ -1,158 +1,302 @@
 #include "../headers/lib_tar.h"
 
-int check_archive(int tar_fd)
+typedef struct check_job
 {
+    int tar_fd;
+    off_t *offsets;               /* offsets of the headers, in archive order */
+    size_t no_headers;
+    size_t next_header;           /* first header not taken by a worker yet */
+    size_t first_error;           /* index of the first invalid header found so far */
+    int error;                    /* error code of that header */
+    pthread_mutex_t lock;
+} check_job_t;
+
+
+static void *check_worker(void *arg)
+{
+    check_job_t *job = (check_job_t *) arg;
     tar_header_t header;
-    int nber_valid_headers = 0;
-    int ret = 0;
+    STATS_ATTACH(TAR_API_CHECK_ARCHIVE);
 
-    lseek(tar_fd, 0, SEEK_SET);
+    while (1)
+    {
+        size_t begin = __atomic_fetch_add(&job->next_header, CHECK_BATCH_SIZE, __ATOMIC_RELAXED);
+        // Headers after an invalid one do not change the result
+        if (begin >= job->no_headers || begin > __atomic_load_n(&job->first_error, __ATOMIC_RELAXED)) break;
+
+        size_t end = (begin + CHECK_BATCH_SIZE < job->no_headers) ? begin + CHECK_BATCH_SIZE : job->no_headers;
+        for (size_t i = begin; i < end; i++)
+        {
+            int ret = -3;
+            STATS_ADD(no_syscalls, 1);
+            if (archive_pread(job->tar_fd, &header, HEADER_SIZE, job->offsets[i]) == HEADER_SIZE) {STATS_ADD(bytes_read, HEADER_SIZE); ret = check_header(&header);}
+            if (ret == 0) continue;
+
+            pthread_mutex_lock(&job->lock);
+            if (i < job->first_error) {job->error = ret; __atomic_store_n(&job->first_error, i, __ATOMIC_RELAXED);}
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
 
-    while (read(tar_fd, &header, HEADER_SIZE) > 0 && header.name[0] != '\0')
-    { 
-        // Vérifie la valeur "magic" et "version"
-        if (strncmp(header.magic, TMAGIC, TMAGLEN) != 0)      {ret = -1; break;}
-        if (strncmp(header.version, TVERSION, TVERSLEN) != 0) {ret = -2; break;}
+    return NULL;
+}
 
-        // Calcule le checksum
-        long int header_chksum = TAR_INT(header.chksum);
-        memset(header.chksum, ' ', 8);
 
-        long int chksum_calculated = 0;
-        uint8_t *current_byte = (uint8_t *) &header;
+static int check_headers(int tar_fd, int no_threads)
+{
+    block_reader_t reader;
+    const tar_header_t *header;
+    check_job_t job = {.tar_fd = tar_fd, .no_headers = 0, .next_header = 0, .first_error = SIZE_MAX, .error = 0};
 
-        for (int i = 0; i < HEADER_SIZE; i++) chksum_calculated += *(current_byte + i);
+    // Premier passage : ne fait que trouver les headers
+    size_t cap_offsets = 1024;
+    job.offsets = (off_t *) malloc(cap_offsets * sizeof(off_t));
+    if (job.offsets == NULL) return -3;
+    if (reader_init(&reader, tar_fd) != 0) {free(job.offsets); return -3;}
 
-        // Vérifie le checksum
-        if (header_chksum != chksum_calculated) {ret = -3; break;}
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
+    {
+        if (job.no_headers == cap_offsets)
+        {
+            cap_offsets *= 2;
+            off_t *new_offsets = (off_t *) realloc(job.offsets, cap_offsets * sizeof(off_t));
+            if (new_offsets == NULL) {free(job.offsets); reader_free(&reader); return -3;}
+            job.offsets = new_offsets;
+        }
+        job.offsets[job.no_headers++] = reader_tell(&reader) - HEADER_SIZE;
 
-        skip_file_content(tar_fd, header);
-        nber_valid_headers++;
+        skip_file_content(&reader, header);
     }
 
-    lseek(tar_fd, 0, SEEK_SET);
-    return (ret == 0) ? nber_valid_headers : ret;
+    reader_free(&reader);
+
+    // Second passage : valide les headers en parallèle
+    // With one thread per CPU, each thread gets at least CHECK_MIN_HEADERS_PER_THREAD headers
+    size_t max_useful = (no_threads <= 0) ? job.no_headers / CHECK_MIN_HEADERS_PER_THREAD : job.no_headers;
+    pthread_mutex_init(&job.lock, NULL);
+    run_workers(check_worker, &job, no_threads, max_useful);
+    pthread_mutex_destroy(&job.lock);
+    free(job.offsets);
+    return (job.first_error == SIZE_MAX) ? (int) job.no_headers : job.error;
 }
 
 
-int exists(int tar_fd, char *path)
+int check_archive_mt(int tar_fd, int no_threads) { return STATS_CALL(TAR_API_CHECK_ARCHIVE, check_headers(tar_fd, no_threads)); }
+
+
+int check_archive(int tar_fd) { return check_archive_mt(tar_fd, 0); }
+
+
+static int find_header(int tar_fd, char *path)
 {
-    tar_header_t header;
+    block_reader_t reader;
+    const tar_header_t *header;
+    char name[TAR_PATH_MAX];
     int ret = 0;
 
-    lseek(tar_fd, 0, SEEK_SET);
+    if (reader_init(&reader, tar_fd) != 0) return 0;
 
-    while (read(tar_fd, &header, HEADER_SIZE) > 0 && header.name[0] != '\0')
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
     {
-        if (strcmp(header.name, path) == 0) {ret = 1; break;}
-        skip_file_content(tar_fd, header);
+        header_path(header, name);
+        // Shadowing members have the same path: the first match answers
+        if (strcmp(name, path) == 0) {ret = 1; break;}
+        skip_file_content(&reader, header);
     }
 
-    lseek(tar_fd, 0, SEEK_SET);
+    reader_free(&reader);
     return ret;
 }
 
 
-int is_dir(int tar_fd, char *path) { return is_x(tar_fd, path, "dir"); }
+int exists(int tar_fd, char *path) { return STATS_CALL(TAR_API_EXISTS, find_header(tar_fd, path)); }
+
+
+int is_dir(int tar_fd, char *path) { return STATS_CALL(TAR_API_IS_DIR, is_x(tar_fd, path, "dir")); }
 
 
-int is_file(int tar_fd, char *path) { return is_x(tar_fd, path, "file"); }
+int is_file(int tar_fd, char *path) { return STATS_CALL(TAR_API_IS_FILE, is_x(tar_fd, path, "file")); }
 
 
-int is_symlink(int tar_fd, char *path) { return is_x(tar_fd, path, "symlink"); }
+int is_symlink(int tar_fd, char *path) { return STATS_CALL(TAR_API_IS_SYMLINK, is_x(tar_fd, path, "symlink")); }
 
 
-int list(int tar_fd, char *path, char **entries, size_t *no_entries)
+static int list_hops(int tar_fd, char *path, char **entries, size_t *no_entries, int hops)
 {
-    tar_header_t header;
+    block_reader_t reader;
+    const tar_header_t *header;
+    tar_header_t dir_header;
+    char name[TAR_PATH_MAX];
+    char dir_name[TAR_PATH_MAX];
     size_t listed_entries = 0;
     int dir_founded = 0;
 
-    lseek(tar_fd, 0, SEEK_SET);
+    if (reader_init(&reader, tar_fd) != 0) {*no_entries = 0; return 0;}
 
-    while (read(tar_fd, &header, HEADER_SIZE) > 0 && header.name[0] != '\0')
+    // The entries of a directory may be stored anywhere in the archive, even before the directory itself
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
     {
-        skip_file_content(tar_fd, header);
-
-        // Continue the loop until we find the path
-        if (strcmp(header.name, path) != 0) continue;
+        skip_file_content(&reader, header);
+        header_path(header, name);
 
-
-        if (header.typeflag == REGTYPE || header.typeflag == AREGTYPE) break;
-        else if (header.typeflag == SYMTYPE || header.typeflag == LNKTYPE)
+        if (strcmp(name, path) == 0)
         {
-            char *parsed_name = parse_symlink(header.name, header.linkname);
-            if (is_symlink(tar_fd, parsed_name) == 0) strcat(parsed_name, "/");
-            int result =  list(tar_fd, parsed_name, entries, no_entries);
-            free(parsed_name);
-            return result;
+            dir_founded = 1;
+            dir_header = *header;
+            strcpy(dir_name, name);
         }
-        else if (header.typeflag == DIRTYPE)
+        else if (listed_entries < *no_entries && is_direct_child(path, name) == 1)
         {
-            dir_founded = 1;
-            char *name_dir = (char *) malloc(100 * sizeof(char));
-            memcpy(name_dir, header.name, 100 * sizeof(char));
-
-            if (read(tar_fd, &header, HEADER_SIZE) <= 0 || header.name[0] == '\0') {free(name_dir); break;}
-
-            while (check_if_entry_folder(name_dir, header.name) == 1)
-            {
-                if (*no_entries <= listed_entries) break;
-                memcpy(entries[listed_entries], header.name, 100 * sizeof(char));
-                listed_entries++;
-
-                // Skip the subdirectory
-                if (header.typeflag == DIRTYPE) skip_dir(tar_fd, &header);
-                else
-                {
-                    skip_file_content(tar_fd, header);
-                    if (read(tar_fd, &header, HEADER_SIZE) <= 0 || header.name[0] == '\0') break;
-                }
-            }
-
-            free(name_dir);
-            break;
+            // A member shadowing an earlier one is listed once
+            size_t i = 0;
+            while (i < listed_entries && strcmp(entries[i], name) != 0) i++;
+            if (i == listed_entries) strcpy(entries[listed_entries++], name);
         }
     }
 
+    reader_free(&reader);
+
+    if (dir_founded == 1 && (dir_header.typeflag == SYMTYPE || dir_header.typeflag == LNKTYPE))
+    {
+        char target[TAR_PATH_MAX];
+        if (hops >= MAX_SYMLINK_HOPS || link_target(dir_name, dir_header.linkname, dir_header.typeflag, target, sizeof(target) - 1) != 0) {*no_entries = 0; return 0;}
+
+        // A link to a directory may omit the trailing '/' of the directory's name
+        size_t target_len = strlen(target);
+        if (target_len > 0 && target[target_len - 1] != '/' && is_symlink(tar_fd, target) == 0) strcat(target, "/");
+        STATS_ADD(symlink_hops, 1);
+        return list_hops(tar_fd, target, entries, no_entries, hops + 1);
+    }
+
+    if (dir_founded == 0 || dir_header.typeflag != DIRTYPE) {*no_entries = 0; return 0;}
+
     *no_entries = listed_entries;
-    if (dir_founded == 1 && listed_entries == 0) return 1;
-    return (listed_entries > 0) ? 1 : 0;
+    return 1;
 }
 
 
-ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len)
+int list(int tar_fd, char *path, char **entries, size_t *no_entries) { return STATS_CALL(TAR_API_LIST, list_hops(tar_fd, path, entries, no_entries, 0)); }
+
+
+static ssize_t read_file_hops(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len, int hops)
 {
-    tar_header_t header;
+    block_reader_t reader;
+    const tar_header_t *header;
+    tar_header_t found_header;
+    char target[TAR_PATH_MAX];
+    char name[TAR_PATH_MAX];
+    off_t data_offset = 0;
+    int found = 0;
     size_t dest_len = *len;
-    if ((int) offset < 0) {*len = 0; return -2;}
-    int ret = -1;
+    *len = 0;
+    if ((int) offset < 0) return -2;
 
-    lseek(tar_fd, 0, SEEK_SET);
+    if (reader_init(&reader, tar_fd) != 0) return -1;
 
-    while (read(tar_fd, &header, HEADER_SIZE) > 0 && header.name[0] != '\0')
+    // Later members shadow earlier ones with the same path: the last match is read
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
     {
-        if (strcmp(header.name, path) == 0)
+        header_path(header, name);
+        if (strcmp(name, path) == 0)
         {
-            if (header.typeflag == SYMTYPE || header.typeflag == LNKTYPE) return read_file(tar_fd, header.linkname, offset, dest, len);
-            if (header.typeflag == AREGTYPE || header.typeflag == REGTYPE)
-            {
-                size_t total_len = TAR_INT(header.size) - offset;
-                if (total_len <= 0) {ret = -2; break;}
-
-                lseek(tar_fd, offset, SEEK_CUR);
-
-                size_t used_len = (total_len > dest_len) ? dest_len : total_len;
-                if (read(tar_fd, dest, used_len) <= 0) break;
-                *len = used_len;
-                ret = total_len - used_len;
-                break;
-            }
+            found = 1;
+            found_header = *header;
+            data_offset = reader_tell(&reader);
         }
-        skip_file_content(tar_fd, header);
+        skip_file_content(&reader, header);
     }
-    
-    if (ret < 0) *len = 0;
-    lseek(tar_fd, 0, SEEK_SET);
-    return ret;
-}
\ No newline at end of file
+    reader_free(&reader);
+    if (found == 0) return -1;
+
+    if (found_header.typeflag == SYMTYPE || found_header.typeflag == LNKTYPE)
+    {
+        if (hops >= MAX_SYMLINK_HOPS || link_target(path, found_header.linkname, found_header.typeflag, target, sizeof(target)) != 0) return -1;
+        STATS_ADD(symlink_hops, 1);
+        *len = dest_len;
+        return read_file_hops(tar_fd, target, offset, dest, len, hops + 1);
+    }
+    if (found_header.typeflag != AREGTYPE && found_header.typeflag != REGTYPE) return -1;
+
+    size_t size = TAR_INT(found_header.size);
+    if (offset >= size) return -2;
+    size_t total_len = size - offset;
+    size_t used_len = (total_len > dest_len) ? dest_len : total_len;
+    if (used_len == 0) return -1;
+
+    size_t done = 0;
+    while (done < used_len)
+    {
+        ssize_t nber_read = archive_pread(tar_fd, dest + done, used_len - done, data_offset + offset + done);
+        STATS_ADD(no_syscalls, 1);
+        if (nber_read <= 0) return -1;
+        STATS_ADD(bytes_read, nber_read);
+        done += nber_read;
+    }
+    *len = used_len;
+    return total_len - used_len;
+}
+
+
+ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) { return STATS_CALL(TAR_API_READ_FILE, read_file_hops(tar_fd, path, offset, dest, len, 0)); }
+
+
+static ssize_t lookup_batch(int tar_fd, char **paths, size_t n, tar_lookup_result_t *results)
+{
+    block_reader_t reader;
+    const tar_header_t *header;
+    char name[TAR_PATH_MAX];
+
+    // Open-addressing table of the first query of each path, the others are chained by 'same_path'
+    size_t no_slots = 16;
+    while (no_slots < 2 * n) no_slots *= 2;
+    size_t mask = no_slots - 1;
+    size_t *slots = (size_t *) malloc(no_slots * sizeof(size_t));
+    size_t *same_path = (size_t *) malloc((n > 0 ? n : 1) * sizeof(size_t));
+    if (slots == NULL || same_path == NULL || reader_init(&reader, tar_fd) != 0) {free(slots); free(same_path); return -1;}
+    memset(slots, 0xff, no_slots * sizeof(size_t));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        memset(&results[i], 0, sizeof(tar_lookup_result_t));
+        same_path[i] = SIZE_MAX;
+
+        size_t slot = hash_path(paths[i]) & mask;
+        while (slots[slot] != SIZE_MAX && strcmp(paths[slots[slot]], paths[i]) != 0) slot = (slot + 1) & mask;
+
+        if (slots[slot] == SIZE_MAX) slots[slot] = i;
+        else
+        {
+            same_path[i] = same_path[slots[slot]];
+            same_path[slots[slot]] = i;
+        }
+    }
+
+    while ((header = reader_next_header(&reader)) != NULL && header->name[0] != '\0')
+    {
+        header_path(header, name);
+        size_t slot = hash_path(name) & mask;
+        while (slots[slot] != SIZE_MAX && strcmp(paths[slots[slot]], name) != 0) slot = (slot + 1) & mask;
+
+        for (size_t i = slots[slot]; i != SIZE_MAX; i = same_path[i])
+        {
+            results[i].found = 1;
+            results[i].typeflag = header->typeflag;
+            results[i].size = TAR_INT(header->size);
+            results[i].data_offset = reader_tell(&reader);
+        }
+
+        skip_file_content(&reader, header);
+    }
+
+    reader_free(&reader);
+    free(slots);
+    free(same_path);
+
+    ssize_t no_found = 0;
+    for (size_t i = 0; i < n; i++) no_found += results[i].found;
+    return no_found;
+}
+
+
+ssize_t tar_lookup_batch(int tar_fd, char **paths, size_t n, tar_lookup_result_t *results) { return STATS_CALL(TAR_API_LOOKUP_BATCH, lookup_batch(tar_fd, paths, n, results)); }
@@ -0,0 +1,229 @@
+#include "../headers/overlay.h"
+
+// Name of the last component of a path, trailing '/' included
+static const char *base_name(const char *path)
+{
+    size_t len = strlen(path);
+    if (len > 0 && path[len - 1] == '/') len--;
+    while (len > 0 && path[len - 1] != '/') len--;
+    return path + len;
+}
+
+
+// Adds a path to the set of paths hidden from the lower layers. Paths without a trailing '/'
+// hide the entry of that name, paths ending with '/' hide everything under that directory.
+static int hide(tar_index_t *hidden, const char *path, size_t len)
+{
+    tar_header_t header;
+    char key[TAR_PATH_MAX + 1];
+    memcpy(key, path, len);
+    key[len] = '\0';
+    // A path that does not fit in a header cannot be the path, or the directory, of any entry of the layers
+    if (tar_fill_header(&header, key, REGTYPE, 0, 0, 0, NULL) != 0) return 0;
+    return (index_insert(hidden, &header, 0) == NULL) ? -1 : 0;
+}
+
+
+static int is_hidden(const tar_index_t *hidden, const char *path)
+{
+    if (hidden->no_entries == 0) return 0;
+
+    char key[TAR_PATH_MAX];
+    size_t len = strlen(path);
+    if (len > 0 && path[len - 1] == '/') len--;
+    memcpy(key, path, len);
+    key[len] = '\0';
+    if (index_find(hidden, key) != NULL) return 1;
+
+    // Directories deleted or made opaque above hide their whole subtree
+    for (size_t i = 0; i < len; i++)
+    {
+        if (key[i] != '/') continue;
+        char next = key[i + 1];
+        key[i + 1] = '\0';
+        int found = (index_find(hidden, key) != NULL);
+        key[i + 1] = next;
+        if (found) return 1;
+    }
+    return 0;
+}
+
+
+static int add_to_view(tar_overlay_t *overlay, const tar_index_t *layer, const tar_entry_t *entry, const char *path, size_t layer_id)
+{
+    tar_header_t header;
+    tar_index_t *view = &overlay->view->index;
+    char typeflag = index_type(layer, entry);
+    const char *linkname = index_linkname(layer, entry);
+
+    if (tar_fill_header(&header, path, typeflag, index_size(layer, entry), index_mode(layer, entry), 0, (linkname[0] == '\0') ? NULL : linkname) != 0) return -1;
+    tar_entry_t *added = index_insert(view, &header, index_offset(layer, entry));
+    if (added == NULL) return -1;
+
+    size_t id = added - view->entries;
+    if (id >= overlay->cap_layers)
+    {
+        size_t cap = (overlay->cap_layers == 0) ? 64 : 2 * overlay->cap_layers;
+        uint8_t *layers = (uint8_t *) realloc(overlay->layers, cap);
+        if (layers == NULL) return -1;
+        overlay->layers = layers;
+        overlay->cap_layers = cap;
+    }
+    overlay->layers[id] = (uint8_t) layer_id;
+    return 0;
+}
+
+
+// Hides from the layers below what a layer deletes or replaces
+static int hide_layer(tar_index_t *hidden, const tar_index_t *layer, int *opaque_root)
+{
+    char path[TAR_PATH_MAX + 1];
+    size_t whiteout_len = strlen(WHITEOUT_PREFIX);
+
+    for (size_t i = 0; i < layer->no_entries; i++)
+    {
+        const tar_entry_t *entry = &layer->entries[i];
+        size_t len = index_path(layer, entry, path, TAR_PATH_MAX);
+        if (len > 0 && path[len - 1] == '/') len--;
+        path[len] = '\0';
+        size_t dir_len = base_name(path) - path;
+        int ret;
+
+        if (strcmp(path + dir_len, WHITEOUT_OPAQUE) == 0)
+        {
+            if (dir_len == 0) *opaque_root = 1;
+            ret = (dir_len == 0) ? 0 : hide(hidden, path, dir_len);
+        }
+        else if (strncmp(path + dir_len, WHITEOUT_PREFIX, whiteout_len) == 0)
+        {
+            if (len == dir_len + whiteout_len) continue;
+            // The deleted entry, and its contents if it is a directory
+            memmove(path + dir_len, path + dir_len + whiteout_len, len - dir_len - whiteout_len + 1);
+            len -= whiteout_len;
+            path[len] = '/';
+            ret = hide(hidden, path, len);
+            if (ret == 0) ret = hide(hidden, path, len + 1);
+        }
+        else
+        {
+            // A directory is merged with the lower ones, anything else replaces their subtree
+            path[len] = '/';
+            ret = hide(hidden, path, len);
+            if (ret == 0 && index_type(layer, entry) != DIRTYPE) ret = hide(hidden, path, len + 1);
+        }
+        if (ret != 0) return -1;
+    }
+    return 0;
+}
+
+
+// Adds the entries of the layers to the view, from the upper one down, each layer hiding entries from the next ones
+static int merge_layers(tar_overlay_t *overlay, tar_index_t *hidden)
+{
+    char path[TAR_PATH_MAX];
+    int opaque_root = 0;
+
+    for (size_t layer_id = overlay->no_layers; layer_id-- > 0 && opaque_root == 0;)
+    {
+        tar_handle_t *layer = tar_open(overlay->layer_fds[layer_id]);
+        if (layer == NULL) return -1;
+        tar_index_t *index = &layer->index;
+
+        int ret = 0;
+        for (size_t i = 0; i < index->no_entries && ret == 0; i++)
+        {
+            const tar_entry_t *entry = &index->entries[i];
+            index_path(index, entry, path, sizeof(path));
+            if (strncmp(base_name(path), WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX)) == 0 || is_hidden(hidden, path)) continue;
+            ret = add_to_view(overlay, index, entry, path, layer_id);
+        }
+        // The whiteouts of a layer only apply to the layers below it
+        if (ret == 0 && layer_id > 0) ret = hide_layer(hidden, index, &opaque_root);
+        tar_close(layer);
+        if (ret != 0) return -1;
+    }
+    return 0;
+}
+
+
+tar_overlay_t *tar_overlay_open(const int *tar_fds, size_t no_layers)
+{
+    if (no_layers > OVERLAY_MAX_LAYERS) return NULL;
+    tar_overlay_t *overlay = (tar_overlay_t *) calloc(1, sizeof(tar_overlay_t));
+    if (overlay == NULL) return NULL;
+
+    overlay->no_layers = no_layers;
+    overlay->layer_fds = (int *) malloc((no_layers + 1) * sizeof(int));
+    overlay->view = (tar_handle_t *) malloc(sizeof(tar_handle_t));
+    if (overlay->layer_fds == NULL || overlay->view == NULL) {free(overlay->view); overlay->view = NULL; tar_overlay_close(overlay); return NULL;}
+    memcpy(overlay->layer_fds, tar_fds, no_layers * sizeof(int));
+
+    // The view is a handle on no archive in particular
+    overlay->view->tar_fd = -1;
+    overlay->view->map = NULL;
+    overlay->view->map_len = 0;
+    if (index_init(&overlay->view->index) != 0) {free(overlay->view); overlay->view = NULL; tar_overlay_close(overlay); return NULL;}
+
+    tar_index_t hidden;
+    if (index_init(&hidden) != 0) {tar_overlay_close(overlay); return NULL;}
+    int ret = merge_layers(overlay, &hidden);
+    index_free(&hidden);
+    if (ret != 0) {tar_overlay_close(overlay); return NULL;}
+
+    index_build_tree(&overlay->view->index);
+    return overlay;
+}
+
+
+void tar_overlay_close(tar_overlay_t *overlay)
+{
+    if (overlay == NULL) return;
+    tar_close(overlay->view);
+    free(overlay->layers);
+    free(overlay->layer_fds);
+    free(overlay);
+}
+
+
+int tar_overlay_layer(tar_overlay_t *overlay, char *path)
+{
+    tar_index_t *index = &overlay->view->index;
+    tar_entry_t *entry = index_find(index, path);
+    return (entry == NULL) ? -1 : overlay->layers[entry - index->entries];
+}
+
+
+int tar_overlay_exists(tar_overlay_t *overlay, char *path) { return tar_exists(overlay->view, path); }
+
+
+int tar_overlay_is_dir(tar_overlay_t *overlay, char *path) { return tar_is_dir(overlay->view, path); }
+
+
+int tar_overlay_is_file(tar_overlay_t *overlay, char *path) { return tar_is_file(overlay->view, path); }
+
+
+int tar_overlay_is_symlink(tar_overlay_t *overlay, char *path) { return tar_is_symlink(overlay->view, path); }
+
+
+int tar_overlay_list(tar_overlay_t *overlay, char *path, char **entries, size_t *no_entries) { return tar_list(overlay->view, path, entries, no_entries); }
+
+
+ssize_t tar_overlay_read_file(tar_overlay_t *overlay, char *path, size_t offset, uint8_t *dest, size_t *len)
+{
+    tar_index_t *index = &overlay->view->index;
+    tar_entry_t *entry = tar_resolve(overlay->view, path);
+    size_t dest_len = *len;
+    *len = 0;
+
+    if (entry == NULL || (index_type(index, entry) != REGTYPE && index_type(index, entry) != AREGTYPE)) return -1;
+    size_t size = index_size(index, entry);
+    if ((ssize_t) offset < 0 || offset >= size) return -2;
+
+    size_t used_len = (size - offset > dest_len) ? dest_len : size - offset;
+    int tar_fd = overlay->layer_fds[overlay->layers[entry - index->entries]];
+    ssize_t nber_read = archive_pread(tar_fd, dest, used_len, index_offset(index, entry) + HEADER_SIZE + offset);
+    if (nber_read <= 0) return -1;
+
+    *len = nber_read;
+    return size - offset - nber_read;
+}
@@ -0,0 +1,97 @@
+#include "../headers/protocol.h"
+
+int protocol_send(int sock_fd, const void *buffer, size_t len, int pass_fd)
+{
+    const uint8_t *bytes = (const uint8_t *) buffer;
+    union {struct cmsghdr header; char space[CMSG_SPACE(sizeof(int))];} control;
+
+    while (len > 0)
+    {
+        struct iovec iov = {.iov_base = (void *) bytes, .iov_len = len};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        // The descriptor goes with the first bytes sent only
+        if (pass_fd != -1)
+        {
+            memset(&control, 0, sizeof(control));
+            msg.msg_control = control.space;
+            msg.msg_controllen = sizeof(control.space);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+        }
+
+        ssize_t nber_sent = sendmsg(sock_fd, &msg, MSG_NOSIGNAL);
+        if (nber_sent < 0 && errno == EINTR) continue;
+        if (nber_sent <= 0) return -1;
+        bytes += nber_sent;
+        len -= nber_sent;
+        pass_fd = -1;
+    }
+    return 0;
+}
+
+
+ssize_t protocol_send_some(int sock_fd, const void *buffer, size_t len)
+{
+    while (1)
+    {
+        ssize_t nber_sent = send(sock_fd, buffer, len, MSG_NOSIGNAL);
+        if (nber_sent >= 0) return nber_sent;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno != EINTR) return -1;
+    }
+}
+
+
+ssize_t protocol_recv_some(int sock_fd, void *buffer, size_t len, int *received_fd)
+{
+    union {struct cmsghdr header; char space[CMSG_SPACE(sizeof(int))];} control;
+    struct iovec iov = {.iov_base = buffer, .iov_len = len};
+    struct msghdr msg;
+    ssize_t nber_received;
+
+    do
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof(control.space);
+        nber_received = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (nber_received < 0 && errno == EINTR);
+
+    if (nber_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (nber_received <= 0) return -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        if (received_fd != NULL && *received_fd == -1) *received_fd = fd;
+        else close(fd);
+    }
+    return nber_received;
+}
+
+
+int protocol_recv(int sock_fd, void *buffer, size_t len, int *received_fd)
+{
+    uint8_t *bytes = (uint8_t *) buffer;
+    if (received_fd != NULL) *received_fd = -1;
+
+    while (len > 0)
+    {
+        ssize_t nber_received = protocol_recv_some(sock_fd, bytes, len, received_fd);
+        if (nber_received <= 0) return -1;
+        bytes += nber_received;
+        len -= nber_received;
+    }
+    return 0;
+}
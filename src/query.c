@@ -0,0 +1,238 @@
+#include "../headers/query.h"
+
+typedef enum
+{
+    TOKEN_CHAR,                   /* a literal character */
+    TOKEN_ANY,                    /* '?' */
+    TOKEN_STAR,                   /* '*' */
+    TOKEN_GLOBSTAR,               /* '**' */
+    TOKEN_DIRS                    /* '**' followed by '/', at the start of a component */
+} token_kind_t;
+
+typedef struct pattern_token
+{
+    uint8_t kind;
+    char c;
+} pattern_token_t;
+
+typedef struct compiled_pattern
+{
+    char literal[TAR_PATTERN_MAX + 1];    /* part before the first wildcard, searched in the sorted paths */
+    size_t literal_len;
+    pattern_token_t tokens[TAR_PATTERN_MAX];  /* rest of the pattern */
+    size_t no_tokens;
+    int dirs_only;                /* the pattern ends with '/' */
+    int is_prefix;                /* every path starting with the literal part matches */
+} compiled_pattern_t;
+
+
+static int compile_glob(const char *glob, compiled_pattern_t *pattern)
+{
+    size_t len = strlen(glob);
+    if (len > TAR_PATTERN_MAX) return -1;
+    pattern->literal_len = pattern->no_tokens = 0;
+    pattern->dirs_only = (len > 0 && glob[len - 1] == '/');
+    pattern->is_prefix = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        pattern_token_t token = {.kind = TOKEN_CHAR, .c = glob[i]};
+        if (glob[i] == '\\' && i + 1 < len) token.c = glob[++i];
+        else if (glob[i] == '?') token.kind = TOKEN_ANY;
+        else if (glob[i] == '*' && glob[i + 1] != '*') token.kind = TOKEN_STAR;
+        else if (glob[i] == '*')
+        {
+            int component_start = (i == 0 || glob[i - 1] == '/');
+            while (glob[i + 1] == '*') i++;
+            token.kind = TOKEN_GLOBSTAR;
+            if (component_start && glob[i + 1] == '/') {token.kind = TOKEN_DIRS; i++;}
+        }
+
+        if (token.kind == TOKEN_CHAR && pattern->no_tokens == 0) pattern->literal[pattern->literal_len++] = token.c;
+        else pattern->tokens[pattern->no_tokens++] = token;
+    }
+    pattern->literal[pattern->literal_len] = '\0';
+    return 0;
+}
+
+
+// Whether the tokens match the 'len' bytes of 'str'. The positions of 'str' reachable
+// after each token are computed in one pass, so no pattern backtracks.
+static int match_tokens(const compiled_pattern_t *pattern, const char *str, size_t len)
+{
+    uint8_t states[2][TAR_PATH_MAX + 1];
+    uint8_t *current = states[0];
+    uint8_t *next = states[1];
+    if (len > TAR_PATH_MAX) return 0;
+    memset(current, 0, len + 1);
+    current[0] = 1;
+
+    for (size_t t = 0; t < pattern->no_tokens; t++)
+    {
+        const pattern_token_t *token = &pattern->tokens[t];
+        uint8_t reach = 0;
+        uint8_t any = 0;
+        next[0] = 0;
+
+        switch (token->kind)
+        {
+            case TOKEN_CHAR:
+                for (size_t j = 0; j < len; j++) any |= next[j + 1] = current[j] & (str[j] == token->c);
+                break;
+            case TOKEN_ANY:
+                for (size_t j = 0; j < len; j++) any |= next[j + 1] = current[j] & (str[j] != '/');
+                break;
+            case TOKEN_STAR:
+                for (size_t j = 0; j <= len; j++)
+                {
+                    reach |= current[j];
+                    any |= next[j] = reach;
+                    if (j < len && str[j] == '/') reach = 0;
+                }
+                break;
+            case TOKEN_GLOBSTAR:
+                for (size_t j = 0; j <= len; j++) any |= next[j] = (reach |= current[j]);
+                break;
+            case TOKEN_DIRS:
+                // Nothing, or anything ending with '/'
+                for (size_t j = 0; j <= len; j++)
+                {
+                    any |= next[j] = current[j] | (j > 0 && str[j - 1] == '/' && reach);
+                    reach |= current[j];
+                }
+                break;
+        }
+
+        if (any == 0) return 0;
+        uint8_t *swap = current;
+        current = next;
+        next = swap;
+    }
+    return current[len];
+}
+
+
+static int path_matches(const compiled_pattern_t *pattern, const char *path)
+{
+    if (pattern->is_prefix) return 1;
+
+    size_t len = strlen(path);
+    // The trailing '/' of a directory is only matched by a pattern ending with '/'
+    if (len > 0 && path[len - 1] == '/' && pattern->dirs_only == 0) len--;
+    if (len < pattern->literal_len) return 0;
+    return match_tokens(pattern, path + pattern->literal_len, len - pattern->literal_len);
+}
+
+
+// Passes the matches from the position 'start' of the sorted table to 'callback', at most 'max_matches' of them.
+// 'end' is set to the position following the last match passed, TAR_QUERY_END if there is none left.
+static ssize_t run_query(tar_handle_t *handle, const compiled_pattern_t *pattern, size_t start, size_t max_matches,
+                         tar_match_fn callback, void *user_data, size_t *end)
+{
+    tar_index_t *index = &handle->index;
+    const uint32_t *sorted = index_sorted(index);
+    char path[TAR_PATH_MAX];
+    *end = TAR_QUERY_END;
+    if (sorted == NULL) return -1;
+
+    // First path not before the literal part: the paths starting with it follow
+    size_t low = 0;
+    size_t high = index->no_entries;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        index_path(index, &index->entries[sorted[middle]], path, sizeof(path));
+        if (strcmp(path, pattern->literal) < 0) low = middle + 1;
+        else high = middle;
+    }
+
+    ssize_t no_matches = 0;
+    for (size_t i = (start > low) ? start : low; i < index->no_entries; i++)
+    {
+        const tar_entry_t *entry = &index->entries[sorted[i]];
+        index_path(index, entry, path, sizeof(path));
+        if (strncmp(path, pattern->literal, pattern->literal_len) != 0) break;
+        if (path_matches(pattern, path) == 0) continue;
+
+        no_matches++;
+        if (callback(path, entry, user_data) != 0 || (size_t) no_matches == max_matches)
+        {
+            *end = i + 1;
+            break;
+        }
+    }
+    return no_matches;
+}
+
+
+typedef struct page
+{
+    char **entries;
+    size_t no_entries;
+} page_t;
+
+
+static int copy_to_page(const char *path, const tar_entry_t *entry, void *user_data)
+{
+    (void) entry;
+    page_t *page = (page_t *) user_data;
+    strcpy(page->entries[page->no_entries++], path);
+    return 0;
+}
+
+
+static ssize_t query_page(tar_handle_t *handle, const compiled_pattern_t *pattern, size_t *cursor, char **entries, size_t no_entries)
+{
+    if (*cursor == TAR_QUERY_END || no_entries == 0) return 0;
+    page_t page = {.entries = entries, .no_entries = 0};
+    ssize_t ret = run_query(handle, pattern, *cursor, no_entries, copy_to_page, &page, cursor);
+    return (ret < 0) ? -1 : (ssize_t) page.no_entries;
+}
+
+
+static int compile_prefix(const char *prefix, compiled_pattern_t *pattern)
+{
+    size_t len = strlen(prefix);
+    // Longer than any path: nothing matches
+    if (len > TAR_PATTERN_MAX) return -1;
+    memcpy(pattern->literal, prefix, len + 1);
+    pattern->literal_len = len;
+    pattern->no_tokens = 0;
+    pattern->dirs_only = 0;
+    pattern->is_prefix = 1;
+    return 0;
+}
+
+
+ssize_t tar_glob(tar_handle_t *handle, const char *glob, tar_match_fn callback, void *user_data)
+{
+    compiled_pattern_t pattern;
+    size_t end;
+    if (compile_glob(glob, &pattern) != 0) return -1;
+    return run_query(handle, &pattern, 0, SIZE_MAX, callback, user_data, &end);
+}
+
+
+ssize_t tar_glob_page(tar_handle_t *handle, const char *glob, size_t *cursor, char **entries, size_t no_entries)
+{
+    compiled_pattern_t pattern;
+    if (compile_glob(glob, &pattern) != 0) return -1;
+    return query_page(handle, &pattern, cursor, entries, no_entries);
+}
+
+
+ssize_t tar_prefix(tar_handle_t *handle, const char *prefix, tar_match_fn callback, void *user_data)
+{
+    compiled_pattern_t pattern;
+    size_t end;
+    if (compile_prefix(prefix, &pattern) != 0) return 0;
+    return run_query(handle, &pattern, 0, SIZE_MAX, callback, user_data, &end);
+}
+
+
+ssize_t tar_prefix_page(tar_handle_t *handle, const char *prefix, size_t *cursor, char **entries, size_t no_entries)
+{
+    compiled_pattern_t pattern;
+    if (compile_prefix(prefix, &pattern) != 0) {*cursor = TAR_QUERY_END; return 0;}
+    return query_page(handle, &pattern, cursor, entries, no_entries);
+}
@@ -0,0 +1,349 @@
+// pipe2(), accept4()
+#define _GNU_SOURCE
+
+#include "../headers/server.h"
+
+int tar_server_init(tar_server_t *server, const char *socket_path)
+{
+    memset(server, 0, sizeof(tar_server_t));
+    server->listen_fd = server->wake_fds[0] = server->wake_fds[1] = -1;
+    if (strlen(socket_path) >= sizeof(server->socket_path)) return -1;
+    strcpy(server->socket_path, socket_path);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd == -1 || pipe2(server->wake_fds, O_CLOEXEC | O_NONBLOCK) != 0) {tar_server_free(server); return -1;}
+    unlink(socket_path);
+    if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(server->listen_fd, 64) != 0)
+    {
+        // The socket of another server must not be removed
+        server->socket_path[0] = '\0';
+        tar_server_free(server);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int is_gzip(int tar_fd)
+{
+    uint8_t magic[2];
+    return pread(tar_fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+
+static void close_archive(server_archive_t *archive)
+{
+    tar_close(archive->handle);
+    if (archive->direct == 0) tar_gz_close(archive->tar_fd);
+    close(archive->tar_fd);
+    memset(archive, 0, sizeof(server_archive_t));
+}
+
+
+// Whether the archive was modified since it was indexed
+static int is_stale(const server_archive_t *archive, const struct stat *st)
+{
+    return archive->size != st->st_size || archive->mtime.tv_sec != st->st_mtim.tv_sec || archive->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+
+// Archive of the descriptor received, indexed if no client opened it before
+static server_archive_t *open_archive(tar_server_t *server, int tar_fd, int *shared)
+{
+    struct stat st;
+    if (fstat(tar_fd, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+
+    server_archive_t *slot = NULL;
+    server_archive_t *unused = NULL;
+    *shared = 1;
+    for (size_t i = 0; i < server->no_archives; i++)
+    {
+        server_archive_t *archive = &server->archives[i];
+        if (archive->handle != NULL && archive->dev == st.st_dev && archive->ino == st.st_ino)
+        {
+            if (!is_stale(archive, &st)) {archive->no_clients++; return archive;}
+            // An earlier version of the archive, closed once its clients are gone
+            if (archive->no_clients == 0) close_archive(archive);
+        }
+        if (archive->handle == NULL) {if (slot == NULL) slot = archive; continue;}
+        if (archive->no_clients == 0 && (unused == NULL || archive->last_used < unused->last_used)) unused = archive;
+    }
+
+    // A free slot, a new one, or the one of the archive unused for the longest time
+    *shared = 0;
+    if (slot == NULL && server->no_archives < SERVER_MAX_ARCHIVES) slot = &server->archives[server->no_archives];
+    if (slot == NULL && unused != NULL) {close_archive(unused); slot = unused;}
+    if (slot == NULL) return NULL;
+
+    int own_fd = fcntl(tar_fd, F_DUPFD_CLOEXEC, 0);
+    if (own_fd == -1) return NULL;
+    int direct = !is_gzip(own_fd);
+    if (direct == 0 && tar_gz_open(own_fd, 0) != 0) {close(own_fd); return NULL;}
+    tar_handle_t *handle = tar_open(own_fd);
+    if (handle == NULL)
+    {
+        if (direct == 0) tar_gz_close(own_fd);
+        close(own_fd);
+        return NULL;
+    }
+
+    *slot = (server_archive_t) {.tar_fd = own_fd, .dev = st.st_dev, .ino = st.st_ino, .size = st.st_size, .mtime = st.st_mtim,
+                                .direct = direct, .handle = handle, .no_clients = 1, .last_used = 0};
+    if (slot == &server->archives[server->no_archives]) server->no_archives++;
+    return slot;
+}
+
+
+// A client does not use its archive anymore, which is closed if it was modified since it was indexed
+static void release_archive(tar_server_t *server, server_archive_t *archive)
+{
+    struct stat st;
+    if (archive == NULL || --archive->no_clients > 0) return;
+    archive->last_used = ++server->clock;
+    if (fstat(archive->tar_fd, &st) != 0 || is_stale(archive, &st)) close_archive(archive);
+}
+
+
+// Keeps the reply and the bytes following it until the socket of the client takes them
+static int queue_reply(server_client_t *client, const reply_t *reply, const void *data, size_t len)
+{
+    client->out = (uint8_t *) malloc(sizeof(reply_t) + len);
+    if (client->out == NULL) return -1;
+    memcpy(client->out, reply, sizeof(reply_t));
+    if (len > 0) memcpy(client->out + sizeof(reply_t), data, len);
+    client->out_len = sizeof(reply_t) + len;
+    client->out_sent = 0;
+    return 0;
+}
+
+
+static int reply_list(server_client_t *client, char *path, size_t max_entries, reply_t *reply)
+{
+    if (max_entries > SERVER_LIST_MAX) max_entries = SERVER_LIST_MAX;
+    char *names = (char *) malloc((max_entries + 1) * TAR_PATH_MAX);
+    char **entries = (char **) malloc((max_entries + 1) * sizeof(char *));
+    if (names == NULL || entries == NULL) {free(names); free(entries); return -1;}
+    for (size_t i = 0; i < max_entries; i++) entries[i] = names + i * TAR_PATH_MAX;
+
+    size_t no_entries = max_entries;
+    reply->ret = tar_list(client->archive->handle, path, entries, &no_entries);
+    reply->count = no_entries;
+
+    // The names are packed one after the other
+    size_t len = 0;
+    for (size_t i = 0; i < no_entries; i++)
+    {
+        size_t name_len = strlen(entries[i]) + 1;
+        memmove(names + len, entries[i], name_len);
+        len += name_len;
+    }
+    reply->len = len;
+
+    int ret = queue_reply(client, reply, names, len);
+    free(names);
+    free(entries);
+    return ret;
+}
+
+
+static int reply_read(server_client_t *client, char *path, uint64_t offset, uint64_t len, reply_t *reply)
+{
+    tar_handle_t *handle = client->archive->handle;
+
+    if (client->archive->direct)
+    {
+        // The client reads the content from its own descriptor
+        tar_entry_t *entry = tar_resolve(handle, path);
+        tar_index_t *index = &handle->index;
+        size_t size = (entry == NULL) ? 0 : index_size(index, entry);
+        if (entry == NULL || (index_type(index, entry) != REGTYPE && index_type(index, entry) != AREGTYPE)) reply->ret = -1;
+        else if ((int64_t) offset < 0 || offset >= size) reply->ret = -2;
+        else
+        {
+            reply->len = (size - offset < len) ? size - offset : len;
+            reply->data_offset = index_offset(index, entry) + HEADER_SIZE + offset;
+            reply->ret = (reply->len == 0) ? -1 : (int64_t) (size - offset - reply->len);
+        }
+        return queue_reply(client, reply, NULL, 0);
+    }
+
+    size_t inline_len = (len < PROTOCOL_INLINE_MAX) ? len : PROTOCOL_INLINE_MAX;
+    uint8_t *buffer = (uint8_t *) malloc(inline_len + 1);
+    if (buffer == NULL) return -1;
+    reply->ret = tar_read_file(handle, path, offset, buffer, &inline_len);
+    reply->len = inline_len;
+    reply->flags = REPLY_INLINE;
+
+    int ret = queue_reply(client, reply, buffer, inline_len);
+    free(buffer);
+    return ret;
+}
+
+
+// Answers the request received by the client, returns -1 if the client must be disconnected
+static int serve_request(tar_server_t *server, server_client_t *client)
+{
+    request_t request;
+    reply_t reply;
+    char path[PROTOCOL_PATH_MAX + 1];
+    int received_fd = client->in_fd;
+    client->in_fd = -1;
+
+    memcpy(&request, client->in, sizeof(request_t));
+    memcpy(path, client->in + sizeof(request_t), request.path_len);
+    path[request.path_len] = '\0';
+    memset(&reply, 0, sizeof(reply_t));
+
+    if (request.op == OP_OPEN)
+    {
+        int shared = 0;
+        server_archive_t *archive = (received_fd == -1 || client->archive != NULL) ? NULL : open_archive(server, received_fd, &shared);
+        if (received_fd != -1) close(received_fd);
+        if (archive != NULL) client->archive = archive;
+        reply.ret = (archive == NULL) ? -1 : 0;
+        reply.count = shared;
+        reply.flags = (archive != NULL && archive->direct == 0) ? REPLY_INLINE : 0;
+        return queue_reply(client, &reply, NULL, 0);
+    }
+    if (received_fd != -1) close(received_fd);
+    if (client->archive == NULL) return -1;
+
+    tar_handle_t *handle = client->archive->handle;
+    switch (request.op)
+    {
+        case OP_EXISTS:     reply.ret = tar_exists(handle, path); break;
+        case OP_IS_DIR:     reply.ret = tar_is_dir(handle, path); break;
+        case OP_IS_FILE:    reply.ret = tar_is_file(handle, path); break;
+        case OP_IS_SYMLINK: reply.ret = tar_is_symlink(handle, path); break;
+        case OP_LIST:       return reply_list(client, path, request.len, &reply);
+        case OP_READ_FILE:  return reply_read(client, path, request.offset, request.len, &reply);
+        default:            return -1;
+    }
+    return queue_reply(client, &reply, NULL, 0);
+}
+
+
+// Receives what the client sent, up to the end of its request which is then answered. Returns -1 if the client must be disconnected.
+static int receive_request(tar_server_t *server, server_client_t *client)
+{
+    while (client->out == NULL)
+    {
+        // The header of the request, then the path whose length it gives
+        size_t expected = sizeof(request_t);
+        if (client->in_len >= sizeof(request_t))
+        {
+            const request_t *request = (const request_t *) client->in;
+            if (request->version != PROTOCOL_VERSION || request->path_len > PROTOCOL_PATH_MAX) return -1;
+            expected += request->path_len;
+        }
+
+        if (client->in_len < expected)
+        {
+            ssize_t nber_received = protocol_recv_some(client->sock_fd, client->in + client->in_len, expected - client->in_len, &client->in_fd);
+            if (nber_received <= 0) return (int) nber_received;
+            client->in_len += nber_received;
+        }
+        else
+        {
+            client->in_len = 0;
+            if (serve_request(server, client) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Sends what the socket of the client takes of its reply. Returns -1 if the client must be disconnected.
+static int send_reply(server_client_t *client)
+{
+    while (client->out != NULL)
+    {
+        ssize_t nber_sent = protocol_send_some(client->sock_fd, client->out + client->out_sent, client->out_len - client->out_sent);
+        if (nber_sent <= 0) return (int) nber_sent;
+        client->out_sent += nber_sent;
+        if (client->out_sent == client->out_len) {free(client->out); client->out = NULL;}
+    }
+    return 0;
+}
+
+
+static void drop_client(tar_server_t *server, server_client_t *client)
+{
+    release_archive(server, client->archive);
+    close(client->sock_fd);
+    if (client->in_fd != -1) close(client->in_fd);
+    free(client->in);
+    free(client->out);
+}
+
+
+int tar_server_run(tar_server_t *server)
+{
+    struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+
+    while (__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE) == 0)
+    {
+        fds[0] = (struct pollfd) {.fd = server->wake_fds[0], .events = POLLIN, .revents = 0};
+        fds[1] = (struct pollfd) {.fd = server->listen_fd, .events = POLLIN, .revents = 0};
+        for (size_t i = 0; i < server->no_clients; i++)
+        {
+            // A client waiting for its reply is not read
+            short events = (server->clients[i].out != NULL) ? POLLOUT : POLLIN;
+            fds[i + 2] = (struct pollfd) {.fd = server->clients[i].sock_fd, .events = events, .revents = 0};
+        }
+
+        int ready = poll(fds, server->no_clients + 2, -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) return -1;
+
+        // Clients first, in reverse order: a disconnected client is replaced by the last one
+        for (size_t i = server->no_clients; i-- > 0;)
+        {
+            if (fds[i + 2].revents == 0) continue;
+            server_client_t *client = &server->clients[i];
+            int ret = (client->out == NULL) ? receive_request(server, client) : 0;
+            if (ret == 0) ret = send_reply(client);
+            if (ret == 0) continue;
+            drop_client(server, client);
+            server->clients[i] = server->clients[--server->no_clients];
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            int sock_fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            uint8_t *in = (sock_fd == -1 || server->no_clients == SERVER_MAX_CLIENTS) ? NULL : (uint8_t *) malloc(SERVER_REQUEST_MAX);
+            if (sock_fd != -1 && in == NULL) close(sock_fd);
+            else if (sock_fd != -1) server->clients[server->no_clients++] = (server_client_t) {.sock_fd = sock_fd, .archive = NULL, .in = in, .in_len = 0, .in_fd = -1, .out = NULL};
+        }
+    }
+    return 0;
+}
+
+
+void tar_server_stop(tar_server_t *server)
+{
+    __atomic_store_n(&server->stop, 1, __ATOMIC_RELEASE);
+    char byte = 0;
+    if (write(server->wake_fds[1], &byte, 1) != 1) return;
+}
+
+
+void tar_server_free(tar_server_t *server)
+{
+    for (size_t i = 0; i < server->no_clients; i++) drop_client(server, &server->clients[i]);
+    for (size_t i = 0; i < server->no_archives; i++)
+    {
+        if (server->archives[i].handle != NULL) close_archive(&server->archives[i]);
+    }
+    if (server->listen_fd != -1) close(server->listen_fd);
+    if (server->wake_fds[0] != -1) close(server->wake_fds[0]);
+    if (server->wake_fds[1] != -1) close(server->wake_fds[1]);
+    if (server->socket_path[0] != '\0') unlink(server->socket_path);
+    server->no_clients = server->no_archives = 0;
+    server->listen_fd = server->wake_fds[0] = server->wake_fds[1] = -1;
+}
@@ -0,0 +1,299 @@
+#include "../headers/sidecar.h"
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t) 7))
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *bytes, size_t len)
+{
+    // FNV-1a, 64 bits
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// Hash of the first header of the archive and of the header at 'last_offset'
+static int archive_hash(int tar_fd, off_t last_offset, uint64_t *hash)
+{
+    uint8_t block[HEADER_SIZE];
+    *hash = 14695981039346656037ull;
+    STATS_ADD(no_syscalls, 2);
+    STATS_ADD(bytes_read, 2 * HEADER_SIZE);
+    if (archive_pread(tar_fd, block, HEADER_SIZE, 0) != HEADER_SIZE) return -1;
+    *hash = hash_bytes(*hash, block, HEADER_SIZE);
+    if (archive_pread(tar_fd, block, HEADER_SIZE, last_offset) != HEADER_SIZE) return -1;
+    *hash = hash_bytes(*hash, block, HEADER_SIZE);
+    return 0;
+}
+
+
+// Offset of the last header of the index, the member stored last
+static off_t last_header(const tar_index_t *index)
+{
+    off_t last_offset = 0;
+    for (size_t i = 0; i < index->no_entries; i++)
+    {
+        if ((off_t) index->offsets[i] > last_offset) last_offset = index->offsets[i];
+    }
+    return last_offset;
+}
+
+
+static int write_all(int fd, const void *buffer, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *) buffer;
+    while (len > 0)
+    {
+        ssize_t nber_written = write(fd, bytes, len);
+        if (nber_written <= 0) return -1;
+        bytes += nber_written;
+        len -= nber_written;
+    }
+    return 0;
+}
+
+
+static int write_at(int fd, uint64_t offset, const void *buffer, size_t len)
+{
+    if (lseek(fd, offset, SEEK_SET) != (off_t) offset) return -1;
+    return write_all(fd, buffer, len);
+}
+
+
+int sidecar_write(tar_index_t *index, int tar_fd, const char *idx_path)
+{
+    struct stat st;
+    sidecar_header_t header;
+    const uint32_t *sorted = index_sorted(index);
+    if (sorted == NULL || fstat(tar_fd, &st) != 0) return -1;
+
+    memset(&header, 0, sizeof(sidecar_header_t));
+    memcpy(header.magic, SIDECAR_MAGIC, SIDECAR_MAGLEN);
+    header.version = SIDECAR_VERSION;
+    header.byte_order = SIDECAR_BYTE_ORDER;
+    header.entry_size = sizeof(tar_entry_t);
+    header.archive_size = st.st_size;
+    header.archive_mtime_sec = st.st_mtim.tv_sec;
+    header.archive_mtime_nsec = st.st_mtim.tv_nsec;
+    header.last_offset = last_header(index);
+    if (archive_hash(tar_fd, header.last_offset, &header.header_hash) != 0) return -1;
+
+    header.no_entries = index->no_entries;
+    header.no_buckets = index->no_buckets;
+    header.arena_len = index->arena_len;
+    header.entries_offset = ALIGN8(sizeof(sidecar_header_t));
+    header.buckets_offset = ALIGN8(header.entries_offset + header.no_entries * sizeof(tar_entry_t));
+    header.sorted_offset = ALIGN8(header.buckets_offset + header.no_buckets * sizeof(uint32_t));
+    header.offsets_offset = ALIGN8(header.sorted_offset + header.no_entries * sizeof(uint32_t));
+    header.sizes_offset = ALIGN8(header.offsets_offset + header.no_entries * sizeof(uint64_t));
+    header.types_offset = ALIGN8(header.sizes_offset + header.no_entries * sizeof(uint64_t));
+    header.modes_offset = ALIGN8(header.types_offset + header.no_entries);
+    header.arena_offset = ALIGN8(header.modes_offset + header.no_entries * sizeof(uint16_t));
+    header.no_prefixes = index->no_prefixes;
+    header.journal_offset = ALIGN8(header.arena_offset + header.arena_len);
+
+    // The memoized link targets are not written
+    tar_entry_t *entries = (tar_entry_t *) malloc((index->no_entries + 1) * sizeof(tar_entry_t));
+    if (entries == NULL) return -1;
+    memcpy(entries, index->entries, index->no_entries * sizeof(tar_entry_t));
+    for (size_t i = 0; i < index->no_entries; i++) entries[i].target = INDEX_EMPTY;
+
+    // A unique temporary name in the same directory: writers of the same sidecar do not truncate each other's file
+    size_t tmp_len = strlen(idx_path) + 8;
+    char *tmp_path = (char *) malloc(tmp_len);
+    if (tmp_path == NULL) {free(entries); return -1;}
+    snprintf(tmp_path, tmp_len, "%s.XXXXXX", idx_path);
+
+    int ret = -1;
+    int idx_fd = mkstemp(tmp_path);
+    if (idx_fd != -1)
+    {
+        if (fchmod(idx_fd, 0644) == 0
+            && write_at(idx_fd, 0, &header, sizeof(sidecar_header_t)) == 0
+            && write_at(idx_fd, header.entries_offset, entries, header.no_entries * sizeof(tar_entry_t)) == 0
+            && write_at(idx_fd, header.buckets_offset, index->buckets, header.no_buckets * sizeof(uint32_t)) == 0
+            && write_at(idx_fd, header.sorted_offset, sorted, header.no_entries * sizeof(uint32_t)) == 0
+            && write_at(idx_fd, header.offsets_offset, index->offsets, header.no_entries * sizeof(uint64_t)) == 0
+            && write_at(idx_fd, header.sizes_offset, index->sizes, header.no_entries * sizeof(uint64_t)) == 0
+            && write_at(idx_fd, header.types_offset, index->types, header.no_entries) == 0
+            && write_at(idx_fd, header.modes_offset, index->modes, header.no_entries * sizeof(uint16_t)) == 0
+            && write_at(idx_fd, header.arena_offset, index->arena, header.arena_len) == 0) ret = 0;
+        if (close(idx_fd) != 0) ret = -1;
+        if (ret == 0 && rename(tmp_path, idx_path) != 0) ret = -1;
+        if (ret != 0) unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(entries);
+    return ret;
+}
+
+
+int sidecar_append(int tar_fd, const char *idx_path, off_t start, const uint64_t *offsets, size_t count)
+{
+    struct stat st;
+    sidecar_header_t header;
+    uint64_t hash;
+    int idx_fd = open(idx_path, O_RDWR);
+    if (idx_fd == -1) return -1;
+
+    int ret = -1;
+    if (pread(idx_fd, &header, sizeof(sidecar_header_t), 0) == sizeof(sidecar_header_t)
+        && memcmp(header.magic, SIDECAR_MAGIC, SIDECAR_MAGLEN) == 0 && header.version == SIDECAR_VERSION
+        && header.byte_order == SIDECAR_BYTE_ORDER && header.entry_size == sizeof(tar_entry_t)
+        && header.no_journaled + count <= ((header.no_entries / 4 > SIDECAR_JOURNAL_MIN) ? header.no_entries / 4 : SIDECAR_JOURNAL_MIN)
+        // The sidecar must have matched the archive up to where the new members start
+        && header.last_offset < (uint64_t) start && (uint64_t) start <= header.archive_size
+        && archive_hash(tar_fd, header.last_offset, &hash) == 0 && hash == header.header_hash)
+    {
+        if (count > 0) header.last_offset = offsets[count - 1];
+        uint64_t journal_end = header.journal_offset + header.no_journaled * sizeof(uint64_t);
+
+        // The header is written last: a sidecar whose header is not updated is only found stale
+        if (archive_hash(tar_fd, header.last_offset, &header.header_hash) == 0 && fstat(tar_fd, &st) == 0
+            && write_at(idx_fd, journal_end, offsets, count * sizeof(uint64_t)) == 0)
+        {
+            header.archive_size = st.st_size;
+            header.archive_mtime_sec = st.st_mtim.tv_sec;
+            header.archive_mtime_nsec = st.st_mtim.tv_nsec;
+            header.no_journaled += count;
+            ret = write_at(idx_fd, 0, &header, sizeof(sidecar_header_t));
+        }
+    }
+
+    if (close(idx_fd) != 0) ret = -1;
+    return ret;
+}
+
+
+// Whether 'count' items of 'size' bytes at 'offset' fit in the file, without overflowing
+static int section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_len)
+{
+    return offset <= file_len && count <= (file_len - offset) / size;
+}
+
+
+static int is_id(uint32_t id, uint64_t no_entries) { return id == INDEX_EMPTY || id < no_entries; }
+
+
+// Checks every id and arena offset of a mapped index, so that a corrupt sidecar cannot make the lookups read outside of it
+static int validate_index(const tar_index_t *index)
+{
+    uint64_t no_used = 0;
+    for (size_t i = 0; i < index->no_buckets; i++)
+    {
+        if (!is_id(index->buckets[i], index->no_entries)) return -1;
+        no_used += (index->buckets[i] != INDEX_EMPTY);
+    }
+    // The probing of a lookup stops at an empty bucket
+    if (no_used >= index->no_buckets) return -1;
+
+    for (size_t i = 0; i < index->no_entries; i++)
+    {
+        const tar_entry_t *entry = &index->entries[i];
+        if (entry->prefix >= index->arena_len || entry->name >= index->arena_len || entry->linkname >= index->arena_len) return -1;
+        if (!is_id(entry->parent, index->no_entries) || !is_id(entry->first_child, index->no_entries) || index->sorted[i] >= index->no_entries) return -1;
+        // The entries of a directory are chained in archive order, so that walking them always ends
+        if (entry->next_sibling != INDEX_EMPTY && (entry->next_sibling <= i || entry->next_sibling >= index->no_entries)) return -1;
+        if (entry->target != INDEX_EMPTY) return -1;
+    }
+    return 0;
+}
+
+
+// Indexes the members journaled by sidecar_append(), read from the archive
+static int load_journal(tar_index_t *index, int tar_fd, const uint64_t *journal, size_t count)
+{
+    // The journal is in the mapping, which index_own() releases
+    uint64_t *offsets = (uint64_t *) malloc(count * sizeof(uint64_t));
+    if (offsets == NULL) return -1;
+    memcpy(offsets, journal, count * sizeof(uint64_t));
+
+    int ret = (index_own(index) == 0) ? 0 : -1;
+    size_t first = index->no_entries;
+    for (size_t i = 0; i < count && ret == 0; i++)
+    {
+        tar_header_t header;
+        STATS_ADD(no_syscalls, 1);
+        STATS_ADD(bytes_read, HEADER_SIZE);
+        if (archive_pread(tar_fd, &header, HEADER_SIZE, offsets[i]) != HEADER_SIZE || check_header(&header) != 0) ret = -2;
+        else if (index_insert(index, &header, offsets[i]) == NULL) ret = -1;
+    }
+    if (ret == 0) index_link_entries(index, first);
+
+    free(offsets);
+    return ret;
+}
+
+
+int sidecar_load(tar_index_t *index, int tar_fd, const char *idx_path)
+{
+    struct stat st;
+    struct stat idx_st;
+
+    int idx_fd = open(idx_path, O_RDONLY);
+    if (idx_fd == -1) return -1;
+    if (fstat(idx_fd, &idx_st) != 0 || (size_t) idx_st.st_size < sizeof(sidecar_header_t)) {close(idx_fd); return -1;}
+
+    // Private mapping: the memoized link targets are written to copies of the pages, never to the file
+    void *map = mmap(NULL, idx_st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, idx_fd, 0);
+    close(idx_fd);
+    if (map == MAP_FAILED) return -1;
+
+    // Copied: the mapping is released if journaled members are indexed
+    sidecar_header_t header = *(const sidecar_header_t *) map;
+    uint64_t file_len = idx_st.st_size;
+    int ret = 0;
+
+    if (memcmp(header.magic, SIDECAR_MAGIC, SIDECAR_MAGLEN) != 0 || header.version != SIDECAR_VERSION
+        || header.byte_order != SIDECAR_BYTE_ORDER || header.entry_size != sizeof(tar_entry_t)) ret = -1;
+    else if (header.no_buckets == 0 || (header.no_buckets & (header.no_buckets - 1)) != 0 || header.no_buckets <= header.no_entries
+        || header.no_entries >= INDEX_DANGLING || header.arena_len > UINT32_MAX
+        || !section_fits(header.entries_offset, header.no_entries, sizeof(tar_entry_t), file_len)
+        || !section_fits(header.buckets_offset, header.no_buckets, sizeof(uint32_t), file_len)
+        || !section_fits(header.sorted_offset, header.no_entries, sizeof(uint32_t), file_len)
+        || !section_fits(header.offsets_offset, header.no_entries, sizeof(uint64_t), file_len)
+        || !section_fits(header.sizes_offset, header.no_entries, sizeof(uint64_t), file_len)
+        || !section_fits(header.types_offset, header.no_entries, 1, file_len)
+        || !section_fits(header.modes_offset, header.no_entries, sizeof(uint16_t), file_len)
+        // The journal starts at the aligned end of the arena, after the end of the file until a member is journaled
+        || (header.no_journaled > 0 && !section_fits(header.journal_offset, header.no_journaled, sizeof(uint64_t), file_len))
+        || (header.entries_offset | header.buckets_offset | header.sorted_offset | header.offsets_offset | header.sizes_offset | header.modes_offset | header.journal_offset) % 8 != 0
+        || header.arena_len == 0 || !section_fits(header.arena_offset, header.arena_len, 1, file_len)
+        || ((const char *) map)[header.arena_offset + header.arena_len - 1] != '\0') ret = -1;
+    else if (fstat(tar_fd, &st) != 0 || (uint64_t) st.st_size != header.archive_size
+        || st.st_mtim.tv_sec != header.archive_mtime_sec || st.st_mtim.tv_nsec != header.archive_mtime_nsec) ret = -2;
+
+    if (ret != 0) {munmap(map, idx_st.st_size); return ret;}
+
+    memset(index, 0, sizeof(tar_index_t));
+    index->entries = (tar_entry_t *) ((uint8_t *) map + header.entries_offset);
+    index->no_entries = index->cap_entries = header.no_entries;
+    index->buckets = (uint32_t *) ((uint8_t *) map + header.buckets_offset);
+    index->no_buckets = header.no_buckets;
+    index->sorted = (uint32_t *) ((uint8_t *) map + header.sorted_offset);
+    index->offsets = (uint64_t *) ((uint8_t *) map + header.offsets_offset);
+    index->sizes = (uint64_t *) ((uint8_t *) map + header.sizes_offset);
+    index->types = (char *) map + header.types_offset;
+    index->modes = (uint16_t *) ((uint8_t *) map + header.modes_offset);
+    index->no_prefixes = header.no_prefixes;
+    index->arena = (char *) map + header.arena_offset;
+    index->arena_len = index->arena_cap = header.arena_len;
+    index->map = map;
+    index->map_len = idx_st.st_size;
+    if (validate_index(index) != 0) {index_free(index); return -1;}
+
+    if (header.no_journaled > 0)
+    {
+        ret = load_journal(index, tar_fd, (const uint64_t *) ((uint8_t *) map + header.journal_offset), header.no_journaled);
+        if (ret != 0) {index_free(index); return ret;}
+    }
+
+    // The archive may have been rewritten with the same size and modification time
+    uint64_t hash;
+    if (last_header(index) != (off_t) header.last_offset || archive_hash(tar_fd, header.last_offset, &hash) != 0 || hash != header.header_hash) {index_free(index); return -2;}
+
+    return 0;
+}
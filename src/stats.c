@@ -0,0 +1,97 @@
+#include "../headers/stats.h"
+
+static const char *api_names[TAR_API_COUNT] = {
+    "other", "check_archive", "exists", "is_dir", "is_file", "is_symlink", "list", "read_file",
+    "tar_lookup_batch", "tar_open", "tar_open_mmap", "tar_open_sidecar", "tar_resolve", "tar_exists",
+    "tar_is_dir", "tar_is_file", "tar_is_symlink", "tar_list", "tar_read_file", "read_file_view",
+    "tar_iter_next", "tar_iter_read", "tar_extract"
+};
+
+#ifdef TAR_STATS
+
+static tar_stats_t stats;
+
+// API function running in the thread, and the number of API calls nested in it
+static __thread tar_api_t current_api = TAR_API_OTHER;
+static __thread int depth = 0;
+static __thread uint64_t start_ns;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void stats_enter(tar_api_t api)
+{
+    if (depth++ > 0) return;
+    current_api = api;
+    start_ns = now_ns();
+}
+
+
+void stats_exit(void)
+{
+    if (--depth > 0) return;
+    tar_api_stats_t *api = &stats.api[current_api];
+    __atomic_fetch_add(&api->no_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&api->time_ns, now_ns() - start_ns, __ATOMIC_RELAXED);
+    current_api = TAR_API_OTHER;
+}
+
+
+void stats_attach(tar_api_t api) { current_api = api; }
+
+
+void stats_add(size_t field, uint64_t n)
+{
+    uint64_t *counter = (uint64_t *) ((uint8_t *) &stats.api[current_api] + field);
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+#endif /* TAR_STATS */
+
+
+int tar_stats_get(tar_stats_t *copy)
+{
+    memset(copy, 0, sizeof(tar_stats_t));
+#ifdef TAR_STATS
+    const uint64_t *counters = (const uint64_t *) &stats;
+    uint64_t *copied = (uint64_t *) copy;
+    for (size_t i = 0; i < sizeof(tar_stats_t) / sizeof(uint64_t); i++) copied[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+void tar_stats_reset(void)
+{
+#ifdef TAR_STATS
+    uint64_t *counters = (uint64_t *) &stats;
+    for (size_t i = 0; i < sizeof(tar_stats_t) / sizeof(uint64_t); i++) __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+#endif
+}
+
+
+const char *tar_api_name(tar_api_t api) { return (api < TAR_API_COUNT) ? api_names[api] : "unknown"; }
+
+
+void get_info_stats(const tar_stats_t *stats)
+{
+    printf("stats\n");
+    for (int i = 0; i < TAR_API_COUNT; i++)
+    {
+        const tar_api_stats_t *api = &stats->api[i];
+        if (api->no_calls == 0 && api->no_headers == 0 && api->no_syscalls == 0 && api->bytes_read == 0) continue;
+
+        printf("\t%s : %lu calls, %lu headers, %lu syscalls, %lu bytes, %lu symlink hops, %.1f us\n", tar_api_name(i),
+               (unsigned long) api->no_calls, (unsigned long) api->no_headers, (unsigned long) api->no_syscalls,
+               (unsigned long) api->bytes_read, (unsigned long) api->symlink_hops, api->time_ns / 1000.0);
+    }
+    printf("\n");
+}
@@ -0,0 +1,137 @@
+#include "../headers/stream.h"
+
+void tar_stream_init(tar_stream_t *stream, const tar_stream_callbacks_t *callbacks)
+{
+    memset(stream, 0, sizeof(tar_stream_t));
+    stream->callbacks = *callbacks;
+    stream->state = STREAM_HEADER;
+}
+
+
+static int fail(tar_stream_t *stream, int error)
+{
+    stream->state = STREAM_ERROR;
+    stream->error = error;
+    return error;
+}
+
+
+// Handles a whole header, returns 0 or an error
+static int parse_header(tar_stream_t *stream, const uint8_t *block)
+{
+    const tar_header_t *header = (const tar_header_t *) block;
+    if (header->name[0] == '\0') {stream->state = STREAM_END; return 0;}
+
+    int ret = check_header(header);
+    if (ret != 0) return fail(stream, ret);
+
+    tar_member_t *member = &stream->member;
+    tar_decode_member(header, stream->offset - HEADER_SIZE, member);
+    stream->no_members++;
+    stream->remaining = member->size;
+    stream->padding = TAR_PADDED_SIZE(member->size) - member->size;
+
+    stream->skip = (stream->callbacks.on_data == NULL);
+    if (stream->callbacks.on_member != NULL)
+    {
+        ret = stream->callbacks.on_member(member, stream->callbacks.user_data);
+        if (ret < 0) return fail(stream, STREAM_ABORTED);
+        if (ret == STREAM_SKIP) stream->skip = 1;
+    }
+    stream->state = STREAM_DATA;
+    return 0;
+}
+
+
+// Called once the content of the current member was received
+static int end_content(tar_stream_t *stream)
+{
+    stream->state = STREAM_PADDING;
+    if (stream->skip || stream->callbacks.on_end == NULL) return 0;
+    if (stream->callbacks.on_end(&stream->member, stream->callbacks.user_data) < 0) return fail(stream, STREAM_ABORTED);
+    return 0;
+}
+
+
+int tar_stream_feed(tar_stream_t *stream, const uint8_t *data, size_t len)
+{
+    while (len > 0 || (stream->state == STREAM_DATA && stream->remaining == 0) || (stream->state == STREAM_PADDING && stream->padding == 0))
+    {
+        if (stream->state == STREAM_ERROR) return stream->error;
+        if (stream->state == STREAM_END) return 1;
+
+        size_t used = 0;
+        int ret = 0;
+        switch (stream->state)
+        {
+            case STREAM_HEADER:
+                // A header wholly in the chunk is parsed in place
+                if (stream->header_len == 0 && len >= HEADER_SIZE)
+                {
+                    used = HEADER_SIZE;
+                    stream->offset += used;
+                    ret = parse_header(stream, data);
+                    break;
+                }
+                used = (HEADER_SIZE - stream->header_len < len) ? HEADER_SIZE - stream->header_len : len;
+                memcpy(stream->header + stream->header_len, data, used);
+                stream->header_len += used;
+                stream->offset += used;
+                if (stream->header_len == HEADER_SIZE) {stream->header_len = 0; ret = parse_header(stream, stream->header);}
+                break;
+
+            case STREAM_DATA:
+                if (stream->remaining == 0) {ret = end_content(stream); break;}
+                used = (stream->remaining < len) ? stream->remaining : len;
+                if (stream->skip == 0 && stream->callbacks.on_data(&stream->member, data, used, stream->callbacks.user_data) < 0) ret = fail(stream, STREAM_ABORTED);
+                stream->remaining -= used;
+                stream->offset += used;
+                break;
+
+            case STREAM_PADDING:
+                used = (stream->padding < len) ? stream->padding : len;
+                stream->padding -= used;
+                stream->offset += used;
+                if (stream->padding == 0) stream->state = STREAM_HEADER;
+                break;
+
+            default:
+                break;
+        }
+        if (ret < 0) return ret;
+        data += used;
+        len -= used;
+    }
+
+    if (stream->state == STREAM_ERROR) return stream->error;
+    return stream->state == STREAM_END;
+}
+
+
+int tar_stream_finish(tar_stream_t *stream)
+{
+    if (stream->state == STREAM_ERROR) return stream->error;
+    if (stream->state == STREAM_END || (stream->state == STREAM_HEADER && stream->header_len == 0)) return stream->no_members;
+    return fail(stream, STREAM_TRUNCATED);
+}
+
+
+int tar_stream_fd(int fd, const tar_stream_callbacks_t *callbacks)
+{
+    uint8_t *buffer = (uint8_t *) malloc(STREAM_READ_SIZE);
+    if (buffer == NULL) return STREAM_TRUNCATED;
+
+    tar_stream_t stream;
+    tar_stream_init(&stream, callbacks);
+    int ret = 0;
+    while (ret == 0)
+    {
+        ssize_t nber_read = read(fd, buffer, STREAM_READ_SIZE);
+        if (nber_read < 0 && errno == EINTR) continue;
+        if (nber_read < 0) {ret = fail(&stream, STREAM_TRUNCATED); break;}
+        if (nber_read == 0) break;
+        ret = tar_stream_feed(&stream, buffer, nber_read);
+    }
+    free(buffer);
+    return tar_stream_finish(&stream);
+}
@@ -1,149 +1,1816 @@
+// nftw()
+#define _GNU_SOURCE
+
 #include "../headers/tests.h"
 
-void debug_dump(const uint8_t *bytes, size_t len)
+// When set, the tests go through the handle-based functions instead of the fd-based ones
+static tar_handle_t *test_handle = NULL;
+
+void debug_dump(const uint8_t *bytes, size_t len)
+{
+    for (size_t i = 0; i < len;)
+    {
+        printf("%04x:  ", (int) i);
+        for (size_t j = 0; j < 16 && i + j < len; j++) printf("%02x ", bytes[i + j]);
+        printf("\t");
+        for (size_t j = 0; j < 16 && i < len; j++, i++) printf("%c ", bytes[i]);
+        printf("\n");
+    }
+}
+
+void check_archive_test(int fd, int expected)
+{
+    int ret = check_archive(fd);
+    if (expected != ret) printf("ERROR : check_archive()\nReturn %d instead of %d\n", ret, expected);
+    else printf("\tTest Passed !\n");
+}
+
+void check_archive_mt_test(int fd, int no_threads, int expected)
+{
+    int ret = check_archive_mt(fd, no_threads);
+    if (expected != ret) printf("ERROR : check_archive_mt()\nReturn %d instead of %d\n[args : no_threads = %d ]\n", ret, expected, no_threads);
+    else printf("\tTest Passed !\n");
+}
+
+void header_checksum_test(int fd)
+{
+    uint8_t block[HEADER_SIZE];
+    int no_error = 1;
+
+    // Every header of the archive, then random blocks
+    for (off_t offset = 0; archive_pread(fd, block, HEADER_SIZE, offset) == HEADER_SIZE && block[0] != '\0';)
+    {
+        tar_header_t *header = (tar_header_t *) block;
+        if (header_checksum(block) != tar_octal(header->chksum, sizeof(header->chksum))) no_error = 0;
+        offset += HEADER_SIZE + TAR_PADDED_SIZE(TAR_INT(header->size));
+    }
+
+    srand(1252);
+    for (int i = 0; i < 1000; i++)
+    {
+        for (int j = 0; j < HEADER_SIZE; j++) block[j] = rand() % 256;
+        if (header_checksum(block) != header_checksum_scalar(block)) no_error = 0;
+    }
+
+    if (no_error == 0) printf("ERROR : header_checksum()\n");
+    else printf("\tTest Passed !\n");
+}
+
+void tar_octal_test(char *field, size_t len, long expected)
+{
+    long ret = tar_octal(field, len);
+    if (expected != ret) printf("ERROR : tar_octal()\nReturn %ld instead of %ld\n[args : field = %.*s ]\n", ret, expected, (int) len, field);
+    else printf("\tTest Passed !\n");
+}
+
+void reader_stats_test(int fd, char *path, size_t max_syscalls)
+{
+    reader_reset_stats();
+    exists(fd, path);
+    reader_stats_t stats = reader_get_stats();
+
+    if (stats.no_reads > max_syscalls) printf("ERROR : reader_get_stats()\n%ld system calls instead of at most %ld\n[args : path = %s ]\n", stats.no_reads, max_syscalls, path);
+    else printf("\tTest Passed !\n");
+}
+
+static char *file1_2 = "My fellow citizens, let us embrace the dawn of a new era.\nIn the symphony of democracy, every note contributes to the melody of progress.\nWe must be the architects of our shared destiny, champions of justice, and stewards of liberty.\nTogether, we navigate the uncharted waters of the future, anchored by the values that define us as a people.";
+
+void *stress_worker(void *arg)
+{
+    stress_arg_t *stress = (stress_arg_t *) arg;
+    tar_handle_t *handle = stress->handle;
+    int fd = stress->fd;
+
+    char *entries[10];
+    char entries_buffer[10][100];
+    for (int i = 0; i < 10; i++) entries[i] = entries_buffer[i];
+    uint8_t buffer[32];
+
+    for (int i = 0; i < stress->no_iterations; i++)
+    {
+        if ((handle != NULL ? tar_exists(handle, "folder1/file1.txt") : exists(fd, "folder1/file1.txt")) != 1) stress->no_errors++;
+        if ((handle != NULL ? tar_is_dir(handle, "folder3/") : is_dir(fd, "folder3/")) != 1) stress->no_errors++;
+
+        size_t no_entries = 10;
+        int ret = (handle != NULL) ? tar_list(handle, "folder2/", entries, &no_entries) : list(fd, "folder2/", entries, &no_entries);
+        if (ret != 1 || no_entries != 5) stress->no_errors++;
+
+        // Each thread reads different parts of the file
+        size_t offset = (i * 7 + stress->id * 13) % 300;
+        size_t len = sizeof(buffer);
+        ssize_t remaining = (handle != NULL) ? tar_read_file(handle, "folder1/subfolder1_1/file1_2.txt", offset, buffer, &len) : read_file(fd, "folder1/subfolder1_1/file1_2.txt", offset, buffer, &len);
+        if (remaining != (ssize_t) (342 - offset - sizeof(buffer)) || len != sizeof(buffer) || memcmp(buffer, file1_2 + offset, len) != 0) stress->no_errors++;
+    }
+
+    return NULL;
+}
+
+void concurrency_test(int fd, tar_handle_t *handle, int no_threads, int no_iterations)
+{
+    pthread_t threads[no_threads];
+    stress_arg_t args[no_threads];
+
+    for (int i = 0; i < no_threads; i++)
+    {
+        args[i] = (stress_arg_t) {.id = i, .fd = fd, .handle = handle, .no_iterations = no_iterations, .no_errors = 0};
+        pthread_create(&threads[i], NULL, stress_worker, &args[i]);
+    }
+
+    int no_errors = 0;
+    for (int i = 0; i < no_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        no_errors += args[i].no_errors;
+    }
+
+    if (no_errors > 0) printf("ERROR : concurrency_test()\n%d wrong results [args : no_threads = %d, handle = %s ]\n", no_errors, no_threads, handle != NULL ? "yes" : "no");
+    else printf("\tTest Passed !\n");
+}
+
+void lookup_batch_test(int fd)
+{
+    char *paths[] = {"folder4/text3.txt", "folder1/", "doesnt_exist.txt", "symlink1", "folder4/text3.txt", "folder2/subfolder2_2/file2_2_1.txt", "folder3"};
+    int expected_found[] = {1, 1, 0, 1, 1, 1, 0};
+    char expected_typeflag[] = {REGTYPE, DIRTYPE, 0, SYMTYPE, REGTYPE, REGTYPE, 0};
+    size_t expected_size[] = {18, 0, 0, 0, 18, 63, 0};
+    size_t n = sizeof(paths) / sizeof(paths[0]);
+    tar_lookup_result_t results[n];
+
+    ssize_t ret = tar_lookup_batch(fd, paths, n, results);
+    int no_error = (ret == 5);
+    if (no_error == 0) printf("ERROR : tar_lookup_batch()\nReturn %ld instead of 5\n", ret);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (results[i].found != expected_found[i] || results[i].typeflag != expected_typeflag[i] || results[i].size != expected_size[i])
+        {
+            no_error = 0;
+            printf("ERROR : tar_lookup_batch()\nfound = %d, typeflag = %c, size = %ld [args : path = %s ]\n", results[i].found, results[i].typeflag, results[i].size, paths[i]);
+        }
+    }
+
+    // The data offset points to the content of the file
+    char content[19] = "";
+    pread(fd, content, 18, results[0].data_offset);
+    if (strcmp(content, "Tr\xc3\xa8s court texte.") != 0) {no_error = 0; printf("ERROR : tar_lookup_batch()\ncontent = %s\n", content);}
+
+    if (no_error == 1) printf("\tTest Passed !\n");
+}
+
+void iter_test(int fd)
+{
+    tar_iter_t iter;
+    const tar_member_t *member;
+    int no_members = 0;
+    size_t total_size = 0;
+    int no_error = 1;
+    int ret;
+
+    if (tar_iter_begin(&iter, fd) != 0) {printf("ERROR : tar_iter_begin()\n"); return;}
+
+    while ((ret = tar_iter_next(&iter, &member)) == 1)
+    {
+        no_members++;
+        total_size += member->size;
+
+        if (no_members == 1 && (strcmp(member->name, "folder1/") != 0 || member->typeflag != DIRTYPE || member->mode != 0775)) no_error = 0;
+        if (strcmp(member->name, "symlink_multi") == 0 && strcmp(member->linkname, "folder2/symlink_test") != 0) no_error = 0;
+
+        // Content read by small chunks, or only partially: the next member must still be found
+        if (strcmp(member->name, "folder4/text3.txt") == 0)
+        {
+            uint8_t content[32] = "";
+            size_t len = 0, nber_read;
+            while ((nber_read = tar_iter_read(&iter, content + len, 5)) > 0) len += nber_read;
+            if (len != 18 || strcmp((char *) content, "Tr\xc3\xa8s court texte.") != 0) no_error = 0;
+        }
+        if (strcmp(member->name, "folder4/text1.txt") == 0)
+        {
+            uint8_t content[10];
+            if (tar_iter_read(&iter, content, 10) != 10) no_error = 0;
+        }
+    }
+
+    tar_iter_end(&iter);
+    if (ret != 0 || no_members != 23 || total_size != 594 + 342 * 2 + 63 + 330 + 528 + 2561 + 76 + 18) no_error = 0;
+
+    // The longest path a header can hold, a full prefix and a full name, must not spill into the link target
+    tar_header_t header;
+    tar_member_t decoded;
+    memset(&header, 0, HEADER_SIZE);
+    memset(header.prefix, 'p', sizeof(header.prefix));
+    memset(header.name, 'n', sizeof(header.name));
+    memcpy(header.magic, TMAGIC, TMAGLEN);
+    strcpy(header.linkname, "target");
+    tar_decode_member(&header, 0, &decoded);
+    size_t name_len = strnlen(decoded.name, sizeof(decoded.name));
+    if (name_len != sizeof(header.prefix) + 1 + sizeof(header.name) || name_len == sizeof(decoded.name) || strcmp(decoded.linkname, "target") != 0) no_error = 0;
+
+    if (no_error == 0) printf("ERROR : tar_iter_next()\nret = %d, %d members, total size = %ld\n", ret, no_members, total_size);
+    else printf("\tTest Passed !\n");
+}
+
+void stats_test(tar_api_t api, uint64_t no_calls, uint64_t no_headers, uint64_t no_syscalls, uint64_t bytes_read, uint64_t symlink_hops)
+{
+    tar_stats_t stats;
+    tar_stats_get(&stats);
+    tar_api_stats_t *counters = &stats.api[api];
+
+    if (counters->no_calls != no_calls || counters->no_headers != no_headers || counters->no_syscalls != no_syscalls
+        || counters->bytes_read != bytes_read || counters->symlink_hops != symlink_hops)
+    {
+        printf("ERROR : %s counted %lu calls, %lu headers, %lu syscalls, %lu bytes and %lu symlink hops "
+               "instead of %lu, %lu, %lu, %lu and %lu\n", tar_api_name(api),
+               (unsigned long) counters->no_calls, (unsigned long) counters->no_headers, (unsigned long) counters->no_syscalls,
+               (unsigned long) counters->bytes_read, (unsigned long) counters->symlink_hops,
+               (unsigned long) no_calls, (unsigned long) no_headers, (unsigned long) no_syscalls,
+               (unsigned long) bytes_read, (unsigned long) symlink_hops);
+    }
+    else printf("\tTest Passed !\n");
+}
+
+
+// Empty temporary file, already unlinked: it is removed once the descriptor is closed
+static int temp_archive(const char *tag)
+{
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "/tmp/lib_tar_%s_XXXXXX", tag);
+    int fd = mkstemp(tmp_path);
+    if (fd != -1) unlink(tmp_path);
+    return fd;
+}
+
+
+// Archive of the given members: a name ending with '/' is a directory, a content starting with "->" a symlink
+static int members_archive(const char *tag, const char *const members[][2], size_t no_members)
+{
+    int fd = temp_archive(tag);
+    if (fd == -1) return -1;
+
+    tar_writer_t writer;
+    int ret = tar_writer_init(&writer, fd);
+    for (size_t i = 0; i < no_members && ret == 0; i++)
+    {
+        const char *name = members[i][0];
+        const char *content = members[i][1];
+        if (name[strlen(name) - 1] == '/') ret = tar_add_dir(&writer, name, 0755, 0);
+        else if (strncmp(content, "->", 2) == 0) ret = tar_add_symlink(&writer, name, content + 2, 0);
+        else ret = tar_add_data(&writer, name, (const uint8_t *) content, strlen(content), 0644, 0);
+    }
+    if (tar_writer_finish(&writer) != 0 || ret != 0) {close(fd); return -1;}
+    return fd;
+}
+
+
+int corrupt_archive(int fd, int no_corruptions, int member[], size_t field_offset[], char value[])
+{
+    int corrupt_fd = temp_archive("corrupt");
+    if (corrupt_fd == -1) return -1;
+
+    uint8_t block[HEADER_SIZE];
+    off_t offset = 0;
+    int no_member = 0;
+    while (pread(fd, block, HEADER_SIZE, offset) == HEADER_SIZE)
+    {
+        tar_header_t *header = (tar_header_t *) block;
+        size_t member_len = (block[0] == '\0') ? HEADER_SIZE : HEADER_SIZE + TAR_PADDED_SIZE(TAR_INT(header->size));
+
+        for (int i = 0; block[0] != '\0' && i < no_corruptions; i++)
+        {
+            if (member[i] == no_member) block[field_offset[i]] = value[i];
+        }
+        write(corrupt_fd, block, HEADER_SIZE);
+
+        uint8_t content[HEADER_SIZE];
+        for (size_t done = HEADER_SIZE; done < member_len; done += HEADER_SIZE)
+        {
+            pread(fd, content, HEADER_SIZE, offset + done);
+            write(corrupt_fd, content, HEADER_SIZE);
+        }
+
+        offset += member_len;
+        if (block[0] != '\0') no_member++;
+    }
+
+    return corrupt_fd;
+}
+
+void exists_test(int fd, char *path, int expected)
+{
+    int ret = (test_handle != NULL) ? tar_exists(test_handle, path) : exists(fd, path);
+    if (expected != ret) printf("ERROR : exists()\nReturn %d instead of %d\n[args : path = %s ]\n", ret, expected, path);
+    else printf("\tTest Passed !\n");
+}
+
+void is_x_test(int fd, char *path, char *type, int expected)
+{
+    int ret;
+    char *function_name;
+    if (strcmp(type, "symlink") == 0)
+    {
+        ret = (test_handle != NULL) ? tar_is_symlink(test_handle, path) : is_symlink(fd, path);
+        function_name = "is_symlink";
+    }
+    else if (strcmp(type, "file") == 0)
+    {
+        ret = (test_handle != NULL) ? tar_is_file(test_handle, path) : is_file(fd, path);
+        function_name = "is_file";
+    }
+    else if (strcmp(type, "dir") == 0)
+    {
+        ret = (test_handle != NULL) ? tar_is_dir(test_handle, path) : is_dir(fd, path);
+        function_name = "is_dir";
+    } else { printf("\tTest Failed !\n"); return; }
+
+    if (expected != ret) printf("ERROR : %s()\nReturn %d instead of %d\n[args : path = %s ]\n", function_name, ret, expected, path);
+    else printf("\tTest Passed !\n");
+}
+
+int cmper_str(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+void list_test(int fd, char *path, size_t no_entries, int expected_ret, size_t expected_no_entries, char *expected_entries[])
+{
+    size_t copy_no_entries = no_entries;
+    char **entries = (char **) malloc(no_entries * sizeof(char *));
+    for (size_t i = 0; i < no_entries; i++) *(entries + i) = (char *) calloc(200, sizeof(char));
+    int ret = (test_handle != NULL) ? tar_list(test_handle, path, entries, &no_entries) : list(fd, path, entries, &no_entries);
+
+    int error = 1;
+    if (expected_ret != ret)               error = 0;
+    if (expected_no_entries != no_entries) error = 0;
+
+    qsort(expected_entries, expected_no_entries, sizeof(char *), cmper_str);
+    qsort(entries, expected_no_entries, sizeof(char *), cmper_str);
+
+    for (size_t i = 0; i < expected_no_entries; i++)
+    {
+        if (strcmp(expected_entries[i], entries[i]) != 0)
+        {
+            error = 0;
+            break;
+        }
+    }
+    
+    if (error == 0)
+    {
+        printf("ERROR : list() [args : path = %s , no_entries = %ld ]\n", path, copy_no_entries);
+        printf("no_entries = %ld AND expected_no_entries = %ld\n", no_entries, expected_no_entries);
+        printf("ret = %d AND expected_ret = %d\n", ret, expected_ret);
+
+        if (no_entries > 0)
+        {
+            char entries_str[100000] = "[ ";
+            char expected_entries_str[100000] = "[ ";
+            for (size_t i = 0; i < expected_no_entries - 1; i++)
+            {
+                strcat(expected_entries_str, expected_entries[i]);
+                strcat(expected_entries_str, ", ");
+                strcat(entries_str, entries[i]);
+                strcat(entries_str, ", ");
+            }
+            if (expected_no_entries > 0)
+            {
+                strcat(expected_entries_str, expected_entries[expected_no_entries - 1]);
+                strcat(entries_str, entries[expected_no_entries - 1]);
+            }
+            strcat(expected_entries_str, "]");
+            strcat(entries_str, "]");
+        
+            printf("entries = %s AND expected_entries = %s\n", entries_str, expected_entries_str);
+        }
+    } else printf("\tTest Passed !\n");
+
+    for (size_t i = 0; i < copy_no_entries; i++) {free(entries[i]); entries[i] = NULL;}
+    free(entries);
+    entries = NULL;
+}
+
+
+void read_file_test(int fd, char *path, size_t offset, size_t len, int expected_ret, size_t expected_len, char *expected_buffer)
+{
+    uint8_t *buffer = calloc(sizeof(char), len + 1);
+    int ret = (test_handle != NULL) ? tar_read_file(test_handle, path, offset, buffer, &len) : read_file(fd, path, offset, buffer, &len);
+    int no_error = 1;
+    if (expected_ret != ret) {no_error = 0; printf("ERROR : read_file()\nReturn %d instead of %d\n[args : path = %s ]\n", ret, expected_ret, path);}
+    if (expected_len != len) {no_error = 0; printf("ERROR : read_file()\nlen = %ld instead of len = %ld\n[args : path = %s ]\n", len, expected_len, path);}
+    if (strcmp(expected_buffer, (char *) buffer) != 0) {no_error = 0; printf("ERROR : read_file()\nbuffer = %s instead of buffer = %s\n[args : path = %s ]\n", buffer, expected_buffer, path);}
+
+    if (no_error == 1) printf("\tTest Passed !\n");
+    free(buffer);
+}
+
+void read_file_view_test(tar_handle_t *handle, char *path, size_t offset, int expected_ret, size_t expected_len, char *expected_buffer)
+{
+    const uint8_t *view;
+    size_t len;
+    int ret = read_file_view(handle, path, offset, &view, &len);
+    int no_error = 1;
+    if (expected_ret != ret) {no_error = 0; printf("ERROR : read_file_view()\nReturn %d instead of %d\n[args : path = %s ]\n", ret, expected_ret, path);}
+    if (expected_len != len) {no_error = 0; printf("ERROR : read_file_view()\nlen = %ld instead of len = %ld\n[args : path = %s ]\n", len, expected_len, path);}
+    if (len > 0 && memcmp(expected_buffer, view, len) != 0) {no_error = 0; printf("ERROR : read_file_view()\nview = %.*s instead of %s\n[args : path = %s ]\n", (int) len, view, expected_buffer, path);}
+
+    if (no_error == 1) printf("\tTest Passed !\n");
+}
+
+void sidecar_load_test(int fd, const char *idx_path, int expected)
+{
+    tar_index_t index;
+    int ret = sidecar_load(&index, fd, idx_path);
+    if (ret == 0) index_free(&index);
+    if (ret != expected) printf("ERROR : sidecar_load(%s) returned %d instead of %d\n", idx_path, ret, expected);
+    else                 printf("\tTest Passed !\n");
+}
+
+
+int gzip_archive(int fd, size_t flush_every)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+
+    uint8_t *archive = (uint8_t *) malloc(st.st_size);
+    uint8_t *compressed = (uint8_t *) malloc(compressBound(st.st_size) + 1024);
+    if (archive == NULL || compressed == NULL || pread(fd, archive, st.st_size, 0) != st.st_size) {free(archive); free(compressed); return -1;}
+
+    // 31: gzip header. A full flush ends a deflate block, so the index can make a checkpoint there
+    z_stream strm;
+    memset(&strm, 0, sizeof(z_stream));
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    strm.next_out = compressed;
+    strm.avail_out = compressBound(st.st_size) + 1024;
+    for (size_t done = 0; done < (size_t) st.st_size; done += flush_every)
+    {
+        size_t chunk = ((size_t) st.st_size - done < flush_every) ? st.st_size - done : flush_every;
+        strm.next_in = archive + done;
+        strm.avail_in = chunk;
+        deflate(&strm, (done + chunk == (size_t) st.st_size) ? Z_FINISH : Z_FULL_FLUSH);
+    }
+    size_t compressed_len = strm.total_out;
+    deflateEnd(&strm);
+
+    int gz_fd = temp_archive("gzip");
+    if (gz_fd != -1) write(gz_fd, compressed, compressed_len);
+
+    free(archive);
+    free(compressed);
+    return gz_fd;
+}
+
+
+void gz_read_test(int fd, gz_index_t *index, size_t min_points)
+{
+    struct stat st;
+    fstat(fd, &st);
+    uint8_t expected[1500];
+    uint8_t buffer[1500];
+    int no_errors = 0;
+
+    if (index->no_points < min_points || index->length != st.st_size)
+    {
+        printf("ERROR : gz_build_index() made %zu checkpoints for %ld bytes\n", index->no_points, (long) index->length);
+        return;
+    }
+
+    // Forward, then backward, so that the cursor is continued or restarted from a checkpoint
+    for (int backward = 0; backward <= 1; backward++)
+    {
+        for (off_t i = 0; i < st.st_size; i += 997)
+        {
+            off_t offset = backward ? st.st_size - 1 - i : i;
+            ssize_t expected_len = pread(fd, expected, sizeof(expected), offset);
+            ssize_t len = gz_read_at(index, buffer, sizeof(buffer), offset);
+            if (len != expected_len || memcmp(buffer, expected, len) != 0) no_errors++;
+        }
+    }
+    if (gz_read_at(index, buffer, sizeof(buffer), st.st_size) != 0) no_errors++;
+
+    if (no_errors > 0) printf("ERROR : gz_read_at()\n%d wrong reads\n", no_errors);
+    else               printf("\tTest Passed !\n");
+}
+
+
+int reverse_archive(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+
+    uint8_t *archive = (uint8_t *) malloc(st.st_size);
+    if (archive == NULL) return -1;
+    if (pread(fd, archive, st.st_size, 0) != st.st_size) {free(archive); return -1;}
+
+    // Offsets of the members, each one being a header and its content
+    size_t offsets[1024];
+    size_t no_members = 0;
+    size_t offset = 0;
+    while (offset + HEADER_SIZE <= (size_t) st.st_size && archive[offset] != '\0' && no_members < 1024)
+    {
+        offsets[no_members++] = offset;
+        offset += HEADER_SIZE + TAR_PADDED_SIZE(TAR_INT(((tar_header_t *) (archive + offset))->size));
+    }
+    offsets[no_members] = offset;
+
+    int reversed_fd = temp_archive("reversed");
+    if (reversed_fd == -1) {free(archive); return -1;}
+
+    for (size_t i = no_members; i-- > 0;) write(reversed_fd, archive + offsets[i], offsets[i + 1] - offsets[i]);
+    uint8_t end_blocks[2 * HEADER_SIZE];
+    memset(end_blocks, 0, sizeof(end_blocks));
+    write(reversed_fd, end_blocks, sizeof(end_blocks));
+
+    free(archive);
+    return reversed_fd;
+}
+
+void unordered_list_tests(int fd)
+{
+    printf("\nTest list() :\n");
+    char *expected_entries_1[] = {"folder1/subfolder1_1/", "folder1/file1.txt", "folder1/symlink2"};
+    list_test(fd, "folder1/", 3, 1, 3, expected_entries_1);
+
+    char *expected_entries_2[] = {"folder2/subfolder2_1/", "folder2/subfolder2_2/", "folder2/symlink3", "folder2/symlink4", "folder2/symlink_test"};
+    list_test(fd, "folder2/", 10, 1, 5, expected_entries_2);
+
+    char *expected_entries_3[] = {"folder4/text1.txt", "folder4/text2.txt", "folder4/text3.txt"};
+    list_test(fd, "folder4/", 10, 1, 3, expected_entries_3);
+
+    char *expected_entries_4[] = {"folder1/subfolder1_1/file1_1.txt", "folder1/subfolder1_1/file1_2.txt"};
+    list_test(fd, "symlink1", 10, 1, 2, expected_entries_4);
+
+    char *expected_entries_5[] = {"folder2/subfolder2_1/file2_2_1.txt"};
+    list_test(fd, "symlink_multi", 1, 1, 1, expected_entries_5);
+
+    char *expected_entries_6[] = {""};
+    list_test(fd, "doesnt_exist/", 10, 0, 0, expected_entries_6);
+
+    char *expected_entries_7[] = {""};
+    list_test(fd, "folder3/file3_1.txt", 10, 0, 0, expected_entries_7);
+}
+
+int link_cycle_archive(void)
+{
+    const char *const members[][2] = {{"dir/", ""}, {"loop_a", "->loop_b"}, {"loop_b", "->loop_a"}, {"dir/self", "->./self"}, {"dir/outside", "->../../file"}};
+    return members_archive("cycle", members, sizeof(members) / sizeof(members[0]));
+}
+
+int unsafe_archive(void)
+{
+    // name - typeflag - linkname
+    char *members[][3] = {{"ok.txt", "0", ""}, {"../evil.txt", "0", ""}, {"/tmp/lib_tar_absolute.txt", "0", ""},
+                          {"link", "2", "/tmp"}, {"link/lib_tar_escape.txt", "0", ""}, {"hard", "1", "ok.txt"}};
+
+    int fd = temp_archive("unsafe");
+    if (fd == -1) return -1;
+
+    // The writer has no hard links: the headers are filled by it and written as they are
+    tar_header_t header;
+    uint8_t content[HEADER_SIZE];
+    memset(content, 0, HEADER_SIZE);
+    memcpy(content, "abc", 3);
+
+    for (size_t i = 0; i < sizeof(members) / sizeof(members[0]); i++)
+    {
+        char typeflag = members[i][1][0];
+        size_t size = (typeflag == REGTYPE) ? 3 : 0;
+        if (tar_fill_header(&header, members[i][0], typeflag, size, 0644, 0, members[i][2]) != 0) {close(fd); return -1;}
+        write(fd, &header, HEADER_SIZE);
+        if (typeflag == REGTYPE) write(fd, content, HEADER_SIZE);
+    }
+
+    memset(&header, 0, HEADER_SIZE);
+    write(fd, &header, HEADER_SIZE);
+    write(fd, &header, HEADER_SIZE);
+    return fd;
+}
+
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void) st; (void) type; (void) ftw;
+    return remove(path);
+}
+
+
+void remove_tree(const char *path) { nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS); }
+
+
+void extract_test(int fd, int no_threads)
+{
+    char dest_dir[] = "/tmp/lib_tar_extract_XXXXXX";
+    if (mkdtemp(dest_dir) == NULL) {printf("ERROR : mkdtemp()\n"); return;}
+
+    tar_extract_options_t options = {.no_threads = no_threads, .no_permissions = 0};
+    ssize_t ret = tar_extract(fd, dest_dir, &options);
+    int no_errors = (ret != 23);
+
+    // Every regular file has the content and the mode of its member
+    tar_iter_t iter;
+    const tar_member_t *member;
+    char path[2 * TAR_PATH_MAX];
+    uint8_t expected[4096];
+    uint8_t extracted[4096];
+    struct stat st;
+    tar_iter_begin(&iter, fd);
+    while (tar_iter_next(&iter, &member) == 1)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dest_dir, member->name);
+        if (lstat(path, &st) != 0) {no_errors++; continue;}
+        if ((st.st_mode & 07777) != member->mode && member->typeflag != SYMTYPE) no_errors++;
+
+        if (member->typeflag == DIRTYPE && !S_ISDIR(st.st_mode)) no_errors++;
+        if (member->typeflag == SYMTYPE)
+        {
+            ssize_t len = readlink(path, (char *) extracted, sizeof(extracted));
+            if (!S_ISLNK(st.st_mode) || len != (ssize_t) strlen(member->linkname) || memcmp(extracted, member->linkname, len) != 0) no_errors++;
+        }
+        if (member->typeflag == REGTYPE)
+        {
+            size_t len = tar_iter_read(&iter, expected, sizeof(expected));
+            int file_fd = open(path, O_RDONLY);
+            if (!S_ISREG(st.st_mode) || (size_t) st.st_size != member->size || read(file_fd, extracted, sizeof(extracted)) != (ssize_t) len
+                || memcmp(expected, extracted, len) != 0) no_errors++;
+            close(file_fd);
+        }
+    }
+    tar_iter_end(&iter);
+
+    remove_tree(dest_dir);
+    if (no_errors > 0) printf("ERROR : tar_extract()\n%d wrong entries [args : no_threads = %d, ret = %ld ]\n", no_errors, no_threads, (long) ret);
+    else printf("\tTest Passed !\n");
+}
+
+
+void default_modes_extract_test(int fd)
+{
+    char dest_dir[] = "/tmp/lib_tar_modes_XXXXXX";
+    if (mkdtemp(dest_dir) == NULL) {printf("ERROR : mkdtemp()\n"); return;}
+
+    // The directories get the mode left by the umask, not the one they were created with
+    mode_t mask = umask(0);
+    umask(mask);
+    tar_extract_options_t options = {.no_threads = 1, .no_permissions = 1};
+    ssize_t ret = tar_extract(fd, dest_dir, &options);
+    int no_errors = (ret != 23);
+
+    tar_iter_t iter;
+    const tar_member_t *member;
+    char path[2 * TAR_PATH_MAX];
+    struct stat st;
+    tar_iter_begin(&iter, fd);
+    while (tar_iter_next(&iter, &member) == 1)
+    {
+        if (member->typeflag != DIRTYPE) continue;
+        snprintf(path, sizeof(path), "%s/%s", dest_dir, member->name);
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode) || (st.st_mode & 07777) != (0777 & ~mask)) no_errors++;
+    }
+    tar_iter_end(&iter);
+
+    remove_tree(dest_dir);
+    if (no_errors > 0) printf("ERROR : tar_extract()\n%d wrong directories [args : no_permissions = 1, ret = %ld ]\n", no_errors, (long) ret);
+    else printf("\tTest Passed !\n");
+}
+
+
+void unsafe_extract_test(int fd)
+{
+    char dest_dir[] = "/tmp/lib_tar_extract_XXXXXX";
+    char path[2 * TAR_PATH_MAX];
+    struct stat st, hard_st;
+    if (mkdtemp(dest_dir) == NULL) {printf("ERROR : mkdtemp()\n"); return;}
+
+    // The archive is extracted one level down, so that '../evil.txt' would still be inside the temporary directory
+    snprintf(path, sizeof(path), "%s/out", dest_dir);
+    int no_errors = (tar_extract(fd, path, NULL) != -2);
+
+    snprintf(path, sizeof(path), "%s/out/ok.txt", dest_dir);
+    if (stat(path, &st) != 0 || st.st_size != 3) no_errors++;
+    snprintf(path, sizeof(path), "%s/out/hard", dest_dir);
+    if (stat(path, &hard_st) != 0 || hard_st.st_ino != st.st_ino) no_errors++;
+    snprintf(path, sizeof(path), "%s/out/link", dest_dir);
+    if (lstat(path, &st) != 0 || !S_ISLNK(st.st_mode)) no_errors++;
+    snprintf(path, sizeof(path), "%s/evil.txt", dest_dir);
+    if (lstat(path, &st) == 0) no_errors++;
+    if (lstat("/tmp/lib_tar_escape.txt", &st) == 0 || lstat("/tmp/lib_tar_absolute.txt", &st) == 0) no_errors++;
+
+    remove_tree(dest_dir);
+    if (no_errors > 0) printf("ERROR : tar_extract()\n%d entries extracted outside of the directory or missing\n", no_errors);
+    else printf("\tTest Passed !\n");
+}
+
+
+int writer_archive(uint8_t *big, size_t big_size)
+{
+    int fd = temp_archive("writer");
+    if (fd == -1) return -1;
+
+    // Garbage after the end of the archive is truncated by tar_writer_finish()
+    uint8_t garbage[3 * HEADER_SIZE];
+    memset(garbage, 'X', sizeof(garbage));
+    pwrite(fd, garbage, sizeof(garbage), 100000);
+
+    char long_name[160];
+    memset(long_name, 'a', sizeof(long_name));
+    memcpy(long_name, "dir/", 4);
+    long_name[60] = '/';
+    long_name[sizeof(long_name) - 1] = '\0';
+
+    tar_writer_t writer;
+    int ret = tar_writer_init(&writer, fd);
+    if (ret == 0) ret = tar_add_dir(&writer, "dir", 0750, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/small.txt", (const uint8_t *) "hello", 5, 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/big.bin", big, big_size, 0600, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/empty", NULL, 0, 0644, 0);
+    if (ret == 0) ret = tar_add_symlink(&writer, "link", "dir/small.txt", 0);
+    if (ret == 0) ret = tar_add_data(&writer, long_name, (const uint8_t *) "long", 4, 0644, 0);
+    // The name does not fit, nothing is written
+    memset(long_name, 'b', sizeof(long_name) - 1);
+    if (ret == 0 && tar_add_data(&writer, long_name, (const uint8_t *) "x", 1, 0644, 0) != -1) ret = -1;
+    if (tar_writer_finish(&writer) != 0 || ret != 0) {close(fd); return -1;}
+    return fd;
+}
+
+
+void writer_test(int fd, uint8_t *big, size_t big_size)
+{
+    struct stat st;
+    int no_errors = (check_archive(fd) != 6);
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size != TAR_PADDED_SIZE(big_size) + 10 * HEADER_SIZE) no_errors++;
+
+    tar_header_t header;
+    if (pread(fd, &header, HEADER_SIZE, 0) != HEADER_SIZE || strcmp(header.mode, "0000750") != 0 || header.typeflag != DIRTYPE) no_errors++;
+    if (exists(fd, "dir/small.txt") != 1 || is_symlink(fd, "link") != 1 || is_dir(fd, "dir/") != 1) no_errors++;
+
+    uint8_t *buffer = (uint8_t *) malloc(big_size);
+    size_t len = big_size;
+    if (buffer == NULL || read_file(fd, "dir/big.bin", 0, buffer, &len) != 0 || len != big_size || memcmp(buffer, big, big_size) != 0) no_errors++;
+    len = big_size;
+    if (buffer == NULL || read_file(fd, "link", 0, buffer, &len) != 0 || len != 5 || memcmp(buffer, "hello", 5) != 0) no_errors++;
+    free(buffer);
+
+    // The long name is split between the prefix and the name fields
+    tar_iter_t iter;
+    const tar_member_t *member;
+    int no_long = 0;
+    tar_iter_begin(&iter, fd);
+    while (tar_iter_next(&iter, &member) == 1) no_long += (strlen(member->name) == 159 && member->size == 4);
+    tar_iter_end(&iter);
+    if (no_long != 1) no_errors++;
+
+    // and read back by its full path, through the archive and through a handle
+    char long_name[160];
+    memset(long_name, 'a', sizeof(long_name));
+    memcpy(long_name, "dir/", 4);
+    long_name[60] = '/';
+    long_name[sizeof(long_name) - 1] = '\0';
+    char content[8];
+    len = sizeof(content);
+    if (exists(fd, long_name) != 1 || exists(fd, long_name + 61) != 0 || read_file(fd, long_name, 0, (uint8_t *) content, &len) != 0 || len != 4) no_errors++;
+    tar_handle_t *handle = tar_open(fd);
+    len = sizeof(content);
+    if (handle == NULL || tar_exists(handle, long_name) == 0 || tar_exists(handle, long_name + 61) != 0
+        || tar_read_file(handle, long_name, 0, (uint8_t *) content, &len) != 0 || len != 4 || memcmp(content, "long", 4) != 0) no_errors++;
+    tar_close(handle);
+
+    if (no_errors > 0) printf("ERROR : tar_writer\n%d wrong members\n", no_errors);
+    else printf("\tTest Passed !\n");
+}
+
+
+void add_files_test(int fd, int no_threads)
+{
+    char dest_dir[] = "/tmp/lib_tar_add_XXXXXX";
+    if (mkdtemp(dest_dir) == NULL) {printf("ERROR : mkdtemp()\n"); return;}
+    tar_extract(fd, dest_dir, NULL);
+
+    // The members of the archive in its order, plus a file too large to be read in memory and a missing one
+    char paths[32][2 * TAR_PATH_MAX];
+    char names[32][TAR_PATH_MAX];
+    const char *path_list[32];
+    const char *name_list[32];
+    size_t n = 0;
+    tar_iter_t iter;
+    const tar_member_t *member;
+    tar_iter_begin(&iter, fd);
+    while (tar_iter_next(&iter, &member) == 1 && n < 30)
+    {
+        snprintf(paths[n], sizeof(paths[n]), "%s/%s", dest_dir, member->name);
+        snprintf(names[n], sizeof(names[n]), "%s", member->name);
+        n++;
+    }
+    tar_iter_end(&iter);
+
+    size_t big_size = WRITER_PREFETCH_MAX + 1000;
+    uint8_t *big = (uint8_t *) malloc(big_size);
+    for (size_t i = 0; big != NULL && i < big_size; i++) big[i] = (uint8_t) (i * 7);
+    snprintf(paths[n], sizeof(paths[n]), "%s/big.bin", dest_dir);
+    snprintf(names[n++], sizeof(names[0]), "big.bin");
+    int big_fd = open(paths[n - 1], O_WRONLY | O_CREAT, 0644);
+    if (big == NULL || write(big_fd, big, big_size) != (ssize_t) big_size) {printf("ERROR : big.bin\n"); free(big); close(big_fd); remove_tree(dest_dir); return;}
+    close(big_fd);
+    snprintf(paths[n], sizeof(paths[n]), "%s/doesnt_exist", dest_dir);
+    snprintf(names[n++], sizeof(names[0]), "doesnt_exist");
+    for (size_t i = 0; i < n; i++) {path_list[i] = paths[i]; name_list[i] = names[i];}
+
+    int out_fd = temp_archive("added");
+    tar_writer_t writer;
+    ssize_t ret = -1;
+    if (out_fd != -1 && tar_writer_init(&writer, out_fd) == 0)
+    {
+        ret = tar_add_files(&writer, path_list, name_list, n, no_threads);
+        if (tar_writer_finish(&writer) != 0) ret = -1;
+    }
+    int no_errors = (ret != -2 || check_archive(out_fd) != 24);
+
+    // Same members, in the same order, as the original archive
+    tar_iter_t out_iter;
+    const tar_member_t *out_member;
+    uint8_t expected[4096];
+    uint8_t written[4096];
+    tar_iter_begin(&iter, fd);
+    tar_iter_begin(&out_iter, out_fd);
+    while (tar_iter_next(&iter, &member) == 1)
+    {
+        if (tar_iter_next(&out_iter, &out_member) != 1) {no_errors++; break;}
+        if (strcmp(member->name, out_member->name) != 0 || member->typeflag != out_member->typeflag || member->size != out_member->size
+            || member->mode != out_member->mode || strcmp(member->linkname, out_member->linkname) != 0) no_errors++;
+        size_t len = tar_iter_read(&iter, expected, sizeof(expected));
+        if (tar_iter_read(&out_iter, written, sizeof(written)) != len || memcmp(expected, written, len) != 0) no_errors++;
+    }
+    tar_iter_end(&iter);
+    tar_iter_end(&out_iter);
+
+    uint8_t *buffer = (uint8_t *) malloc(big_size);
+    size_t len = big_size;
+    if (buffer == NULL || read_file(out_fd, "big.bin", 0, buffer, &len) != 0 || len != big_size || memcmp(buffer, big, big_size) != 0) no_errors++;
+    free(buffer);
+    free(big);
+
+    close(out_fd);
+    remove_tree(dest_dir);
+    if (no_errors > 0) printf("ERROR : tar_add_files()\n%d wrong members [args : no_threads = %d, ret = %ld ]\n", no_errors, no_threads, (long) ret);
+    else printf("\tTest Passed !\n");
+}
+
+
+// Appends a file with the given content, returns the number of errors
+static int append_one(int fd, tar_handle_t *handle, const char *idx_path, const char *name, const char *content)
+{
+    tar_writer_t writer;
+    if (tar_append_begin(&writer, fd, handle) != 0) return 1;
+    int no_errors = (tar_add_data(&writer, name, (const uint8_t *) content, strlen(content), 0644, 0) != 0);
+    if (tar_append_finish(&writer, handle, idx_path) != 0) no_errors++;
+    return no_errors;
+}
+
+
+// Number of errors if the handle does not read 'expected' at 'path'
+static int handle_content(tar_handle_t *handle, char *path, const char *expected)
+{
+    uint8_t buffer[64];
+    size_t len = sizeof(buffer);
+    if (handle == NULL || tar_read_file(handle, path, 0, buffer, &len) != 0) return 1;
+    return (len != strlen(expected) || memcmp(buffer, expected, len) != 0);
+}
+
+
+// Number of members journaled in a sidecar since it was written, UINT64_MAX if it cannot be read
+static uint64_t journaled(const char *idx_path)
+{
+    sidecar_header_t header;
+    int idx_fd = open(idx_path, O_RDONLY);
+    ssize_t nber_read = pread(idx_fd, &header, sizeof(sidecar_header_t), 0);
+    close(idx_fd);
+    return (nber_read == sizeof(sidecar_header_t)) ? header.no_journaled : UINT64_MAX;
+}
+
+
+void append_test(int fd)
+{
+    char idx_path[] = "/tmp/lib_tar_append_XXXXXX";
+    int idx_fd = mkstemp(idx_path);
+    int copy_fd = corrupt_archive(fd, 0, NULL, NULL, NULL);
+    if (idx_fd == -1 || copy_fd == -1) {printf("ERROR : append files\n"); return;}
+    close(idx_fd);
+
+    // End of the last member, before the zero blocks
+    tar_iter_t iter;
+    const tar_member_t *member;
+    off_t expected_end = 0;
+    tar_iter_begin(&iter, copy_fd);
+    while (tar_iter_next(&iter, &member) == 1) expected_end = member->data_offset + TAR_PADDED_SIZE(member->size);
+    tar_iter_end(&iter);
+
+    tar_handle_t *handle = tar_open(copy_fd);
+    int no_errors = (handle == NULL || tar_write_sidecar(handle, idx_path) != 0);
+    if (tar_archive_end(copy_fd, NULL) != expected_end || tar_archive_end(copy_fd, handle) != expected_end) no_errors++;
+
+    // A member shadowing an existing one, and a new directory
+    tar_writer_t writer;
+    if (tar_append_begin(&writer, copy_fd, handle) != 0) no_errors++;
+    else
+    {
+        if (tar_add_data(&writer, "folder1/file1.txt", (const uint8_t *) "new content", 11, 0600, 0) != 0) no_errors++;
+        if (tar_add_dir(&writer, "new_dir", 0755, 0) != 0) no_errors++;
+        if (tar_add_data(&writer, "new_dir/new.txt", (const uint8_t *) "new file", 8, 0644, 0) != 0) no_errors++;
+        if (tar_append_finish(&writer, handle, idx_path) != 0) no_errors++;
+    }
+
+    struct stat st;
+    if (check_archive(copy_fd) != 26 || fstat(copy_fd, &st) != 0 || st.st_size != expected_end + 3 * HEADER_SIZE + 2 * HEADER_SIZE + 2 * HEADER_SIZE) no_errors++;
+    no_errors += handle_content(handle, "folder1/file1.txt", "new content");
+    no_errors += handle_content(handle, "new_dir/new.txt", "new file");
+    char entry[100];
+    char *entries[] = {entry};
+    size_t no_entries = 1;
+    if (handle == NULL || tar_list(handle, "new_dir/", entries, &no_entries) != 1 || no_entries != 1 || strcmp(entry, "new_dir/new.txt") != 0) no_errors++;
+    tar_lookup_result_t result;
+    char *paths[] = {"folder1/file1.txt"};
+    if (tar_lookup_batch(copy_fd, paths, 1, &result) != 1 || result.size != 11) no_errors++;
+    tar_close(handle);
+
+    // The new members were journaled in the sidecar: it is not stale, and a handle loaded from it indexes them
+    tar_index_t loaded;
+    if (journaled(idx_path) != 3 || sidecar_load(&loaded, copy_fd, idx_path) != 0) no_errors++;
+    else
+    {
+        if (loaded.map != NULL || index_find(&loaded, "new_dir/new.txt") == NULL || index_find(&loaded, "new_dir/")->first_child == INDEX_EMPTY) no_errors++;
+        index_free(&loaded);
+    }
+    handle = tar_open_sidecar(copy_fd, idx_path);
+    no_errors += handle_content(handle, "folder1/file1.txt", "new content");
+    no_errors += append_one(copy_fd, handle, idx_path, "new_dir/second.txt", "second");
+    no_errors += handle_content(handle, "new_dir/second.txt", "second");
+    no_errors += handle_content(handle, "new_dir/new.txt", "new file");
+    tar_close(handle);
+
+    // Without a handle, then on a mapped archive
+    no_errors += append_one(copy_fd, NULL, idx_path, "folder1/file1.txt", "third");
+    if (journaled(idx_path) != 5) no_errors++;
+    handle = tar_open_sidecar(copy_fd, idx_path);
+    no_errors += handle_content(handle, "folder1/file1.txt", "third");
+    tar_close(handle);
+
+    handle = tar_open_mmap(copy_fd);
+    no_errors += append_one(copy_fd, handle, NULL, "text4.txt", "mapped");
+    const uint8_t *view;
+    size_t len;
+    if (handle == NULL || read_file_view(handle, "text4.txt", 0, &view, &len) != 0 || len != 6 || memcmp(view, "mapped", 6) != 0) no_errors++;
+    tar_close(handle);
+    if (check_archive(copy_fd) != 29) no_errors++;
+
+    // Through the file descriptor, the last member with a path is the one read and typed, and it is listed once
+    if (tar_append_begin(&writer, copy_fd, NULL) != 0) no_errors++;
+    else
+    {
+        if (tar_add_symlink(&writer, "text4.txt", "text1.txt", 0) != 0) no_errors++;
+        if (tar_add_data(&writer, "lonely/a.txt", (const uint8_t *) "alone", 5, 0644, 0) != 0) no_errors++;
+        if (tar_append_finish(&writer, NULL, idx_path) != 0) no_errors++;
+    }
+    uint8_t buffer[64];
+    len = sizeof(buffer);
+    if (read_file(copy_fd, "folder1/file1.txt", 0, buffer, &len) != 0 || len != 5 || memcmp(buffer, "third", 5) != 0) no_errors++;
+    if (is_file(copy_fd, "text4.txt") != 0 || is_symlink(copy_fd, "text4.txt") != 1) no_errors++;
+    char listed[16][100];
+    char *listed_entries[16];
+    for (size_t i = 0; i < 16; i++) listed_entries[i] = listed[i];
+    no_entries = 16;
+    int no_file1 = 0;
+    if (list(copy_fd, "folder1/", listed_entries, &no_entries) != 1) no_errors++;
+    for (size_t i = 0; i < no_entries; i++) no_file1 += (strcmp(listed[i], "folder1/file1.txt") == 0);
+    if (no_file1 != 1) no_errors++;
+
+    // A directory appended after its own entries, which are linked to it
+    handle = tar_open_sidecar(copy_fd, idx_path);
+    if (tar_append_begin(&writer, copy_fd, handle) != 0) no_errors++;
+    else
+    {
+        if (tar_add_dir(&writer, "lonely", 0755, 0) != 0) no_errors++;
+        if (tar_add_data(&writer, "lonely/b.txt", (const uint8_t *) "second", 6, 0644, 0) != 0) no_errors++;
+        if (tar_append_finish(&writer, handle, idx_path) != 0) no_errors++;
+    }
+    char lonely[2][100];
+    char *lonely_entries[] = {lonely[0], lonely[1]};
+    no_entries = 2;
+    if (handle == NULL || tar_list(handle, "lonely/", lonely_entries, &no_entries) != 1 || no_entries != 2
+        || strcmp(lonely[0], "lonely/a.txt") != 0 || strcmp(lonely[1], "lonely/b.txt") != 0) no_errors++;
+    tar_close(handle);
+
+    // A full journal: the sidecar is written again, and mapped when loaded
+    handle = tar_open_sidecar(copy_fd, idx_path);
+    if (tar_append_begin(&writer, copy_fd, handle) != 0) no_errors++;
+    else
+    {
+        for (int i = 0; i <= SIDECAR_JOURNAL_MIN; i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "many/%d.txt", i);
+            if (tar_add_data(&writer, name, (const uint8_t *) name, strlen(name), 0644, 0) != 0) no_errors++;
+        }
+        if (tar_append_finish(&writer, handle, idx_path) != 0) no_errors++;
+    }
+    tar_close(handle);
+    handle = tar_open_sidecar(copy_fd, idx_path);
+    if (journaled(idx_path) != 0 || handle == NULL || handle->index.map == NULL) no_errors++;
+    no_errors += handle_content(handle, "lonely/b.txt", "second");
+    tar_close(handle);
+
+    unlink(idx_path);
+    close(copy_fd);
+    if (no_errors > 0) printf("ERROR : tar_append\n%d errors\n", no_errors);
+    else printf("\tTest Passed !\n");
+}
+
+
+void async_test(tar_handle_t *handle, const tar_async_options_t *options)
+{
+    char *paths[] = {"folder4/text3.txt", "folder1/file1.txt", "symlink1/file1_1.txt", "folder2/symlink4", "folder1/", "doesnt_exist.txt", "text1.txt"};
+    size_t offsets[] = {7, 0, 100, 0, 0, 0, 3000};
+    size_t no_paths = sizeof(paths) / sizeof(paths[0]);
+
+    // The same reads many times, more than the depth of the queue, some with a buffer too small for the file
+    tar_read_req_t reqs[70];
+    uint8_t buffers[70][600];
+    size_t n = sizeof(reqs) / sizeof(reqs[0]);
+    for (size_t i = 0; i < n; i++)
+    {
+        memset(&reqs[i], 0, sizeof(tar_read_req_t));
+        reqs[i].path = paths[i % no_paths];
+        reqs[i].offset = offsets[i % no_paths];
+        reqs[i].dest = buffers[i];
+        reqs[i].len = (i % 3 == 0) ? 10 : sizeof(buffers[i]);
+    }
+
+    int no_errors = 0;
+    ssize_t no_succeeded = tar_read_batch(handle, reqs, n, options);
+    size_t expected_succeeded = 0;
+    uint8_t expected[600];
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t len = (i % 3 == 0) ? 10 : sizeof(expected);
+        ssize_t ret = tar_read_file(handle, reqs[i].path, reqs[i].offset, expected, &len);
+        expected_succeeded += (ret >= 0);
+        if (ret != reqs[i].ret || len != reqs[i].len || memcmp(expected, reqs[i].dest, len) != 0) no_errors++;
+    }
+    if (no_succeeded != (ssize_t) expected_succeeded) no_errors++;
+
+    // Driven by poll() on the eventfd, as an event loop would
+    tar_async_t async;
+    if (tar_async_init(&async, handle, options) != 0) no_errors++;
+    else
+    {
+        tar_read_req_t *ptrs[70];
+        tar_read_req_t *done[70];
+        for (size_t i = 0; i < n; i++) {ptrs[i] = &reqs[i]; reqs[i].len = sizeof(buffers[i]); reqs[i].ret = -3; reqs[i].user_data = &reqs[i];}
+
+        size_t no_submitted = 0, no_reaped = 0;
+        while (no_reaped < n)
+        {
+            ssize_t ret = tar_async_submit(&async, ptrs + no_submitted, n - no_submitted);
+            if (ret < 0) {no_errors++; break;}
+            no_submitted += ret;
+
+            struct pollfd pfd = {.fd = tar_async_fd(&async), .events = POLLIN, .revents = 0};
+            if (poll(&pfd, 1, 5000) != 1) {no_errors++; break;}
+            size_t no_done = tar_async_reap(&async, done, n, 0);
+            for (size_t i = 0; i < no_done; i++) no_errors += (done[i]->user_data != done[i] || done[i]->ret == -3);
+            no_reaped += no_done;
+        }
+        tar_async_free(&async);
+    }
+
+    // A submission refused by the kernel: the reads from the first one it did not take are given back
+    if (tar_async_init(&async, handle, options) == 0 && async.uring)
+    {
+        tar_read_req_t *ptrs[] = {&reqs[4], &reqs[0], &reqs[5]};
+        tar_read_req_t *done[3];
+        int ring_fd = async.ring_fd;
+        async.ring_fd = -1;
+        if (tar_async_submit(&async, ptrs, 3) != 1 || async.in_flight != 1 || async.done_len != 1) no_errors++;
+        async.ring_fd = ring_fd;
+        if (tar_async_submit(&async, ptrs + 1, 2) != 2) no_errors++;
+        size_t no_reaped = 0;
+        while (async.in_flight > 0) no_reaped += tar_async_reap(&async, done, 3, 1);
+        if (no_reaped != 3 || reqs[0].ret < 0) no_errors++;
+        tar_async_free(&async);
+    }
+    else if (async.event_fd != -1) tar_async_free(&async);
+
+    if (no_errors > 0) printf("ERROR : tar_async\n%d wrong reads [args : depth = %u, no_uring = %d ]\n", no_errors, options->depth, options->no_uring);
+    else printf("\tTest Passed !\n");
+}
+
+
+void cache_test(int fd)
+{
+    tar_cache_stats_t stats;
+    int no_errors = (tar_cache_get_stats(&stats) != -1 || tar_cache_open(fd) != -1);
+
+    // 16 blocks in 4 shards: the archive does not fit, blocks are evicted
+    if (tar_cache_init(16 * CACHE_BLOCK_SIZE, 3) != 0 || tar_cache_open(fd) != 0) {printf("ERROR : tar_cache_init()\n"); return;}
+    uint8_t first[600], second[600];
+    size_t first_len = sizeof(first), second_len = sizeof(second);
+    read_file(fd, "folder1/subfolder1_1/file1_1.txt", 0, first, &first_len);
+    tar_cache_get_stats(&stats);
+    uint64_t misses = stats.misses;
+    read_file(fd, "folder1/subfolder1_1/file1_1.txt", 0, second, &second_len);
+    tar_cache_get_stats(&stats);
+    if (first_len != 594 || second_len != first_len || memcmp(first, second, first_len) != 0 || stats.misses != misses || stats.hits == 0) no_errors++;
+    if (stats.capacity != 16 || stats.no_blocks == 0 || stats.no_blocks > 16) no_errors++;
+
+    // Blocks written by the writer are not served from the cache anymore
+    int copy_fd = corrupt_archive(fd, 0, NULL, NULL, NULL);
+    tar_cache_open(copy_fd);
+    first_len = sizeof(first);
+    read_file(copy_fd, "folder1/file1.txt", 0, first, &first_len);
+    tar_writer_t writer;
+    if (tar_append_begin(&writer, copy_fd, NULL) != 0 || tar_add_data(&writer, "folder1/file1.txt", (const uint8_t *) "cached", 6, 0644, 0) != 0
+        || tar_append_finish(&writer, NULL, NULL) != 0) no_errors++;
+    tar_lookup_result_t result;
+    char *paths[] = {"folder1/file1.txt"};
+    if (tar_lookup_batch(copy_fd, paths, 1, &result) != 1 || result.size != 6 || check_archive(copy_fd) != 24) no_errors++;
+    tar_cache_close(copy_fd);
+    close(copy_fd);
+
+    tar_cache_get_stats(&stats);
+    if (stats.evictions == 0) no_errors++;
+    if (no_errors > 0) printf("ERROR : block cache\n%d errors [hits = %lu, misses = %lu, evictions = %lu ]\n", no_errors,
+                              (unsigned long) stats.hits, (unsigned long) stats.misses, (unsigned long) stats.evictions);
+    else printf("\tTest Passed !\n");
+}
+
+
+static void *server_thread(void *arg)
+{
+    tar_server_run((tar_server_t *) arg);
+    return NULL;
+}
+
+
+// Compares the answers of the server with the functions reading the archive directly
+static int compare_remote(tar_remote_t *remote, int fd)
+{
+    char *paths[] = {"folder1/", "folder1/file1.txt", "folder1/subfolder1_1/file1_1.txt", "folder4/text3.txt", "text1.txt",
+                     "symlink1", "folder2/symlink4", "folder2/", "missing", "folder1"};
+    int no_errors = 0;
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        no_errors += tar_remote_exists(remote, paths[i]) != exists(fd, paths[i]);
+        no_errors += tar_remote_is_dir(remote, paths[i]) != is_dir(fd, paths[i]);
+        no_errors += tar_remote_is_file(remote, paths[i]) != is_file(fd, paths[i]);
+        no_errors += tar_remote_is_symlink(remote, paths[i]) != is_symlink(fd, paths[i]);
+
+        char names[2][10][TAR_PATH_MAX];
+        char *entries[2][10];
+        for (size_t j = 0; j < 10; j++) {entries[0][j] = names[0][j]; entries[1][j] = names[1][j];}
+        size_t no_entries[2] = {10, 10};
+        no_errors += tar_remote_list(remote, paths[i], entries[0], &no_entries[0]) != list(fd, paths[i], entries[1], &no_entries[1]);
+        no_errors += no_entries[0] != no_entries[1];
+        for (size_t j = 0; j < no_entries[0] && j < no_entries[1]; j++) no_errors += strcmp(names[0][j], names[1][j]) != 0;
+
+        size_t offsets[] = {0, 5, 3000};
+        for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++)
+        {
+            uint8_t content[2][100];
+            size_t len[2] = {100, 100};
+            no_errors += tar_remote_read_file(remote, paths[i], offsets[j], content[0], &len[0]) != read_file(fd, paths[i], offsets[j], content[1], &len[1]);
+            no_errors += len[0] != len[1] || memcmp(content[0], content[1], len[0]) != 0;
+        }
+    }
+    return no_errors;
+}
+
+
+// Replies that do not fit the buffers of the client are consumed all the same: the next reply is read from its start
+static int oversized_replies(void)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) return 1;
+    tar_remote_t remote = {.sock_fd = fds[0], .tar_fd = -1, .shared = 0, .is_inline = 1};
+
+    reply_t replies[4] = {{.ret = 0, .len = 6, .count = 3}, {.ret = 1}, {.ret = 100, .len = 100, .flags = REPLY_INLINE}, {.ret = 1}};
+    uint8_t payload[100] = "a\0b\0c";
+    int no_errors = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (protocol_send(fds[1], &replies[i], sizeof(reply_t), -1) != 0) no_errors++;
+        if (replies[i].len > 0 && protocol_send(fds[1], payload, replies[i].len, -1) != 0) no_errors++;
+    }
+
+    char names[2][TAR_PATH_MAX];
+    char *entries[2] = {names[0], names[1]};
+    size_t no_entries = 2;
+    uint8_t content[10];
+    size_t len = sizeof(content);
+    if (tar_remote_list(&remote, "dir/", entries, &no_entries) != -1 || no_entries != 0 || tar_remote_exists(&remote, "dir/") != 1) no_errors++;
+    if (tar_remote_read_file(&remote, "file", 0, content, &len) != -1 || len != 0 || tar_remote_exists(&remote, "file") != 1) no_errors++;
+
+    close(fds[0]);
+    close(fds[1]);
+    return no_errors;
+}
+
+
+void server_test(int fd)
+{
+    char dir[] = "/tmp/lib_tar_server_XXXXXX";
+    if (mkdtemp(dir) == NULL) {printf("ERROR : mkdtemp()\n"); return;}
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "%s/socket", dir);
+
+    tar_server_t *server = (tar_server_t *) malloc(sizeof(tar_server_t));
+    pthread_t thread;
+    if (server == NULL || tar_server_init(server, socket_path) != 0 || pthread_create(&thread, NULL, server_thread, server) != 0)
+    {
+        printf("ERROR : tar_server_init()\n");
+        free(server);
+        rmdir(dir);
+        return;
+    }
+
+    int no_errors = (tar_remote_open(socket_path, -1) != NULL) + oversized_replies();
+    int gz_fd = gzip_archive(fd, 2048);
+    tar_remote_t *first = tar_remote_open(socket_path, fd);
+    tar_remote_t *second = tar_remote_open(socket_path, fd);
+    tar_remote_t *compressed = tar_remote_open(socket_path, gz_fd);
+
+    // A client sending half a request, and one sending requests without reading the replies, do not hold up the others
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    int stalled_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (stalled_fd == -1 || connect(stalled_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || send(stalled_fd, "\x07\x01", 2, 0) != 2) no_errors++;
+    tar_remote_t *flooding = tar_remote_open(socket_path, gz_fd);
+    if (flooding == NULL) no_errors++;
+    else
+    {
+        request_t request = {.op = OP_READ_FILE, .version = PROTOCOL_VERSION, .path_len = 9, .offset = 0, .len = 100};
+        uint8_t message[sizeof(request_t) + 9];
+        memcpy(message, &request, sizeof(request_t));
+        memcpy(message + sizeof(request_t), "text1.txt", 9);
+        for (int i = 0; i < 100000 && send(flooding->sock_fd, message, sizeof(message), MSG_DONTWAIT) == sizeof(message); i++);
+    }
+
+    if (first == NULL || second == NULL || compressed == NULL) no_errors++;
+    else
+    {
+        // The second client shares the index built for the first one
+        if (first->shared != 0 || second->shared != 1 || first->is_inline != 0 || compressed->is_inline != 1) no_errors++;
+        no_errors += compare_remote(first, fd) + compare_remote(second, fd) + compare_remote(compressed, fd);
+
+        // An archive modified since it was indexed is indexed again, its earlier version is closed once no client uses it
+        int copy_fd = corrupt_archive(fd, 0, NULL, NULL, NULL);
+        tar_remote_t *copy = tar_remote_open(socket_path, copy_fd);
+        if (copy != NULL) tar_remote_close(copy);
+        no_errors += append_one(copy_fd, NULL, NULL, "added.txt", "added");
+        copy = tar_remote_open(socket_path, copy_fd);
+        if (copy == NULL || copy->shared != 0 || tar_remote_exists(copy, "added.txt") != 1) no_errors++;
+        no_errors += append_one(copy_fd, NULL, NULL, "added_again.txt", "added");
+        if (copy != NULL) tar_remote_close(copy);
+        // Answered after the server saw the disconnection
+        if (tar_remote_exists(first, "folder1/file1.txt") != 1) no_errors++;
+        if (copy_fd != -1) close(copy_fd);
+    }
+    if (first != NULL) tar_remote_close(first);
+    if (second != NULL) tar_remote_close(second);
+    if (compressed != NULL) tar_remote_close(compressed);
+    if (flooding != NULL) tar_remote_close(flooding);
+    if (stalled_fd != -1) close(stalled_fd);
+
+    tar_server_stop(server);
+    pthread_join(thread, NULL);
+    size_t no_open = 0;
+    for (size_t i = 0; i < server->no_archives; i++) no_open += (server->archives[i].handle != NULL);
+    if (server->no_archives != 3 || no_open != 2) no_errors++;
+    tar_server_free(server);
+    free(server);
+    if (gz_fd != -1) close(gz_fd);
+    if (access(socket_path, F_OK) == 0 || rmdir(dir) != 0) no_errors++;
+
+    if (no_errors > 0) printf("ERROR : query server\n%d errors\n", no_errors);
+    else printf("\tTest Passed !\n");
+}
+
+
+typedef struct stream_context
+{
+    int fd;                       /* the archive, to compare the contents with read_file() */
+    size_t no_members;
+    size_t no_ended;
+    int no_errors;
+    uint8_t content[4096];
+    size_t content_len;
+    int abort_at;                 /* member at which on_member stops the parsing, -1 for none */
+} stream_context_t;
+
+
+static int stream_member(const tar_member_t *member, void *user_data)
+{
+    stream_context_t *context = (stream_context_t *) user_data;
+    if ((int) context->no_members++ == context->abort_at) return -1;
+    context->content_len = 0;
+    return (strncmp(member->name, "folder2/", 8) == 0) ? STREAM_SKIP : STREAM_CONTENT;
+}
+
+
+static int stream_data(const tar_member_t *member, const uint8_t *data, size_t len, void *user_data)
+{
+    stream_context_t *context = (stream_context_t *) user_data;
+    if (strncmp(member->name, "folder2/", 8) == 0 || context->content_len + len > sizeof(context->content)) {context->no_errors++; return 0;}
+    memcpy(context->content + context->content_len, data, len);
+    context->content_len += len;
+    return 0;
+}
+
+
+static int stream_end(const tar_member_t *member, void *user_data)
+{
+    stream_context_t *context = (stream_context_t *) user_data;
+    context->no_ended++;
+    if (member->typeflag != REGTYPE && member->typeflag != AREGTYPE) return 0;
+
+    uint8_t expected[4096];
+    size_t len = sizeof(expected);
+    read_file(context->fd, (char *) member->name, 0, expected, &len);
+    if (len != context->content_len || memcmp(expected, context->content, len) != 0) context->no_errors++;
+    return 0;
+}
+
+
+static void *pipe_writer(void *arg)
+{
+    int *fds = (int *) arg;
+    uint8_t buffer[4096];
+    ssize_t nber_read;
+    for (off_t offset = 0; (nber_read = pread(fds[0], buffer, sizeof(buffer), offset)) > 0; offset += nber_read)
+    {
+        if (write(fds[1], buffer, nber_read) != nber_read) break;
+    }
+    close(fds[1]);
+    return NULL;
+}
+
+
+void stream_test(int fd)
+{
+    stream_context_t context = {.fd = fd, .abort_at = -1};
+    tar_stream_callbacks_t callbacks = {.on_member = stream_member, .on_data = stream_data, .on_end = stream_end, .user_data = &context};
+    int no_errors = 0;
+
+    // From a pipe, which cannot be seeked
+    int pipe_fds[2];
+    pthread_t thread;
+    if (pipe(pipe_fds) != 0) {printf("ERROR : pipe()\n"); return;}
+    int writer_fds[2] = {fd, pipe_fds[1]};
+    if (pthread_create(&thread, NULL, pipe_writer, writer_fds) != 0) {printf("ERROR : pthread_create()\n"); close(pipe_fds[0]); close(pipe_fds[1]); return;}
+    int ret = tar_stream_fd(pipe_fds[0], &callbacks);
+    pthread_join(thread, NULL);
+    close(pipe_fds[0]);
+    // The members of folder2/ are skipped, on_end is not called for them
+    if (ret != 23 || context.no_members != 23 || context.no_errors != 0 || context.no_ended >= context.no_members || context.no_ended == 0) no_errors++;
+    size_t no_ended = context.no_ended;
+
+    // From buffers of any size, split anywhere
+    struct stat st;
+    uint8_t *archive = (fstat(fd, &st) == 0) ? (uint8_t *) malloc(st.st_size) : NULL;
+    if (archive == NULL || pread(fd, archive, st.st_size, 0) != st.st_size) {printf("ERROR : reading the archive\n"); free(archive); return;}
+    size_t chunk_sizes[] = {1, 7, 511, 512, 1000, st.st_size};
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++)
+    {
+        tar_stream_t stream;
+        context = (stream_context_t) {.fd = fd, .abort_at = -1};
+        tar_stream_init(&stream, &callbacks);
+        ret = 0;
+        for (size_t pos = 0; pos < (size_t) st.st_size && ret == 0; pos += chunk_sizes[i])
+        {
+            size_t len = ((size_t) st.st_size - pos < chunk_sizes[i]) ? (size_t) st.st_size - pos : chunk_sizes[i];
+            ret = tar_stream_feed(&stream, archive + pos, len);
+        }
+        if (ret != 1 || tar_stream_finish(&stream) != 23 || context.no_errors != 0 || context.no_ended != no_ended) no_errors++;
+    }
+
+    // Errors: corrupted checksum, truncated input, parsing stopped by a callback
+    tar_stream_t stream;
+    context = (stream_context_t) {.fd = fd, .abort_at = -1};
+    tar_stream_init(&stream, &callbacks);
+    archive[148] ^= 1;
+    if (tar_stream_feed(&stream, archive, st.st_size) != -3 || tar_stream_feed(&stream, archive, 1) != -3 || tar_stream_finish(&stream) != -3) no_errors++;
+    archive[148] ^= 1;
+
+    tar_stream_init(&stream, &callbacks);
+    if (tar_stream_feed(&stream, archive, 2 * HEADER_SIZE + 100) != 0 || tar_stream_finish(&stream) != STREAM_TRUNCATED) no_errors++;
+
+    context.abort_at = 4;
+    context.no_members = 0;
+    tar_stream_init(&stream, &callbacks);
+    if (tar_stream_feed(&stream, archive, st.st_size) != STREAM_ABORTED || context.no_members != 5) no_errors++;
+
+    // Without on_data, every content is skipped
+    tar_stream_callbacks_t count_only = {.on_member = NULL, .on_data = NULL, .on_end = NULL, .user_data = NULL};
+    tar_stream_init(&stream, &count_only);
+    if (tar_stream_feed(&stream, archive, st.st_size) != 1 || tar_stream_finish(&stream) != 23) no_errors++;
+    free(archive);
+
+    if (no_errors > 0) printf("ERROR : streaming parser\n%d errors\n", no_errors);
+    else printf("\tTest Passed !\n");
+}
+
+
+void index_test(int fd)
 {
-    for (size_t i = 0; i < len;)
+    int no_errors = 0;
+    tar_index_usage_t usage;
+
+    // The fixture: 23 entries in 6 directories, the path of each entry rebuilt from its prefix
+    tar_handle_t *handle = tar_open(fd);
+    if (handle == NULL) {printf("ERROR : tar_open()\n"); return;}
+    tar_index_usage(handle, &usage);
+    size_t paths_len = 0;
+    for (size_t i = 0; i < handle->index.no_entries; i++)
     {
-        printf("%04x:  ", (int) i);
-        for (size_t j = 0; j < 16 && i + j < len; j++) printf("%02x ", bytes[i + j]);
-        printf("\t");
-        for (size_t j = 0; j < 16 && i < len; j++, i++) printf("%c ", bytes[i]);
-        printf("\n");
+        char path[TAR_PATH_MAX];
+        size_t len = index_path(&handle->index, &handle->index.entries[i], path, sizeof(path));
+        paths_len += len + 1;
+        size_t link_len = strlen(index_linkname(&handle->index, &handle->index.entries[i]));
+        if (link_len > 0) paths_len += link_len + 1;
+        if (len != strlen(path) || index_find(&handle->index, path) != &handle->index.entries[i]) no_errors++;
+    }
+    char truncated[8];
+    tar_entry_t *entry = index_find(&handle->index, "folder1/subfolder1_1/file1_1.txt");
+    if (entry == NULL || index_path(&handle->index, entry, truncated, sizeof(truncated)) != 32 || strcmp(truncated, "folder1") != 0
+        || index_size(&handle->index, entry) != 594 || index_type(&handle->index, entry) != REGTYPE) no_errors++;
+    if (usage.no_entries != 23 || usage.no_prefixes == 0 || usage.no_prefixes >= usage.no_entries
+        || usage.total_bytes != usage.entries_bytes + usage.tables_bytes + usage.arena_bytes) no_errors++;
+    // The shared prefixes are stored once, the arena is smaller than the paths and link targets it holds
+    if (handle->index.arena_len >= paths_len) no_errors++;
+    tar_close(handle);
+
+    // A large index: 20000 files in 400 directories of 2 levels, inserted in a shuffled order
+    tar_index_t index;
+    if (index_init(&index) != 0) {printf("ERROR : index_init()\n"); return;}
+    tar_header_t header;
+    char path[TAR_PATH_MAX];
+    size_t no_files = 20000;
+    for (size_t i = 0; i < no_files; i++)
+    {
+        size_t n = (i * 7919) % no_files;
+        snprintf(path, sizeof(path), "directory_%02zu/subdirectory_%02zu/file_%05zu.txt", n % 20, (n / 20) % 20, n);
+        if (tar_fill_header(&header, path, REGTYPE, n, 0644, 0, NULL) != 0 || index_insert(&index, &header, (off_t) n * HEADER_SIZE) == NULL) {no_errors++; break;}
+    }
+    for (size_t n = 0; n < no_files; n += 97)
+    {
+        snprintf(path, sizeof(path), "directory_%02zu/subdirectory_%02zu/file_%05zu.txt", n % 20, (n / 20) % 20, n);
+        entry = index_find(&index, path);
+        if (entry == NULL || index_size(&index, entry) != n || index_offset(&index, entry) != (off_t) n * HEADER_SIZE || index_mode(&index, entry) != 0644) no_errors++;
+    }
+    if (index_find(&index, "directory_00/subdirectory_00/") != NULL || index_find(&index, "directory_00/subdirectory_0") != NULL) no_errors++;
+
+    const uint32_t *sorted = index_sorted(&index);
+    char previous[TAR_PATH_MAX] = "";
+    for (size_t i = 0; sorted != NULL && i < index.no_entries; i++)
+    {
+        index_path(&index, &index.entries[sorted[i]], path, sizeof(path));
+        if (strcmp(previous, path) >= 0) no_errors++;
+        strcpy(previous, path);
     }
+    index_usage(&index, &usage);
+    // 400 prefixes of 2 levels: "directory_xx/subdirectory_yy/"
+    if (sorted == NULL || usage.no_entries != no_files || usage.no_prefixes != 400 || usage.total_bytes / no_files >= 128) no_errors++;
+    index_free(&index);
+
+    if (no_errors > 0) printf("ERROR : compact index\n%d errors [%zu bytes for %zu entries]\n", no_errors, usage.total_bytes, usage.no_entries);
+    else printf("\tTest Passed !\n");
 }
 
-void check_archive_test(int fd, int expected)
+
+typedef struct query_results
 {
-    int ret = check_archive(fd);
-    if (expected != ret) printf("ERROR : check_archive()\nReturn %d instead of %d\n", ret, expected);
-    else printf("\tTest Passed !\n");
+    char paths[32][TAR_PATH_MAX];
+    size_t no_paths;
+    size_t stop_after;            /* stops the query after this number of matches, 0 for never */
+} query_results_t;
+
+
+static int collect_match(const char *path, const tar_entry_t *entry, void *user_data)
+{
+    (void) entry;
+    query_results_t *results = (query_results_t *) user_data;
+    if (results->no_paths < 32) strcpy(results->paths[results->no_paths], path);
+    results->no_paths++;
+    return results->stop_after != 0 && results->no_paths == results->stop_after;
 }
 
-void exists_test(int fd, char *path, int expected)
+
+static void *glob_in_thread(void *arg)
 {
-    int ret = exists(fd, path);
-    if (expected != ret) printf("ERROR : exists()\nReturn %d instead of %d\n[args : path = %s ]\n", ret, expected, path);
-    else printf("\tTest Passed !\n");
+    query_results_t *results = (query_results_t *) malloc(sizeof(query_results_t));
+    if (results == NULL) return (void *) 1;
+    results->no_paths = results->stop_after = 0;
+    ssize_t ret = tar_glob((tar_handle_t *) arg, "**/*.txt", collect_match, results);
+    free(results);
+    return (void *) (intptr_t) (ret != 9);
 }
 
-void is_x_test(int fd, char *path, char *type, int expected)
+
+void query_test(int fd)
 {
-    int ret;
-    char *function_name;
-    if (strcmp(type, "symlink") == 0)
+    int no_errors = 0;
+    tar_handle_t *handle = tar_open(fd);
+    if (handle == NULL) {printf("ERROR : tar_open()\n"); return;}
+
+    // Number of matches of each pattern in the test archive
+    const char *patterns[] = {"folder1/*", "**/*.txt", "folder?/", "folder?", "*", "**", "folder2/**", "folder4/text\\?.txt",
+                              "symlink\\_multi", "**/file2_2_1.txt", "folder1/**/", "folder1/file1.txt", "folder1/file1", "*/*/*.txt"};
+    ssize_t expected[] = {3, 9, 4, 4, 6, 23, 7, 0, 1, 2, 2, 1, 0, 4};
+    query_results_t *results = (query_results_t *) malloc(sizeof(query_results_t));
+    if (results == NULL) {tar_close(handle); printf("ERROR : malloc()\n"); return;}
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
     {
-        ret = is_symlink(fd, path);
-        function_name = "is_symlink";
+        results->no_paths = results->stop_after = 0;
+        ssize_t ret = tar_glob(handle, patterns[i], collect_match, results);
+        if (ret != expected[i] || (size_t) ret != results->no_paths) {printf("\t%s: %zd matches instead of %zd\n", patterns[i], ret, expected[i]); no_errors++;}
+        // In path order
+        for (size_t j = 1; j < results->no_paths && j < 32; j++) no_errors += (strcmp(results->paths[j - 1], results->paths[j]) >= 0);
     }
-    else if (strcmp(type, "file") == 0)
+
+    // Pages of 3 paths return the same matches as the callback
+    char buffers[3][TAR_PATH_MAX];
+    char *page[3] = {buffers[0], buffers[1], buffers[2]};
+    results->no_paths = results->stop_after = 0;
+    tar_glob(handle, "**/*.txt", collect_match, results);
+    size_t cursor = 0;
+    size_t no_paged = 0;
+    while (cursor != TAR_QUERY_END)
     {
-        ret = is_file(fd, path);
-        function_name = "is_file";
+        ssize_t ret = tar_glob_page(handle, "**/*.txt", &cursor, page, 3);
+        if (ret < 0 || ret > 3 || no_paged + ret > results->no_paths) {no_errors++; break;}
+        for (ssize_t j = 0; j < ret; j++, no_paged++) no_errors += (strcmp(page[j], results->paths[no_paged]) != 0);
     }
-    else if (strcmp(type, "dir") == 0)
+    if (no_paged != 9) no_errors++;
+
+    // Prefixes, the callback stopping the query, too long a pattern
+    results->no_paths = results->stop_after = 0;
+    ssize_t ret = tar_prefix(handle, "folder2/sub", collect_match, results);
+    results->no_paths = 0;
+    results->stop_after = 3;
+    if (ret != 4 || tar_prefix(handle, "", collect_match, results) != 3 || results->no_paths != 3) no_errors++;
+    cursor = 0;
+    if (tar_prefix_page(handle, "zzz", &cursor, page, 3) != 0 || cursor != TAR_QUERY_END) no_errors++;
+    cursor = 0;
+    if (tar_prefix_page(handle, "folder3/", &cursor, page, 3) != 3 || strcmp(page[0], "folder3/") != 0
+        || tar_prefix_page(handle, "folder3/", &cursor, page, 3) != 0 || cursor != TAR_QUERY_END) no_errors++;
+    char long_pattern[TAR_PATTERN_MAX + 2];
+    memset(long_pattern, '*', sizeof(long_pattern) - 1);
+    long_pattern[TAR_PATTERN_MAX + 1] = '\0';
+    if (tar_glob(handle, long_pattern, collect_match, results) != -1) no_errors++;
+    tar_close(handle);
+    free(results);
+
+    // Threads querying a new handle build its sorted table at the same time
+    handle = tar_open(fd);
+    pthread_t threads[4];
+    size_t no_started = 0;
+    while (handle != NULL && no_started < 4 && pthread_create(&threads[no_started], NULL, glob_in_thread, handle) == 0) no_started++;
+    for (size_t i = 0; i < no_started; i++)
     {
-        ret = is_dir(fd, path);
-        function_name = "is_dir";
-    } else { printf("\tTest Failed !\n"); return; }
+        void *thread_ret;
+        pthread_join(threads[i], &thread_ret);
+        if (thread_ret != NULL) no_errors++;
+    }
+    if (handle == NULL) no_errors++;
+    tar_close(handle);
 
-    if (expected != ret) printf("ERROR : %s()\nReturn %d instead of %d\n[args : path = %s ]\n", function_name, ret, expected, path);
+    if (no_errors > 0) printf("ERROR : prefix and glob queries\n%d errors\n", no_errors);
     else printf("\tTest Passed !\n");
 }
 
-int cmper_str(const void *a, const void *b)
+
+void overlay_test(void)
 {
-    return strcmp(*(const char **)a, *(const char **)b);
+    int no_errors = 0;
+    const char *const base[][2] = {{"etc/", ""}, {"etc/a.conf", "base-a"}, {"etc/b.conf", "base-b"}, {"opt/", ""}, {"opt/tool/", ""},
+                                   {"opt/tool/bin", "tool"}, {"var/", ""}, {"var/log", "log"}, {"data", "old"}, {"lib/", ""}, {"lib/x", "x"}};
+    // Replaces a file, deletes a file and a directory, makes a directory opaque, replaces a file by a directory
+    const char *const delta[][2] = {{"etc/a.conf", "layer1-a"}, {"etc/.wh.b.conf", ""}, {"opt/.wh.tool", ""}, {"var/", ""},
+                                    {"var/.wh..wh..opq", ""}, {"var/new", "new"}, {"data/", ""}, {"data/inner", "in"}, {"link", "->etc/a.conf"}};
+    // Replaces a directory by a file, adds back the deleted directory
+    const char *const top[][2] = {{"lib", "lib-file"}, {"opt/tool/", ""}, {"opt/tool/fresh", "fresh"}, {".wh.nothing", ""}};
+
+    int fds[3] = {members_archive("layer", base, sizeof(base) / sizeof(base[0])), members_archive("layer", delta, sizeof(delta) / sizeof(delta[0])),
+                  members_archive("layer", top, sizeof(top) / sizeof(top[0]))};
+    tar_overlay_t *overlay = (fds[0] == -1 || fds[1] == -1 || fds[2] == -1) ? NULL : tar_overlay_open(fds, 3);
+    if (overlay == NULL) {printf("ERROR : tar_overlay_open()\n"); for (int i = 0; i < 3; i++) if (fds[i] != -1) close(fds[i]); return;}
+
+    // Visible entries, and the layer providing them
+    char *visible[] = {"etc/", "etc/a.conf", "opt/", "opt/tool/", "opt/tool/fresh", "var/", "var/new", "data/", "data/inner", "link", "lib"};
+    int layers[] = {0, 1, 0, 2, 2, 1, 1, 1, 1, 1, 2};
+    for (size_t i = 0; i < sizeof(visible) / sizeof(visible[0]); i++)
+    {
+        if (tar_overlay_exists(overlay, visible[i]) == 0 || tar_overlay_layer(overlay, visible[i]) != layers[i]) {printf("\t%s is not visible from layer %d\n", visible[i], layers[i]); no_errors++;}
+    }
+    char *deleted[] = {"etc/b.conf", "etc/.wh.b.conf", "opt/tool/bin", "var/log", "var/.wh..wh..opq", "data", "lib/", "lib/x", ".wh.nothing"};
+    for (size_t i = 0; i < sizeof(deleted) / sizeof(deleted[0]); i++)
+    {
+        if (tar_overlay_exists(overlay, deleted[i]) != 0 || tar_overlay_layer(overlay, deleted[i]) != -1) {printf("\t%s is visible\n", deleted[i]); no_errors++;}
+    }
+    if (overlay->view->index.no_entries != sizeof(visible) / sizeof(visible[0])) no_errors++;
+    if (!tar_overlay_is_dir(overlay, "data/") || !tar_overlay_is_file(overlay, "lib") || !tar_overlay_is_symlink(overlay, "link") || tar_overlay_is_dir(overlay, "lib/")) no_errors++;
+
+    // Directories list the entries of every layer merged in them
+    char buffers[4][TAR_PATH_MAX];
+    char *entries[4] = {buffers[0], buffers[1], buffers[2], buffers[3]};
+    size_t no_entries = 4;
+    if (tar_overlay_list(overlay, "etc/", entries, &no_entries) == 0 || no_entries != 1 || strcmp(entries[0], "etc/a.conf") != 0) no_errors++;
+    no_entries = 4;
+    if (tar_overlay_list(overlay, "var/", entries, &no_entries) == 0 || no_entries != 1 || strcmp(entries[0], "var/new") != 0) no_errors++;
+    no_entries = 4;
+    if (tar_overlay_list(overlay, "opt/", entries, &no_entries) == 0 || no_entries != 1 || strcmp(entries[0], "opt/tool/") != 0) no_errors++;
+
+    // Contents come from the layer providing the file, links are resolved in the view
+    uint8_t buffer[16];
+    size_t len = sizeof(buffer);
+    if (tar_overlay_read_file(overlay, "link", 0, buffer, &len) != 0 || len != 8 || memcmp(buffer, "layer1-a", 8) != 0) no_errors++;
+    len = 3;
+    if (tar_overlay_read_file(overlay, "opt/tool/fresh", 1, buffer, &len) != 1 || len != 3 || memcmp(buffer, "res", 3) != 0) no_errors++;
+    len = sizeof(buffer);
+    if (tar_overlay_read_file(overlay, "etc/b.conf", 0, buffer, &len) != -1 || tar_overlay_read_file(overlay, "lib", 8, buffer, &len) != -2) no_errors++;
+    tar_overlay_close(overlay);
+
+    // An opaque root hides every layer below it
+    const char *const opaque[][2] = {{".wh..wh..opq", ""}, {"only", "only"}};
+    int opaque_fds[2] = {fds[0], members_archive("layer", opaque, 2)};
+    overlay = (opaque_fds[1] == -1) ? NULL : tar_overlay_open(opaque_fds, 2);
+    if (overlay == NULL || overlay->view->index.no_entries != 1 || tar_overlay_exists(overlay, "only") == 0) no_errors++;
+    tar_overlay_close(overlay);
+    if (tar_overlay_open(fds, OVERLAY_MAX_LAYERS + 1) != NULL) no_errors++;
+
+    for (int i = 0; i < 3; i++) close(fds[i]);
+    if (opaque_fds[1] != -1) close(opaque_fds[1]);
+
+    if (no_errors > 0) printf("ERROR : layered overlay\n%d errors\n", no_errors);
+    else printf("\tTest Passed !\n");
 }
 
-void list_test(int fd, char *path, size_t no_entries, int expected_ret, size_t expected_no_entries, char *expected_entries[])
+
+typedef struct diff_results
 {
-    size_t copy_no_entries = no_entries;
-    char **entries = (char **) malloc(no_entries * sizeof(char *));
-    for (size_t i = 0; i < no_entries; i++) *(entries + i) = (char *) calloc(200, sizeof(char));
-    int ret = list(fd, path, entries, &no_entries);
+    char kinds[16];
+    int changes[16];
+    char paths[16][64];
+    size_t no_results;
+} diff_results_t;
 
-    int error = 1;
-    if (expected_ret != ret)               error = 0;
-    if (expected_no_entries != no_entries) error = 0;
 
-    qsort(expected_entries, expected_no_entries, sizeof(char *), cmper_str);
-    qsort(entries, expected_no_entries, sizeof(char *), cmper_str);
+static int collect_difference(const tar_diff_entry_t *entry, void *user_data)
+{
+    diff_results_t *results = (diff_results_t *) user_data;
+    if (results->no_results == 16) return 1;
+    results->kinds[results->no_results] = entry->kind;
+    results->changes[results->no_results] = entry->changes;
+    snprintf(results->paths[results->no_results++], 64, "%s", entry->path);
+    return 0;
+}
 
-    for (size_t i = 0; i < expected_no_entries; i++)
+
+int diff_archive(int is_new, uint8_t *big, size_t big_size)
+{
+    int fd = temp_archive("diff");
+    if (fd == -1) return -1;
+
+    tar_writer_t writer;
+    int ret = tar_writer_init(&writer, fd);
+    if (ret == 0) ret = tar_add_dir(&writer, "dir", 0755, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/same.txt", (const uint8_t *) "same", 4, 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/changed.txt", (const uint8_t *) (is_new ? "abd" : "abc"), 3, 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "dir/grown.txt", (const uint8_t *) "abc", is_new ? 3 : 2, 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, is_new ? "added.txt" : "removed.txt", (const uint8_t *) "x", 1, 0644, 0);
+    if (ret == 0) ret = tar_add_symlink(&writer, "link", is_new ? "dir/changed.txt" : "dir/same.txt", 0);
+    if (ret == 0) ret = is_new ? tar_add_dir(&writer, "swap", 0755, 0) : tar_add_data(&writer, "swap", (const uint8_t *) "f", 1, 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "mode.txt", (const uint8_t *) "m", 1, is_new ? 0600 : 0644, 0);
+    if (ret == 0) ret = tar_add_data(&writer, "big_same.bin", big, big_size, 0644, 0);
+    // Differs in its last chunk only
+    if (ret == 0 && is_new) big[big_size - 1] ^= 0xff;
+    if (ret == 0) ret = tar_add_data(&writer, "big.bin", big, big_size, 0644, 0);
+    if (ret == 0 && is_new) big[big_size - 1] ^= 0xff;
+    if (tar_writer_finish(&writer) != 0 || ret != 0) {close(fd); return -1;}
+    return fd;
+}
+
+
+void diff_test(void)
+{
+    int no_errors = 0;
+    size_t big_size = 3 * DIFF_CHUNK_SIZE + 5;
+    uint8_t *big = (uint8_t *) malloc(big_size);
+    if (big == NULL) {printf("ERROR : malloc()\n"); return;}
+    for (size_t i = 0; i < big_size; i++) big[i] = (uint8_t) (i * 31 + 7);
+    int old_fd = diff_archive(0, big, big_size);
+    int new_fd = diff_archive(1, big, big_size);
+    free(big);
+    if (old_fd == -1 || new_fd == -1) {printf("ERROR : diff_archive()\n"); return;}
+
+    // In path order, whatever the number of threads
+    char kinds[] = {DIFF_ADDED, DIFF_MODIFIED, DIFF_MODIFIED, DIFF_MODIFIED, DIFF_MODIFIED, DIFF_MODIFIED, DIFF_REMOVED, DIFF_TYPE_CHANGED};
+    int changes[] = {0, DIFF_CONTENT, DIFF_CONTENT, DIFF_SIZE, DIFF_LINKNAME, DIFF_MODE, 0, 0};
+    char *paths[] = {"added.txt", "big.bin", "dir/changed.txt", "dir/grown.txt", "link", "mode.txt", "removed.txt", "swap/"};
+    int thread_counts[] = {1, 4, 0};
+    diff_results_t results;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
     {
-        if (strcmp(expected_entries[i], entries[i]) != 0)
+        tar_diff_options_t options = {.no_threads = thread_counts[t]};
+        results.no_results = 0;
+        ssize_t ret = tar_diff(old_fd, new_fd, &options, collect_difference, &results);
+        if (ret != 8 || results.no_results != 8) {printf("\t%zd differences with %d threads\n", ret, thread_counts[t]); no_errors++; continue;}
+        for (size_t i = 0; i < 8; i++)
         {
-            error = 0;
-            break;
+            if (results.kinds[i] == kinds[i] && results.changes[i] == changes[i] && strcmp(results.paths[i], paths[i]) == 0) continue;
+            printf("\t%c %s (%d) instead of %c %s (%d)\n", results.kinds[i], results.paths[i], results.changes[i], kinds[i], paths[i], changes[i]);
+            no_errors++;
         }
     }
-    
-    if (error == 0)
-    {
-        printf("ERROR : list() [args : path = %s , no_entries = %ld ]\n", path, copy_no_entries);
-        printf("no_entries = %ld AND expected_no_entries = %ld\n", no_entries, expected_no_entries);
-        printf("ret = %d AND expected_ret = %d\n", ret, expected_ret);
 
-        if (no_entries > 0)
-        {
-            char entries_str[100000] = "[ ";
-            char expected_entries_str[100000] = "[ ";
-            for (size_t i = 0; i < expected_no_entries - 1; i++)
-            {
-                strcat(expected_entries_str, expected_entries[i]);
-                strcat(expected_entries_str, ", ");
-                strcat(entries_str, entries[i]);
-                strcat(entries_str, ", ");
-            }
-            if (expected_no_entries > 0)
-            {
-                strcat(expected_entries_str, expected_entries[expected_no_entries - 1]);
-                strcat(entries_str, entries[expected_no_entries - 1]);
-            }
-            strcat(expected_entries_str, "]");
-            strcat(entries_str, "]");
-        
-            printf("entries = %s AND expected_entries = %s\n", entries_str, expected_entries_str);
-        }
-    } else printf("\tTest Passed !\n");
+    // An archive is the same as itself, the reverse comparison swaps additions and removals
+    results.no_results = 0;
+    if (tar_diff(old_fd, old_fd, NULL, collect_difference, &results) != 0 || tar_diff(new_fd, old_fd, NULL, collect_difference, &results) != 8
+        || results.kinds[0] != DIFF_REMOVED || results.kinds[6] != DIFF_ADDED || strcmp(results.paths[7], "swap") != 0) no_errors++;
+    if (tar_diff(old_fd, new_fd, NULL, NULL, NULL) != 8) no_errors++;
 
-    for (size_t i = 0; i < no_entries; i++) {free(entries[i]); entries[i] = NULL;}
-    free(entries);
-    entries = NULL;
+    close(old_fd);
+    close(new_fd);
+    if (no_errors > 0) printf("ERROR : archive diff\n%d errors\n", no_errors);
+    else printf("\tTest Passed !\n");
 }
 
 
-void read_file_test(int fd, char *path, size_t offset, size_t len, int expected_ret, size_t expected_len, char *expected_buffer)
+void link_cycle_tests(int fd)
 {
-    uint8_t *buffer = calloc(sizeof(char), len);
-    int ret = read_file(fd, path, offset, buffer, &len);
-    int no_error = 1;
-    if (expected_ret != ret) {no_error = 0; printf("ERROR : read_file()\nReturn %d instead of %d\n[args : path = %s ]\n", ret, expected_ret, path);}
-    if (expected_len != len) {no_error = 0; printf("ERROR : read_file()\nlen = %ld instead of len = %ld\n[args : path = %s ]\n", len, expected_len, path);}
-    if (strcmp(expected_buffer, (char *) buffer) != 0) {no_error = 0; printf("ERROR : read_file()\nbuffer = %s instead of buffer = %s\n[args : path = %s ]\n", buffer, expected_buffer, path);}
+    char *expected_entries[] = {""};
+    char *paths[] = {"loop_a", "loop_b", "dir/self", "dir/outside"};
 
-    if (no_error == 1) printf("\tTest Passed !\n");
-    free(buffer);
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        list_test(fd, paths[i], 10, 0, 0, expected_entries);
+        read_file_test(fd, paths[i], 0, 10, -1, 0, "");
+    }
 }
 
-int main(int argc, char **argv)
+void link_hops_test(void)
 {
-    if (argc < 2)
+    // target <- l40 <- l39 <- ... <- l00: l00 is one hop too far, l01 just within the limit
+    char names[MAX_SYMLINK_HOPS + 2][8];
+    char contents[MAX_SYMLINK_HOPS + 2][16];
+    const char *members[MAX_SYMLINK_HOPS + 2][2];
+    for (int i = 0; i <= MAX_SYMLINK_HOPS; i++)
     {
-        printf("Usage: %s tar_file\n", argv[0]);
-        return EXIT_FAILURE;
+        snprintf(names[i], sizeof(names[i]), "l%02d", i);
+        if (i < MAX_SYMLINK_HOPS) snprintf(contents[i], sizeof(contents[i]), "->l%02d", i + 1);
+        else snprintf(contents[i], sizeof(contents[i]), "->target");
+        members[i][0] = names[i];
+        members[i][1] = contents[i];
     }
+    members[MAX_SYMLINK_HOPS + 1][0] = "target";
+    members[MAX_SYMLINK_HOPS + 1][1] = "content";
 
-    int fd = open(argv[1] , O_RDONLY);
-    if (fd == -1)
+    int fd = members_archive("hops", members, MAX_SYMLINK_HOPS + 2);
+    if (fd == -1) {printf("ERROR : members_archive()\n"); return;}
+
+    // The result of a link must not depend on the links resolved before it
+    int no_errors = 0;
+    for (int order = 0; order < 2; order++)
     {
-        perror("open(tar_file)");
-        return EXIT_FAILURE;
+        tar_handle_t *handle = tar_open(fd);
+        if (handle == NULL) {no_errors++; continue;}
+        for (int i = 0; i < 2; i++)
+        {
+            int first = (order == 0) ? i : 1 - i;
+            tar_entry_t *entry = tar_resolve(handle, (first == 0) ? "l00" : "l01");
+            if ((first == 0) != (entry == NULL)) no_errors++;
+            if (entry != NULL && index_type(&handle->index, entry) != REGTYPE) no_errors++;
+        }
+        tar_close(handle);
     }
 
+    close(fd);
+    if (no_errors > 0) printf("ERROR : tar_resolve()\n%d wrong chains of %d links\n", no_errors, MAX_SYMLINK_HOPS + 1);
+    else printf("\tTest Passed !\n");
+}
+
+void run_tests(int fd)
+{
     // *** check_archive_test() : BEGIN ***
     printf("Test check_archive() :\n");
     check_archive_test(fd, 23);
+    check_archive_mt_test(fd, 1, 23);
+    check_archive_mt_test(fd, 4, 23);
+    header_checksum_test(fd);
+    tar_octal_test("0012345\0 ", 8, 012345);
+    tar_octal_test("  1234 \0", 8, 01234);
+    tar_octal_test("77777777", 8, 077777777);
+    tar_octal_test("00000000000", 12, 0);
+    tar_octal_test("\0\0\0\0\0\0\0\0", 8, -1);
+    tar_octal_test("0009", 4, 0);
     // *** check_archive_test() : END ***
 
 
@@ -212,14 +1879,14 @@ int main(int argc, char **argv)
     char *expected_entries_7[] = {""};
     list_test(fd, "folder1/symlink2", 3, 0, 0, expected_entries_7);
 
-    char *expected_entries_8[] = {""};
-    list_test(fd, "folder2/symlink3", 1, 0, 0, expected_entries_8);
+    char *expected_entries_8[] = {"folder2/subfolder2_2/file2_2_1.txt"};
+    list_test(fd, "folder2/symlink3", 1, 1, 1, expected_entries_8);
 
     char *expected_entries_9[] = {"folder4/text1.txt", "folder4/text2.txt", "folder4/text3.txt"};
     list_test(fd, "folder4/", 10, 1, 3, expected_entries_9);
 
-    char *expected_entries_11[] = {""};
-    list_test(fd, "folder3/symlink5", 10, 0, 0, expected_entries_11);
+    char *expected_entries_11[] = {"folder4/text1.txt", "folder4/text2.txt", "folder4/text3.txt"};
+    list_test(fd, "folder3/symlink5", 10, 1, 3, expected_entries_11);
 
     char *expected_entries_12[] = {"folder4/text1.txt", "folder4/text2.txt"};
     list_test(fd, "folder4/", 2, 1, 2, expected_entries_12);
@@ -259,13 +1926,424 @@ int main(int argc, char **argv)
     read_file_test(fd, "folder1/subfolder1_1/doesnt_exist.txt", 0, 1000, -1, 0, "");
     read_file_test(fd, "folder1/", 0, 1000, -1, 0, "");
 
-    /*
-    * Next test doesn't work because my code doesn't work with relative path symlink like "../other_folder/..."
-    * FOr the INGInious tests, no problem! because we don't need to take care about relative path (and multi symlinks also btw).
-    */
-   
-    // read_file_test(fd, "folder1/symlink2", 0, 1000, 0, 528, "Citizens and dreamers alike, let our aspirations soar higher than the tallest peaks.\nIn the grand tapestry of human endeavor, each thread is a story waiting to be told.\nLet our collective narrative be one of resilience, compassion, and boundless ambition.\nTogether, we paint the canvas of progress, guided by the enduring principles that define our shared humanity.\nAs we face the challenges of tomorrow, let us embrace the promise of a brighter, interconnected world, where the dreams of today become the realities of tomorrow.");
+    // Relative symlinks ("../folder3/file3_1.txt") and chains of symlinks
+    read_file_test(fd, "folder1/symlink2", 0, 1000, 0, 528, "Citizens and dreamers alike, let our aspirations soar higher than the tallest peaks.\nIn the grand tapestry of human endeavor, each thread is a story waiting to be told.\nLet our collective narrative be one of resilience, compassion, and boundless ambition.\nTogether, we paint the canvas of progress, guided by the enduring principles that define our shared humanity.\nAs we face the challenges of tomorrow, let us embrace the promise of a brighter, interconnected world, where the dreams of today become the realities of tomorrow.");
+    read_file_test(fd, "folder2/symlink4", 0, 8, 520, 8, "Citizens");
+    read_file_test(fd, "folder3/symlink5", 0, 1000, -1, 0, "");
     // *** read_file_test() : END ***
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s tar_file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(argv[1] , O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open(tar_file)");
+        return EXIT_FAILURE;
+    }
+
+    run_tests(fd);
+
+    // The whole archive fits in the default readahead: a single pread() scans it
+    printf("\n*** Block reader system calls ***\n");
+    reader_stats_test(fd, "doesnt_exist.txt", 1);
+
+    printf("\n*** Iterator ***\n");
+    iter_test(fd);
+
+    printf("\n*** Batched lookups ***\n");
+    lookup_batch_test(fd);
+
+    printf("\n*** Per-API counters ***\n");
+    tar_stats_t stats;
+#ifdef TAR_STATS
+    // api - calls - headers - syscalls - bytes - symlink hops
+    uint8_t stats_buffer[1024];
+    size_t stats_len = sizeof(stats_buffer);
+    char **stats_entries = (char **) malloc(10 * sizeof(char *));
+    for (int i = 0; i < 10; i++) stats_entries[i] = (char *) malloc(100 * sizeof(char));
+    size_t stats_no_entries = 10;
+
+    tar_stats_reset();
+    exists(fd, "doesnt_exist.txt");
+    is_dir(fd, "folder1/");
+    stats_test(TAR_API_EXISTS, 1, 24, 1, 30720, 0);
+    stats_test(TAR_API_IS_DIR, 1, 24, 1, 30720, 0);
+
+    // The calls made by list() itself are counted in list()
+    tar_stats_reset();
+    list(fd, "symlink_multi", stats_entries, &stats_no_entries);
+    stats_test(TAR_API_LIST, 1, 120, 5, 5 * 30720, 2);
+    stats_test(TAR_API_IS_SYMLINK, 0, 0, 0, 0, 0);
+    read_file(fd, "folder1/symlink2", 0, stats_buffer, &stats_len);
+    // Every header is read to find the last member with the path, then its content is read
+    stats_test(TAR_API_READ_FILE, 1, 48, 3, 2 * 30720 + stats_len, 1);
+
+    // The work of the worker threads is counted in check_archive()
+    tar_stats_reset();
+    check_archive_mt(fd, 4);
+    stats_test(TAR_API_CHECK_ARCHIVE, 1, 24, 24, 30720 + 23 * 512, 0);
+    stats_test(TAR_API_OTHER, 0, 0, 0, 0, 0);
+
+    tar_stats_reset();
+    tar_handle_t *stats_handle = tar_open(fd);
+    tar_resolve(stats_handle, "folder2/symlink4");
+    stats_test(TAR_API_OPEN, 1, 24, 1, 30720, 0);
+    stats_test(TAR_API_RESOLVE, 1, 0, 0, 0, 2);
+    tar_resolve(stats_handle, "folder2/symlink4");
+    stats_test(TAR_API_RESOLVE, 2, 0, 0, 0, 3);
+    stats_len = sizeof(stats_buffer);
+    tar_read_file(stats_handle, "folder4/text3.txt", 0, stats_buffer, &stats_len);
+    stats_test(TAR_API_HANDLE_READ_FILE, 1, 0, 1, 18, 0);
+    tar_close(stats_handle);
+
+    tar_stats_reset();
+    stats_handle = tar_open_mmap(fd);
+    stats_len = sizeof(stats_buffer);
+    tar_read_file(stats_handle, "folder4/text3.txt", 0, stats_buffer, &stats_len);
+    stats_test(TAR_API_OPEN_MMAP, 1, 23, 0, 0, 0);
+    stats_test(TAR_API_HANDLE_READ_FILE, 1, 0, 0, 18, 0);
+    tar_close(stats_handle);
+
+    if (tar_stats_get(&stats) == 0) get_info_stats(&stats);
+    for (int i = 0; i < 10; i++) free(stats_entries[i]);
+    free(stats_entries);
+#else
+    exists(fd, "doesnt_exist.txt");
+    if (tar_stats_get(&stats) != -1 || stats.api[TAR_API_EXISTS].no_calls != 0) printf("ERROR : tar_stats_get() without TAR_STATS\n");
+    else                                                                       printf("\tTest Passed !\n");
+#endif
+
+    // Many threads sharing the same file descriptor, then the same handle
+    printf("\n*** Concurrent calls on a single file descriptor ***\n");
+    concurrency_test(fd, NULL, 8, 200);
+    tar_handle_t *shared_handle = tar_open(fd);
+    concurrency_test(fd, shared_handle, 8, 2000);
+    tar_close(shared_handle);
+
+    printf("\n*** Same tests with a readahead of a single block ***\n\n");
+    reader_set_readahead(HEADER_SIZE);
+    run_tests(fd);
+    reader_set_readahead(0);
+
+    printf("\n*** Same tests through tar_open() ***\n\n");
+    test_handle = tar_open(fd);
+    if (test_handle == NULL)
+    {
+        printf("ERROR : tar_open()\n");
+        return EXIT_FAILURE;
+    }
+    run_tests(fd);
+    tar_close(test_handle);
+
+    printf("\n*** Same tests through tar_open_mmap() ***\n\n");
+    test_handle = tar_open_mmap(fd);
+    if (test_handle == NULL)
+    {
+        printf("ERROR : tar_open_mmap()\n");
+        return EXIT_FAILURE;
+    }
+    run_tests(fd);
+
+    // *** read_file_view_test() : BEGIN ***
+    // handle - path - offset - expected_ret - expected_len - expected_buffer
+    printf("\nTest read_file_view() :\n");
+    read_file_view_test(test_handle, "folder4/text3.txt", 0, 0, 18, "Tr\xc3\xa8s court texte.");
+    read_file_view_test(test_handle, "folder4/text3.txt", 7, 0, 11, "ourt texte.");
+    read_file_view_test(test_handle, "folder4/text3.txt", 18, -2, 0, "");
+    read_file_view_test(test_handle, "folder4/", 0, -1, 0, "");
+    read_file_view_test(test_handle, "doesnt_exist.txt", 0, -1, 0, "");
+    // *** read_file_view_test() : END ***
+
+    tar_close(test_handle);
+    test_handle = NULL;
+
+    // A copy of the archive, whose index is saved to a sidecar file
+    char idx_path[] = "/tmp/lib_tar_sidecar_XXXXXX";
+    int idx_fd = mkstemp(idx_path);
+    int copy_fd = corrupt_archive(fd, 0, NULL, NULL, NULL);
+    if (idx_fd == -1 || copy_fd == -1)
+    {
+        printf("ERROR : sidecar files\n");
+        return EXIT_FAILURE;
+    }
+    close(idx_fd);
+
+    printf("\n*** Sidecar index ***\n");
+    sidecar_load_test(copy_fd, idx_path, -1);
+    sidecar_load_test(copy_fd, "/tmp/doesnt_exist.idx", -1);
+    test_handle = tar_open(copy_fd);
+    if (test_handle == NULL || tar_write_sidecar(test_handle, idx_path) != 0)
+    {
+        printf("ERROR : tar_write_sidecar()\n");
+        return EXIT_FAILURE;
+    }
+    tar_close(test_handle);
+    sidecar_load_test(copy_fd, idx_path, 0);
+
+    printf("\n*** Same tests through tar_open_sidecar() ***\n\n");
+    test_handle = tar_open_sidecar(copy_fd, idx_path);
+    if (test_handle == NULL || test_handle->index.map == NULL)
+    {
+        printf("ERROR : tar_open_sidecar()\n");
+        return EXIT_FAILURE;
+    }
+    run_tests(copy_fd);
+    tar_close(test_handle);
+
+    // A header rewritten in place, the size and the modification time of the archive being unchanged
+    printf("\n*** Stale sidecar index ***\n");
+    struct stat copy_st;
+    fstat(copy_fd, &copy_st);
+    tar_iter_t iter;
+    const tar_member_t *member;
+    off_t last_offset = 0;
+    tar_iter_begin(&iter, copy_fd);
+    while (tar_iter_next(&iter, &member) == 1) last_offset = member->hdr_offset;
+    tar_iter_end(&iter);
+    tar_header_t last_header;
+    pread(copy_fd, &last_header, HEADER_SIZE, last_offset);
+    last_header.uname[0] ^= 1;
+    pwrite(copy_fd, &last_header, HEADER_SIZE, last_offset);
+    struct timespec times[2] = {copy_st.st_atim, copy_st.st_mtim};
+    futimens(copy_fd, times);
+    sidecar_load_test(copy_fd, idx_path, -2);
+    last_header.uname[0] ^= 1;
+    pwrite(copy_fd, &last_header, HEADER_SIZE, last_offset);
+    futimens(copy_fd, times);
+    sidecar_load_test(copy_fd, idx_path, 0);
+
+    // A corrupt sidecar matching the archive: an arena offset out of bounds, then a count overflowing the section checks
+    idx_fd = open(idx_path, O_RDWR);
+    sidecar_header_t idx_header;
+    tar_entry_t idx_entry;
+    pread(idx_fd, &idx_header, sizeof(sidecar_header_t), 0);
+    pread(idx_fd, &idx_entry, sizeof(tar_entry_t), idx_header.entries_offset);
+    idx_entry.name += idx_header.arena_len;
+    pwrite(idx_fd, &idx_entry, sizeof(tar_entry_t), idx_header.entries_offset);
+    sidecar_load_test(copy_fd, idx_path, -1);
+    idx_entry.name -= idx_header.arena_len;
+    pwrite(idx_fd, &idx_entry, sizeof(tar_entry_t), idx_header.entries_offset);
+    uint64_t no_entries = idx_header.no_entries;
+    idx_header.no_entries = UINT64_MAX / sizeof(uint32_t) + 2;
+    pwrite(idx_fd, &idx_header, sizeof(sidecar_header_t), 0);
+    sidecar_load_test(copy_fd, idx_path, -1);
+    idx_header.no_entries = no_entries;
+    pwrite(idx_fd, &idx_header, sizeof(sidecar_header_t), 0);
+    close(idx_fd);
+    sidecar_load_test(copy_fd, idx_path, 0);
+
+    // Touching the archive is enough to make the sidecar stale, tar_open_sidecar() scans it again
+    times[1].tv_sec++;
+    futimens(copy_fd, times);
+    sidecar_load_test(copy_fd, idx_path, -2);
+    test_handle = tar_open_sidecar(copy_fd, idx_path);
+    if (test_handle == NULL || test_handle->index.map != NULL) printf("ERROR : tar_open_sidecar() used a stale sidecar\n");
+    else                                                          printf("\tTest Passed !\n");
+    exists_test(copy_fd, "folder4/text3.txt", 1);
+    tar_close(test_handle);
+    test_handle = NULL;
+
+    unlink(idx_path);
+    close(copy_fd);
+
+    // The same archive compressed with gzip, with a checkpoint about every 4 KiB
+    int gz_fd = gzip_archive(fd, 2048);
+    if (gz_fd == -1)
+    {
+        printf("ERROR : gzip_archive()\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\n*** Random access in a gzip file ***\n");
+    gz_index_t gz_index;
+    if (gz_build_index(&gz_index, fd, 0) != -1) printf("ERROR : gz_build_index() on an uncompressed file\n");
+    else                                        printf("\tTest Passed !\n");
+    if (gz_build_index(&gz_index, gz_fd, 4096) != 0) printf("ERROR : gz_build_index()\n");
+    else
+    {
+        gz_read_test(fd, &gz_index, 5);
+        gz_free_index(&gz_index);
+    }
+    if (gz_build_index(&gz_index, gz_fd, 0) != 0) printf("ERROR : gz_build_index()\n");
+    else
+    {
+        gz_read_test(fd, &gz_index, 1);
+        gz_free_index(&gz_index);
+    }
+
+    printf("\n*** Same tests on the gzip-compressed archive ***\n\n");
+    if (tar_gz_open(fd, 0) != -1 || tar_gz_open(gz_fd, 4096) != 0)
+    {
+        printf("ERROR : tar_gz_open()\n");
+        return EXIT_FAILURE;
+    }
+    run_tests(gz_fd);
+
+    printf("\n*** Same tests on the gzip-compressed archive through tar_open() ***\n\n");
+    test_handle = tar_open(gz_fd);
+    run_tests(gz_fd);
+    // io_uring cannot read a compressed archive: the thread pool is used
+    tar_async_options_t gz_async_options = {.depth = 8, .no_threads = 2, .no_uring = 0};
+    async_test(test_handle, &gz_async_options);
+    tar_close(test_handle);
+    test_handle = NULL;
+    if (tar_open_mmap(gz_fd) != NULL) printf("ERROR : tar_open_mmap() on a compressed archive\n");
+
+    printf("\n*** Extraction of the gzip-compressed archive ***\n");
+    extract_test(gz_fd, 2);
+
+    printf("\n*** Concurrent calls on the gzip-compressed archive ***\n");
+    concurrency_test(gz_fd, NULL, 4, 50);
+    tar_gz_close(gz_fd);
+    close(gz_fd);
+
+    // The same archive with its members stored in reverse order: each directory comes after its entries
+    int reversed_fd = reverse_archive(fd);
+    if (reversed_fd == -1)
+    {
+        printf("ERROR : reverse_archive()\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\n*** list() on the archive in reverse order ***\n");
+    unordered_list_tests(reversed_fd);
+
+    printf("\n*** list() on the archive in reverse order through tar_open() ***\n");
+    test_handle = tar_open(reversed_fd);
+    unordered_list_tests(reversed_fd);
+    tar_close(test_handle);
+    test_handle = NULL;
+    close(reversed_fd);
+
+    // Archives with invalid headers, the first one in archive order must be reported
+    printf("\n*** check_archive_mt() on corrupted archives ***\n");
+    int members_1[] = {5};
+    size_t fields_1[] = {offsetof(tar_header_t, magic)};
+    char values_1[] = {'X'};
+    int members_2[] = {20, 3, 12};
+    size_t fields_2[] = {offsetof(tar_header_t, magic), offsetof(tar_header_t, version), offsetof(tar_header_t, name) + 1};
+    char values_2[] = {'X', '1', 'X'};
+    int members_3[] = {22};
+    size_t fields_3[] = {offsetof(tar_header_t, uname)};
+    char values_3[] = {'X'};
+
+    int corrupt_fd = corrupt_archive(fd, 1, members_1, fields_1, values_1);
+    check_archive_mt_test(corrupt_fd, 1, -1);
+    check_archive_mt_test(corrupt_fd, 4, -1);
+    close(corrupt_fd);
+    corrupt_fd = corrupt_archive(fd, 3, members_2, fields_2, values_2);
+    check_archive_mt_test(corrupt_fd, 1, -2);
+    check_archive_mt_test(corrupt_fd, 4, -2);
+    close(corrupt_fd);
+    corrupt_fd = corrupt_archive(fd, 1, members_3, fields_3, values_3);
+    check_archive_mt_test(corrupt_fd, 1, -3);
+    check_archive_mt_test(corrupt_fd, 4, -3);
+    close(corrupt_fd);
+
+    printf("\n*** Extraction ***\n");
+    extract_test(fd, 1);
+    extract_test(fd, 4);
+    extract_test(fd, 0);
+    default_modes_extract_test(fd);
+
+    int unsafe_fd = unsafe_archive();
+    if (unsafe_fd == -1)
+    {
+        printf("ERROR : unsafe_archive()\n");
+        return EXIT_FAILURE;
+    }
+    unsafe_extract_test(unsafe_fd);
+    close(unsafe_fd);
+
+    printf("\n*** Writing archives ***\n");
+    size_t big_size = 3 * WRITER_COPY_MAX + 100;
+    uint8_t big[3 * WRITER_COPY_MAX + 100];
+    for (size_t i = 0; i < big_size; i++) big[i] = (uint8_t) i;
+    int writer_fd = writer_archive(big, big_size);
+    if (writer_fd == -1)
+    {
+        printf("ERROR : writer_archive()\n");
+        return EXIT_FAILURE;
+    }
+    writer_test(writer_fd, big, big_size);
+    close(writer_fd);
+    add_files_test(fd, 1);
+    add_files_test(fd, 4);
+
+    printf("\n*** Appending to an archive ***\n");
+    append_test(fd);
+
+    printf("\n*** Asynchronous reads ***\n");
+    tar_async_options_t async_options[] = {{.depth = 0, .no_threads = 0, .no_uring = 0}, {.depth = 4, .no_threads = 0, .no_uring = 0},
+                                           {.depth = 0, .no_threads = 4, .no_uring = 1}, {.depth = 3, .no_threads = 2, .no_uring = 1}};
+    test_handle = tar_open(fd);
+    for (size_t i = 0; i < sizeof(async_options) / sizeof(async_options[0]); i++) async_test(test_handle, &async_options[i]);
+    tar_close(test_handle);
+    test_handle = tar_open_mmap(fd);
+    async_test(test_handle, &async_options[1]);
+    tar_close(test_handle);
+    test_handle = NULL;
+
+    printf("\n*** Block cache ***\n");
+    cache_test(fd);
+
+    printf("\n*** Same tests through the block cache ***\n\n");
+    run_tests(fd);
+    test_handle = tar_open(fd);
+    run_tests(fd);
+    tar_close(test_handle);
+    test_handle = NULL;
+
+    printf("\n*** Concurrent calls through the block cache ***\n");
+    concurrency_test(fd, NULL, 4, 50);
+    tar_cache_close(fd);
+    tar_cache_free();
+
+    printf("\n*** Query server ***\n");
+    server_test(fd);
+
+    printf("\n*** Streaming parser ***\n");
+    stream_test(fd);
+
+    printf("\n*** Compact index ***\n");
+    index_test(fd);
+
+    printf("\n*** Prefix and glob queries ***\n");
+    query_test(fd);
+
+    printf("\n*** Layered overlay ***\n");
+    overlay_test();
+
+    printf("\n*** Archive diff ***\n");
+    diff_test();
+
+    // An archive whose symlinks loop or point outside of the archive
+    int cycle_fd = link_cycle_archive();
+    if (cycle_fd == -1)
+    {
+        printf("ERROR : link_cycle_archive()\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\n*** Symlink cycles ***\n");
+    link_cycle_tests(cycle_fd);
+
+    printf("\n*** Symlink cycles through tar_open() ***\n");
+    test_handle = tar_open(cycle_fd);
+    link_cycle_tests(cycle_fd);
+    tar_close(test_handle);
+    test_handle = NULL;
+    close(cycle_fd);
+
+    printf("\n*** Symlink hop limit ***\n");
+    link_hops_test();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
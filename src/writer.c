@@ -0,0 +1,358 @@
+// copy_file_range()
+#define _GNU_SOURCE
+
+#include "../headers/writer.h"
+
+typedef struct writer_input
+{
+    const char *path;
+    struct stat st;
+    uint8_t *data;                /* content of a small regular file, NULL for the other members */
+    char linkname[101];           /* target of a symlink */
+    int status;                   /* 0 if the file was read, -1 otherwise */
+} writer_input_t;
+
+typedef struct add_job
+{
+    writer_input_t *inputs;
+    size_t no_inputs;
+    size_t next_input;            /* first input not taken by a worker yet */
+} add_job_t;
+
+static const uint8_t zeros[HEADER_SIZE];
+
+
+static void set_checksum(tar_header_t *header)
+{
+    // header_checksum() counts the checksum field as spaces, whatever it holds
+    snprintf(header->chksum, sizeof(header->chksum), "%06lo", (unsigned long) header_checksum((const uint8_t *) header));
+    header->chksum[7] = ' ';
+}
+
+
+int tar_fill_header(tar_header_t *header, const char *name, char typeflag, size_t size, mode_t mode, time_t mtime, const char *linkname)
+{
+    memset(header, 0, sizeof(tar_header_t));
+    size_t len = strlen(name);
+
+    if (len <= sizeof(header->name)) memcpy(header->name, name, len);
+    else
+    {
+        // The ustar prefix holds the beginning of a long path, up to one of its '/'
+        size_t split = 0;
+        for (size_t i = len - sizeof(header->name) - 1; i <= sizeof(header->prefix) && i + 1 < len; i++)
+        {
+            if (name[i] == '/') {split = i; break;}
+        }
+        if (split == 0) return -1;
+        memcpy(header->prefix, name, split);
+        memcpy(header->name, name + split + 1, len - split - 1);
+    }
+
+    if (linkname != NULL)
+    {
+        size_t link_len = strlen(linkname);
+        if (link_len > sizeof(header->linkname)) return -1;
+        memcpy(header->linkname, linkname, link_len);
+    }
+    if (size > (size_t) TAR_SIZE_MAX) return -1;
+
+    snprintf(header->mode, sizeof(header->mode), "%07o", (unsigned) (mode & 07777));
+    snprintf(header->uid, sizeof(header->uid), "%07o", 0);
+    snprintf(header->gid, sizeof(header->gid), "%07o", 0);
+    snprintf(header->size, sizeof(header->size), "%011lo", (unsigned long) size);
+    // Same 12 bytes as the size: the time is clamped to what they can hold
+    if (mtime < 0) mtime = 0;
+    if (mtime > TAR_SIZE_MAX) mtime = TAR_SIZE_MAX;
+    snprintf(header->mtime, sizeof(header->mtime), "%011lo", (unsigned long) mtime);
+    header->typeflag = typeflag;
+    memcpy(header->magic, TMAGIC, TMAGLEN);
+    memcpy(header->version, TVERSION, TVERSLEN);
+    set_checksum(header);
+    return 0;
+}
+
+
+int tar_writer_init(tar_writer_t *writer, int tar_fd)
+{
+    memset(writer, 0, sizeof(tar_writer_t));
+    writer->tar_fd = tar_fd;
+    writer->staging = (uint8_t *) malloc(WRITER_STAGING_SIZE);
+    return (writer->staging == NULL) ? -1 : 0;
+}
+
+
+int tar_writer_flush(tar_writer_t *writer)
+{
+    off_t begin = writer->offset;
+    int start = 0;
+    while (writer->error == 0 && start < writer->no_iov)
+    {
+        ssize_t nber_written = pwritev(writer->tar_fd, writer->iov + start, writer->no_iov - start, writer->offset);
+        if (nber_written < 0 && errno == EINTR) continue;
+        if (nber_written <= 0) {writer->error = 1; break;}
+        writer->offset += nber_written;
+
+        // Skips the buffers written, a partial write leaves the rest of a buffer
+        while (nber_written > 0)
+        {
+            struct iovec *iov = &writer->iov[start];
+            if ((size_t) nber_written >= iov->iov_len) {nber_written -= iov->iov_len; start++; continue;}
+            iov->iov_base = (uint8_t *) iov->iov_base + nber_written;
+            iov->iov_len -= nber_written;
+            nber_written = 0;
+        }
+    }
+
+    tar_cache_invalidate(writer->tar_fd, begin, writer->offset - begin);
+    for (int i = 0; i < writer->no_owned; i++) free(writer->owned[i]);
+    writer->no_owned = 0;
+    writer->no_iov = 0;
+    writer->staging_len = 0;
+    writer->pending = 0;
+    return (writer->error == 0) ? 0 : -1;
+}
+
+
+// Copies bytes to the staging buffer
+static int push_copy(tar_writer_t *writer, const void *bytes, size_t len)
+{
+    if ((writer->staging_len + len > WRITER_STAGING_SIZE || writer->no_iov == WRITER_IOV_MAX) && tar_writer_flush(writer) != 0) return -1;
+
+    uint8_t *dest = writer->staging + writer->staging_len;
+    memcpy(dest, bytes, len);
+    writer->staging_len += len;
+    writer->pending += len;
+
+    struct iovec *last = (writer->no_iov > 0) ? &writer->iov[writer->no_iov - 1] : NULL;
+    if (last != NULL && (uint8_t *) last->iov_base + last->iov_len == dest) last->iov_len += len;
+    else writer->iov[writer->no_iov++] = (struct iovec) {.iov_base = dest, .iov_len = len};
+    return 0;
+}
+
+
+// Adds a buffer to the next write without copying it, 'owned' is released once it is written
+static int push_ref(tar_writer_t *writer, const void *bytes, size_t len, void *owned)
+{
+    if ((writer->no_iov == WRITER_IOV_MAX || writer->no_owned == WRITER_IOV_MAX) && tar_writer_flush(writer) != 0) {free(owned); return -1;}
+
+    writer->iov[writer->no_iov++] = (struct iovec) {.iov_base = (void *) bytes, .iov_len = len};
+    if (owned != NULL) writer->owned[writer->no_owned++] = owned;
+    writer->pending += len;
+    return (writer->pending >= WRITER_BATCH_BYTES) ? tar_writer_flush(writer) : 0;
+}
+
+
+static int push_padding(tar_writer_t *writer, size_t size)
+{
+    size_t padding = TAR_PADDED_SIZE(size) - size;
+    if (padding == 0) return 0;
+    return (writer->staging_len + padding <= WRITER_STAGING_SIZE) ? push_copy(writer, zeros, padding) : push_ref(writer, zeros, padding, NULL);
+}
+
+
+int tar_add_dir(tar_writer_t *writer, const char *name, mode_t mode, time_t mtime)
+{
+    tar_header_t header;
+    char dir_name[2 * TAR_PATH_MAX];
+    size_t len = strlen(name);
+    if (len == 0 || len + 2 > sizeof(dir_name)) return -1;
+
+    memcpy(dir_name, name, len + 1);
+    if (dir_name[len - 1] != '/') strcpy(dir_name + len, "/");
+    if (writer->error != 0 || tar_fill_header(&header, dir_name, DIRTYPE, 0, mode, mtime, NULL) != 0) return -1;
+    return push_copy(writer, &header, HEADER_SIZE);
+}
+
+
+int tar_add_symlink(tar_writer_t *writer, const char *name, const char *target, time_t mtime)
+{
+    tar_header_t header;
+    if (writer->error != 0 || tar_fill_header(&header, name, SYMTYPE, 0, 0777, mtime, target) != 0) return -1;
+    return push_copy(writer, &header, HEADER_SIZE);
+}
+
+
+int tar_add_data(tar_writer_t *writer, const char *name, const uint8_t *data, size_t size, mode_t mode, time_t mtime)
+{
+    tar_header_t header;
+    if (writer->error != 0 || tar_fill_header(&header, name, REGTYPE, size, mode, mtime, NULL) != 0) return -1;
+    if (push_copy(writer, &header, HEADER_SIZE) != 0) return -1;
+
+    if (size == 0) return 0;
+    if (size <= WRITER_COPY_MAX) {if (push_copy(writer, data, size) != 0) return -1;}
+    // The caller's buffer is written before returning
+    else if (push_ref(writer, data, size, NULL) != 0 || tar_writer_flush(writer) != 0) return -1;
+
+    return push_padding(writer, size);
+}
+
+
+static void *read_worker(void *arg)
+{
+    add_job_t *job = (add_job_t *) arg;
+
+    while (1)
+    {
+        size_t i = __atomic_fetch_add(&job->next_input, 1, __ATOMIC_RELAXED);
+        if (i >= job->no_inputs) break;
+
+        writer_input_t *input = &job->inputs[i];
+        input->status = -1;
+        if (lstat(input->path, &input->st) != 0) continue;
+
+        if (S_ISLNK(input->st.st_mode))
+        {
+            ssize_t len = readlink(input->path, input->linkname, sizeof(input->linkname));
+            if (len < 0 || (size_t) len >= sizeof(input->linkname)) continue;
+            input->linkname[len] = '\0';
+        }
+        else if (S_ISREG(input->st.st_mode) && input->st.st_size > 0 && input->st.st_size <= WRITER_PREFETCH_MAX)
+        {
+            int fd = open(input->path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) continue;
+            input->data = (uint8_t *) malloc(input->st.st_size);
+
+            size_t done = 0;
+            while (input->data != NULL && done < (size_t) input->st.st_size)
+            {
+                ssize_t nber_read = pread(fd, input->data + done, input->st.st_size - done, done);
+                if (nber_read <= 0) break;
+                done += nber_read;
+            }
+            close(fd);
+            if (input->data == NULL || done < (size_t) input->st.st_size) {free(input->data); input->data = NULL; continue;}
+        }
+        else if (!S_ISREG(input->st.st_mode) && !S_ISDIR(input->st.st_mode)) continue;
+
+        input->status = 0;
+    }
+
+    return NULL;
+}
+
+
+// Writes the content of a large file straight from the file to the archive
+static int copy_large(tar_writer_t *writer, const char *path, size_t size)
+{
+    if (tar_writer_flush(writer) != 0) return -1;
+    tar_cache_invalidate(writer->tar_fd, writer->offset, size);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    off_t in_offset = 0;
+    size_t done = 0;
+    while (fd != -1 && done < size)
+    {
+        ssize_t nber_copied = copy_file_range(fd, &in_offset, writer->tar_fd, &writer->offset, size - done, 0);
+        if (nber_copied <= 0) break;
+        done += nber_copied;
+    }
+
+    // Without copy_file_range(), or if the file shrank: through a buffer, then zeros
+    uint8_t buffer[64 * 1024];
+    while (done < size)
+    {
+        size_t chunk = (size - done < sizeof(buffer)) ? size - done : sizeof(buffer);
+        ssize_t nber_read = (fd == -1) ? 0 : pread(fd, buffer, chunk, done);
+        if (nber_read <= 0) {memset(buffer, 0, chunk); nber_read = chunk;}
+        if (pwrite(writer->tar_fd, buffer, nber_read, writer->offset) != nber_read) {writer->error = 1; break;}
+        writer->offset += nber_read;
+        done += nber_read;
+    }
+
+    if (fd != -1) close(fd);
+    return (writer->error == 0) ? 0 : -1;
+}
+
+
+static int add_input(tar_writer_t *writer, writer_input_t *input, const char *name)
+{
+    tar_header_t header;
+    char member_name[2 * TAR_PATH_MAX];
+    while (name[0] == '/') name++;
+
+    size_t len = strlen(name);
+    if (len == 0 || len + 2 > sizeof(member_name)) return -2;
+    memcpy(member_name, name, len + 1);
+
+    int ret;
+    if (S_ISDIR(input->st.st_mode))
+    {
+        if (member_name[len - 1] != '/') strcpy(member_name + len, "/");
+        ret = tar_fill_header(&header, member_name, DIRTYPE, 0, input->st.st_mode, input->st.st_mtime, NULL);
+    }
+    else if (S_ISLNK(input->st.st_mode)) ret = tar_fill_header(&header, member_name, SYMTYPE, 0, input->st.st_mode, input->st.st_mtime, input->linkname);
+    else                                 ret = tar_fill_header(&header, member_name, REGTYPE, input->st.st_size, input->st.st_mode, input->st.st_mtime, NULL);
+    if (ret != 0) return -2;
+
+    if (input->st.st_uid <= 07777777) snprintf(header.uid, sizeof(header.uid), "%07o", (unsigned) input->st.st_uid);
+    if (input->st.st_gid <= 07777777) snprintf(header.gid, sizeof(header.gid), "%07o", (unsigned) input->st.st_gid);
+    set_checksum(&header);
+
+    if (push_copy(writer, &header, HEADER_SIZE) != 0) return -1;
+    if (!S_ISREG(input->st.st_mode) || input->st.st_size == 0) return 0;
+
+    if (input->data != NULL) ret = push_ref(writer, input->data, input->st.st_size, input->data);
+    else                     ret = copy_large(writer, input->path, input->st.st_size);
+    input->data = NULL;
+    if (ret != 0) return -1;
+    return push_padding(writer, input->st.st_size);
+}
+
+
+ssize_t tar_add_files(tar_writer_t *writer, const char *const *paths, const char *const *names, size_t n, int no_threads)
+{
+    writer_input_t inputs[WRITER_BATCH_FILES];
+    size_t no_added = 0;
+    int skipped = 0;
+    if (writer->error != 0) return -1;
+
+    for (size_t begin = 0; begin < n; begin += WRITER_BATCH_FILES)
+    {
+        size_t end = (begin + WRITER_BATCH_FILES < n) ? begin + WRITER_BATCH_FILES : n;
+        add_job_t job = {.inputs = inputs, .no_inputs = end - begin, .next_input = 0};
+        memset(inputs, 0, job.no_inputs * sizeof(writer_input_t));
+        for (size_t i = begin; i < end; i++) inputs[i - begin].path = paths[i];
+
+        run_workers(read_worker, &job, no_threads, job.no_inputs);
+
+        // The members are written in the given order, whatever the order the files were read in
+        int ret = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            writer_input_t *input = &inputs[i - begin];
+            if (ret == -1 || input->status != 0) {free(input->data); skipped = 1; continue;}
+
+            ret = add_input(writer, input, (names != NULL) ? names[i] : paths[i]);
+            free(input->data);
+            if (ret == 0) no_added++;
+            else          skipped = 1;
+        }
+        if (ret == -1) return -1;
+    }
+
+    if (skipped) return -2;
+    return no_added;
+}
+
+
+int tar_writer_finish(tar_writer_t *writer)
+{
+    uint8_t end_blocks[2 * HEADER_SIZE];
+    memset(end_blocks, 0, sizeof(end_blocks));
+
+    int ret = 0;
+    if (writer->error != 0 || push_copy(writer, end_blocks, sizeof(end_blocks)) != 0 || tar_writer_flush(writer) != 0) ret = -1;
+
+    // Whatever followed in the file is not part of the archive anymore
+    struct stat st;
+    if (ret == 0 && fstat(writer->tar_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > writer->offset)
+    {
+        tar_cache_invalidate(writer->tar_fd, writer->offset, st.st_size - writer->offset);
+        if (ftruncate(writer->tar_fd, writer->offset) != 0) ret = -1;
+    }
+
+    free(writer->staging);
+    writer->staging = NULL;
+    return ret;
+}